@@ -388,6 +388,7 @@ DataMatrix * DataMatrix_new(PyObject * obj, int * max)
  // Checks passed - malloc the object...
   DataMatrix * this = (DataMatrix*)malloc(sizeof(DataMatrix) + fbc*sizeof(FeatureBlock) + feats*sizeof(int));
   this->weights = weights;
+  this->multiplier = NULL;
   this->blocks = fbc;
   this->max = (int*)((char*)this + sizeof(DataMatrix) + fbc*sizeof(FeatureBlock));
   
@@ -467,23 +468,39 @@ void DataMatrix_delete(DataMatrix * this)
   free(this);
 }
 
+DataMatrix * DataMatrix_new_copy(DataMatrix * this)
+{
+ // Copy the object, but not the max array, which is left pointing at the original...
+  size_t size = sizeof(DataMatrix) + this->blocks * sizeof(FeatureBlock);
+  DataMatrix * ret = (DataMatrix*)malloc(size);
+  memcpy(ret, this, size);
+  ret->multiplier = NULL;
+ 
+ // Take ownership of the arrays...
+  Py_XINCREF(ret->weights);
+  
+  int i;
+  for (i=0; i<ret->blocks; i++)
+  {
+   Py_INCREF(ret->block[i].array);
+  }
+ 
+ return ret;
+}
+
 
 
 // Helper function - converts a feature index into a block/offset...
 void DataMatrix_Pos(DataMatrix * this, int feature, int * block, int * offset)
 {
- // Binary search to find the block...
+ // Binary search to find the block - the last one that starts at or before the feature...
   int low = 0;
   int high = this->blocks-1;
   while (low<high)
   {
-   int half = (low + high) / 2;
-   if (feature<this->block[half].offset) high = half;
-   else
-   {
-    if (low!=half) low = half;
-              else low = half+1;
-   }
+   int half = (low + high + 1) / 2;
+   if (feature<this->block[half].offset) high = half - 1;
+                                    else low = half;
   }
  
  // Do the return...
@@ -526,18 +543,20 @@ float DataMatrix_GetContinuous(DataMatrix * this, int exemplar, int feature)
 
 float DataMatrix_GetWeight(DataMatrix * this, int exemplar)
 {
+ float ret = 1.0;
+ 
  if (this->weights)
  {
-  exemplar = exemplar % PyArray_DIMS(this->weights)[0]; 
+  int index = exemplar % PyArray_DIMS(this->weights)[0]; 
   char * ptr = PyArray_DATA(this->weights);
-  ptr += PyArray_STRIDES(this->weights)[0] * exemplar;
+  ptr += PyArray_STRIDES(this->weights)[0] * index;
    
-  return this->weights_continuous(ptr);
- }
- else
- {
-  return 1.0; 
+  ret = this->weights_continuous(ptr);
  }
+ 
+ if (this->multiplier!=NULL) ret *= this->multiplier[exemplar];
+ 
+ return ret;
 }
 
 int DataMatrix_Max(DataMatrix * this, int feature)
@@ -559,6 +578,30 @@ int DataMatrix_Max(DataMatrix * this, int feature)
   return this->max[feature];
 }
 
+void DataMatrix_MaxAll(DataMatrix * this)
+{
+ int i;
+ for (i=0; i<this->features; i++) DataMatrix_Max(this, i);
+}
+
+void DataMatrix_GetBlock(DataMatrix * this, int start, int count, float * continuous, int * discrete)
+{
+ int i, j;
+ for (j=0; j<this->features; j++)
+ {
+  int block;
+  int offset;
+  DataMatrix_Pos(this, j, &block, &offset);
+  
+  FeatureBlock * fb = this->block + block;
+  for (i=0; i<count; i++)
+  {
+   continuous[i*this->features + j] = FeatureBlock_GetContinuous(fb, start + i, offset);
+   discrete[i*this->features + j] = FeatureBlock_GetDiscrete(fb, start + i, offset);
+  }
+ }
+}
+
 
 
 void Setup_DataMatrix(void)
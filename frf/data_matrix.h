@@ -88,6 +88,7 @@ struct DataMatrix
  // Weights...
   PyArrayObject * weights;
   ToContinuous weights_continuous;
+  const unsigned char * multiplier; // NULL, or a count for each exemplar that its weight is multiplied by - how a Poisson bootstrap draw is represented.
  
  // Feature blocks...
   int blocks;
@@ -99,6 +100,9 @@ struct DataMatrix
 DataMatrix * DataMatrix_new(PyObject * obj, int * max);
 void DataMatrix_delete(DataMatrix * this);
 
+// Creates a shallow copy of a DataMatrix, which shares the data and maximum array of the original (so the original must outlive it), but can be given its own multiplier. Delete as normal...
+DataMatrix * DataMatrix_new_copy(DataMatrix * this);
+
 
 // Accessors for the DataMatrix object - pretty straight forward really...
 NumberType DataMatrix_Type(DataMatrix * this, int feature);
@@ -110,6 +114,12 @@ float DataMatrix_GetWeight(DataMatrix * this, int exemplar);
 // Returns the maximum value of a discrete feature, noting that it always includes zero and can be fixed in construction if the user wants space for extra values/to ignore values past a fixed point - its basically how big to make categorical distributions from the data...
 int DataMatrix_Max(DataMatrix * this, int feature);
 
+// Calculates the maximum of every feature in advance (continuous ones included, as the user can still ask for a discrete summary of them), so DataMatrix_Max will never write to the object - call before sharing a DataMatrix between threads...
+void DataMatrix_MaxAll(DataMatrix * this);
+
+// Fetches every feature of the exemplars [start, start+count) as both continuous and discrete values, into dense arrays indexed [exemplar - start][feature] - for when lots of lookups are going to be made into a few exemplars, so the conversion only happens once...
+void DataMatrix_GetBlock(DataMatrix * this, int start, int count, float * continuous, int * discrete);
+
 
 
 // Setup this module - for internal use only...
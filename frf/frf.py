@@ -10,13 +10,16 @@
 
 import bz2
 
+import numpy
+import numpy.lib.format
+
 
 
 try:
   from utils.make import make_mod
   import os.path
 
-  make_mod('frf_c', os.path.dirname(__file__), ['philox.h', 'philox.c', 'data_matrix.h', 'data_matrix.c', 'summary.h', 'summary.c', 'information.h', 'information.c', 'learner.h', 'learner.c', 'index_set.h', 'index_set.c', 'tree.h', 'tree.c', 'frf_c.h', 'frf_c.c'])
+  make_mod('frf_c', os.path.dirname(__file__), ['philox.h', 'philox.c', 'data_matrix.h', 'data_matrix.c', 'summary.h', 'summary.c', 'information.h', 'information.c', 'learner.h', 'learner.c', 'index_set.h', 'index_set.c', 'tree.h', 'tree.c', 'threads.h', 'threads.c', 'frf_c.h', 'frf_c.c'])
 except: pass
 
 
@@ -24,13 +27,14 @@ from frf_c import *
 
 
 
-def save_forest(fn, forest):
-  """Saves a forest - the actual Forest interface is fairly flexible, so this is just one way of doing it - streams the Forest header followed by each Tree into a bzip2 compressed file. Suggested extension is '.rf'. The code for this is in Python, and forms a good reference if you need to write your own i/o for this module."""
+def save_forest(fn, forest, compact = False):
+  """Saves a forest - the actual Forest interface is fairly flexible, so this is just one way of doing it - streams the Forest header followed by each Tree into a bzip2 compressed file. Suggested extension is '.rf'. If compact is True the trees are saved in the compact, lossy, format (see Tree.compact and compact_report), which load_forest handles without being told. The code for this is in Python, and forms a good reference if you need to write your own i/o for this module."""
   f = bz2.BZ2File(fn, 'w')
   f.write(forest.save())
   
   for i in xrange(len(forest)):
-    f.write(forest[i]) # The Tree objects returned by forest[i] have the memoryview interface, so write knows what to do!
+    tree = forest[i].compact() if compact else forest[i]
+    f.write(tree) # The Tree objects returned by forest[i] have the memoryview interface, so write knows what to do!
   
   f.close()
 
@@ -63,3 +67,85 @@ def load_forest(fn):
   # Cleanup and return...
   f.close()
   return ret
+
+
+
+def compact_report(forest, x):
+  """Reports what saving a forest in the compact format does to it, by compacting every tree and comparing the predictions for the data matrix x with those of the original. Returns a dictionary containing 'size' and 'compact', the total bytes of the trees before and after, and 'outputs', a list indexed by output feature of dictionaries giving, for each array predict returns, the maximum absolute difference (None for features with no output). For outputs with a 'prob' array there is also 'agree', the proportion of exemplars where the most probable class is unchanged."""
+  # Create a copy of the forest with compact trees (appending them expands them)...
+  other = forest.clone()
+  size = 0
+  compact = 0
+  
+  for i in xrange(len(forest)):
+    tree = forest[i].compact()
+    size += forest[i].size
+    compact += tree.size
+    other.append(tree)
+  
+  # Compare the predictions of both...
+  outputs = []
+  for before, after in zip(forest.predict(x), other.predict(x)):
+    if before is None:
+      outputs.append(None)
+      continue
+    
+    out = dict()
+    for key in before:
+      out[key] = float(numpy.fabs(before[key] - after[key]).max()) if before[key].size!=0 else 0.0
+    
+    if 'prob' in before:
+      out['agree'] = float((numpy.argmax(before['prob'], axis=1)==numpy.argmax(after['prob'], axis=1)).mean())
+    
+    outputs.append(out)
+  
+  return {'size' : size, 'compact' : compact, 'outputs' : outputs}
+
+
+
+def save_forest_mmap(fn, forest):
+  """Saves a forest in the uncompressed format that Forest.load_mmap can memory map - the Forest header, then each Tree followed by its index, with every part padded to a multiple of 8 bytes. Much bigger than save_forest, but loading it is almost free and the memory is shared between every process that loads the same file. Suggested extension is '.rfm'."""
+  f = open(fn, 'wb')
+  
+  head = forest.save()
+  f.write(head)
+  f.write(bytearray(-len(head) % 8))
+  
+  for i in xrange(len(forest)):
+    tree = forest[i]
+    f.write(tree)
+    f.write(bytearray(-tree.size % 8))
+    f.write(tree.index())
+  
+  f.close()
+
+
+
+def load_forest_mmap(fn):
+  """Loads a forest that was previously saved using save_forest_mmap, without copying it into memory - just a convenience wrapper around Forest.load_mmap."""
+  ret = Forest()
+  ret.load_mmap(fn)
+  return ret
+
+
+
+def save_columns(fn, chunks, rows, features, dtype = numpy.float32):
+  """Writes a data matrix too big to hold in memory to a .npy file, in column major order, so the values of a feature are contiguous - the ordering that training reads them in. chunks is an iterable of 2D arrays of the rows, in order, [rows in chunk, features]; rows is the total number of rows they add up to and features the number of columns. Use load_columns to get it back, as a memory mapped array that can be given to Forest.train. Suggested extension is '.npy'."""
+  out = numpy.lib.format.open_memmap(fn, mode='w+', dtype=dtype, shape=(rows, features), fortran_order=True)
+  
+  offset = 0
+  for chunk in chunks:
+    out[offset:offset+chunk.shape[0],:] = chunk
+    offset += chunk.shape[0]
+  
+  if offset!=rows:
+    raise ValueError('chunks contained %i rows, not %i' % (offset, rows))
+  
+  out.flush()
+  del out
+
+
+
+def load_columns(fn):
+  """Opens a data matrix saved by save_columns (or any .npy file) as a read only memory mapped array, so only the parts that are used are paged in - pass it to Forest.train as is. Best combined with Forest.poisson, so the exemplars are read in order."""
+  return numpy.load(fn, mmap_mode='r')
@@ -15,11 +15,17 @@
 #include <numpy/arrayobject.h>
 
 #include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 
+#include "philox.h"
 #include "summary.h"
 #include "information.h"
 #include "learner.h"
+#include "threads.h"
 
 #include "frf_c.h"
 
@@ -31,6 +37,64 @@ static PyTypeObject ForestType;
 
 
 
+//
+// Memory mapped files...
+//
+
+// Maps the given file, returning NULL with a python error set on failure. Mapped privately, so the file is only ever read - the few pages that get written, when trees are attached to their indices, become private copies...
+MappedFile * MappedFile_new(const char * path)
+{
+ int fd = open(path, O_RDONLY);
+ if (fd<0)
+ {
+  PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char*)path);
+  return NULL;
+ }
+ 
+ struct stat info;
+ if (fstat(fd, &info)!=0)
+ {
+  PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char*)path);
+  close(fd);
+  return NULL;
+ }
+ 
+ if (info.st_size==0)
+ {
+  PyErr_SetString(PyExc_ValueError, "Can not map an empty file.");
+  close(fd);
+  return NULL;
+ }
+ 
+ void * ptr = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+ close(fd); // The mapping keeps the file alive.
+ 
+ if (ptr==MAP_FAILED)
+ {
+  PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char*)path);
+  return NULL;
+ }
+ 
+ MappedFile * this = (MappedFile*)malloc(sizeof(MappedFile));
+ this->refs = 1;
+ this->ptr = ptr;
+ this->size = info.st_size;
+ 
+ return this;
+}
+
+void MappedFile_release(MappedFile * this)
+{
+ this->refs -= 1;
+ if (this->refs==0)
+ {
+  munmap(this->ptr, this->size);
+  free(this);
+ }
+}
+
+
+
 //
 // The Tree type...
 //
@@ -41,12 +105,41 @@ void TreeBuffer_new(TreeBuffer * this, size_t size)
  this->tree = malloc(size);
  
  this->ready = 0;
+ this->flat = NULL;
+ this->mapped = NULL;
 }
 
 void TreeBuffer_dealloc(TreeBuffer * this)
 {
- if (this->ready!=0) Tree_deinit(this->tree);
- free(this->tree);
+ if (this->mapped==NULL)
+ {
+  if (this->ready!=0) Tree_deinit(this->tree);
+  free(this->tree);
+ }
+ else
+ {
+  MappedFile_release(this->mapped);
+ }
+ free(this->flat);
+}
+
+// If the buffer contains a CompactTree this replaces it with the expanded Tree, so everything else can ignore the compact format. Returns zero, with a python error set, if it is corrupt...
+int TreeBuffer_expand(TreeBuffer * this)
+{
+ if ((this->size<Tree_head_size())||(Tree_compacted(this->tree)==0)) return 1;
+ 
+ Tree * tree = Tree_expand((CompactTree*)this->tree, this->size);
+ if (tree==NULL) return 0;
+ 
+ TreeBuffer_dealloc(this);
+ 
+ this->size = Tree_size(tree);
+ this->tree = tree;
+ this->ready = 1;
+ this->flat = NULL;
+ this->mapped = NULL;
+ 
+ return 1;
 }
 
 
@@ -94,12 +187,12 @@ static PyObject * TreeBuffer_size_from_head_py(Forest * self, PyObject * args)
    return NULL; 
   }
   
-  if (Tree_safe((Tree*)data)==0)
+  if ((Tree_compacted(data)==0)&&(Tree_safe((Tree*)data)==0))
   {
    return NULL; 
   }
  
- // Extract the value and return it...
+ // Extract the value and return it - same place for a compact tree...
   size_t size = Tree_size((Tree*)(data));
   return Py_BuildValue("n", size);
 }
@@ -108,24 +201,28 @@ static PyObject * TreeBuffer_size_from_head_py(Forest * self, PyObject * args)
 
 static PyObject * TreeBuffer_nodes_py(TreeBuffer * self, PyObject * args)
 {
+ if (TreeBuffer_expand(self)==0) return NULL;
  int nodes = Tree_objects(self->tree) - 1; // -1 to remove the node of codes.
  return Py_BuildValue("i", nodes);
 }
 
 static PyObject * TreeBuffer_trained_py(TreeBuffer * self, PyObject * args)
 {
+ if (TreeBuffer_expand(self)==0) return NULL;
  return Py_BuildValue("i", self->tree->trained);
 }
 
 
 static PyObject * TreeBuffer_human_py(TreeBuffer * self, PyObject * args)
 {
+ if (TreeBuffer_expand(self)==0) return NULL;
  return Tree_human(self->tree);
 }
 
 
 static PyObject * TreeBuffer_importance_py(TreeBuffer * self, PyObject * args)
 {
+ if (TreeBuffer_expand(self)==0) return NULL;
  // Get the data...
   int length;
   const float * importance = Tree_importance(self->tree, &length);
@@ -147,6 +244,49 @@ static PyObject * TreeBuffer_importance_py(TreeBuffer * self, PyObject * args)
 
 
 
+static PyObject * TreeBuffer_index_py(TreeBuffer * self, PyObject * args)
+{
+ // Make sure the index exists...
+  if (TreeBuffer_expand(self)==0) return NULL;
+  if (self->ready==0)
+  {
+   if (Tree_init(self->tree)==0) return NULL;
+   self->ready = 1;
+  }
+ 
+ // Return a copy of it...
+  return PyByteArray_FromStringAndSize((char*)Tree_index(self->tree), Tree_objects(self->tree) * sizeof(long long));
+}
+
+
+
+static PyObject * TreeBuffer_compact_py(TreeBuffer * self, PyObject * args)
+{
+ // Make sure its a tree that is ready to use...
+  if (TreeBuffer_expand(self)==0) return NULL;
+  if (self->ready==0)
+  {
+   if (Tree_init(self->tree)==0) return NULL;
+   self->ready = 1;
+  }
+ 
+ // Create the compact version...
+  CompactTree * compact = Tree_compact(self->tree);
+  if (compact==NULL) return NULL;
+ 
+ // Wrap it in a new tree object...
+  TreeBuffer * ret = (TreeBuffer*)TreeBufferType.tp_alloc(&TreeBufferType, 0);
+  ret->size = compact->size;
+  ret->tree = (Tree*)compact;
+  ret->ready = 0;
+  ret->flat = NULL;
+  ret->mapped = NULL;
+  
+  return (PyObject*)ret;
+}
+
+
+
 static Py_ssize_t TreeBuffer_buffer_get(TreeBuffer * self, Py_ssize_t index, const void **ptr)
 {
  if (index!=0)
@@ -205,6 +345,8 @@ static PyMethodDef TreeBuffer_methods[] =
  {"trained", (PyCFunction)TreeBuffer_trained_py, METH_NOARGS, "Returns how many exemplars were used to train this tree."},
  {"human", (PyCFunction)TreeBuffer_human_py, METH_NOARGS, "Returns a human understandable representation of the tree - horribly inefficient data structure and of no use beyond human consumption, so for testing/diagnostics/curiosity only. Each leaf node is represented by a string giving the distributions assigned to the output variables, each test by a string. Non-leaf nodes are then represented by dictionaries, containing 'test', 'pass' and 'fail'."},
  {"importance", (PyCFunction)TreeBuffer_importance_py, METH_NOARGS, "Returns a new numpy vector of the importance of each feature as inferred from the trainning of this tree. The vector contains the sum from each split of how much information gain the feature of the split provided, multiplied by the number of training exemplars that went through the split."},
+ {"compact", (PyCFunction)TreeBuffer_compact_py, METH_NOARGS, "Returns a new Tree containing a compact, lossy, version of this tree, for storage or distribution - continuous split points are indices into per-feature tables of the values used, there are no child indices and leaf summaries are quantised, typically to 16 bits. The returned Tree can be written to a stream like any other, and when read back in it can be used directly - it is expanded into a normal tree the first time it is needed, including when added to a Forest. Use frf.compact_report to see what the quantisation does to the predictions."},
+ {"index", (PyCFunction)TreeBuffer_index_py, METH_NOARGS, "Returns the index of the tree, as a bytearray containing a 64 bit offset from the start of the tree to each object within it. Only of use for writing files that Forest.load_mmap can use - see save_forest_mmap, which writes it directly after the tree."},
  {NULL}
 };
 
@@ -283,6 +425,10 @@ void Forest_new(Forest * this)
  
  this->info_ratios = NULL;
  
+ this->threads = 1;
+ this->tree_threads = 1;
+ this->poisson = 0;
+ 
  this->trees = 0;
  this->tree = NULL;
  
@@ -448,31 +594,27 @@ static PyObject * Forest_size_from_initial_py(Forest * self, PyObject * args)
 }
 
 
-static PyObject * Forest_load_py(Forest * self, PyObject * args)
+// Loads the given header into the forest, throwing away any trees it has; returns how many trees the header says follow it, or -1 with a python error set on failure...
+static int Forest_load(Forest * self, const char * data, size_t data_size)
 {
- // Read in the header...
-  const char * data;
-  int data_size;
-  if (!PyArg_ParseTuple(args, "s#", &data, &data_size)) return NULL;
-  
  // Verify its safe...
   if (data_size<sizeof(ForestHeader))
   {
    PyErr_SetString(PyExc_RuntimeError, "Data block too small to be a Forest initial header.");
-   return NULL; 
+   return -1; 
   }
   ForestHeader * fh = (ForestHeader*)data;
   
   if ((fh->magic[0]!='F')||(fh->magic[1]!='R')||(fh->magic[2]!='F')||(fh->magic[3]!='F')||(fh->revision!=FRF_REVISION))
   {
    PyErr_SetString(PyExc_ValueError, "Forest initial header appears corrupted or wrong version.");
-   return NULL; 
+   return -1; 
   }
   
   if (fh->size<data_size)
   {
    PyErr_SetString(PyExc_RuntimeError, "Data block too small to be a Forest complete header.");
-   return NULL; 
+   return -1; 
   }
   
  // Terminate any trees in the object at present...
@@ -552,7 +694,109 @@ static PyObject * Forest_load_py(Forest * self, PyObject * args)
   }
   
  // Return the number of trees...
-  return Py_BuildValue("i", fh->trees);  
+  return fh->trees;
+}
+
+static PyObject * Forest_load_py(Forest * self, PyObject * args)
+{
+ // Read in the header...
+  const char * data;
+  int data_size;
+  if (!PyArg_ParseTuple(args, "s#", &data, &data_size)) return NULL;
+  
+ // Load it, and return the number of trees...
+  int trees = Forest_load(self, data, data_size);
+  if (trees<0) return NULL;
+  
+  return Py_BuildValue("i", trees);
+}
+
+
+
+static PyObject * Forest_load_mmap_py(Forest * self, PyObject * args)
+{
+ // Parse the parameters...
+  const char * path;
+  if (!PyArg_ParseTuple(args, "s", &path)) return NULL;
+  
+ // Map the file...
+  MappedFile * file = MappedFile_new(path);
+  if (file==NULL) return NULL;
+  
+  char * base = (char*)file->ptr;
+  
+ // The Forest header, which has its own size in it...
+  if (file->size<sizeof(ForestHeader))
+  {
+   MappedFile_release(file);
+   PyErr_SetString(PyExc_ValueError, "File too small to contain a forest.");
+   return NULL;
+  }
+  
+  size_t offset = ((ForestHeader*)base)->size;
+  if (offset>file->size)
+  {
+   MappedFile_release(file);
+   PyErr_SetString(PyExc_ValueError, "File too small to contain the forest header.");
+   return NULL;
+  }
+  
+  int trees = Forest_load(self, base, offset);
+  if (trees<0)
+  {
+   MappedFile_release(file);
+   return NULL;
+  }
+  
+ // Each tree in turn, pointed straight into the mapping with the index that follows it...
+  int i;
+  for (i=0; i<trees; i++)
+  {
+   offset = (offset + 7) & ~((size_t)7);
+   
+   Tree * tree = (Tree*)(base + offset);
+   if ((offset+Tree_head_size()>file->size)||(Tree_safe(tree)==0))
+   {
+    if (PyErr_Occurred()==NULL) PyErr_SetString(PyExc_ValueError, "File too small to contain all of the trees.");
+    MappedFile_release(file);
+    return NULL;
+   }
+   
+   size_t size = Tree_size(tree);
+   size_t index = (offset + size + 7) & ~((size_t)7);
+   offset = index + Tree_objects(tree) * sizeof(long long);
+   
+   if (offset>file->size)
+   {
+    PyErr_SetString(PyExc_ValueError, "File too small to contain all of the trees.");
+    MappedFile_release(file);
+    return NULL;
+   }
+   
+   if (Tree_init_index(tree, (long long*)(base + index))==0)
+   {
+    MappedFile_release(file);
+    return NULL;
+   }
+   
+   TreeBuffer * tb = (TreeBuffer*)TreeBufferType.tp_alloc(&TreeBufferType, 0);
+   tb->size = size;
+   tb->tree = tree;
+   tb->ready = 1;
+   tb->flat = NULL;
+   tb->mapped = file;
+   file->refs += 1;
+   
+   self->tree = (TreeBuffer**)realloc(self->tree, (self->trees + 1) * sizeof(TreeBuffer*));
+   self->tree[self->trees] = tb;
+   self->trees += 1;
+  }
+ 
+ // Drop the reference held by this function - the trees keep the mapping alive for as long as they exist...
+  MappedFile_release(file);
+  
+ // Return the number of trees...
+  return Py_BuildValue("i", trees);
 }
 
 
@@ -863,6 +1107,10 @@ static PyObject * Forest_clone_py(Forest * self, PyObject * args)
   ret->info_ratios = self->info_ratios;
   Py_XINCREF(ret->info_ratios);
   
+  ret->threads = self->threads;
+  ret->tree_threads = self->tree_threads;
+  ret->poisson = self->poisson;
+  
   ret->trees = 0;
   ret->tree = NULL;
   
@@ -956,6 +1204,7 @@ static PyObject * Forest_append_py(Forest * self, PyObject * args)
  // Parse the parameters...
   TreeBuffer * tree;
   if (!PyArg_ParseTuple(args, "O!", &TreeBufferType, &tree)) return NULL;
+  if (TreeBuffer_expand(tree)==0) return NULL;
   
  // Dump it on the end...
   self->tree = (TreeBuffer**)realloc(self->tree, (self->trees + 1) * sizeof(TreeBuffer*));
@@ -981,26 +1230,147 @@ struct CallbackData
  
  int last_report; // Reporting every time its called would slow stuff down - only do so when gap exceds report_gap.
  int report_gap;
+ 
+ int threaded; // Non-zero if it is being called from several threads at once, with the GIL released.
 };
 
+void CallbackCall(CallbackData * this, int done)
+{
+ PyObject * args = Py_BuildValue("ii", done, this->total);
+ PyObject * result = PyObject_CallObject(this->callback, args);
+ Py_DECREF(args);
+   
+ if (result==NULL) PyErr_Clear();
+           else Py_DECREF(result);
+}
+
 void CallbackReport(int count, void * ptr)
 {
  CallbackData * this = (CallbackData*)ptr;
  
- this->done += count;
- if ((this->last_report+this->report_gap)<this->done)
+ if (this->threaded==0)
  {
-  this->last_report = this->done;
-  if (this->callback!=NULL)
+  this->done += count;
+  if ((this->last_report+this->report_gap)<this->done)
   {
+   this->last_report = this->done;
+   if (this->callback!=NULL) CallbackCall(this, this->done);
+  }
+ }
+ else
+ {
+  // Counters are updated atomically, and only the thread that moves last_report on gets to call the callback, which it does after grabbing the GIL...
+   int done = __sync_add_and_fetch(&this->done, count);
+   int last = this->last_report;
    
-   PyObject * args = Py_BuildValue("ii", this->done, this->total);
-   PyObject * result = PyObject_CallObject(this->callback, args);
-   Py_DECREF(args);
-   
-   if (result==NULL) PyErr_Clear();
-             else Py_DECREF(result);
+   if (((last+this->report_gap)<done)&&(__sync_bool_compare_and_swap(&this->last_report, last, done)))
+   {
+    if (this->callback!=NULL)
+    {
+     PyGILState_STATE gil = PyGILState_Ensure();
+     CallbackCall(this, done);
+     PyGILState_Release(gil);
+    }
+   }
+ }
+}
+
+
+
+// Per-thread state for training, so each thread has its own LearnerSet, InfoSet and key...
+typedef struct TrainThread TrainThread;
+
+struct TrainThread
+{
+ TreeParam tp;
+ unsigned int key[4]; // Key of the current tree, if it has its own stream; tp.key points here in that case.
+ IndexSet * indices;
+ 
+ DataMatrix * y; // For a Poisson draw, a copy of y with the below as its multiplier; tp.y points here in that case. NULL otherwise.
+ unsigned char * count;
+ 
+ int tree_threads; // If the tree is learnt with several threads the below are arrays of this length, for the threads within the tree; index 0 is the same as in tp. NULL otherwise.
+ LearnerSet ** ls;
+ InfoSet ** is;
+};
+
+void TrainThread_delete(TrainThread * tt, int count)
+{
+ int t, i;
+ for (t=0; t<count; t++)
+ {
+  if (tt[t].ls!=NULL)
+  {
+   for (i=1; i<tt[t].tree_threads; i++)
+   {
+    if (tt[t].is[i]!=NULL) InfoSet_delete(tt[t].is[i]);
+    if (tt[t].ls[i]!=NULL) LearnerSet_delete(tt[t].ls[i]);
+   }
+   free(tt[t].is);
+   free(tt[t].ls);
   }
+  
+  if (tt[t].tp.is!=NULL) InfoSet_delete(tt[t].tp.is);
+  if (tt[t].tp.ls!=NULL) LearnerSet_delete(tt[t].tp.ls);
+  if (tt[t].indices!=NULL) IndexSet_delete(tt[t].indices);
+  if (tt[t].y!=NULL) DataMatrix_delete(tt[t].y);
+  free(tt[t].count);
+ }
+ free(tt);
+}
+
+
+// Everything the training task needs to know...
+typedef struct TrainBatch TrainBatch;
+
+struct TrainBatch
+{
+ Forest * self;
+ int create; // Number of trees being created.
+ 
+ int stream; // Non-zero if each tree gets its own random stream, derived from the below key and its index.
+ unsigned int key[4];
+ 
+ TrainThread * thread;
+ CallbackData * cd;
+ 
+ Tree ** out; // Output, indexed by tree.
+};
+
+// Learns the trees in the range [start, end) - touches no Python objects, so can be run with the GIL released, as long as the callback is threaded. The oob leaf nodes are written into the trees column of ss, so different trees never touch the same memory...
+void train_task(void * data, int thread, int start, int end)
+{
+ TrainBatch * this = (TrainBatch*)data;
+ TrainThread * tt = this->thread + thread;
+ 
+ int i;
+ for (i=start; i<end; i++)
+ {
+  // Prepare for the learning...
+   if (this->stream!=0)
+   {
+    PhiloxRNG_stream(this->key, i, tt->key);
+    LearnerSet_reset(tt->tp.ls); // Otherwise the tree would depend on which trees this thread did before.
+   }
+   
+   if (this->self->bootstrap==0) IndexSet_init_all(tt->indices);
+   else
+   {
+    if (tt->count!=NULL) IndexSet_init_poisson(tt->indices, tt->tp.x->exemplars, tt->count, tt->tp.key);
+                    else IndexSet_init_bootstrap(tt->indices, tt->tp.key);
+   }
+
+  // Learn a new tree - this is going to take a while...
+   if (tt->ls==NULL) this->out[i] = Tree_learn(&tt->tp, tt->indices, CallbackReport, this->cd);
+                else this->out[i] = Tree_learn_threaded(&tt->tp, tt->tree_threads, tt->ls, tt->is, tt->indices, CallbackReport, this->cd);
+    
+  // If needed record the leaf nodes into which the oob exemplars land...
+   if (this->self->bootstrap!=0)
+   {
+    IndexSet * oob = IndexSet_new_reflect(tt->indices, tt->tp.x->exemplars);
+    Tree_run_many(this->out[i], tt->tp.x, oob, this->self->ss+i, this->create);
+    IndexSet_delete(oob);
+   }
  }
 }
 
@@ -1017,6 +1387,15 @@ static PyObject * Forest_train_py(Forest * self, PyObject * args)
   CallbackData cd;
   cd.callback = NULL;
   if (!PyArg_ParseTuple(args, "OO|iO", &x_obj, &y_obj, &create, &cd.callback)) return NULL;
+  
+ // Decide how many threads to use - if several trees are learnt at once each gets its own random stream, so the output does not depend on the thread count (how many threads learn each tree never changes it). The GIL is released if either is not the default of 1...
+  int stream = (self->threads!=1) ? 1 : 0;
+  int parallel = ((self->threads!=1)||(self->tree_threads!=1)) ? 1 : 0;
+  int threads = thread_count(self->threads);
+  if (threads>create) threads = create;
+  if (threads<1) threads = 1;
+  
+  int tree_threads = thread_count(self->tree_threads);
 
  // Create all the required objects, with lots of error checking/rollback requirements...
   TreeParam tp;
@@ -1060,25 +1439,72 @@ static PyObject * Forest_train_py(Forest * self, PyObject * args)
    DataMatrix_delete(tp.x);
    return NULL; 
   }
-    
-  tp.ls = LearnerSet_new(tp.x, self->learn_codes);
-  if (tp.ls==NULL)
-  {
-   DataMatrix_delete(tp.y);
-   DataMatrix_delete(tp.x);
-   return NULL;  
+  
+  TrainThread * tt = (TrainThread*)malloc(threads * sizeof(TrainThread));
+  int t;
+  for (t=0; t<threads; t++)
+  {
+   tt[t].tp = tp;
+   if (stream!=0) tt[t].tp.key = tt[t].key;
+   tt[t].indices = NULL;
+   tt[t].y = NULL;
+   tt[t].count = NULL;
+   tt[t].tree_threads = 0;
+   tt[t].ls = NULL;
+   tt[t].is = NULL;
+   
+   if ((self->bootstrap!=0)&&(self->poisson!=0))
+   {
+    // Each thread weights y by its own draw, so needs its own copy...
+     tt[t].y = DataMatrix_new_copy(tp.y);
+     tt[t].count = (unsigned char*)malloc(tp.x->exemplars * sizeof(unsigned char));
+     tt[t].y->multiplier = tt[t].count;
+     tt[t].tp.y = tt[t].y;
+   }
+   
+   tt[t].tp.ls = LearnerSet_new(tp.x, self->learn_codes);
+   if (tt[t].tp.ls==NULL) break;
+   
+   tt[t].tp.is = InfoSet_new(tt[t].tp.y, self->info_codes, self->info_ratios);
+   if (tt[t].tp.is==NULL) break;
+   
+   tt[t].indices = IndexSet_new(tp.x->exemplars);
+   
+   if (self->tree_threads!=1)
+   {
+    // Trees are learnt with several threads, each of which needs its own LearnerSet and InfoSet...
+     tt[t].tree_threads = tree_threads;
+     tt[t].ls = (LearnerSet**)malloc(tree_threads * sizeof(LearnerSet*));
+     tt[t].is = (InfoSet**)malloc(tree_threads * sizeof(InfoSet*));
+     
+     tt[t].ls[0] = tt[t].tp.ls;
+     tt[t].is[0] = tt[t].tp.is;
+     for (i=1; i<tree_threads; i++)
+     {
+      tt[t].ls[i] = NULL;
+      tt[t].is[i] = NULL;
+     }
+     
+     for (i=1; i<tree_threads; i++)
+     {
+      tt[t].ls[i] = LearnerSet_new(tp.x, self->learn_codes);
+      if (tt[t].ls[i]==NULL) break;
+      
+      tt[t].is[i] = InfoSet_new(tt[t].tp.y, self->info_codes, self->info_ratios);
+      if (tt[t].is[i]==NULL) break;
+     }
+     
+     if (i<tree_threads) break;
+   }
   }
   
-  tp.is = InfoSet_new(tp.y, self->info_codes, self->info_ratios);
-  if (tp.is==NULL)
+  if (t<threads)
   {
-   LearnerSet_delete(tp.ls);
+   TrainThread_delete(tt, t+1);
    DataMatrix_delete(tp.y);
    DataMatrix_delete(tp.x);
    return NULL; 
   }
-  
-  IndexSet * indices = IndexSet_new(tp.x->exemplars);
 
  // If we are doing oob prepare...
   if (self->bootstrap!=0)
@@ -1103,42 +1529,61 @@ static PyObject * Forest_train_py(Forest * self, PyObject * args)
   cd.total = tp.x->exemplars * create;
   cd.report_gap = (cd.total / 1000) + 1;
   cd.last_report = -cd.report_gap;
+  cd.threaded = 0;
   
+ // Learn the trees - either in this thread, or with the GIL released (each tree then has its own key if there are several at once)...
+  TrainBatch batch;
+  batch.self = self;
+  batch.create = create;
+  batch.stream = stream;
+  for (i=0; i<4; i++) batch.key[i] = self->key[i];
+  batch.thread = tt;
+  batch.cd = &cd;
+  batch.out = (Tree**)malloc(create * sizeof(Tree*));
   
- // Loop and create each tree in turn...
-  for (i=0; i<create; i++)
+  if (parallel==0)
   {
-   // Prepare for the learning...
-    if (self->bootstrap==0) IndexSet_init_all(indices);
-                       else IndexSet_init_bootstrap(indices, self->key);
-
-   // Learn a new tree - this is going to take a while...
-    Tree * tree = Tree_learn(&tp, indices, CallbackReport, &cd);
-   
-   // Create a tree buffer and dump it into the right position...
-    TreeBuffer * tb = (TreeBuffer*)TreeBufferType.tp_alloc(&TreeBufferType, 0);
-    tb->size = Tree_size(tree);
-    tb->tree = tree;
-    tb->ready = 1;
-   
-    self->tree[self->trees+i] = tb;
+   train_task(&batch, 0, 0, create);
+  }
+  else
+  {
+   // The summaries ask for the maximum of y lazily, so fill it in before the threads share it...
+    DataMatrix_MaxAll(tp.y);
     
-   // If needed record the leaf nodes into which the oob exemplars land...
-    if (self->bootstrap!=0)
+   // Do the work...
+    cd.threaded = 1;
+    
+    Py_BEGIN_ALLOW_THREADS
+     thread_run(train_task, &batch, create, 1, threads);
+    Py_END_ALLOW_THREADS
+   
+   // Move the key on, so the next call makes different trees - without streams the trees have already done so...
+    if (stream!=0)
     {
-     IndexSet * oob = IndexSet_new_reflect(indices);
-     Tree_run_many(tree, tp.x, oob, self->ss+i, create);
-     IndexSet_delete(oob);
+     PhiloxRNG rng;
+     PhiloxRNG_init(&rng, self->key);
+     PhiloxRNG_next(&rng);
     }
   }
   
+ // Create a tree buffer for each tree and dump it into the right position...
+  for (i=0; i<create; i++)
+  {
+   TreeBuffer * tb = (TreeBuffer*)TreeBufferType.tp_alloc(&TreeBufferType, 0);
+   tb->size = Tree_size(batch.out[i]);
+   tb->tree = batch.out[i];
+   tb->ready = 1;
+   tb->flat = NULL;
+   tb->mapped = NULL;
+   
+   self->tree[self->trees+i] = tb;
+  }
+  
   self->trees += create;
  
  // Clean up (mostly)...
-  IndexSet_delete(indices);
- 
-  InfoSet_delete(tp.is);
-  LearnerSet_delete(tp.ls);
+  free(batch.out);
+  TrainThread_delete(tt, threads);
   DataMatrix_delete(tp.x);
   
  // Return, either None or construct and return a vector of oob errors...  
@@ -1195,12 +1640,303 @@ static PyObject * Forest_train_py(Forest * self, PyObject * args)
 
 
 
+// Everything the update task needs to know - the threads are the same as for training, but without the tree threads or Poisson draws...
+typedef struct UpdateBatch UpdateBatch;
+
+struct UpdateBatch
+{
+ Forest * self;
+ 
+ float keep;
+ int grace;
+ float confidence;
+ 
+ int stream; // As for TrainBatch.
+ unsigned int key[4];
+ 
+ TrainThread * thread;
+ 
+ Tree ** out; // Output, indexed by tree.
+ int * splits; // Number of splits made in each tree.
+};
+
+// Updates the trees in the range [start, end) - touches no Python objects, so can be run with the GIL released...
+void update_task(void * data, int thread, int start, int end)
+{
+ UpdateBatch * this = (UpdateBatch*)data;
+ TrainThread * tt = this->thread + thread;
+ 
+ int i;
+ for (i=start; i<end; i++)
+ {
+  if (this->stream!=0)
+  {
+   PhiloxRNG_stream(this->key, i, tt->key);
+   LearnerSet_reset(tt->tp.ls);
+  }
+ 
+  IndexSet_init_all(tt->indices);
+  this->out[i] = Tree_update(this->self->tree[i]->tree, &tt->tp, tt->indices, this->keep, this->grace, this->confidence, this->splits + i);
+ }
+}
+
+
+
+static PyObject * Forest_update_py(Forest * self, PyObject * args)
+{
+ int i;
+ 
+ // Handle the parameters...
+  PyObject * x_obj;
+  PyObject * y_obj;
+  float keep = 1.0;
+  int grace = 200;
+  float confidence = 1e-3;
+  if (!PyArg_ParseTuple(args, "OO|fif", &x_obj, &y_obj, &keep, &grace, &confidence)) return NULL;
+ 
+  if ((keep<0.0)||(keep>1.0))
+  {
+   PyErr_SetString(PyExc_ValueError, "keep must be in [0, 1].");
+   return NULL;
+  }
+ 
+  if ((confidence<=0.0)||(confidence>=1.0))
+  {
+   PyErr_SetString(PyExc_ValueError, "confidence must be in (0, 1).");
+   return NULL;
+  }
+ 
+  if (grace<1) grace = 1;
+ 
+ // Make sure every tree is ready to go...
+  for (i=0; i<self->trees; i++)
+  {
+   if (self->tree[i]->ready==0)
+   {
+    Tree_init(self->tree[i]->tree);
+    self->tree[i]->ready = 1;
+   }
+  }
+ 
+ // Decide how many threads to use - same rules as training...
+  int stream = (self->threads!=1) ? 1 : 0;
+  int threads = thread_count(self->threads);
+  if (threads>self->trees) threads = self->trees;
+  if (threads<1) threads = 1;
+ 
+ // Create all the required objects, with lots of error checking/rollback requirements...
+  TreeParam tp;
+  tp.x = NULL;
+  tp.y = NULL;
+  tp.ls = NULL;
+  tp.is = NULL;
+  tp.summary_codes = self->summary_codes;
+  tp.key = self->key;
+  tp.opt_features = self->opt_features;
+  tp.min_exemplars = self->min_exemplars;
+  tp.max_splits = self->max_splits;
+ 
+  tp.x = DataMatrix_new(x_obj, self->x_max);
+  if (tp.x==NULL) return NULL;
+  if (tp.x->features!=self->x_feat)
+  {
+   DataMatrix_delete(tp.x);
+   PyErr_SetString(PyExc_ValueError, "X datamatrix has wrong number features.");
+   return NULL;
+  }
+ 
+  tp.y = DataMatrix_new(y_obj, self->y_max);
+  if (tp.y==NULL)
+  {
+   DataMatrix_delete(tp.x);
+   return NULL;
+  }
+  if (tp.y->features!=self->y_feat)
+  {
+   PyErr_SetString(PyExc_ValueError, "Y datamatrix has wrong number features.");
+   DataMatrix_delete(tp.y);
+   DataMatrix_delete(tp.x);
+   return NULL;
+  }
+ 
+  if (tp.x->exemplars!=tp.y->exemplars)
+  {
+   PyErr_SetString(PyExc_ValueError, "Data matrices must have the same number of exemplars.");
+   DataMatrix_delete(tp.y);
+   DataMatrix_delete(tp.x);
+   return NULL;
+  }
+ 
+  TrainThread * tt = (TrainThread*)malloc(threads * sizeof(TrainThread));
+  int t;
+  for (t=0; t<threads; t++)
+  {
+   tt[t].tp = tp;
+   if (stream!=0) tt[t].tp.key = tt[t].key;
+   tt[t].indices = NULL;
+   tt[t].y = NULL;
+   tt[t].count = NULL;
+   tt[t].tree_threads = 0;
+   tt[t].ls = NULL;
+   tt[t].is = NULL;
+ 
+   tt[t].tp.ls = LearnerSet_new(tp.x, self->learn_codes);
+   if (tt[t].tp.ls==NULL) break;
+ 
+   tt[t].tp.is = InfoSet_new(tp.y, self->info_codes, self->info_ratios);
+   if (tt[t].tp.is==NULL) break;
+ 
+   tt[t].indices = IndexSet_new(tp.x->exemplars);
+  }
+ 
+  if (t<threads)
+  {
+   TrainThread_delete(tt, t+1);
+   DataMatrix_delete(tp.y);
+   DataMatrix_delete(tp.x);
+   return NULL;
+  }
+ 
+ // Update the trees, as for training...
+  UpdateBatch batch;
+  batch.self = self;
+  batch.keep = keep;
+  batch.grace = grace;
+  batch.confidence = confidence;
+  batch.stream = stream;
+  for (i=0; i<4; i++) batch.key[i] = self->key[i];
+  batch.thread = tt;
+  batch.out = (Tree**)malloc(self->trees * sizeof(Tree*));
+  batch.splits = (int*)malloc(self->trees * sizeof(int));
+ 
+  if (stream==0)
+  {
+   update_task(&batch, 0, 0, self->trees);
+  }
+  else
+  {
+   DataMatrix_MaxAll(tp.y);
+ 
+   Py_BEGIN_ALLOW_THREADS
+    thread_run(update_task, &batch, self->trees, 1, threads);
+   Py_END_ALLOW_THREADS
+ 
+   PhiloxRNG rng;
+   PhiloxRNG_init(&rng, self->key);
+   PhiloxRNG_next(&rng);
+  }
+ 
+ // Replace the trees with new tree buffers, so anyone holding on to the old ones is unaffected...
+  int splits = 0;
+  for (i=0; i<self->trees; i++)
+  {
+   TreeBuffer * tb = (TreeBuffer*)TreeBufferType.tp_alloc(&TreeBufferType, 0);
+   tb->size = Tree_size(batch.out[i]);
+   tb->tree = batch.out[i];
+   tb->ready = 1;
+   tb->flat = NULL;
+   tb->mapped = NULL;
+ 
+   Py_DECREF((PyObject*)self->tree[i]);
+   self->tree[i] = tb;
+ 
+   splits += batch.splits[i];
+  }
+ 
+ // Clean up and return the number of splits...
+  free(batch.splits);
+  free(batch.out);
+  TrainThread_delete(tt, threads);
+  DataMatrix_delete(tp.y);
+  DataMatrix_delete(tp.x);
+ 
+ return Py_BuildValue("i", splits);
+}
+
+
+
+// Number of exemplars in each block when predicting an entire data matrix - small enough that the leaves and feature values of a block stay in cache whilst every tree is run on it...
+#define PREDICT_BLOCK 256
+
+// Everything the prediction task needs to know...
+typedef struct PredictBatch PredictBatch;
+
+struct PredictBatch
+{
+ Forest * self;
+ DataMatrix * x;
+ int compiled; // Non-zero to use the FlatTree of each tree.
+ 
+ float ** out; // Pointers into the output, as provided by SummarySet_merge_many_new.
+ 
+ // Per-thread buffers, each for a single block...
+  SummarySet *** leaf; // PREDICT_BLOCK x trees.
+  float ** continuous; // PREDICT_BLOCK x features, only if compiled.
+  int ** discrete; // "
+};
+
+// Predicts the blocks in the range [start, end), writing straight into the output - touches no Python objects, so can be run with the GIL released...
+void predict_task(void * data, int thread, int start, int end)
+{
+ PredictBatch * this = (PredictBatch*)data;
+ Forest * self = this->self;
+ SummarySet ** leaf = this->leaf[thread];
+ int features = this->x->features;
+ 
+ int b, i, j;
+ for (b=start; b<end; b++)
+ {
+  int base = b * PREDICT_BLOCK;
+  int count = this->x->exemplars - base;
+  if (count>PREDICT_BLOCK) count = PREDICT_BLOCK;
+  
+  // Find the leaf that every exemplar of the block lands in for every tree - done a tree at a time, so each tree only needs to be brought into cache once per block...
+   if (this->compiled!=0)
+   {
+    float * continuous = this->continuous[thread];
+    int * discrete = this->discrete[thread];
+    DataMatrix_GetBlock(this->x, base, count, continuous, discrete);
+    
+    for (j=0; j<self->trees; j++)
+    {
+     TreeBuffer * tb = self->tree[j];
+     for (i=0; i<count; i++)
+     {
+      leaf[i*self->trees + j] = FlatTree_run(tb->flat, tb->tree, this->x, base + i, continuous + i*features, discrete + i*features);
+     }
+    }
+   }
+   else
+   {
+    for (j=0; j<self->trees; j++)
+    {
+     Tree * tree = self->tree[j]->tree;
+     for (i=0; i<count; i++)
+     {
+      leaf[i*self->trees + j] = Tree_run(tree, this->x, base + i);
+     }
+    }
+   }
+  
+  // Merge them into the output...
+   SummarySet_merge_many_fill(this->out, base, count, self->trees, leaf);
+ }
+}
+
+
 static PyObject * Forest_predict_py(Forest * self, PyObject * args)
 {
  // Handle the parameters...
   PyObject * x_obj;
   int exemplar = -1;
-  if (!PyArg_ParseTuple(args, "O|i", &x_obj, &exemplar)) return NULL;
+  int compiled = 0;
+  if (!PyArg_ParseTuple(args, "O|ii", &x_obj, &exemplar, &compiled)) return NULL;
+  
+  if (self->trees==0)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "Can not predict with a Forest that has no trees.");
+   return NULL;
+  }
   
  // Create a data matrix from x_obj...
   DataMatrix * x = DataMatrix_new(x_obj, self->x_max);
@@ -1218,6 +1954,27 @@ static PyObject * Forest_predict_py(Forest * self, PyObject * args)
    PyErr_SetString(PyExc_IndexError, "Requested exemplar is out of range of provided data matrix.");
    return NULL;     
   }
+ 
+ // Make sure every tree is ready to go, including compiling them if required...
+  int i;
+  for (i=0; i<self->trees; i++)
+  {
+   if (self->tree[i]->ready==0)
+   {
+    Tree_init(self->tree[i]->tree);
+    self->tree[i]->ready = 1; 
+   }
+   
+   if ((compiled!=0)&&(self->tree[i]->flat==NULL))
+   {
+    self->tree[i]->flat = Tree_flatten(self->tree[i]->tree);
+    if (self->tree[i]->flat==NULL)
+    {
+     DataMatrix_delete(x);
+     return PyErr_NoMemory();
+    }
+   }
+  }
   
  // Behaviour depends on if we are requesting a singular exemplar or all of them... 
   if (exemplar>=0)
@@ -1231,16 +1988,26 @@ static PyObject * Forest_predict_py(Forest * self, PyObject * args)
     }
    
    // Find the leaves the exemplar falls into...
-    int i;
-    for (i=0; i<self->trees; i++)
+    if (compiled!=0)
     {
-     if (self->tree[i]->ready==0)
+     float * continuous = (float*)malloc(x->features * sizeof(float));
+     int * discrete = (int*)malloc(x->features * sizeof(int));
+     DataMatrix_GetBlock(x, exemplar, 1, continuous, discrete);
+     
+     for (i=0; i<self->trees; i++)
      {
-      Tree_init(self->tree[i]->tree);
-      self->tree[i]->ready = 1; 
+      self->ss[i] = FlatTree_run(self->tree[i]->flat, self->tree[i]->tree, x, exemplar, continuous, discrete);
      }
      
-     self->ss[i] = Tree_run(self->tree[i]->tree, x, exemplar);
+     free(discrete);
+     free(continuous);
+    }
+    else
+    {
+     for (i=0; i<self->trees; i++)
+     {
+      self->ss[i] = Tree_run(self->tree[i]->tree, x, exemplar);
+     }
     }
     
    // Convert into a return value...
@@ -1252,36 +2019,51 @@ static PyObject * Forest_predict_py(Forest * self, PyObject * args)
   }
   else
   {
-   // All exemplars...
-   // Create required objects...
-    IndexSet * is = IndexSet_new(x->exemplars);
+   // All exemplars, a block at a time, so memory use does not depend on the number of exemplars...
+   // Create the return value, so the blocks can be written straight into it...
+    SummarySet * first = Tree_first_leaf(self->tree[0]->tree);
+    float ** out = (float**)malloc(first->features * SUMMARY_OUTPUTS * sizeof(float*));
+    PyObject * ret = SummarySet_merge_many_new(x->exemplars, first, out);
     
-    if (self->ss_size<self->trees*x->exemplars)
-    {
-     self->ss_size = self->trees*x->exemplars;
-     self->ss = realloc(self->ss, self->ss_size * sizeof(SummarySet*));
-    }
-   
-   // Find the leaves the exemplars fall into...
-    int i;
-    for (i=0; i<self->trees; i++)
+   // Decide how many threads to use and create their buffers...
+    int blocks = (x->exemplars + PREDICT_BLOCK - 1) / PREDICT_BLOCK;
+    int threads = thread_count(self->threads);
+    if (threads>blocks) threads = blocks;
+    if (threads<1) threads = 1;
+    
+    PredictBatch batch;
+    batch.self = self;
+    batch.x = x;
+    batch.compiled = compiled;
+    batch.out = out;
+    batch.leaf = (SummarySet***)malloc(threads * sizeof(SummarySet**));
+    batch.continuous = (float**)malloc(threads * sizeof(float*));
+    batch.discrete = (int**)malloc(threads * sizeof(int*));
+    
+    for (i=0; i<threads; i++)
     {
-     if (self->tree[i]->ready==0)
-     {
-      Tree_init(self->tree[i]->tree);
-      self->tree[i]->ready = 1; 
-     }
-     
-     IndexSet_init_all(is);
-     
-     Tree_run_many(self->tree[i]->tree, x, is, self->ss + i, self->trees);
+     batch.leaf[i] = (SummarySet**)malloc(PREDICT_BLOCK * self->trees * sizeof(SummarySet*));
+     batch.continuous[i] = (compiled!=0) ? (float*)malloc(PREDICT_BLOCK * x->features * sizeof(float)) : NULL;
+     batch.discrete[i] = (compiled!=0) ? (int*)malloc(PREDICT_BLOCK * x->features * sizeof(int)) : NULL;
     }
    
-   // Convert into a return value...
-    PyObject * ret = SummarySet_merge_many_py(x->exemplars, self->trees, self->ss);
+   // Do the work...
+    Py_BEGIN_ALLOW_THREADS
+     thread_run(predict_task, &batch, blocks, 1, threads);
+    Py_END_ALLOW_THREADS
    
    // Clean up and return...
-    IndexSet_delete(is);
+    for (i=0; i<threads; i++)
+    {
+     free(batch.discrete[i]);
+     free(batch.continuous[i]);
+     free(batch.leaf[i]);
+    }
+    free(batch.discrete);
+    free(batch.continuous);
+    free(batch.leaf);
+    free(out);
+    
     DataMatrix_delete(x);
     return ret;
   }
@@ -1454,6 +2236,8 @@ static int Forest_SetItem(Forest * self, Py_ssize_t i, PyObject * tree)
   PyErr_SetString(PyExc_ValueError, "Forest can only contain trees.");
   return -1;
  }
+ 
+ if (TreeBuffer_expand((TreeBuffer*)tree)==0) return -1;
   
  Py_DECREF((PyObject*)self->tree[i]);
  self->tree[i] = (TreeBuffer*)tree;
@@ -1533,6 +2317,10 @@ static PyMemberDef Forest_members[] =
  {"seed2", T_UINT, offsetof(Forest, key[2]), 0, "One of the 4 seeds that drives the random number generator used during tree construction. Will change as its moved along by the need for more pseudo-random data."},
  {"seed3", T_UINT, offsetof(Forest, key[3]), 0, "One of the 4 seeds that drives the random number generator used during tree construction. Will change as its moved along by the need for more pseudo-random data."},
  
+ {"threads", T_INT, offsetof(Forest, threads), 0, "Number of threads to use when training and predicting. Defaults to 1, which trains the trees one after another, each moving the seeds along; set it to 0 (or anything less than 1) to use one thread per core. When it is not 1 the trees are trained in parallel with the GIL released, and each tree gets its own random stream, derived from the seeds and the index of the tree within the call to train - the forest is then the same for any thread count (but differs from the single threaded output). Prediction gives identical results for any thread count. Not saved with the forest."},
+ {"tree_threads", T_INT, offsetof(Forest, tree_threads), 0, "Number of threads to use within each tree when training, so even a single tree can use several cores - candidate features of large nodes are optimised at the same time, and large subtrees are handed to idle threads. Defaults to 1, which learns each tree in a single thread; 0 (or anything less than 1) means one per core. Each tree is identical to the one learnt by a single thread, so the forest does not depend on tree_threads. If opt_features is less than the number of features the nodes have to be done in the same order as by a single thread, as they take turns with the seeds, so only the features of large nodes are then optimised at the same time. Combines with threads, so the total number of threads used is the product of the two. Not saved with the forest."},
+ {"poisson", T_BOOL, offsetof(Forest, poisson), 0, "If True, and bootstrap is True, then the bootstrap draw is replaced with a Poisson(1) count for each exemplar, used to multiply its weight - statistically much the same as a bootstrap draw, but each exemplar appears at most once in a tree's index set and they are visited in order, which is kinder to memory when the data is large (e.g. a memory mapped array from save_columns/load_columns). Only the exemplars with a count of zero are out of bag. Defaults to False. Not saved with the forest."},
+ 
  {"info_ratios", T_OBJECT, offsetof(Forest, info_ratios), READONLY, "Returns the information ratios numpy array, if it has been set. A 2D array, indexed by depth in the first dimension, by y-feature in the second (First dimension accessed modulus). Returns the weight of the entropy from that feature when summing them together, so you can control the objective of the tree."},
  
  {"trees", T_INT, offsetof(Forest, trees), READONLY, "Number of trees in the forest."},
@@ -1550,6 +2338,7 @@ static PyMethodDef Forest_methods[] =
  {"initial_size", (PyCFunction)Forest_initial_size_py, METH_NOARGS | METH_STATIC, "Returns the size of a forests initial header, so you can load that to get basic information about the forest, then load the rest of the header then the trees."},
  {"size_from_initial", (PyCFunction)Forest_size_from_initial_py, METH_VARARGS | METH_STATIC, "Given the inital header, as a read-only buffer compatible object (string, return value of read(), numpy array.) this returns the size of the entire header, or throws an error if there is something wrong."},
  {"load", (PyCFunction)Forest_load_py, METH_VARARGS, "Given an entire header (See initial_size and size_from_initial for how to do this) as a read-only buffer compatible object this initialises this object to those settings. If there are any trees they will be terminated. Can raise a whole litany of errors. Returns how many trees follow the header - it is upto the user to then load them from whatever stream is providing the information."},
+ {"load_mmap", (PyCFunction)Forest_load_mmap_py, METH_VARARGS, "Given the path of a file written by save_forest_mmap this memory maps it and initialises this object from it, including the trees, which point straight into the mapping rather than being copied - the index each tree needs is also stored in the file, so nothing has to be rebuilt. The file is mapped privately; because the pages are shared with the operating system's file cache every process that maps the same file (e.g. after a fork, or in seperate workers) shares one copy of the forest. Any trees already in this object are terminated. Returns how many trees were loaded. The mapping lives until the last tree from it has been destroyed; the file must not be modified whilst it is in use."},
  
  {"configure", (PyCFunction)Forest_configure_py, METH_VARARGS, "Configures the object - must be called before any learning, unless load is used instead. Takes three tag strings - first for summary, next for info, final for learn. Summary and info must have the same length, being the number of output features in length, whilst learn is the length of the number of input features. See the various _list static methods for lists of possible codes. Will throw an error if any are wrong. It can optionally have two further parameters - an array of category counts for x/input and an array of category counts for y/output - these are used when building categorical distributions over a feature to decide on the range, which will be [0,cateogory). Values outside the range will be treated as unknown. Negative values in these arrays are ignored, and the system reverts to calculating them automatically."},
  {"set_ratios", (PyCFunction)Forest_set_ratios_py, METH_VARARGS, "Sets the ratios to use when balancing the priority of learning each output feature - must be a 2D numpy array with the first dimension indexed by depth, the second indexed by output feature. The depth is indexed modulus its size, so you can have a repeating structure. Can only be called on a ready Forest, and keeps a pointer to the array, so you can change its values afterwards if you want. Note that the ratios effect the feature importance measure - if you are using that its probably wise to normalise each set of depth ratios, so the contributions from each level are comparable."},
@@ -1563,9 +2352,10 @@ static PyMethodDef Forest_methods[] =
  {"clear", (PyCFunction)Forest_clear_py, METH_NOARGS, "Removes all trees from the forest. Note that because you can't snipe individual trees if you want to be selective you can use the list interface to get all of them, clear the forest then append each tree that you want to keep."},
  {"append", (PyCFunction)Forest_append_py, METH_VARARGS, "Appends a Tree to the Forest, that has presumably been trained in another Forest and is now to be merged. Note that the Forest must be compatible (identical type codes given to configure), and this is not checked. Break this and expect the fan to get very brown."},
 
- {"train", (PyCFunction)Forest_train_py, METH_VARARGS, "Trains and appends more trees to this Forest - first parameter is the x/input data matrix, second is the y/output data matrix, third is the number of trees, which defaults to 1. Data matrices can be either a numpy array (exemplars X features) or a list of numpy arrays that are implicity joined to make the final data matrix - good when you want both continuous and discrete types. When a list contains 1D arrays they are assumed to be indexed by exemplar. The list can also contain a tuple, ('w', 1D vector), which will contain a weight for each exemplar, as in how many exemplars it counts as - good for imbalanced data. Note that only a weight in y matters - a weighted x is silently ignored. If boostrap is true this returns the out of bag error - an array indexed by output feature of how much error exists in that channel - note that they are independent calculations and its upto the user to combine them as desired if an overall error measure is required. A fourth optional parameter is a callback function, used to report progress - it will be called as func(# of work units done, total # of work units). Note that any errors it throws will be silently ignored, including not accepting those parameters."},
+ {"train", (PyCFunction)Forest_train_py, METH_VARARGS, "Trains and appends more trees to this Forest - first parameter is the x/input data matrix, second is the y/output data matrix, third is the number of trees, which defaults to 1. Data matrices can be either a numpy array (exemplars X features) or a list of numpy arrays that are implicity joined to make the final data matrix - good when you want both continuous and discrete types. When a list contains 1D arrays they are assumed to be indexed by exemplar. The list can also contain a tuple, ('w', 1D vector), which will contain a weight for each exemplar, as in how many exemplars it counts as - good for imbalanced data. Note that only a weight in y matters - a weighted x is silently ignored. If boostrap is true this returns the out of bag error - an array indexed by output feature of how much error exists in that channel - note that they are independent calculations and its upto the user to combine them as desired if an overall error measure is required. A fourth optional parameter is a callback function, used to report progress - it will be called as func(# of work units done, total # of work units). Note that any errors it throws will be silently ignored, including not accepting those parameters. If the threads or tree_threads member is not 1 the trees are trained in parallel - the callback is then called from whichever thread is reporting, with the GIL held."},
  
- {"predict", (PyCFunction)Forest_predict_py, METH_VARARGS, "Given an x/input data matrix (With support for a tuple of matrices identical to train.) returns what it knows about the output data matrix. Return will be a list indexed by feature, with the contents defined by the summary codes (Typically a dictionary of arrays, often of things like 'prob' or 'mean'). You can provide a second parameter as in exemplar index if you want to just do one item from the data matrix, but note that this is very inefficient compared to doing everything at once in a single data matrix (Or several large data matrices if that is unreasonable)."},
+ {"update", (PyCFunction)Forest_update_py, METH_VARARGS, "Updates the trees of the Forest with new data, for learning online, without needing the data they were trained with - good for when the data keeps arriving or drifts over time. The parameters are an x and a y data matrix, as for train, then three optional parameters: keep, grace and confidence. The exemplars are pushed down each tree and each leaf they reach has its summaries updated with them, with its existing statistics weighted by keep first - 1 (the default) adds the new data to the old, 0 replaces the old with the new and anything in between gradually forgets old data. A leaf reached by at least grace exemplars (default 200) then tries to split, using just the exemplars that reach it and the same settings as train, but only if it passes a Hoeffding test - the information gain of the best split must exceed that of the runner up (the best split on any other feature tried, or zero for not splitting) by more than R sqrt(ln(1/confidence) / 2n) nats, where n is the effective number of exemplars, (sum w)^2 / sum w^2 for weights w, and R is the range of the information gain, summed over the outputs (ln of the number of categories for a categorical output; Gaussian outputs have no finite range so count as 1, making the test a heuristic for them; info_ratios weights them as for the entropy), with confidence defaulting to 1e-3. Features that are equally good therefore never split. The new leaves start from just the exemplars that reach them and can split in turn. Every exemplar goes to every tree, so there is no bootstrap draw. Each tree is replaced with a new one, so trees obtained from the forest beforehand are unchanged. Uses threads as train does. Returns how many splits were made."},
+ {"predict", (PyCFunction)Forest_predict_py, METH_VARARGS, "Given an x/input data matrix (With support for a tuple of matrices identical to train.) returns what it knows about the output data matrix. Return will be a list indexed by feature, with the contents defined by the summary codes (Typically a dictionary of arrays, often of things like 'prob' or 'mean'). You can provide a second parameter as in exemplar index if you want to just do one item from the data matrix, but note that this is very inefficient compared to doing everything at once in a single data matrix (Or several large data matrices if that is unreasonable). A negative exemplar index means to do them all. If the optional third parameter is True a compiled version of each tree is used, where the nodes are packed into a flat array with the common tests stored inline - it is built the first time it is needed and then kept with the tree, and gives identical results faster, particularly for single exemplars. An entire data matrix is processed in blocks of exemplars, against every tree at once, so memory use does not grow with the number of exemplars; the blocks are divided between threads according to the threads member, with the GIL released."},
  {"error", (PyCFunction)Forest_error_py, METH_VARARGS, "Given a x/input data matrix and a y/output data matrix of true answers (Same as train) this returns an array, indexed by output feature, of how much error exists in that channel. Same as the oob calculation, but using all trees and therefore for a hold out set etc. If you want a weighted output then it should be provided in the y data matrix - any weights in x will be ignored."},
  
  {"importance", (PyCFunction)Forest_importance_py, METH_NOARGS, "Returns the importance of each feature as calculated during trainning for every tree currently in the forest. This is a new numpy vector indexed by feature that gives the information gain obtained from splits on that feature, weighted by the number of trainning exemplars that went through that split. Note that this is different from the tree version of this method, as it divided through by the number of exemplars, so the weighting is one only for the very first split, and then averages the vectors provided by all of the trees. This gives a metric which is average information gain (in nats, or whatever the training objective uses) provided by the feature per exemplar, though most people then normalise the entire vector to get a relative feature weighting."},
@@ -1598,7 +2388,7 @@ static PyTypeObject ForestType =
  0,                                /*tp_setattro*/
  0,                                /*tp_as_buffer*/
  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
- "A random forest implimentation, designed with speed in mind, as well as I/O that doesn't suck (almost - should be 32/64 bit safe, but not endian change safe.) so it can actually be saved/loaded to disk. Remains fairly modular so it can be customised to specific use cases. Supports both classification and regression, as well as multivariate output (Including mixed classification/regression!). Input feature vectors can contain both discrete and continuous variables; kinda supports unknown values for discrete features. Provides the sequence interface, to access the individual Tree objects contained within. Note that is not thread safe - use multiprocessing if parallism is required, for which it has good support.", /* tp_doc */
+ "A random forest implimentation, designed with speed in mind, as well as I/O that doesn't suck (almost - should be 32/64 bit safe, but not endian change safe.) so it can actually be saved/loaded to disk. Remains fairly modular so it can be customised to specific use cases. Supports both classification and regression, as well as multivariate output (Including mixed classification/regression!). Input feature vectors can contain both discrete and continuous variables; kinda supports unknown values for discrete features. Provides the sequence interface, to access the individual Tree objects contained within. Note that is not thread safe - use multiprocessing if parallism is required, for which it has good support, or set the threads and tree_threads members to have train use several cores.", /* tp_doc */
  0,                                /* tp_traverse */
  0,                                /* tp_clear */
  0,                                /* tp_richcompare */
@@ -1637,6 +2427,7 @@ PyMODINIT_FUNC initfrf_c(void)
   PyObject * mod = Py_InitModule3("frf_c", frf_c_methods, "Provides a straight forward random forest implimentation that is designed to be fast and have good loading/saving capabilities, unlike other Python ones.");
  
  // Call some initialisation code...
+  PyEval_InitThreads(); // Threaded training calls the progress callback from other threads.
   import_array();
   
   Setup_DataMatrix();
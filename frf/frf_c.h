@@ -50,6 +50,20 @@ struct ForestHeader
 
 
 
+// A memory mapped file that trees live inside - reference counted by the TreeBuffers that use it, so it is unmapped when the last of them goes...
+typedef struct MappedFile MappedFile;
+
+struct MappedFile
+{
+ int refs; // Number of users; only touched with the GIL held.
+ void * ptr;
+ size_t size;
+};
+
+// Layout of a file that can be memory mapped by Forest.load_mmap - uncompressed, with every part starting 8 byte aligned so trees can be used in place: the ForestHeader, then for each tree the Tree followed by its index, as an array of long long offsets from the start of the Tree to each object, so loading never has to rebuild it. Everything is padded with zeros to a multiple of 8 bytes.
+
+
+
 // Declare the python version of the tree object...
 typedef struct TreeBuffer TreeBuffer;
 
@@ -61,6 +75,9 @@ struct TreeBuffer
  Tree * tree;
  
  char ready; // 1 if its ready to be used (init has been called), 0 if not.
+ FlatTree * flat; // Compiled version, for fast prediction - created the first time it is needed, NULL before then.
+ 
+ MappedFile * mapped; // NULL if this owns tree, otherwise the file mapping it points into, which this holds a reference to. A mapped tree uses the index stored in the file, so it is never deinit-ed.
 };
 
 
@@ -94,6 +111,11 @@ struct Forest
   
   PyArrayObject * info_ratios; // 2D array indexed by depth (modulus) then feature, of weight to assign to information of feature when optimising at that depth.
   
+ // Runtime settings, which are not saved with the forest...
+  int threads; // Number of threads to train with - 1 for the original single threaded behaviour, less than 1 for one per core.
+  int tree_threads; // Number of threads used within each tree, same convention.
+  char poisson; // Non-zero to replace the bootstrap draw with a Poisson(1) count for each exemplar, used as a weight.
+  
  // Store the trees as a straight array of pointers (The cost of loading a tree, let alone learning one, compared to a realloc means doing anything more complicated is pointless.)...
   int trees;
   TreeBuffer ** tree;
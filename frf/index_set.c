@@ -13,6 +13,8 @@
 
 #include "index_set.h"
 
+#include <math.h>
+
 
 
 // Methods for the IndexSet...
@@ -28,13 +30,13 @@ void IndexSet_delete(IndexSet * this)
  free(this);  
 }
 
-IndexSet * IndexSet_new_reflect(IndexSet * other)
+IndexSet * IndexSet_new_reflect(IndexSet * other, int exemplars)
 {
  int i;
  
  // Create a temporary array of tags - zero if not seen, non-zero if seen...
-  char * tags = (char*)malloc(other->size * sizeof(char));
-  for (i=0; i<other->size; i++) tags[i] = 0;
+  char * tags = (char*)malloc(exemplars * sizeof(char));
+  for (i=0; i<exemplars; i++) tags[i] = 0;
 
  // Go through and mark seen everything in the other...
   for (i=0; i<other->size; i++)
@@ -44,7 +46,7 @@ IndexSet * IndexSet_new_reflect(IndexSet * other)
 
  // Count how many unseen indices exist...
   int unseen = 0;
-  for (i=0; i<other->size; i++)
+  for (i=0; i<exemplars; i++)
   {
    if (tags[i]==0) unseen += 1; 
   }
@@ -55,7 +57,7 @@ IndexSet * IndexSet_new_reflect(IndexSet * other)
 
  // Write out the unseen into the return...
   unseen = 0;
-  for (i=0; i<other->size; i++)
+  for (i=0; i<exemplars; i++)
   {
    if (tags[i]==0)
    {
@@ -96,6 +98,45 @@ void IndexSet_init_bootstrap(IndexSet * this, unsigned int key[4])
 }
 
 
+void IndexSet_init_poisson(IndexSet * this, int exemplars, unsigned char * count, unsigned int key[4])
+{
+ int i, k;
+ 
+ // Thresholds on a 32 bit random number for each count below the cap, from the cumulative distribution of Poisson(1) - anything that passes them all gets the cap...
+  unsigned int threshold[POISSON_CAP];
+  double p = exp(-1.0);
+  double cdf = 0.0;
+  for (k=0; k<POISSON_CAP; k++)
+  {
+   cdf += p;
+   p /= k + 1;
+   
+   double t = cdf * 4294967296.0;
+   threshold[k] = (t<4294967295.0) ? (unsigned int)t : 4294967295U;
+  }
+ 
+ // Draw a count for each exemplar, recording those that are in the set...
+  PhiloxRNG rng;
+  PhiloxRNG_init(&rng, key);
+  
+  this->size = 0;
+  for (i=0; i<exemplars; i++)
+  {
+   unsigned int r = PhiloxRNG_next(&rng);
+   
+   k = 0;
+   while ((k<POISSON_CAP)&&(r>=threshold[k])) k += 1;
+   
+   count[i] = k;
+   if (k!=0)
+   {
+    this->vals[this->size] = i;
+    this->size += 1;
+   }
+  }
+}
+
+
 
 // Methods for the IndexView...
 void IndexView_init(IndexView * this, IndexSet * source)
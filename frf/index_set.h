@@ -31,13 +31,19 @@ struct IndexSet
 IndexSet * IndexSet_new(int size);
 void IndexSet_delete(IndexSet * this);
 
-// This returns a new IndexSet containing a list of all the entries that are not included in the given IndexSet - meaningless after init_all (it will be empty), but after init_boostrap this returns the out of bag set...
-IndexSet * IndexSet_new_reflect(IndexSet * other);
+// This returns a new IndexSet containing a list of all the entries that are not included in the given IndexSet, out of exemplars entries in total - meaningless after init_all (it will be empty), but after init_boostrap or init_poisson this returns the out of bag set...
+IndexSet * IndexSet_new_reflect(IndexSet * other, int exemplars);
 
 // Initalises an index set - can either do all samples or a bootstrap draw. Note that key will be modified, and left at a position where it can be used for the next use if you want. (Assumes its for an object with size exemplars)...
 void IndexSet_init_all(IndexSet * this);
 void IndexSet_init_bootstrap(IndexSet * this, unsigned int key[4]);
 
+// Largest count IndexSet_init_poisson will draw - the chance of a Poisson(1) draw exceeding it is around 2e-14, well below the resolution of the 32 bit random number used...
+#define POISSON_CAP 15
+
+// Alternative to a bootstrap draw, where each exemplar is drawn a Poisson(1) number of times, capped at POISSON_CAP. The counts are written into count (length exemplars, which this must have been created with) and the exemplars drawn at least once are put into the set once each, in increasing order, so its size shrinks to about 63% of exemplars. The counts are then used as a DataMatrix multiplier, so the weights match a bootstrap draw without the duplicates, and the data is accessed in order. Key is modified as above...
+void IndexSet_init_poisson(IndexSet * this, int exemplars, unsigned char * count, unsigned int key[4]);
+
 
 
 // The index view object - view of part of an index set - sent down the tree indicating the indices of the data set relevant to learning the current node - basically a pointer to a subpart of an IndexSet that will be reordered and split to be sent down to leafs. Note that these do not handle their own memory management - that is the users responsibility...
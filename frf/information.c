@@ -65,6 +65,46 @@ float Info_entropy(Info this)
  return type->entropy(this);
 }
 
+void Info_sweep(InfoPair * pair, int size, const int * vals, float ratio, float * out)
+{
+ const InfoType * type = *(const InfoType**)pair->fail;
+ if (type->sweep!=NULL)
+ {
+  type->sweep(pair->fail, size, vals, ratio, out);
+  return;
+ }
+ 
+ // No sweep method - move the exemplars over one at a time...
+  int i;
+  type->reset(pair->pass);
+  type->reset(pair->fail);
+  for (i=0; i<size; i++)
+  {
+   type->add(pair->pass, vals[i]);
+  }
+ 
+  for (i=0; i<size-1; i++)
+  {
+   type->remove(pair->pass, vals[i]);
+   type->add(pair->fail, vals[i]);
+ 
+   float fail_total = type->count(pair->fail);
+   float pass_total = type->count(pair->pass);
+   float total = fail_total + pass_total;
+   if (total<1e-6) total = 1e-6;
+ 
+   float weight = fail_total / total;
+   out[i] += ratio * (weight * type->entropy(pair->fail) + (1.0 - weight) * type->entropy(pair->pass));
+  }
+}
+
+float Info_range(Info this)
+{
+ const InfoType * type = *(const InfoType**)this;
+ if (type->range==NULL) return -1.0;
+ return type->range(this);
+}
+
 
 
 // The nothing information type - still records count as some optimisers could get irrate otherwise...
@@ -124,6 +164,16 @@ static float Nothing_entropy(Info this)
  return 0.0; 
 }
 
+static void Nothing_sweep(Info this, int size, const int * vals, float ratio, float * out)
+{
+ // Entropy is always zero, so nothing to add.
+}
+
+static float Nothing_range(Info this)
+{
+ return 0.0;
+}
+
 
 const InfoType NothingInfo =
 {
@@ -137,6 +187,8 @@ const InfoType NothingInfo =
  Nothing_remove,
  Nothing_count,
  Nothing_entropy,
+ Nothing_sweep,
+ Nothing_range,
 };
 
 
@@ -161,6 +213,9 @@ struct Categorical
  float exemplars; // Number of exemplars in the system.
  float total; // Sum if you add up count - can be less than exemplars due to unknown values.
  
+ int capacity; // Number of exemplars the below has space for.
+ double * work; // Buffer for sweep, so each Info is independent and its safe to have one per thread.
+ 
  int cats;
  CategoricalInner cat[0];
 };
@@ -178,6 +233,9 @@ static Info Categorical_new(DataMatrix * dm, int feature)
  this->exemplars = 0.0;
  this->total = 0.0;
  
+ this->capacity = 0;
+ this->work = NULL;
+ 
  this->cats = cats;
  int i;
  for (i=0; i<cats; i++)
@@ -202,8 +260,10 @@ static void Categorical_reset(Info self)
  }
 }
 
-static void Categorical_delete(Info this)
+static void Categorical_delete(Info self)
 {
+ Categorical * this = (Categorical*)self;
+ free(this->work);
  free(this);
 }
 
@@ -255,6 +315,7 @@ static float Categorical_entropy(Info self)
 {
  Categorical * this = (Categorical*)self;
  float ret = 0.0;
+ if (this->total<1e-6) return ret; // Nothing known - zero rather than log(0), to match sweep.
  
  float mult = 1.0 / (float)this->total;
  
@@ -270,6 +331,129 @@ static float Categorical_entropy(Info self)
  return ret + log(this->total);
 }
 
+// Helper for below - the entropy of a categorical distribution is log(total) - sum(count * log(count)) / total, so this is the term each category contributes to that sum...
+static inline double count_log_count(double count)
+{
+ return (count>1e-6) ? (count * log(count)) : 0.0;
+}
+
+static void Categorical_sweep(Info self, int size, const int * vals, float ratio, float * out)
+{
+ Categorical * this = (Categorical*)self;
+ int i;
+ 
+ // Make sure the buffer is large enough - four arrays indexed by position, then four indexed by category...
+  if (this->capacity<size)
+  {
+   this->capacity = size;
+   this->work = (double*)realloc(this->work, (4 * this->capacity + 4 * this->cats) * sizeof(double));
+  }
+ 
+  double * exemplars = this->work; // Weight of the fail half, for each split point.
+  double * total = exemplars + this->capacity; // Weight of the fail half with a known category, for each split point.
+  double * fail_sum = total + this->capacity; // Sum of count * log(count) over the fail half, for each split point.
+  double * pass_sum = fail_sum + this->capacity; // Same for the pass half.
+ 
+  double * cat_fail = pass_sum + this->capacity; // Count of each category in the fail half.
+  double * cat_pass = cat_fail + this->cats; // Count of each category in the pass half.
+  double * clc_fail = cat_pass + this->cats; // count_log_count of the above two.
+  double * clc_pass = clc_fail + this->cats;
+ 
+ // Fetch the weight and category of every exemplar, summing the counts of each category over all of them - to start with everything is in the pass half...
+  for (i=0; i<this->cats; i++)
+  {
+   cat_fail[i] = 0.0;
+   cat_pass[i] = 0.0;
+   clc_fail[i] = 0.0;
+  }
+ 
+  double all_exemplars = 0.0;
+  double all_total = 0.0;
+ 
+  for (i=0; i<size; i++)
+  {
+   double w = DataMatrix_GetWeight(this->dm, vals[i]);
+   int val = DataMatrix_GetDiscrete(this->dm, vals[i], this->feature);
+   if ((val<0)||(val>=this->cats)) val = -1;
+ 
+   exemplars[i] = w;
+   total[i] = val;
+ 
+   all_exemplars += w;
+   if (val>=0)
+   {
+    all_total += w;
+    cat_pass[val] += w;
+   }
+  }
+ 
+  double sum_fail = 0.0;
+  double sum_pass = 0.0;
+  for (i=0; i<this->cats; i++)
+  {
+   clc_pass[i] = count_log_count(cat_pass[i]);
+   sum_pass += clc_pass[i];
+  }
+ 
+ // Move the exemplars into the fail half one at a time, updating the prefix sums - only the category that changes needs updating, so its constant time per exemplar however many categories there are...
+  double run_exemplars = 0.0;
+  double run_total = 0.0;
+ 
+  for (i=0; i<size-1; i++)
+  {
+   double w = exemplars[i];
+   int val = (int)total[i];
+ 
+   run_exemplars += w;
+   if (val>=0)
+   {
+    run_total += w;
+ 
+    cat_fail[val] += w;
+    double clc = count_log_count(cat_fail[val]);
+    sum_fail += clc - clc_fail[val];
+    clc_fail[val] = clc;
+ 
+    cat_pass[val] -= w;
+    clc = count_log_count(cat_pass[val]);
+    sum_pass += clc - clc_pass[val];
+    clc_pass[val] = clc;
+   }
+ 
+   exemplars[i] = run_exemplars;
+   total[i] = run_total;
+   fail_sum[i] = sum_fail;
+   pass_sum[i] = sum_pass;
+  }
+ 
+ // Evaluate the entropy of every split point - each is independent of the others, so this loop is branch free and can be vectorised...
+  double all = all_exemplars;
+  if (all<1e-6) all = 1e-6;
+ 
+  for (i=0; i<size-1; i++)
+  {
+   double fail_total = total[i];
+   double pass_total = all_total - fail_total;
+ 
+   // A half with no known categories has zero entropy (its count log count sum is zero too)...
+   double fail_safe = (fail_total>1e-6) ? fail_total : 1.0;
+   double pass_safe = (pass_total>1e-6) ? pass_total : 1.0;
+ 
+   double fail_entropy = log(fail_safe) - fail_sum[i] / fail_safe;
+   double pass_entropy = log(pass_safe) - pass_sum[i] / pass_safe;
+ 
+   double weight = exemplars[i] / all;
+   out[i] += ratio * (weight * fail_entropy + (1.0 - weight) * pass_entropy);
+  }
+}
+
+
+static float Categorical_range(Info self)
+{
+ Categorical * this = (Categorical*)self;
+ return log(this->cats); // The most a split can reduce the entropy by is the entropy of a uniform distribution.
+}
+
 
 const InfoType CategoricalInfo =
 {
@@ -283,6 +467,8 @@ const InfoType CategoricalInfo =
  Categorical_remove,
  Categorical_count,
  Categorical_entropy,
+ Categorical_sweep,
+ Categorical_range,
 };
 
 
@@ -301,6 +487,9 @@ struct Gaussian
  
  float mean;
  float scatter; // i.e. variance multiplied by exemplars.
+ 
+ int capacity; // Number of exemplars the below has space for.
+ double * work; // Buffer for sweep, so each Info is independent and its safe to have one per thread.
 };
 
 
@@ -317,6 +506,9 @@ static Info Gaussian_new(DataMatrix * dm, int feature)
  this->mean = 0.0;
  this->scatter = 0.0;
  
+ this->capacity = 0;
+ this->work = NULL;
+ 
  return this;  
 }
 
@@ -330,8 +522,10 @@ static void Gaussian_reset(Info self)
  this->scatter = 0.0;
 }
 
-static void Gaussian_delete(Info this)
+static void Gaussian_delete(Info self)
 {
+ Gaussian * this = (Gaussian*)self;
+ free(this->work);
  free(this);
 }
 
@@ -381,6 +575,83 @@ static float Gaussian_entropy(Info self)
  return 0.5 * log(2*M_PI*M_E*var);
 }
 
+static void Gaussian_sweep(Info self, int size, const int * vals, float ratio, float * out)
+{
+ Gaussian * this = (Gaussian*)self;
+ int i;
+ 
+ // Make sure the buffer is large enough - three arrays indexed by position...
+  if (this->capacity<size)
+  {
+   this->capacity = size;
+   this->work = (double*)realloc(this->work, 3 * this->capacity * sizeof(double));
+  }
+ 
+  double * weight = this->work; // Prefix sum of weight, for each split point.
+  double * first = weight + this->capacity; // Prefix sum of weight * (value - centre).
+  double * second = first + this->capacity; // Prefix sum of weight * (value - centre)^2.
+ 
+ // Fetch the weight and value of every exemplar, calculating the mean so the moments can be centred, to avoid losing precision...
+  double all_weight = 0.0;
+  double centre = 0.0;
+ 
+  for (i=0; i<size; i++)
+  {
+   weight[i] = DataMatrix_GetWeight(this->dm, vals[i]);
+   first[i] = DataMatrix_GetContinuous(this->dm, vals[i], this->feature);
+ 
+   all_weight += weight[i];
+   centre += weight[i] * first[i];
+  }
+ 
+  if (all_weight>1e-6) centre /= all_weight;
+ 
+ // Convert into prefix sums of the moments...
+  double run_weight = 0.0;
+  double run_first = 0.0;
+  double run_second = 0.0;
+ 
+  for (i=0; i<size; i++)
+  {
+   double w = weight[i];
+   double delta = first[i] - centre;
+ 
+   run_weight += w;
+   run_first += w * delta;
+   run_second += w * delta * delta;
+ 
+   weight[i] = run_weight;
+   first[i] = run_first;
+   second[i] = run_second;
+  }
+ 
+ // Evaluate the entropy of every split point from the moments of each half - each is independent of the others, so this loop is branch free and can be vectorised...
+  double all_first = first[size-1];
+  double all_second = second[size-1];
+ 
+  double all = all_weight;
+  if (all<1e-6) all = 1e-6;
+ 
+  for (i=0; i<size-1; i++)
+  {
+   double fail_weight = weight[i];
+   double pass_weight = all_weight - fail_weight;
+ 
+   double fail_safe = (fail_weight>1e-6) ? fail_weight : 1e-6;
+   double pass_safe = (pass_weight>1e-6) ? pass_weight : 1e-6;
+ 
+   double pass_first = all_first - first[i];
+   double fail_var = (second[i] - first[i] * first[i] / fail_safe) / fail_safe;
+   double pass_var = ((all_second - second[i]) - pass_first * pass_first / pass_safe) / pass_safe;
+ 
+   if (fail_var<1e-6) fail_var = 1e-6; // To avoid log(0), as above.
+   if (pass_var<1e-6) pass_var = 1e-6;
+ 
+   double w = fail_weight / all;
+   out[i] += ratio * 0.5 * (w * log(2*M_PI*M_E*fail_var) + (1.0 - w) * log(2*M_PI*M_E*pass_var));
+  }
+}
+
 
 const InfoType GaussianInfo =
 {
@@ -394,6 +665,8 @@ const InfoType GaussianInfo =
  Gaussian_remove,
  Gaussian_count,
  Gaussian_entropy,
+ Gaussian_sweep,
+ NULL,
 };
 
 
@@ -544,6 +817,8 @@ const InfoType BiGaussianInfo =
  BiGaussian_remove,
  BiGaussian_count,
  BiGaussian_entropy,
+ NULL,
+ NULL,
 };
 
 
@@ -594,6 +869,9 @@ InfoSet * InfoSet_new(DataMatrix * dm, const char * codes, PyArrayObject * ratio
     
   this->features = feats;
   
+  this->capacity = 0;
+  this->sweep = NULL;
+  
  // Zero out the array of info objects (makes error handling easier...)...
   int i;
   for (i=0; i<feats; i++)
@@ -659,6 +937,7 @@ void InfoSet_delete(InfoSet * this)
  }
    
  Py_XDECREF(this->ratios);
+ free(this->sweep);
  free(this); 
 }
 
@@ -778,6 +1057,61 @@ float InfoSet_view_entropy(InfoSet * this, IndexView * iv, int depth)
 }
 
 
+const float * InfoSet_sweep(InfoSet * this, int size, const int * vals, int depth)
+{
+ // Make sure the output is large enough and zero it...
+  if (this->capacity<size)
+  {
+   this->capacity = size;
+   this->sweep = (float*)realloc(this->sweep, this->capacity * sizeof(float));
+  }
+ 
+  int i;
+  for (i=0; i<size-1; i++) this->sweep[i] = 0.0;
+ 
+ // Add in the entropy of each feature in turn...
+  for (i=0; i<this->features; i++)
+  {
+   float ratio = 1.0;
+   if (this->ratios!=NULL)
+   {
+    ratio = this->rat_func(PyArray_GETPTR2(this->ratios, depth % PyArray_DIMS(this->ratios)[0], i));
+   }
+ 
+   if (ratio>1e-6)
+   {
+    Info_sweep(this->pair + i, size, vals, ratio, this->sweep);
+   }
+  }
+ 
+ return this->sweep;
+}
+
+float InfoSet_range(InfoSet * this, int depth)
+{
+ float ret = 0.0;
+ 
+ int i;
+ for (i=0; i<this->features; i++)
+ {
+  float ratio = 1.0;
+  if (this->ratios!=NULL)
+  {
+   ratio = this->rat_func(PyArray_GETPTR2(this->ratios, depth % PyArray_DIMS(this->ratios)[0], i));
+  }
+  
+  if (ratio>1e-6)
+  {
+   float range = Info_range(this->pair[i].fail);
+   if (range<0.0) range = 1.0; // Unbounded - see header.
+   ret += ratio * range;
+  }
+ }
+ 
+ return ret;
+}
+
+
 
 void Setup_Information(void)
 {
@@ -46,6 +46,12 @@ typedef float (*InfoCount)(Info this);
 // Returns the entropy (in nats) of the current set of exemplars...
 typedef float (*InfoEntropy)(Info this);
 
+// Optional (NULL if not supported) - given a list of exemplars, in order, this considers every split point i in [0, size-1), where [0, i] go to the fail half and the rest to the pass half, adding ratio multiplied by the entropy of the split, weighted as in InfoSet_entropy, to out[i]. Works from prefix sums over the exemplars, so its much faster than doing the same with add/remove and entropy. Ignores and does not change the set of exemplars in the object...
+typedef void (*InfoSweep)(Info this, int size, const int * vals, float ratio, float * out);
+
+// Optional (NULL if unbounded) - returns the range of the information gain, in nats, that any split can achieve with this type, for the Hoeffding bound used when growing a tree online...
+typedef float (*InfoRange)(Info this);
+
 
 
 // Definition of type object (v-table) for Info objects...
@@ -66,6 +72,20 @@ struct InfoType
  
  InfoCount count;
  InfoEntropy entropy;
+ 
+ InfoSweep sweep;
+ InfoRange range;
+};
+
+
+
+// Cute-lil struct for pairing up a pass and fail Info...
+typedef struct InfoPair InfoPair;
+
+struct InfoPair
+{
+ Info pass;
+ Info fail;
 };
 
 
@@ -81,6 +101,12 @@ void Info_remove(Info this, int exemplar);
 float Info_count(Info this);
 float Info_entropy(Info this);
 
+// Uses the sweep method if the type has one, otherwise does the same thing with add/remove and entropy, using the given pair (which is left dirty)...
+void Info_sweep(InfoPair * pair, int size, const int * vals, float ratio, float * out);
+
+// Returns the range of the information gain, or a negative value if the type has none...
+float Info_range(Info this);
+
 
 
 // Basic information types...
@@ -88,7 +114,7 @@ float Info_entropy(Info this);
 // Big fat NO-OP - always returns 0, mainly for use with BiGaussian on the second channel...
 const InfoType NothingInfo; // N
 
-// Entropy of a Categorical distribution over the data...
+// Entropy of a Categorical distribution over the data - exemplars with an unknown (out of range) category only count towards the weighting, and a set with no known categories has an entropy of zero, so a split cannot gain by isolating unknowns...
 const InfoType CategoricalInfo; // C
 
 // Entropy of a Gaussian distribution over the data...
@@ -104,17 +130,6 @@ extern const InfoType * ListInfo[];
 
 
 
-// Cute-lil struct for the below...
-typedef struct InfoPair InfoPair;
-
-struct InfoPair
-{
- Info pass;
- Info fail;
-};
-
-
-
 // A set of info types, two for each feature in a target DataMatrix - allows configuration and fetching the entropy of all of them combined, noting that you can configure the ratios of feature entropy on a per depth basis, to optimise for different things at different depths...
 typedef struct InfoSet InfoSet;
 
@@ -123,6 +138,9 @@ struct InfoSet
  PyArrayObject * ratios;
  ToContinuous rat_func; // For above matrix.
  
+ int capacity; // Size of below.
+ float * sweep; // Output of InfoSet_sweep.
+ 
  int features;
  InfoPair pair[0];
 };
@@ -149,6 +167,12 @@ float InfoSet_entropy(InfoSet * this, int depth);
 // Returns the entropy of the given index view - a kind of helper function in a sense as you can do this by adding the entire index view to one half and leaving the other empty, but this is more efficient. Will leave the InfoSet in state where you will want to reset it before next use. Depth provides ratios for the level...
 float InfoSet_view_entropy(InfoSet * this, IndexView * iv, int depth);
 
+// Returns the entropy of every split point of a list of exemplars in one go - entry i of the returned array is what InfoSet_entropy would return with [0, i] in the fail half and the rest in the pass half, for i in [0, size-1). The array belongs to the InfoSet and is valid until the next call. Much faster than the equivalent loop of add/remove and entropy for the info types that support sweep, and never slower. Will leave the InfoSet in state where you will want to reset it before next use. Depth provides ratios for the level...
+const float * InfoSet_sweep(InfoSet * this, int size, const int * vals, int depth);
+
+// Returns the range of the information gain, in nats, that a split can achieve - the sum over features of the range of each, weighted by the ratios for the given depth. Info types without a finite range (the Gaussians, as differential entropy is unbounded) count as one nat, so for them a Hoeffding bound built on this is only a heuristic...
+float InfoSet_range(InfoSet * this, int depth);
+
 
 
 // Setup this module - for internal use only...
@@ -70,26 +70,11 @@ void Learner_fetch(Learner this, void * out)
  return type->fetch(this, out);
 }
 
-
-
-// Structs for the test types...
-// Continuous split: 'C'...
-typedef struct ContinuousSplit ContinuousSplit;
-
-struct ContinuousSplit
+LearnerSortKey Learner_sort_key(Learner this)
 {
- int feature;
- float split; // less than == fail, greater than or equal = pass.
-};
-
-// Accept one class: 'D'...
-typedef struct DiscreteSelect DiscreteSelect;
-
-struct DiscreteSelect
-{
- int feature;
- int accept; // Index of discrete feature it accepts.
-};
+ const LearnerType * type = *(const LearnerType **)this;
+ return type->sort_key;
+}
 
 
 
@@ -132,11 +117,21 @@ const LearnerType IdiotLearner =
  NULL,
  NULL,
  NULL,
+ NULL,
 };
 
 
 
 // The split learner...
+typedef struct SplitPair SplitPair;
+
+struct SplitPair
+{
+ float value;
+ int position; // In the IndexView before sorting.
+ int exemplar;
+};
+
 typedef struct Split Split;
 
 struct Split
@@ -148,6 +143,9 @@ struct Split
  
  float entropy;
  float split;
+ 
+ int capacity; // Size of below.
+ SplitPair * pair; // Buffer for sorting, so each learner (and hence each LearnerSet) is independent, and its safe to have one per thread.
 };
 
 
@@ -159,30 +157,28 @@ Learner Split_new(DataMatrix * dm, int feature)
  this->dm = dm;
  this->feature = feature;
  
+ this->capacity = 0;
+ this->pair = NULL;
+ 
  return this;
 }
 
-static void Split_delete(Learner this)
+static void Split_delete(Learner self)
 {
+ Split * this = (Split*)self;
+ free(this->pair);
  free(this); 
 }
 
-// Helper for below - try not to think too much about what that static variable is for, or what it means for thread safety...
-int sort_for_split(const void * a, const void * b)
+// Helper for below - sorts by value, with ties broken by position so the sort is stable, whatever qsort implementation is in use...
+static int sort_for_split(const void * a, const void * b)
 {
- static const Split * this = NULL;
- if (b==NULL)
- {
-  this = (const Split*)a;
-  return 0;
- }
- 
- float va = DataMatrix_GetContinuous(this->dm, *(const int*)a, this->feature);
- float vb = DataMatrix_GetContinuous(this->dm, *(const int*)b, this->feature);
+ const SplitPair * pa = (const SplitPair*)a;
+ const SplitPair * pb = (const SplitPair*)b;
   
- if (va<vb) return -1;
- if (va>vb) return 1;
- return 0;
+ if (pa->value<pb->value) return -1;
+ if (pa->value>pb->value) return 1;
+ return pa->position - pb->position;
 }
 
 static int Split_optimise(Learner self, InfoSet * info, IndexView * view, int depth, float improve, unsigned int key[4])
@@ -192,32 +188,39 @@ static int Split_optimise(Learner self, InfoSet * info, IndexView * view, int de
  
  if (view->size<2) return 0;
  
- // Sort the indices of the IndexView by the associated feature - this involves a nasty qsort hack that I should probably be shot for (static variable that can be set by calling the sorting function with NULL as the second variable, so the sorting function has access to this.)...
-  sort_for_split(this, NULL);
-  qsort(view->vals, view->size, sizeof(int), sort_for_split);
- 
- // Reset the InfoSet and fill in the pass half with all of the items...
-  InfoSet_reset(info);
+ // Sort the indices of the IndexView by the associated feature - the values are fetched once into the pair buffer, so the comparison is cheap...
+  if (this->capacity<view->size)
+  {
+   this->capacity = view->size;
+   this->pair = (SplitPair*)realloc(this->pair, this->capacity * sizeof(SplitPair));
+  }
+  
   for (i=0; i<view->size; i++)
   {
-   InfoSet_pass_add(info, view->vals[i]); 
+   this->pair[i].value = DataMatrix_GetContinuous(this->dm, view->vals[i], this->feature);
+   this->pair[i].position = i;
+   this->pair[i].exemplar = view->vals[i];
   }
   
- // Iterate moving one item from the 
+  qsort(this->pair, view->size, sizeof(SplitPair), sort_for_split);
+  
+  for (i=0; i<view->size; i++)
+  {
+   view->vals[i] = this->pair[i].exemplar;
+  }
+ 
+ // Get the entropy of every split point in one pass, then find the best...
+  const float * e = InfoSet_sweep(info, view->size, view->vals, depth);
+  
   int success = 0;
   this->entropy = improve;
   
   for (i=0; i<view->size-1; i++)
   {
-   InfoSet_pass_remove(info, view->vals[i]);
-   InfoSet_fail_add(info, view->vals[i]);
-   
-   float e = InfoSet_entropy(info, depth);
-   
-   if (e<this->entropy)
+   if (e[i]<this->entropy)
    {
-    this->entropy = e;
-    this->split = 0.5 * (DataMatrix_GetContinuous(this->dm, view->vals[i], this->feature) + DataMatrix_GetContinuous(this->dm, view->vals[i+1], this->feature));
+    this->entropy = e[i];
+    this->split = 0.5 * (this->pair[i].value + this->pair[i+1].value);
     success = 1;
    }
   }
@@ -245,6 +248,12 @@ static void Split_fetch(Learner self, void * out)
  dest->split = this->split;
 }
 
+static float Split_sort_key(Learner self, int exemplar)
+{
+ Split * this = (Split*)self;
+ return DataMatrix_GetContinuous(this->dm, exemplar, this->feature);
+}
+
 
 const LearnerType SplitLearner =
 {
@@ -258,6 +267,233 @@ const LearnerType SplitLearner =
  Split_entropy,
  Split_size,
  Split_fetch,
+ Split_sort_key,
+};
+
+
+
+// The histogram learner - as the split learner, but the feature is quantised into quantile bins once, when the learner is created, so optimisation is a counting sort followed by a scan of the bin boundaries rather than a full sort...
+#define HISTOGRAM_BINS 256
+#define HISTOGRAM_SAMPLE 65536
+
+typedef struct Histogram Histogram;
+
+struct Histogram
+{
+ const LearnerType * type;
+ 
+ DataMatrix * dm;
+ int feature;
+ 
+ int bins; // Number of bins actually in use, after removing duplicate edges - can be less than HISTOGRAM_BINS.
+ float edge[HISTOGRAM_BINS-1]; // Boundaries between bins - an exemplar is in bin b if its value is >= edge[b-1] and < edge[b], with the obvious out of range cases.
+ unsigned char * bin; // Bin of every exemplar in the data matrix.
+ 
+ float entropy;
+ float split;
+ 
+ int count[HISTOGRAM_BINS]; // Bin sizes for the current IndexView.
+ int capacity; // Size of below.
+ int * temp; // Buffer for the counting sort.
+};
+
+
+// Helper for below...
+static int sort_float(const void * a, const void * b)
+{
+ float fa = *(const float*)a;
+ float fb = *(const float*)b;
+ 
+ if (fa<fb) return -1;
+ if (fa>fb) return 1;
+ return 0;
+}
+
+Learner Histogram_new(DataMatrix * dm, int feature)
+{
+ Histogram * this = (Histogram*)malloc(sizeof(Histogram));
+ this->type = &HistogramLearner;
+ 
+ this->dm = dm;
+ this->feature = feature;
+ 
+ this->capacity = 0;
+ this->temp = NULL;
+ 
+ int i;
+ 
+ // Collect a sample of the feature, evenly spaced if there are too many exemplars to use them all, and sort it...
+  int samples = dm->exemplars;
+  if (samples>HISTOGRAM_SAMPLE) samples = HISTOGRAM_SAMPLE;
+  
+  float * sample = (float*)malloc(samples * sizeof(float));
+  for (i=0; i<samples; i++)
+  {
+   int exemplar = (int)(((long long)i * dm->exemplars) / samples);
+   sample[i] = DataMatrix_GetContinuous(dm, exemplar, feature);
+  }
+  
+  qsort(sample, samples, sizeof(float), sort_float);
+  
+ // Select the bin edges as quantiles, skipping duplicates so no bin is empty for the sample...
+  this->bins = 1;
+  for (i=1; i<HISTOGRAM_BINS; i++)
+  {
+   if (samples==0) break;
+   float e = sample[((long long)i * samples) / HISTOGRAM_BINS];
+   
+   if ((e>sample[0]) && ((this->bins==1) || (e>this->edge[this->bins-2])))
+   {
+    this->edge[this->bins-1] = e;
+    this->bins += 1;
+   }
+  }
+  
+  free(sample);
+  
+ // Record the bin of every exemplar, using a binary search of the edges...
+  this->bin = (unsigned char*)malloc(dm->exemplars * sizeof(unsigned char));
+  
+  for (i=0; i<dm->exemplars; i++)
+  {
+   float val = DataMatrix_GetContinuous(dm, i, feature);
+   
+   int low = 0;
+   int high = this->bins - 1;
+   while (low<high)
+   {
+    int mid = (low + high) / 2;
+    if (val<this->edge[mid]) high = mid;
+                        else low = mid + 1;
+   }
+   
+   this->bin[i] = low;
+  }
+ 
+ return this;
+}
+
+static void Histogram_delete(Learner self)
+{
+ Histogram * this = (Histogram*)self;
+ free(this->temp);
+ free(this->bin);
+ free(this); 
+}
+
+static int Histogram_optimise(Learner self, InfoSet * info, IndexView * view, int depth, float improve, unsigned int key[4])
+{
+ Histogram * this = (Histogram*)self;
+ int i, b;
+ 
+ if (view->size<2) return 0;
+ 
+ // Counting sort of the IndexView by bin, which leaves exemplars in the same bin in their original order...
+  if (this->capacity<view->size)
+  {
+   this->capacity = view->size;
+   this->temp = (int*)realloc(this->temp, this->capacity * sizeof(int));
+  }
+  
+  for (b=0; b<this->bins; b++) this->count[b] = 0;
+  for (i=0; i<view->size; i++)
+  {
+   this->count[this->bin[view->vals[i]]] += 1;
+  }
+  
+  int offset[HISTOGRAM_BINS];
+  offset[0] = 0;
+  for (b=1; b<this->bins; b++)
+  {
+   offset[b] = offset[b-1] + this->count[b-1];
+  }
+  
+  for (i=0; i<view->size; i++)
+  {
+   int exemplar = view->vals[i];
+   this->temp[offset[this->bin[exemplar]]++] = exemplar;
+  }
+  
+  memcpy(view->vals, this->temp, view->size * sizeof(int));
+  
+ // Reset the InfoSet and fill in the pass half with all of the items...
+  InfoSet_reset(info);
+  for (i=0; i<view->size; i++)
+  {
+   InfoSet_pass_add(info, view->vals[i]); 
+  }
+  
+ // Move a bin at a time from pass to fail, only evaluating the entropy at the boundaries between non-empty bins...
+  int success = 0;
+  this->entropy = improve;
+  
+  i = 0;
+  for (b=0; b<this->bins-1; b++)
+  {
+   if (this->count[b]==0) continue;
+   
+   int end = i + this->count[b];
+   if (end>=view->size) break;
+   
+   for (; i<end; i++)
+   {
+    InfoSet_pass_remove(info, view->vals[i]);
+    InfoSet_fail_add(info, view->vals[i]);
+   }
+   
+   float e = InfoSet_entropy(info, depth);
+   
+   if (e<this->entropy)
+   {
+    this->entropy = e;
+    this->split = this->edge[b];
+    success = 1;
+   }
+  }
+  
+ return success;
+}
+
+static float Histogram_entropy(Learner self)
+{
+ Histogram * this = (Histogram*)self;
+ return this->entropy;
+}
+
+static size_t Histogram_size(Learner self)
+{
+ return sizeof(ContinuousSplit);
+}
+
+static void Histogram_fetch(Learner self, void * out)
+{
+ Histogram * this = (Histogram*)self;
+ ContinuousSplit * dest = (ContinuousSplit*)out;
+ 
+ dest->feature = this->feature;
+ dest->split = this->split;
+}
+
+static float Histogram_sort_key(Learner self, int exemplar)
+{
+ Histogram * this = (Histogram*)self;
+ return this->bin[exemplar];
+}
+
+
+const LearnerType HistogramLearner =
+{
+ 'H',
+ 'C',
+ "Histogram",
+ "A faster version of the split learner for large data sets - the feature is divided into 256 bins by quantile when training starts, and only the boundaries between bins are considered as split points. Avoids a sort at every node, at the cost of less precise splits and a byte per exemplar of memory. Outputs the same test as the split learner.",
+ Histogram_new,
+ Histogram_delete,
+ Histogram_optimise,
+ Histogram_entropy,
+ Histogram_size,
+ Histogram_fetch,
+ Histogram_sort_key,
 };
 
 
@@ -366,6 +602,7 @@ const LearnerType OneCatLearner =
  OneCat_entropy,
  OneCat_size,
  OneCat_fetch,
+ NULL,
 };
 
 
@@ -375,6 +612,7 @@ const LearnerType * ListLearner[] =
 {
  &IdiotLearner,
  &SplitLearner,
+ &HistogramLearner,
  &OneCatLearner,
  NULL
 };
@@ -396,8 +634,11 @@ LearnerSet * LearnerSet_new(DataMatrix * dm, const char * codes)
  
  // Fill in the basics...
   this->best = -1;
+  this->second = 1e100;
   this->feat = (int*)((char*)this + sizeof(LearnerSet) + dm->features*sizeof(Learner));
   this->features = dm->features;
+  this->capacity = 0;
+  this->order = NULL;
   
  // Fill it all in, creating the required learners...
   int i;
@@ -450,54 +691,84 @@ void LearnerSet_delete(LearnerSet * this)
  {
   Learner_delete(this->learn[i]); 
  }
+ free(this->order);
  free(this);
 }
 
+void LearnerSet_reset(LearnerSet * this)
+{
+ int i;
+ for (i=0; i<this->features; i++)
+ {
+  this->feat[i] = i; 
+ }
+}
+
 int LearnerSet_optimise(LearnerSet * this, InfoSet * info, IndexView * view, int features, int depth, unsigned int key[4])
+{
+ features = LearnerSet_select(this, features, key);
+ return LearnerSet_optimise_features(this, this->feat, features, info, view, depth, key);
+}
+
+int LearnerSet_select(LearnerSet * this, int features, unsigned int key[4])
 {
  int i;
  
- PhiloxRNG rng;
- PhiloxRNG_init(&rng, key);
+ if (features<this->features)
+ {
+  PhiloxRNG rng;
+  PhiloxRNG_init(&rng, key);
+  
+  // We are not doing all of them - shuffle the feat array, at least enough entries for the later loop...
+   for (i=0; i<features; i++)
+   {
+    // Get some random data...
+     unsigned int r = PhiloxRNG_next(&rng);
+     
+    // Select an index in feat to swap into the current position...
+     int target = i + (r % (this->features - i));
+
+    // Perform the swap...
+     int temp = this->feat[i];
+     this->feat[i] = this->feat[target];
+     this->feat[target] = temp;
+   }
+   
+  if (features<0) features = 0;
+ }
+ else
+ {
+  features = this->features; 
+ }
  
- // Decide which features to optimise...
-  if (features<this->features)
-  {
-   // We are not doing all of them - shuffle the feat array, at least enough entries for the later loop...
-    for (i=0; i<features; i++)
-    {
-     // Get some random data...
-      unsigned int r = PhiloxRNG_next(&rng);
-      
-     // Select an index in feat to swap into the current position...
-      int target = i + (r % (this->features - i));
-
-     // Perform the swap...
-      int temp = this->feat[i];
-      this->feat[i] = this->feat[target];
-      this->feat[target] = temp;
-    }
-  }
-  else
-  {
-   features = this->features; 
-  }
+ return features;
+}
 
- // Loop and optimise each selected feature in turn, to choose the best...
+int LearnerSet_optimise_features(LearnerSet * this, const int * feat, int features, InfoSet * info, IndexView * view, int depth, unsigned int key[4])
+{
+ int i;
+ 
+ // Loop and optimise each selected feature in turn, to choose the best - the runner up is tracked as well, and given as the hint, so a learner only gives up if it can't beat either...
   this->best = -1;
+  this->second = 1e100;
   float improve = 1e100;
   
   for (i=0; i<features; i++)
   {
-   int tf = this->feat[i];
-   if (Learner_optimise(this->learn[tf], info, view, depth, improve, key)!=0)
+   int tf = feat[i];
+   if (Learner_optimise(this->learn[tf], info, view, depth, this->second, key)!=0)
    {
     float entropy = Learner_entropy(this->learn[tf]);
     if (entropy<improve)
     {
+     this->second = improve;
      improve = entropy;
      this->best = tf;
     }
+    else
+    {
+     this->second = entropy;
+    }
    }
   }
   
@@ -506,6 +777,111 @@ int LearnerSet_optimise(LearnerSet * this, InfoSet * info, IndexView * view, int
                 else return 0;
 }
 
+
+// Helpers for below - an exemplar with the value it is sorted by, plus what is needed to break a tie the way the sequence of stable sorts would...
+typedef struct OrderContext OrderContext;
+typedef struct OrderEntry OrderEntry;
+
+struct OrderContext
+{
+ LearnerSet * ls;
+ int sorters; // Number of learners that sort, in the order they are applied - the last one provides value.
+ const int * sorter;
+};
+
+struct OrderEntry
+{
+ float value;
+ int position; // In the IndexView before sorting.
+ int exemplar;
+ const OrderContext * context;
+};
+
+static int sort_for_order(const void * a, const void * b)
+{
+ const OrderEntry * pa = (const OrderEntry*)a;
+ const OrderEntry * pb = (const OrderEntry*)b;
+ 
+ if (pa->value<pb->value) return -1;
+ if (pa->value>pb->value) return 1;
+ 
+ // A tie - the earlier sorts decide, most recent first, and if they are all tied too the original order...
+  const OrderContext * context = pa->context;
+  int i;
+  for (i=context->sorters-2; i>=0; i--)
+  {
+   Learner learn = context->ls->learn[context->sorter[i]];
+   LearnerSortKey key = Learner_sort_key(learn);
+   
+   float va = key(learn, pa->exemplar);
+   float vb = key(learn, pb->exemplar);
+   
+   if (va<vb) return -1;
+   if (va>vb) return 1;
+  }
+  
+ return pa->position - pb->position;
+}
+
+int LearnerSet_order(LearnerSet * this, const int * feat, int features, IndexView * view)
+{
+ int i;
+ 
+ // Find the learners that sort - the order only depends on them...
+  int * sorter = (int*)malloc((features>0 ? features : 1) * sizeof(int));
+  OrderContext context;
+  context.ls = this;
+  context.sorters = 0;
+  context.sorter = sorter;
+  
+  for (i=0; i<features; i++)
+  {
+   if (Learner_sort_key(this->learn[feat[i]])!=NULL)
+   {
+    sorter[context.sorters] = feat[i];
+    context.sorters += 1;
+   }
+  }
+  
+  if ((context.sorters==0)||(view->size<2))
+  {
+   free(sorter);
+   return 1;
+  }
+ 
+ // Sequential stable sorts leave the exemplars sorted by the last sorts value, ties broken by the previous sorts value and so on, so do that as a single sort...
+  if (this->capacity<view->size)
+  {
+   this->capacity = view->size;
+   this->order = realloc(this->order, this->capacity * sizeof(OrderEntry));
+  }
+  OrderEntry * entry = (OrderEntry*)this->order;
+  
+  Learner last = this->learn[sorter[context.sorters-1]];
+  LearnerSortKey key = Learner_sort_key(last);
+  
+  int ok = 1;
+  for (i=0; i<view->size; i++)
+  {
+   entry[i].value = key(last, view->vals[i]);
+   entry[i].position = i;
+   entry[i].exemplar = view->vals[i];
+   entry[i].context = &context;
+   
+   if (entry[i].value!=entry[i].value) ok = 0; // NaN.
+  }
+  
+  qsort(entry, view->size, sizeof(OrderEntry), sort_for_order);
+  
+  for (i=0; i<view->size; i++)
+  {
+   view->vals[i] = entry[i].exemplar;
+  }
+ 
+ free(sorter);
+ return ok;
+}
+
 int LearnerSet_feature(LearnerSet * this)
 {
  return this->best; 
@@ -516,6 +892,11 @@ float LearnerSet_entropy(LearnerSet * this)
  return Learner_entropy(this->learn[this->best]); 
 }
 
+float LearnerSet_runner_up(LearnerSet * this)
+{
+ return this->second;
+}
+
 char LearnerSet_code(LearnerSet * this)
 {
  return Learner_test_code(this->learn[this->best]); 
@@ -49,6 +49,9 @@ typedef size_t (*LearnerSize)(Learner this);
 // If the learner has just done a successful optimisation then this will write the test into the given bytes (Does not include the test code)...
 typedef void (*LearnerFetch)(Learner this, void * out);
 
+// Optional (NULL if optimise never reorders the IndexView) - returns the value optimise sorts an exemplar by. The sort must be stable, i.e. exemplars with the same value keep their relative order, so the order optimise leaves the view in can be worked out without running it...
+typedef float (*LearnerSortKey)(Learner this, int exemplar);
+
 
 
 // Define the learner type...
@@ -69,6 +72,8 @@ struct LearnerType
  LearnerEntropy entropy;
  LearnerSize size;
  LearnerFetch fetch;
+ 
+ LearnerSortKey sort_key;
 };
 
 
@@ -83,6 +88,7 @@ char Learner_test_code(Learner this);
 float Learner_entropy(Learner this);
 size_t Learner_size(Learner this);
 void Learner_fetch(Learner this, void * out);
+LearnerSortKey Learner_sort_key(Learner this);
 
 
 
@@ -93,6 +99,9 @@ const LearnerType IdiotLearner; // Code = I.
 // The default learner for real data - finds an optimal split point...
 const LearnerType SplitLearner; // Code = S.
 
+// Alternative to the split learner for large data sets - quantises the feature into bins once, so it never has to sort...
+const LearnerType HistogramLearner; // Code = H.
+
 // The default learner for discrete data - one discrete value passes, all other fail...
 const LearnerType OneCatLearner; // Code = O.
 
@@ -109,8 +118,12 @@ typedef struct LearnerSet LearnerSet;
 struct LearnerSet
 {
  int best; // Index of best, negative if none.
+ float second; // Entropy of the runner up - the best of the other features tried, or a huge value if none succeeded.
  int * feat; // Buffer of feature indices - to avoid allocating memory each time it shuffles them. (Actually stored after the learn array...)
  
+ int capacity; // Size of below.
+ void * order; // Buffer for LearnerSet_order.
+ 
  int features;
  Learner learn[0];
 };
@@ -125,15 +138,30 @@ LearnerSet * LearnerSet_new(DataMatrix * dm, const char * codes);
 // Terminate a LearnerSet, with extreme prejudice...
 void LearnerSet_delete(LearnerSet * this);
 
-// Optimises the split for the data in the given IndexView with the metric in the InfoSet; IndexView will be super jumbled by the process. features is how many randomly selected features to try optimising (without replacement - if greater than # features it just does them all), depth is the depth this is being done at, as required by the InfoView. key is for the random number generator, and will be incrimented as/if its used. Returns non-zero if its found something, zero if it failed...
+// The order of the features is shuffled each time optimise is called and carries over between calls, so the features tried depend on everything done before - this puts it back to its initial state, so what it does next depends only on the key...
+void LearnerSet_reset(LearnerSet * this);
+
+// Optimises the split for the data in the given IndexView with the metric in the InfoSet; IndexView will be super jumbled by the process. features is how many randomly selected features to try optimising (without replacement - if greater than # features it just does them all), depth is the depth this is being done at, as required by the InfoView. key is for the random number generator, and will be incrimented as/if its used. Returns non-zero if its found something, zero if it failed. Simply LearnerSet_select followed by LearnerSet_optimise_features...
 int LearnerSet_optimise(LearnerSet * this, InfoSet * info, IndexView * view, int features, int depth, unsigned int key[4]);
 
+// The first half of LearnerSet_optimise - shuffles the feat array, using the key, and returns how many features to optimise, which are then the first that many entries of feat. Only touches feat and key if features is less than the number of features...
+int LearnerSet_select(LearnerSet * this, int features, unsigned int key[4]);
+
+// The second half of LearnerSet_optimise - optimises the given features in turn, on the same IndexView, and picks the best. feat can be the feat array of this LearnerSet, or a copy of it...
+int LearnerSet_optimise_features(LearnerSet * this, const int * feat, int features, InfoSet * info, IndexView * view, int depth, unsigned int key[4]);
+
+// Reorders the IndexView as optimising the given features in turn would leave it, without optimising them - so the optimisation of each feature can be run seperately, on a copy of the view in the order the previous features would have left it, and do exactly what LearnerSet_optimise_features would. Returns zero if it can't, because a value being sorted by is NaN, which no sort orders consistently - the view is then left in an arbitrary order. Only the values of the last learner that sorts are checked, so to be sure of the order for a list of features every prefix of the list needs checking too...
+int LearnerSet_order(LearnerSet * this, const int * feat, int features, IndexView * view);
+
 // If its found a solution this returns the index of the feature the solution is operating on...
 int LearnerSet_feature(LearnerSet * this);
 
 // If its found a solution this returns that solutions entropy...
 float LearnerSet_entropy(LearnerSet * this);
 
+// If its found a solution this returns the entropy of the runner up, i.e. the best solution for any other feature tried - a huge value if there was none. For the Hoeffding bound, which needs the gap between the best and the second best...
+float LearnerSet_runner_up(LearnerSet * this);
+
 // If its found a solution this is the test code of the blob it will output...
 char LearnerSet_code(LearnerSet * this);
 
@@ -145,6 +173,27 @@ void LearnerSet_fetch(LearnerSet * this, void * out);
 
 
 
+// Structs for the test types, which are public so code that runs trees can special case them...
+// Continuous split: 'C'...
+typedef struct ContinuousSplit ContinuousSplit;
+
+struct ContinuousSplit
+{
+ int feature;
+ float split; // less than == fail, greater than or equal = pass.
+};
+
+// Accept one class: 'D'...
+typedef struct DiscreteSelect DiscreteSelect;
+
+struct DiscreteSelect
+{
+ int feature;
+ int accept; // Index of discrete feature it accepts.
+};
+
+
+
 // Function to run a test - takes a DataMatrix and an exemplar, returns non-zero if it passed, zero if it failed...
 typedef int (*DoTest)(const void * test, DataMatrix * dm, int exemplar);
 
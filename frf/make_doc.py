@@ -58,6 +58,11 @@ doc.addOther('\n'.join(text), 'Learner types', False)
 # Functions...
 doc.addFunction(frf.save_forest)
 doc.addFunction(frf.load_forest)
+doc.addFunction(frf.compact_report)
+doc.addFunction(frf.save_forest_mmap)
+doc.addFunction(frf.load_forest_mmap)
+doc.addFunction(frf.save_columns)
+doc.addFunction(frf.load_columns)
 
 
 
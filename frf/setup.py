@@ -19,8 +19,8 @@ from distutils.core import Extension
 
 
 
-depends = ['philox.h', 'data_matrix.h', 'summary.h', 'information.h', 'learner.h', 'index_set.h', 'tree.h', 'frf_c.h']
-code = ['philox.c', 'data_matrix.c', 'summary.c', 'information.c', 'learner.c', 'index_set.c', 'tree.c', 'frf_c.c']
+depends = ['philox.h', 'data_matrix.h', 'summary.h', 'information.h', 'learner.h', 'index_set.h', 'tree.h', 'threads.h', 'frf_c.h']
+code = ['philox.c', 'data_matrix.c', 'summary.c', 'information.c', 'learner.c', 'index_set.c', 'tree.c', 'threads.c', 'frf_c.c']
 
 ext = Extension('frf_c', code, depends=depends)
 
@@ -41,6 +41,16 @@ PyObject * Summary_merge_many_py(char code, int exemplars, int trees, Summary *
  return CodeSummary[(unsigned char)code]->merge_many_py(exemplars, trees, sums, magic, extra);
 }
 
+PyObject * Summary_merge_many_new(char code, int exemplars, Summary first, SummaryMagic magic, int extra, float ** out)
+{
+ return CodeSummary[(unsigned char)code]->merge_many_new(exemplars, first, magic, extra, out);
+}
+
+void Summary_merge_many_fill(char code, float ** out, int start, int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+{
+ CodeSummary[(unsigned char)code]->merge_many_fill(out, start, exemplars, trees, sums, magic, extra);
+}
+
 size_t Summary_size(char code, Summary this)
 {
  return CodeSummary[(unsigned char)code]->size(this);
@@ -51,6 +61,109 @@ PyObject * Summary_string(char code, Summary this)
  return CodeSummary[(unsigned char)code]->string(this); 
 }
 
+void Summary_bound(char code, Summary this, float * param, int first)
+{
+ CodeSummary[(unsigned char)code]->bound(this, param, first);
+}
+
+size_t Summary_compact(char code, Summary this, const float * param, void * out)
+{
+ return CodeSummary[(unsigned char)code]->compact(this, param, out);
+}
+
+size_t Summary_expand(char code, const void * in, size_t avail, const float * param, Summary out, size_t * used)
+{
+ return CodeSummary[(unsigned char)code]->expand(in, avail, param, out, used);
+}
+
+void Summary_update(char code, Summary this, float keep, DataMatrix * dm, IndexView * view, int feature)
+{
+ CodeSummary[(unsigned char)code]->update(this, keep, dm, view, feature);
+}
+
+
+
+// Helpers for the compact format - conversion to and from 16 bit floats (round to nearest, overflow to infinity) and quantisation to 16 bits within a range...
+static unsigned short Float_to_half(float value)
+{
+ unsigned int bits;
+ memcpy(&bits, &value, sizeof(float));
+ 
+ unsigned short sign = (bits >> 16) & 0x8000;
+ int exp = (int)((bits >> 23) & 0xff) - 127 + 15;
+ unsigned int man = bits & 0x7fffff;
+ 
+ if (((bits >> 23) & 0xff)==0xff) return sign | 0x7c00 | ((man!=0) ? 0x200 : 0); // Infinity or nan.
+ if (exp>=31) return sign | 0x7c00; // Too big.
+ 
+ if (exp<=0)
+ {
+  // Subnormal, or too small, in which case it goes to zero...
+   if (exp<-10) return sign;
+   
+   man |= 0x800000;
+   int shift = 14 - exp;
+   unsigned short ret = sign | (man >> shift);
+   if ((man >> (shift-1)) & 1) ret += 1;
+   return ret;
+ }
+ 
+ unsigned short ret = sign | (exp << 10) | (man >> 13);
+ if (man & 0x1000) ret += 1; // A carry into the exponent is the right answer.
+ return ret;
+}
+
+static float Half_to_float(unsigned short half)
+{
+ unsigned int sign = (unsigned int)(half & 0x8000) << 16;
+ int exp = (half >> 10) & 0x1f;
+ unsigned int man = half & 0x3ff;
+ 
+ unsigned int bits;
+ if (exp==0)
+ {
+  if (man==0) bits = sign;
+  else
+  {
+   // Subnormal - normalise it...
+    exp = 1;
+    while ((man & 0x400)==0)
+    {
+     man <<= 1;
+     exp -= 1;
+    }
+    man &= 0x3ff;
+    
+    bits = sign | ((unsigned int)(exp + 127 - 15) << 23) | (man << 13);
+  }
+ }
+ else
+ {
+  if (exp==31) bits = sign | 0x7f800000 | (man << 13);
+  else bits = sign | ((unsigned int)(exp + 127 - 15) << 23) | (man << 13);
+ }
+ 
+ float ret;
+ memcpy(&ret, &bits, sizeof(float));
+ return ret;
+}
+
+static unsigned short Quantise(float value, float low, float high)
+{
+ if (high<=low) return 0;
+ 
+ float t = (value - low) / (high - low) * 65535.0;
+ if (t<0.0) t = 0.0;
+ if (t>65535.0) t = 65535.0;
+ 
+ return (unsigned short)(t + 0.5);
+}
+
+static float Dequantise(unsigned short value, float low, float high)
+{
+ return low + (high - low) * (value / 65535.0);
+}
+
 
 
 // The nothing summary type - I feel as empty writting this as I am sure you do reading it...
@@ -81,16 +194,48 @@ static PyObject * Nothing_merge_many_py(int exemplars, int trees, Summary * sums
  return Py_None;
 }
 
+static PyObject * Nothing_merge_many_new(int exemplars, Summary first, SummaryMagic magic, int extra, float ** out)
+{
+ Py_INCREF(Py_None);
+ return Py_None;
+}
+
+static void Nothing_merge_many_fill(float ** out, int start, int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+{
+ // No-op
+}
+
 static size_t Nothing_size(Summary this)
 {
  return 0;  
 }
 
+static void Nothing_bound(Summary this, float * param, int first)
+{
+ // No-op
+}
+
+static size_t Nothing_compact(Summary this, const float * param, void * out)
+{
+ return 0;
+}
+
+static size_t Nothing_expand(const void * in, size_t avail, const float * param, Summary out, size_t * used)
+{
+ *used = 0;
+ return 0;
+}
+
 static PyObject * Nothing_string(Summary this)
 {
  return PyString_FromFormat("nothing()");
 }
 
+static void Nothing_update(Summary this, float keep, DataMatrix * dm, IndexView * view, int feature)
+{
+ // No-op
+}
+
 
 const SummaryType NothingSummary =
 {
@@ -102,8 +247,14 @@ const SummaryType NothingSummary =
  Nothing_error,
  Nothing_merge_py,
  Nothing_merge_many_py,
+ Nothing_merge_many_new,
+ Nothing_merge_many_fill,
  Nothing_size,
  Nothing_string,
+ Nothing_bound,
+ Nothing_compact,
+ Nothing_expand,
+ Nothing_update,
 };
 
 
@@ -246,53 +397,68 @@ static PyObject * Categorical_merge_py(int trees, Summary * sums, SummaryMagic m
   return Py_BuildValue("{sfsN}", "count", count, "prob", prob);
 }
 
-static PyObject * Categorical_merge_many_py(int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+static PyObject * Categorical_merge_many_new(int exemplars, Summary first, SummaryMagic magic, int extra, float ** out)
 {
- // Setup the output...
-  Categorical * first = (Categorical*)sums[0];
-  if (magic!=NULL) first = (Categorical*)magic(first, extra);
+ Categorical * targ = (Categorical*)first;
+ if (magic!=NULL) targ = (Categorical*)magic(targ, extra);
   
-  npy_intp size[2] = {exemplars, first->cats};
-  PyArrayObject * count = (PyArrayObject*)PyArray_SimpleNew(1, size, NPY_FLOAT32);
-  PyArrayObject * prob = (PyArrayObject*)PyArray_SimpleNew(2, size, NPY_FLOAT32);
+ npy_intp size[2] = {exemplars, targ->cats};
+ PyArrayObject * count = (PyArrayObject*)PyArray_SimpleNew(1, size, NPY_FLOAT32);
+ PyArrayObject * prob = (PyArrayObject*)PyArray_SimpleNew(2, size, NPY_FLOAT32);
  
-  int i, j, k;
-  
-  for (k=0; k<size[0]; k++)
-  {
-   *(float*)PyArray_GETPTR1(count, k) = 0.0;
-   for (i=0; i<size[1]; i++)
-   {
-    *(float*)PyArray_GETPTR2(prob, k, i) = 0.0;
-   }
-  }
+ out[0] = (float*)PyArray_DATA(count);
+ out[1] = (float*)PyArray_DATA(prob);
+ 
+ return Py_BuildValue("{sNsN}", "count", count, "prob", prob);
+}
+
+static void Categorical_merge_many_fill(float ** out, int start, int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+{
+ if (exemplars==0) return;
+ 
+ Categorical * first = (Categorical*)sums[0];
+ if (magic!=NULL) first = (Categorical*)magic(first, extra);
+ int cats = first->cats;
+ 
+ int i, j, k;
+ for (k=0; k<exemplars; k++)
+ {
+  // Get the output row and zero it...
+   float * count = out[0] + start + k;
+   float * prob = out[1] + (size_t)(start + k) * cats;
+   
+   *count = 0.0;
+   for (i=0; i<cats; i++) prob[i] = 0.0;
   
- // Loop and record the values...
-  for (k=0; k<size[0]; k++)
-  {
+  // Sum in each tree and normalise...
    float total = 0.0;
    for (j=0; j<trees; j++)
    {
     Categorical * targ = (Categorical*)sums[k*trees + j];
     if (magic!=NULL) targ = (Categorical*)magic(targ, extra);
    
-    *(float*)PyArray_GETPTR1(count, k) += targ->count;
+    *count += targ->count;
    
-    for (i=0; i<size[1]; i++)
+    for (i=0; i<cats; i++)
     {
-     *(float*)PyArray_GETPTR2(prob, k, i) += targ->prob[i];
+     prob[i] += targ->prob[i];
      total += targ->prob[i];
     }
    }
   
-   for (i=0; i<size[1]; i++)
+   for (i=0; i<cats; i++)
    {
-    *(float*)PyArray_GETPTR2(prob, k, i) /= total;
+    prob[i] /= total;
    }
-  }
- 
- // Build and return the dictionary...
-  return Py_BuildValue("{sNsN}", "count", count, "prob", prob);
+ }
+}
+
+static PyObject * Categorical_merge_many_py(int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+{
+ float * out[SUMMARY_OUTPUTS];
+ PyObject * ret = Categorical_merge_many_new(exemplars, sums[0], magic, extra, out);
+ Categorical_merge_many_fill(out, 0, exemplars, trees, sums, magic, extra);
+ return ret;
 }
 
 static size_t Categorical_size(Summary self)
@@ -325,6 +491,112 @@ static PyObject * Categorical_string(Summary self)
 }
 
 
+static void Categorical_bound(Summary self, float * param, int first)
+{
+ // No-op - probabilities are always in [0, 1]
+}
+
+static size_t Categorical_compact(Summary self, const float * param, void * out)
+{
+ Categorical * this = (Categorical*)self;
+ 
+ if (out!=NULL)
+ {
+  char * targ = (char*)out;
+  memcpy(targ, &this->count, sizeof(float));
+  memcpy(targ + sizeof(float), &this->cats, sizeof(int));
+  targ += sizeof(float) + sizeof(int);
+  
+  int i;
+  for (i=0; i<this->cats; i++)
+  {
+   unsigned short q = Quantise(this->prob[i], 0.0, 1.0);
+   memcpy(targ + i * sizeof(unsigned short), &q, sizeof(unsigned short));
+  }
+ }
+ 
+ return sizeof(float) + sizeof(int) + this->cats * sizeof(unsigned short);
+}
+
+static size_t Categorical_expand(const void * in, size_t avail, const float * param, Summary self, size_t * used)
+{
+ const char * data = (const char*)in;
+ 
+ *used = sizeof(float) + sizeof(int);
+ if (*used>avail) return 0;
+ 
+ int cats;
+ memcpy(&cats, data + sizeof(float), sizeof(int));
+ if (cats<0)
+ {
+  *used = avail + 1;
+  return 0;
+ }
+ *used += cats * sizeof(unsigned short);
+ 
+ Categorical * this = (Categorical*)self;
+ if (this!=NULL)
+ {
+  memcpy(&this->count, data, sizeof(float));
+  this->cats = cats;
+  
+  int i;
+  for (i=0; i<cats; i++)
+  {
+   unsigned short q;
+   memcpy(&q, data + sizeof(float) + sizeof(int) + i * sizeof(unsigned short), sizeof(unsigned short));
+   this->prob[i] = Dequantise(q, 0.0, 1.0);
+  }
+ }
+ 
+ return sizeof(Categorical) + cats * sizeof(float);
+}
+
+static void Categorical_update(Summary self, float keep, DataMatrix * dm, IndexView * view, int feature)
+{
+ Categorical * this = (Categorical*)self;
+ 
+ // Convert back to weighted counts, after forgetting as requested...
+  this->count *= keep;
+ 
+  int i;
+  for (i=0; i<this->cats; i++)
+  {
+   this->prob[i] *= this->count;
+  }
+ 
+ // Add in the new exemplars...
+  for (i=0; i<view->size; i++)
+  {
+   int exemplar = view->vals[i];
+   int value = DataMatrix_GetDiscrete(dm, exemplar, feature);
+ 
+   if ((value>=0)&&(value<this->cats))
+   {
+    float w = DataMatrix_GetWeight(dm, exemplar);
+    this->count += w;
+    this->prob[value] += w;
+   }
+  }
+ 
+ // Normalise, as for init...
+  if (this->count>1e-6)
+  {
+   for (i=0; i<this->cats; i++)
+   {
+    this->prob[i] /= this->count;
+   }
+  }
+  else
+  {
+   for (i=0; i<this->cats; i++)
+   {
+    this->prob[i] = 1.0 / this->cats;
+   }
+  }
+}
+
+
 const SummaryType CategoricalSummary =
 {
  'C',
@@ -335,8 +607,14 @@ const SummaryType CategoricalSummary =
  Categorical_error,
  Categorical_merge_py,
  Categorical_merge_many_py,
+ Categorical_merge_many_new,
+ Categorical_merge_many_fill,
  Categorical_size,
  Categorical_string,
+ Categorical_bound,
+ Categorical_compact,
+ Categorical_expand,
+ Categorical_update,
 };
 
 
@@ -438,21 +716,29 @@ static PyObject * Gaussian_merge_py(int trees, Summary * sums, SummaryMagic magi
   return Py_BuildValue("{sfsfsf}", "count", count, "mean", mean, "var", var);
 }
 
-static PyObject * Gaussian_merge_many_py(int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+static PyObject * Gaussian_merge_many_new(int exemplars, Summary first, SummaryMagic magic, int extra, float ** out)
 {
- // Create the output numpy arrays...
-  npy_intp size = exemplars;
-  PyArrayObject * count_arr = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_FLOAT32);
-  PyArrayObject * mean_arr  = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_FLOAT32);
-  PyArrayObject * var_arr   = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_FLOAT32);
+ npy_intp size = exemplars;
+ PyArrayObject * count_arr = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_FLOAT32);
+ PyArrayObject * mean_arr  = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_FLOAT32);
+ PyArrayObject * var_arr   = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_FLOAT32);
  
+ out[0] = (float*)PyArray_DATA(count_arr);
+ out[1] = (float*)PyArray_DATA(mean_arr);
+ out[2] = (float*)PyArray_DATA(var_arr);
+ 
+ return Py_BuildValue("{sNsNsN}", "count", count_arr, "mean", mean_arr, "var", var_arr);
+}
+
+static void Gaussian_merge_many_fill(float ** out, int start, int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+{
  // Go through and fill in the values for each row at a time...
   int i, j;
   for (j=0; j<exemplars; j++)
   {
-   float * count = (float*)PyArray_GETPTR1(count_arr, j);
-   float * mean  = (float*)PyArray_GETPTR1(mean_arr, j);
-   float * var   = (float*)PyArray_GETPTR1(var_arr, j);
+   float * count = out[0] + start + j;
+   float * mean  = out[1] + start + j;
+   float * var   = out[2] + start + j;
    
    *count = 0.0;
    *mean = 0.0;
@@ -472,10 +758,15 @@ static PyObject * Gaussian_merge_many_py(int exemplars, int trees, Summary * sum
    }
    
    if (*count>1e-6) *var /= *count;
-  }  
- 
- // Build and return the dictionary of arrays...
-  return Py_BuildValue("{sNsNsN}", "count", count_arr, "mean", mean_arr, "var", var_arr);
+  }
+}
+
+static PyObject * Gaussian_merge_many_py(int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+{
+ float * out[SUMMARY_OUTPUTS];
+ PyObject * ret = Gaussian_merge_many_new(exemplars, sums[0], magic, extra, out);
+ Gaussian_merge_many_fill(out, 0, exemplars, trees, sums, magic, extra);
+ return ret;
 }
 
 static size_t Gaussian_size(Summary self)
@@ -499,6 +790,79 @@ static PyObject * Gaussian_string(Summary self)
 }
 
 
+static void Gaussian_bound(Summary self, float * param, int first)
+{
+ // Range of the mean and the maximum variance...
+  Gaussian * this = (Gaussian*)self;
+  
+  if ((first!=0)||(this->mean<param[0])) param[0] = this->mean;
+  if ((first!=0)||(this->mean>param[1])) param[1] = this->mean;
+  if ((first!=0)||(this->var>param[2])) param[2] = this->var;
+}
+
+static size_t Gaussian_compact(Summary self, const float * param, void * out)
+{
+ Gaussian * this = (Gaussian*)self;
+ 
+ if (out!=NULL)
+ {
+  unsigned short q[2];
+  q[0] = Quantise(this->mean, param[0], param[1]);
+  q[1] = Float_to_half((param[2]>0.0) ? (this->var / param[2]) : 0.0);
+  
+  memcpy(out, &this->count, sizeof(float));
+  memcpy((char*)out + sizeof(float), q, sizeof(q));
+ }
+ 
+ return sizeof(float) + 2 * sizeof(unsigned short);
+}
+
+static size_t Gaussian_expand(const void * in, size_t avail, const float * param, Summary self, size_t * used)
+{
+ *used = sizeof(float) + 2 * sizeof(unsigned short);
+ 
+ Gaussian * this = (Gaussian*)self;
+ if (this!=NULL)
+ {
+  unsigned short q[2];
+  memcpy(&this->count, in, sizeof(float));
+  memcpy(q, (const char*)in + sizeof(float), sizeof(q));
+  
+  this->mean = Dequantise(q[0], param[0], param[1]);
+  this->var = Half_to_float(q[1]) * param[2];
+ }
+ 
+ return sizeof(Gaussian);
+}
+
+static void Gaussian_update(Summary self, float keep, DataMatrix * dm, IndexView * view, int feature)
+{
+ Gaussian * this = (Gaussian*)self;
+ 
+ // Forget as requested and return the variance to being a scatter, then continue the incremental calculation of init...
+  this->count *= keep;
+  this->var *= this->count;
+ 
+  int i;
+  for (i=0; i<view->size; i++)
+  {
+   int exemplar = view->vals[i];
+   float value = DataMatrix_GetContinuous(dm, exemplar, feature);
+   float w = DataMatrix_GetWeight(dm, exemplar);
+ 
+   float new_count = this->count + w;
+   float delta = value - this->mean;
+   float offset = (delta * w) / new_count;
+ 
+   this->mean += offset;
+   this->var += this->count * delta * offset;
+   this->count = new_count;
+  }
+ 
+ if (this->count>1e-6) this->var /= this->count;
+}
+
+
 const SummaryType GaussianSummary =
 {
  'G',
@@ -509,8 +873,14 @@ const SummaryType GaussianSummary =
  Gaussian_error,
  Gaussian_merge_py,
  Gaussian_merge_many_py,
+ Gaussian_merge_many_new,
+ Gaussian_merge_many_fill,
  Gaussian_size,
  Gaussian_string,
+ Gaussian_bound,
+ Gaussian_compact,
+ Gaussian_expand,
+ Gaussian_update,
 };
 
 
@@ -679,22 +1049,30 @@ static PyObject * BiGaussian_merge_py(int trees, Summary * sums, SummaryMagic ma
   return Py_BuildValue("{sfsNsN}", "count", count, "mean", mean_arr, "covar", covar_arr);
 }
 
-static PyObject * BiGaussian_merge_many_py(int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+static PyObject * BiGaussian_merge_many_new(int exemplars, Summary first, SummaryMagic magic, int extra, float ** out)
+{
+ npy_intp dims[3] = {exemplars, 2, 2};
+  
+ PyArrayObject * count_arr = (PyArrayObject*)PyArray_SimpleNew(1, dims, NPY_FLOAT32);
+ PyArrayObject * mean_arr = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
+ PyArrayObject * covar_arr = (PyArrayObject*)PyArray_SimpleNew(3, dims, NPY_FLOAT32);
+ 
+ out[0] = (float*)PyArray_DATA(count_arr);
+ out[1] = (float*)PyArray_DATA(mean_arr);
+ out[2] = (float*)PyArray_DATA(covar_arr);
+ 
+ return Py_BuildValue("{sNsNsN}", "count", count_arr, "mean", mean_arr, "covar", covar_arr);
+}
+
+static void BiGaussian_merge_many_fill(float ** out, int start, int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
 {
  int i, j, k;
  
- // Create the output variables...
-  npy_intp dims[3] = {exemplars, 2, 2};
-  
-  PyArrayObject * count_arr = (PyArrayObject*)PyArray_SimpleNew(1, dims, NPY_FLOAT32);
-  PyArrayObject * mean_arr = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
-  PyArrayObject * covar_arr = (PyArrayObject*)PyArray_SimpleNew(3, dims, NPY_FLOAT32);
-  
  // Loop and process each exemplar in turn... 
   for (j=0; j<exemplars; j++)
   {
    // Get pointers to all the output variables...
-    float * count = (float*)PyArray_GETPTR1(count_arr, j);
+    float * count = out[0] + start + j;
     float * mean[2];
     float * var[2];
     float * covar;
@@ -702,13 +1080,13 @@ static PyObject * BiGaussian_merge_many_py(int exemplars, int trees, Summary * s
     *count = 0.0;
     for (k=0; k<2; k++)
     {
-     mean[k] = (float*)PyArray_GETPTR2(mean_arr, j, k);
-     var[k] = (float*)PyArray_GETPTR3(covar_arr, j, k, k);
+     mean[k] = out[1] + (size_t)(start + j) * 2 + k;
+     var[k] = out[2] + (size_t)(start + j) * 4 + k * 3;
    
      *mean[k] = 0.0;
      *var[k] = 0.0;
     }
-    covar = (float*)PyArray_GETPTR3(covar_arr, j, 0, 1);
+    covar = out[2] + (size_t)(start + j) * 4 + 1;
     *covar = 0.0;
  
    // Combine from all trees...
@@ -739,11 +1117,16 @@ static PyObject * BiGaussian_merge_many_py(int exemplars, int trees, Summary * s
      *var[1] /= *count;
      *covar /= *count;
     }
-    *(float*)PyArray_GETPTR3(covar_arr, j, 1, 0) = *covar;
+    covar[1] = *covar; // The [1, 0] entry, which immediatly follows [0, 1].
   }
-  
- // Build and return a dictionary containing the required values...
-  return Py_BuildValue("{sNsNsN}", "count", count_arr, "mean", mean_arr, "covar", covar_arr);
+}
+
+static PyObject * BiGaussian_merge_many_py(int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra)
+{
+ float * out[SUMMARY_OUTPUTS];
+ PyObject * ret = BiGaussian_merge_many_new(exemplars, sums[0], magic, extra, out);
+ BiGaussian_merge_many_fill(out, 0, exemplars, trees, sums, magic, extra);
+ return ret;
 }
 
 static size_t BiGaussian_size(Summary self)
@@ -775,6 +1158,116 @@ static PyObject * BiGaussian_string(Summary self)
 }
 
 
+static void BiGaussian_bound(Summary self, float * param, int first)
+{
+ // Range of each mean then the maximum of each variance...
+  BiGaussian * this = (BiGaussian*)self;
+  
+  int i;
+  for (i=0; i<2; i++)
+  {
+   if ((first!=0)||(this->mean[i]<param[i*2])) param[i*2] = this->mean[i];
+   if ((first!=0)||(this->mean[i]>param[i*2+1])) param[i*2+1] = this->mean[i];
+   if ((first!=0)||(this->var[i]>param[4+i])) param[4+i] = this->var[i];
+  }
+}
+
+static size_t BiGaussian_compact(Summary self, const float * param, void * out)
+{
+ BiGaussian * this = (BiGaussian*)self;
+ 
+ if (out!=NULL)
+ {
+  unsigned short q[5];
+  float covar_scale = sqrt(param[4] * param[5]);
+  
+  int i;
+  for (i=0; i<2; i++)
+  {
+   q[i] = Quantise(this->mean[i], param[i*2], param[i*2+1]);
+   q[2+i] = Float_to_half((param[4+i]>0.0) ? (this->var[i] / param[4+i]) : 0.0);
+  }
+  q[4] = Float_to_half((covar_scale>0.0) ? (this->covar / covar_scale) : 0.0); // Magnitude can't be more than one.
+  
+  memcpy(out, &this->count, sizeof(float));
+  memcpy((char*)out + sizeof(float), q, sizeof(q));
+ }
+ 
+ return sizeof(float) + 5 * sizeof(unsigned short);
+}
+
+static size_t BiGaussian_expand(const void * in, size_t avail, const float * param, Summary self, size_t * used)
+{
+ *used = sizeof(float) + 5 * sizeof(unsigned short);
+ 
+ BiGaussian * this = (BiGaussian*)self;
+ if (this!=NULL)
+ {
+  unsigned short q[5];
+  memcpy(&this->count, in, sizeof(float));
+  memcpy(q, (const char*)in + sizeof(float), sizeof(q));
+  
+  int i;
+  for (i=0; i<2; i++)
+  {
+   this->mean[i] = Dequantise(q[i], param[i*2], param[i*2+1]);
+   this->var[i] = Half_to_float(q[2+i]) * param[4+i];
+  }
+  this->covar = Half_to_float(q[4]) * sqrt(param[4] * param[5]);
+ }
+ 
+ return sizeof(BiGaussian);
+}
+
+static void BiGaussian_update(Summary self, float keep, DataMatrix * dm, IndexView * view, int feature)
+{
+ BiGaussian * this = (BiGaussian*)self;
+ 
+ int i, k;
+ 
+ // Forget as requested and return the (co)variances to being scatters, then continue the incremental calculation of init...
+  this->count *= keep;
+  for (k=0; k<2; k++)
+  {
+   this->var[k] *= this->count;
+  }
+  this->covar *= this->count;
+ 
+  for (i=0; i<view->size; i++)
+  {
+   int exemplar = view->vals[i];
+   float value[2];
+ 
+   value[0] = DataMatrix_GetContinuous(dm, exemplar, feature);
+   value[1] = DataMatrix_GetContinuous(dm, exemplar, feature+1);
+   float w = DataMatrix_GetWeight(dm, exemplar);
+ 
+   float new_count = this->count + w;
+   float delta[2];
+ 
+   for (k=0; k<2; k++)
+   {
+    delta[k] = value[k] - this->mean[k];
+    float offset = (delta[k] * w) / new_count;
+    this->mean[k] += offset;
+    this->var[k] += this->count * delta[k] * offset;
+   }
+ 
+   this->covar += w * delta[0] * (value[1] - this->mean[1]);
+   this->count = new_count;
+  }
+ 
+ if (this->count>1e-6)
+ {
+  for (k=0; k<2; k++)
+  {
+   this->var[k] /= this->count;
+  }
+  this->covar /= this->count;
+ }
+}
+
+
 const SummaryType BiGaussianSummary =
 {
  'B',
@@ -785,8 +1278,14 @@ const SummaryType BiGaussianSummary =
  BiGaussian_error,
  BiGaussian_merge_py,
  BiGaussian_merge_many_py,
+ BiGaussian_merge_many_new,
+ BiGaussian_merge_many_fill,
  BiGaussian_size,
  BiGaussian_string,
+ BiGaussian_bound,
+ BiGaussian_compact,
+ BiGaussian_expand,
+ BiGaussian_update,
 };
 
 
@@ -910,7 +1409,9 @@ void SummarySet_init(SummarySet * this, DataMatrix * dm, IndexView * view, const
    }
   }
   
-  this->size += sizeof(int) * ((dm->features / sizeof(int)) + (((dm->features%sizeof(int))==0)?0:1));
+  size_t code_size = sizeof(int) * ((dm->features / sizeof(int)) + (((dm->features%sizeof(int))==0)?0:1));
+  memset(code + dm->features, 0, code_size - dm->features); // So identical summaries are identical bytes.
+  this->size += code_size;
   
  // Create the summary object for each feature in the DataMatrix...
   for (i=0; i<dm->features; i++)
@@ -966,17 +1467,27 @@ PyObject * SummarySet_merge_py(int trees, SummarySet ** sum_sets)
 
 PyObject * SummarySet_merge_many_py(int exemplars, int trees, SummarySet ** sum_sets)
 {
- char * code = CodePtr(sum_sets[0]);
+ float * out[sum_sets[0]->features * SUMMARY_OUTPUTS];
+ 
+ PyObject * ret = SummarySet_merge_many_new(exemplars, sum_sets[0], out);
+ SummarySet_merge_many_fill(out, 0, exemplars, trees, sum_sets);
+  
+ return ret;
+}
+
+PyObject * SummarySet_merge_many_new(int exemplars, SummarySet * first, float ** out)
+{
+ char * code = CodePtr(first);
   
  // Create the return tuple...
-  int feats = sum_sets[0]->features;
+  int feats = first->features;
   PyObject * ret = PyTuple_New(feats);
  
  // Iterate and fill the tuple in...
   int i;
   for (i=0; i<feats; i++)
   {
-   PyObject * obj = Summary_merge_many_py(code[i], exemplars, trees, (Summary*)sum_sets, SummarySet_magic, i);
+   PyObject * obj = Summary_merge_many_new(code[i], exemplars, (Summary)first, SummarySet_magic, i, out + i*SUMMARY_OUTPUTS);
    PyTuple_SetItem(ret, i, obj);
   }
   
@@ -984,6 +1495,18 @@ PyObject * SummarySet_merge_many_py(int exemplars, int trees, SummarySet ** sum_
   return ret;
 }
 
+void SummarySet_merge_many_fill(float ** out, int start, int exemplars, int trees, SummarySet ** sum_sets)
+{
+ if (exemplars==0) return;
+ char * code = CodePtr(sum_sets[0]);
+ 
+ int i;
+ for (i=0; i<sum_sets[0]->features; i++)
+ {
+  Summary_merge_many_fill(code[i], out + i*SUMMARY_OUTPUTS, start, exemplars, trees, (Summary*)sum_sets, SummarySet_magic, i);
+ }
+}
+
 size_t SummarySet_size(SummarySet * this)
 {
  return this->size; 
@@ -1006,6 +1529,94 @@ PyObject * SummarySet_string(SummarySet * this)
 }
 
 
+const char * SummarySet_codes(SummarySet * this)
+{
+ return CodePtr(this);
+}
+
+
+
+void SummarySet_bound(SummarySet * this, float * param, int first)
+{
+ char * code = CodePtr(this);
+ 
+ int i;
+ for (i=0; i<this->features; i++)
+ {
+  Summary_bound(code[i], SummaryPtr(this, i), param + i * SUMMARY_PARAMS, first);
+ }
+}
+
+size_t SummarySet_compact(SummarySet * this, const float * param, void * out)
+{
+ char * code = CodePtr(this);
+ size_t ret = 0;
+ 
+ int i;
+ for (i=0; i<this->features; i++)
+ {
+  ret += Summary_compact(code[i], SummaryPtr(this, i), param + i * SUMMARY_PARAMS, (out!=NULL) ? ((char*)out + ret) : NULL);
+ }
+ 
+ return ret;
+}
+
+size_t SummarySet_expand(int features, const char * codes, const void * in, size_t avail, const float * param, SummarySet * out, size_t * used)
+{
+ const char * data = (const char*)in;
+ int i;
+ 
+ // The header, offsets and codes, exactly as SummarySet_init does it...
+  size_t ret = sizeof(SummarySet) + features * sizeof(int);
+  
+  if (out!=NULL)
+  {
+   out->features = features;
+   char * code = CodePtr(out);
+   for (i=0; i<features; i++) code[i] = codes[i];
+  }
+  
+  ret += sizeof(int) * ((features / sizeof(int)) + (((features%sizeof(int))==0)?0:1));
+ 
+ // Each summary in turn...
+  *used = 0;
+  for (i=0; i<features; i++)
+  {
+   size_t u;
+   size_t size = Summary_expand(codes[i], data + *used, avail - *used, param + i * SUMMARY_PARAMS, NULL, &u);
+   if (u>(avail - *used))
+   {
+    *used = avail + 1;
+    return 0;
+   }
+   
+   if (out!=NULL)
+   {
+    out->offset[i] = ret;
+    Summary_expand(codes[i], data + *used, avail - *used, param + i * SUMMARY_PARAMS, SummaryPtr(out, i), &u);
+   }
+   
+   ret += size;
+   *used += u;
+  }
+ 
+ if (out!=NULL) out->size = ret;
+ return ret;
+}
+
+
+void SummarySet_update(SummarySet * this, float keep, DataMatrix * dm, IndexView * view)
+{
+ char * code = CodePtr(this);
+ 
+ int i;
+ for (i=0; i<this->features; i++)
+ {
+  Summary_update(code[i], SummaryPtr(this, i), keep, dm, view, i);
+ }
+}
+
+
 
 void Setup_Summary(void)
 {
@@ -24,6 +24,12 @@ typedef struct IndexView IndexView;
 // Summary type, just a void pointer used for all of the summary types...
 typedef void * Summary;
 
+// Maximum number of arrays a summary type can output from merge_many_py...
+#define SUMMARY_OUTPUTS 4
+
+// Number of floats of parameters a summary type gets for each feature of a tree when being compacted...
+#define SUMMARY_PARAMS 8
+
 
 
 // Define an access function to be used if the Summary pointer is not really a Summary pointer below, to convert whatever it really is into one...
@@ -48,12 +54,30 @@ typedef PyObject * (*SummaryMergePy)(int trees, Summary * sums, SummaryMagic mag
 // As above, but for multiple test exemplars, point being the Python summary can give a datamatrix-like response and be much more efficient this way. Outer is exemplars, inner is trees when going through the sums array...
 typedef PyObject * (*SummaryMergeManyPy)(int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra);
 
+// The below two split merge_many_py in two, so the output can be filled in a block of exemplars at a time, without the GIL. This one creates the Python object merge_many_py would return, with undefined contents, and writes pointers to the data of the (contiguous, float32) arrays within into out, which must have space for SUMMARY_OUTPUTS pointers. first is any of the summaries, for the layout...
+typedef PyObject * (*SummaryMergeManyNew)(int exemplars, Summary first, SummaryMagic magic, int extra, float ** out);
+
+// ...and this one fills in the exemplars [start, start+exemplars) of that output, where sums is exemplars x trees, for just those exemplars. Must not touch any Python object...
+typedef void (*SummaryMergeManyFill)(float ** out, int start, int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra);
+
 // Returns how many bytes the passed Summary object is in size...
 typedef size_t (*SummarySize)(Summary this);
 
 // Represents a summary as a Python string, for human consumption...
 typedef PyObject * (*SummaryString)(Summary this);
 
+// The next three support the compact (lossy) tree format, where the summaries of a tree are quantised against parameters (SUMMARY_PARAMS floats) shared by all summaries of the same feature in the tree, typically a range. This is called on every summary first, to fill in the parameters - first is nonzero for the first summary, in which case param should be initialised rather than updated...
+typedef void (*SummaryBound)(Summary this, float * param, int first);
+
+// Writes the compact version of the summary into out, which has no alignment and can be NULL to just get the size; returns how many bytes it is...
+typedef size_t (*SummaryCompact)(Summary this, const float * param, void * out);
+
+// Reverses the above, writing the full Summary into out, which can be NULL to just get the size; returns the size of the full Summary and sets used to how many bytes of in it consumes. avail is how many bytes of in there are - if there are too few to even work out how many bytes are needed used is set to more than avail and 0 returned...
+typedef size_t (*SummaryExpand)(const void * in, size_t avail, const float * param, Summary out, size_t * used);
+
+// Updates an existing Summary in place with some more exemplars, for learning online - the statistics it already has are first weighted by keep, so 1 adds the new exemplars to it, 0 replaces it with them and anything in between forgets the old data gradually. Never changes the size of the summary, so a discrete value it has no space for is ignored...
+typedef void (*SummaryUpdate)(Summary this, float keep, DataMatrix * dm, IndexView * view, int feature);
+
 
 
 // The summary type - basically all the function pointers and documentation required to run a summary object...
@@ -72,9 +96,17 @@ struct SummaryType
  
  SummaryMergePy merge_py;
  SummaryMergeManyPy merge_many_py;
+ SummaryMergeManyNew merge_many_new;
+ SummaryMergeManyFill merge_many_fill;
  
  SummarySize size;
  SummaryString string;
+ 
+ SummaryBound bound;
+ SummaryCompact compact;
+ SummaryExpand expand;
+ 
+ SummaryUpdate update;
 };
 
 
@@ -87,10 +119,18 @@ float Summary_error(char code, int trees, Summary * sums, SummaryMagic magic, in
 
 PyObject * Summary_merge_py(char code, int trees, Summary * sums, SummaryMagic magic, int extra);
 PyObject * Summary_merge_many_py(char code, int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra);
+PyObject * Summary_merge_many_new(char code, int exemplars, Summary first, SummaryMagic magic, int extra, float ** out);
+void Summary_merge_many_fill(char code, float ** out, int start, int exemplars, int trees, Summary * sums, SummaryMagic magic, int extra);
 
 size_t Summary_size(char code, Summary this);
 PyObject * Summary_string(char code, Summary this);
 
+void Summary_bound(char code, Summary this, float * param, int first);
+size_t Summary_compact(char code, Summary this, const float * param, void * out);
+size_t Summary_expand(char code, const void * in, size_t avail, const float * param, Summary out, size_t * used);
+
+void Summary_update(char code, Summary this, float keep, DataMatrix * dm, IndexView * view, int feature);
+
 
 
 // The SummaryType objects provided by the system...
@@ -145,12 +185,29 @@ PyObject * SummarySet_merge_py(int trees, SummarySet ** sum_sets);
 // As above, but for when we are processing an entire data matrix and hence have an exemplars x trees array of SummarySet pointers, indexed with exemplars in the outer loop, trees in the inner...
 PyObject * SummarySet_merge_many_py(int exemplars, int trees, SummarySet ** sum_sets);
 
+// The above split in two, so the output can be filled in a block of exemplars at a time, without the GIL and possibly from several threads. The first creates the return value, with its contents undefined, given any SummarySet of the forest for its layout; it writes pointers to the data to be filled in into out, which must have space for features * SUMMARY_OUTPUTS pointers...
+PyObject * SummarySet_merge_many_new(int exemplars, SummarySet * first, float ** out);
+
+// ...the second then fills in the exemplars [start, start+exemplars), given an exemplars x trees array of SummarySet pointers for just those exemplars...
+void SummarySet_merge_many_fill(float ** out, int start, int exemplars, int trees, SummarySet ** sum_sets);
+
 // Returns how many bytes the given SummarySet consumes...
 size_t SummarySet_size(SummarySet * this);
 
 // Returns a string representing the summary, for human consumption...
 PyObject * SummarySet_string(SummarySet * this);
 
+// Returns the codes of the summary types, one for each feature...
+const char * SummarySet_codes(SummarySet * this);
+
+// Compact format support, matching the Summary methods - param is features * SUMMARY_PARAMS floats. The compact version only contains the summaries; the codes and number of features have to be stored elsewhere...
+void SummarySet_bound(SummarySet * this, float * param, int first);
+size_t SummarySet_compact(SummarySet * this, const float * param, void * out);
+size_t SummarySet_expand(int features, const char * codes, const void * in, size_t avail, const float * param, SummarySet * out, size_t * used);
+
+// Updates every summary in the set in place with some more exemplars, with keep weighting the existing statistics - see SummaryUpdate. The DataMatrix must have the same features as the one the set was created with...
+void SummarySet_update(SummarySet * this, float keep, DataMatrix * dm, IndexView * view);
+
 
 
 // Setup this module - for internal use only...
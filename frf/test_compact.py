@@ -0,0 +1,79 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import os
+import tempfile
+
+import frf
+
+import numpy
+
+
+
+# Data with a discrete and two continuous outputs, the later as a bivariate Gaussian...
+def make(count):
+  x = numpy.random.randn(count, 6).astype(numpy.float32)
+  y = ((x[:,0] + x[:,1] * x[:,2] - 0.3 * x[:,3] + 0.2 * x[:,4] * x[:,5])>0.0).astype(numpy.int32)
+  z = numpy.column_stack([100.0 * x[:,0] + 50.0 * x[:,1] * x[:,2], x[:,3] * x[:,4]]).astype(numpy.float32)
+  return x, y, z
+
+train_x, train_y, train_z = make(8192)
+test_x, test_y, test_z = make(8192)
+
+
+
+# Train a classification forest and a regression forest...
+classify = frf.Forest()
+classify.configure('C', 'C', 'SSSSSS')
+classify.min_exemplars = 2
+classify.train(train_x, train_y, 16)
+
+regress = frf.Forest()
+regress.configure('BN', 'BN', 'SSSSSS')
+regress.min_exemplars = 4
+regress.train(train_x, train_z, 16)
+
+
+
+# Report what compacting does to each...
+def show(name, forest):
+  report = frf.compact_report(forest, test_x)
+  print '%s: %i bytes, %i compact (%.1f%%)' % (name, report['size'], report['compact'], 100.0 * report['compact'] / float(report['size']))
+  
+  for i, out in enumerate(report['outputs']):
+    if out is None: continue
+    print '  output %i:' % i
+    for key in sorted(out.keys()):
+      print '    %s = %g' % (key, out[key])
+
+show('classify', classify)
+show('regress', regress)
+
+
+
+# Check that saving and loading a compact forest gives the same as compacting it in memory...
+path = tempfile.mkdtemp()
+fn = os.path.join(path, 'forest.rf')
+
+frf.save_forest(fn, classify, True)
+print 'Compact file = %i bytes' % os.path.getsize(fn)
+
+loaded = frf.load_forest(fn)
+
+other = classify.clone()
+for i in xrange(len(classify)):
+  other.append(classify[i].compact())
+
+print 'Loaded matches compacted = %s' % str((loaded.predict(test_x)[0]['prob']==other.predict(test_x)[0]['prob']).all())
+
+os.remove(fn)
+os.rmdir(path)
@@ -0,0 +1,45 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+
+import frf
+
+import numpy
+
+
+
+# A two class problem with lots of exemplars - which side of a curved surface a point in 8D is...
+def make(count):
+  x = numpy.random.randn(count, 8).astype(numpy.float32)
+  y = ((x[:,0] + x[:,1] * x[:,2] + 0.2 * x[:,3] - 0.5 * x[:,4]**2 + 0.5)>0.0).astype(numpy.int32)
+  return x, y
+
+train_x, train_y = make(65536)
+test_x, test_y = make(4096)
+
+
+
+# Train with the standard split learner and the histogram learner, and compare speed and accuracy...
+for code in ['S', 'H']:
+  forest = frf.Forest()
+  forest.configure('C', 'C', code * train_x.shape[1])
+  forest.min_exemplars = 2
+  
+  start = time.time()
+  oob = forest.train(train_x, train_y, 8)
+  end = time.time()
+  
+  res = forest.predict(test_x)[0]
+  correct = (numpy.argmax(res['prob'], axis=1)==test_y).mean()
+  
+  print '%s: oob = %.2f%%, test = %.2f%%, %i nodes (%.2f seconds)' % (code, (1.0 - oob[0]) * 100.0, correct * 100.0, sum([forest[i].nodes() for i in xrange(len(forest))]), end-start)
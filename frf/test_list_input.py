@@ -0,0 +1,41 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import frf
+
+import numpy
+
+
+
+# A problem with mixed feature types, that can be given to the forest either as a single array or as a list of arrays...
+x = numpy.random.randn(2048, 6).astype(numpy.float32)
+y = ((x[:,0] + x[:,1] * x[:,2] - 0.5 * x[:,5])>0.0).astype(numpy.int32)
+
+
+
+# Train both ways, with the same (default) seeds - the list version, made of copies so each block is its own array, should produce an identical forest, as the features are the same...
+results = []
+
+for name, data in [('single array', x), ('list of arrays', [x[:,:1].copy(), x[:,1:3].copy(), x[:,3:].copy()])]:
+  forest = frf.Forest()
+  forest.configure('C', 'C', 'SSSSSS')
+  forest.min_exemplars = 4
+  
+  oob = forest.train(data, y, 4)
+  pred = forest.predict(data)[0]['prob']
+  human = [forest[i].human() for i in xrange(len(forest))]
+  
+  print '%s: oob = %.2f%%, test = %.2f%%' % (name, (1.0 - oob[0]) * 100.0, (numpy.argmax(pred, axis=1)==y).mean() * 100.0)
+  results.append((human, pred))
+
+print 'Identical forests: %s' % str(results[0][0]==results[1][0] and (results[0][1]==results[1][1]).all())
+assert results[0][0]==results[1][0] and (results[0][1]==results[1][1]).all()
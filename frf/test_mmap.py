@@ -0,0 +1,91 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import os
+import time
+import tempfile
+
+import frf
+
+import numpy
+
+
+
+# A two class problem - which side of a curved surface a point in 6D is...
+def make(count):
+  x = numpy.random.randn(count, 6).astype(numpy.float32)
+  y = ((x[:,0] + x[:,1] * x[:,2] - 0.3 * x[:,3] + 0.2 * x[:,4] * x[:,5])>0.0).astype(numpy.int32)
+  return x, y
+
+train_x, train_y = make(16384)
+test_x, test_y = make(16384)
+
+
+
+# Train a forest...
+forest = frf.Forest()
+forest.configure('C', 'C', 'SSSSSS')
+forest.min_exemplars = 2
+
+forest.train(train_x, train_y, 32)
+print 'Trained %i trees, %i nodes' % (len(forest), sum([forest[i].nodes() for i in xrange(len(forest))]))
+
+expected = forest.predict(test_x)[0]['prob']
+
+
+
+# Save it both ways...
+path = tempfile.mkdtemp()
+fn = os.path.join(path, 'forest.rf')
+fn_mmap = os.path.join(path, 'forest.rfm')
+
+frf.save_forest(fn, forest)
+frf.save_forest_mmap(fn_mmap, forest)
+print 'Compressed file = %i bytes, mappable file = %i bytes' % (os.path.getsize(fn), os.path.getsize(fn_mmap))
+
+
+
+# Load it both ways, checking the predictions match those of the original...
+start = time.time()
+loaded = frf.load_forest(fn)
+end = time.time()
+print 'load_forest: %.3f seconds, matches = %s' % (end-start, str((loaded.predict(test_x)[0]['prob']==expected).all()))
+
+start = time.time()
+mapped = frf.load_forest_mmap(fn_mmap)
+end = time.time()
+print 'load_forest_mmap: %.3f seconds, matches = %s' % (end-start, str((mapped.predict(test_x)[0]['prob']==expected).all()))
+print '  compiled matches = %s' % str((mapped.predict(test_x, -1, True)[0]['prob']==expected).all())
+
+
+
+# A tree from a mapped forest should keep the mapping alive after the forest has gone...
+tree = mapped[0]
+del mapped
+
+single = frf.Forest()
+single.load_mmap(fn_mmap)
+single.clear()
+single.append(tree)
+del tree
+
+one = forest.clone()
+one.append(forest[0])
+print 'Tree outlives mapped forest, matches = %s' % str((single.predict(test_x)[0]['prob']==one.predict(test_x)[0]['prob']).all())
+
+
+
+# Clean up...
+del single
+os.remove(fn)
+os.remove(fn_mmap)
+os.rmdir(path)
@@ -0,0 +1,63 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+
+import frf
+
+import numpy
+
+
+
+# Lots of output channels, half discrete and half continuous, all depending on a few of the input features - the case where most of the training time goes in evaluating split points...
+channels = 24
+
+def make(count):
+  x = numpy.random.randn(count, 8).astype(numpy.float32)
+  
+  yd = numpy.empty((count, channels // 2), dtype=numpy.int32)
+  yc = numpy.empty((count, channels // 2), dtype=numpy.float32)
+  for c in xrange(channels // 2):
+    yd[:,c] = (x[:,c%8] + 0.5 * x[:,(c+1)%8])>0.0
+    yc[:,c] = x[:,(c+2)%8] * x[:,(c+5)%8]
+  
+  return x, yd, yc
+
+train_x, train_yd, train_yc = make(16384)
+test_x, test_yd, test_yc = make(4096)
+
+
+
+# Train, timing it...
+forest = frf.Forest()
+forest.configure('C' * (channels // 2) + 'G' * (channels // 2), 'C' * (channels // 2) + 'G' * (channels // 2), 'S' * 8)
+forest.opt_features = 4
+forest.min_exemplars = 4
+
+start = time.time()
+oob = forest.train(train_x, [train_yd, train_yc], 8)
+end = time.time()
+
+print 'Trained %i trees with %i output channels in %.2f seconds' % (len(forest), channels, end - start)
+
+
+
+# Report the test set performance of each output...
+res = forest.predict(test_x)
+
+for c in xrange(channels // 2):
+  correct = (res[c]['prob'].argmax(axis=1)==test_yd[:,c]).mean()
+  print 'Discrete %i: oob error = %.3f, test accuracy = %.2f%%' % (c, oob[c], 100.0 * correct)
+
+for c in xrange(channels // 2):
+  rmse = numpy.sqrt(((res[channels // 2 + c]['mean'] - test_yc[:,c])**2).mean())
+  print 'Continuous %i: oob error = %.3f, test rmse = %.3f (sd = %.3f)' % (c, oob[channels // 2 + c], rmse, test_yc[:,c].std())
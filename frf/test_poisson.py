@@ -0,0 +1,72 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import os
+import time
+import tempfile
+
+import frf
+
+import numpy
+
+
+
+# A two class problem - which side of a curved surface a point in 6D is - generated in chunks, as if it was too big to hold in memory...
+def make(count):
+  x = numpy.random.randn(count, 6).astype(numpy.float32)
+  y = ((x[:,0] + x[:,1] * x[:,2] - 0.3 * x[:,3] + 0.2 * x[:,4] * x[:,5])>0.0).astype(numpy.int32)
+  return x, y
+
+chunk = 4096
+chunks = 16
+data = [make(chunk) for _ in xrange(chunks)]
+test_x, test_y = make(16384)
+
+
+
+# Write the training data to disk as columns, then map it back in...
+path = tempfile.mkdtemp()
+fn_x = os.path.join(path, 'x.npy')
+fn_y = os.path.join(path, 'y.npy')
+
+frf.save_columns(fn_x, (d[0] for d in data), chunk * chunks, 6)
+frf.save_columns(fn_y, (d[1].reshape((-1,1)) for d in data), chunk * chunks, 1, numpy.int32)
+
+train_x = frf.load_columns(fn_x)
+train_y = frf.load_columns(fn_y)
+print 'Mapped %i exemplars from %i bytes' % (train_x.shape[0], os.path.getsize(fn_x) + os.path.getsize(fn_y))
+
+
+
+# Train with a normal bootstrap draw and with a Poisson draw, to compare...
+for poisson in [False, True]:
+  forest = frf.Forest()
+  forest.configure('C', 'C', 'SSSSSS')
+  forest.min_exemplars = 2
+  forest.poisson = poisson
+  
+  start = time.time()
+  oob = forest.train(train_x, train_y, 16)
+  end = time.time()
+  
+  pred = forest.predict(test_x)[0]['prob'].argmax(axis=1)
+  print '%s: trained in %.2f seconds, oob error = %.2f%%, test accuracy = %.2f%%' % ('Poisson' if poisson else 'Bootstrap', end - start, 100.0 * oob[0], 100.0 * (pred==test_y).mean())
+
+
+
+# Clean up...
+del train_x
+del train_y
+
+os.remove(fn_x)
+os.remove(fn_y)
+os.rmdir(path)
@@ -0,0 +1,69 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+
+import frf
+
+import numpy
+
+
+
+# A two class problem - which side of a curved surface a point in 6D is...
+def make(count):
+  x = numpy.random.randn(count, 6).astype(numpy.float32)
+  y = ((x[:,0] + x[:,1] * x[:,2] - 0.3 * x[:,3] + 0.2 * x[:,4] * x[:,5])>0.0).astype(numpy.int32)
+  return x, y
+
+train_x, train_y = make(16384)
+test_x, test_y = make(65536)
+
+
+
+# Train a forest...
+forest = frf.Forest()
+forest.configure('C', 'C', 'SSSSSS')
+forest.min_exemplars = 2
+
+forest.train(train_x, train_y, 32)
+print 'Trained %i trees, %i nodes' % (len(forest), sum([forest[i].nodes() for i in xrange(len(forest))]))
+
+
+
+# Predict the test set with every combination of compiled and thread count, checking they all match...
+first = None
+
+for compiled in [False, True]:
+  for threads in [1, 0]:
+    forest.threads = threads
+    
+    start = time.time()
+    res = forest.predict(test_x, -1, compiled)[0]
+    end = time.time()
+    
+    correct = (numpy.argmax(res['prob'], axis=1)==test_y).mean()
+    print 'compiled = %s, threads = %i: test = %.2f%% (%.3f seconds)' % (str(compiled), threads, correct * 100.0, end-start)
+    
+    if first is None: first = res['prob']
+    else: print '  matches: %s' % str((first==res['prob']).all())
+
+
+
+# Also time doing one exemplar at a time...
+for compiled in [False, True]:
+  start = time.time()
+  for i in xrange(1024):
+    res = forest.predict(test_x, i, compiled)[0]
+    assert((res['prob']==first[i,:]).all())
+  end = time.time()
+  
+  print 'compiled = %s, one at a time: %.1f microseconds per exemplar' % (str(compiled), (end-start) * 1e6 / 1024)
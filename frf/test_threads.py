@@ -0,0 +1,55 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+
+import frf
+
+import numpy
+
+
+
+# A simple two class problem - which side of a curve a point in 4D is...
+def make(count):
+  x = numpy.random.randn(count, 4).astype(numpy.float32)
+  y = ((x[:,0] + x[:,1] * x[:,2] + 0.2 * x[:,3])>0.0).astype(numpy.int32)
+  return x, y
+
+train_x, train_y = make(8192)
+test_x, test_y = make(1024)
+
+
+
+# Train the same forest with various thread counts, checking that every multithreaded forest is identical...
+first = None
+
+for threads in [1, 2, 4, 0]:
+  forest = frf.Forest()
+  forest.configure('C', 'C', 'SSSS')
+  forest.opt_features = 2
+  forest.min_exemplars = 2
+  forest.threads = threads
+  
+  reports = []
+  start = time.time()
+  oob = forest.train(train_x, train_y, 32, lambda done, total: reports.append(done))
+  end = time.time()
+  
+  res = forest.predict(test_x)[0]
+  correct = (numpy.argmax(res['prob'], axis=1)==test_y).mean()
+  
+  print 'threads = %i: oob = %.2f%%, test = %.2f%%, %i nodes, %i progress reports (%.2f seconds)' % (threads, (1.0 - oob[0]) * 100.0, correct * 100.0, sum([forest[i].nodes() for i in xrange(len(forest))]), len(reports), end-start)
+  
+  if threads!=1:
+    human = [forest[i].human() for i in xrange(len(forest))]
+    if first is None: first = human
+    else: print '  matches threads = 2: %s' % str(human==first)
@@ -0,0 +1,66 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+
+import frf
+
+import numpy
+
+
+
+# A two class problem with enough exemplars that the nodes near the root are big enough to be split into tasks...
+def make(count):
+  x = numpy.random.randn(count, 6).astype(numpy.float32)
+  y = ((x[:,0] + x[:,1] * x[:,2] + 0.2 * x[:,3] - 0.3 * x[:,4] * x[:,5])>0.0).astype(numpy.int32)
+  return x, y
+
+train_x, train_y = make(32768)
+test_x, test_y = make(2048)
+
+
+
+# Some of the features are NaN in the last configuration, which no sort orders consistently, so those nodes fall back to optimising their features one after another...
+nan_x = train_x.copy()
+nan_x[numpy.random.random(nan_x.shape[0])<0.1, 2] = numpy.nan
+
+
+
+# Train a couple of deep trees with various numbers of threads inside each tree, for random feature selection, every feature, a mix of learners and some NaN's - tree_threads should never change the forest, so each is compared byte for byte with the tree_threads = 1 version with the same number of threads (threads does change it, as several trees at once get a stream each)...
+for codes, opt_features, x in [('SSSSSS', 3, train_x), ('SSSSSS', 6, train_x), ('SHSHSH', 4, train_x), ('SSSSSS', 6, nan_x)]:
+  print 'codes = %s, opt_features = %i, NaN = %s' % (codes, opt_features, str(numpy.isnan(x).any()))
+  first = dict()
+  
+  for threads, tree_threads in [(1, 1), (1, 2), (1, 4), (1, 0), (2, 1), (2, 3)]:
+    forest = frf.Forest()
+    forest.configure('C', 'C', codes)
+    forest.opt_features = opt_features
+    forest.min_exemplars = 2
+    forest.threads = threads
+    forest.tree_threads = tree_threads
+    
+    start = time.time()
+    oob = forest.train(x, train_y, 2)
+    end = time.time()
+    
+    res = forest.predict(test_x)[0]
+    correct = (numpy.argmax(res['prob'], axis=1)==test_y).mean()
+    
+    print '  threads = %i, tree_threads = %i: oob = %.2f%%, test = %.2f%%, %i nodes (%.2f seconds)' % (threads, tree_threads, (1.0 - oob[0]) * 100.0, correct * 100.0, sum([forest[i].nodes() for i in xrange(len(forest))]), end-start)
+    
+    trees = [memoryview(forest[i]).tobytes() for i in xrange(len(forest))]
+    trees = [t[:24] + t[32:] for t in trees] # Skip the index pointer in the header, which is only valid in memory.
+    if threads not in first: first[threads] = (trees, forest.seed0, forest.seed3)
+    else:
+      same = (trees, forest.seed0, forest.seed3)==first[threads]
+      print '    byte for byte match with tree_threads = 1 (including the seeds it leaves): %s' % str(same)
+      assert same
@@ -0,0 +1,53 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import frf
+import numpy
+
+
+
+# A two class problem decided by feature 0, where every exemplar with feature 1 above 1 has an unknown class (-1) - a split that isolates those exemplars has nothing known on one side, which has an entropy of zero rather than -inf, so it should not look infinitely good...
+def make(count):
+  x = numpy.random.randn(count, 4).astype(numpy.float32)
+  y = (x[:,0]>0.0).astype(numpy.int32)
+  y[x[:,1]>1.0] = -1
+  return x, y
+
+train_x, train_y = make(4096)
+test_x, test_y = make(1024)
+
+
+
+# Train a forest...
+forest = frf.Forest()
+forest.configure('C', 'C', 'SSSS')
+forest.opt_features = 4
+forest.min_exemplars = 2
+
+forest.train(train_x, train_y, 4)
+
+
+
+# The importance should be finite, with feature 0 dominant...
+importance = forest.importance()
+print 'importance = %s' % str(importance)
+print 'finite: %s' % str(numpy.isfinite(importance).all())
+print 'feature 0 dominant: %s' % str(importance[0]>importance[1:].sum())
+
+
+
+# The known exemplars of the test set should still be classified well...
+known = test_y>=0
+res = forest.predict(test_x[known,:])[0]
+correct = (numpy.argmax(res['prob'], axis=1)==test_y[known]).mean()
+
+print 'Percentage right on known = %.1f%%' % (100.0 * correct)
@@ -0,0 +1,67 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import frf
+
+import numpy
+
+
+
+# A two class problem that drifts - the boundary rotates as the stream goes on...
+def make(count, angle):
+  x = numpy.random.randn(count, 4).astype(numpy.float32)
+  y = ((numpy.cos(angle) * x[:,0] + numpy.sin(angle) * x[:,1] + 0.3 * x[:,2] * x[:,3])>0.0).astype(numpy.int32)
+  return x, y
+
+
+
+# Train a forest on the original problem...
+train_x, train_y = make(4096, 0.0)
+
+forest = frf.Forest()
+forest.configure('C', 'C', 'SSSS')
+forest.min_exemplars = 32
+
+forest.train(train_x, train_y, 16)
+print 'Trained %i trees, %i nodes' % (len(forest), sum([forest[i].nodes() for i in xrange(len(forest))]))
+
+
+
+# Stream in batches of data as the problem drifts, updating the forest (and a copy with no forgetting) and reporting accuracy on the current problem before each update...
+forgetful = forest.clone()
+for i in xrange(len(forest)): forgetful.append(forest[i])
+static = forest.clone()
+for i in xrange(len(forest)): static.append(forest[i])
+
+first = forest[0]
+first_nodes = first.nodes()
+
+for batch in xrange(8):
+  angle = 0.25 * numpy.pi * (batch + 1)
+  x, y = make(2048, angle)
+  
+  acc = []
+  for f in [static, forest, forgetful]:
+    acc.append(100.0 * (f.predict(x)[0]['prob'].argmax(axis=1)==y).mean())
+  
+  splits = forest.update(x, y)
+  splits_forgetful = forgetful.update(x, y, 0.5)
+  
+  print 'Batch %i (angle = %.2f): accuracy static = %.1f%%, keep = 1 %.1f%%, keep = 0.5 %.1f%%; %i and %i splits' % (batch, angle, acc[0], acc[1], acc[2], splits, splits_forgetful)
+
+print 'Nodes after updates: %i and %i' % (sum([forest[i].nodes() for i in xrange(len(forest))]), sum([forgetful[i].nodes() for i in xrange(len(forgetful))]))
+
+
+
+# Trees taken from the forest before updating are unaffected...
+assert(first.nodes()==first_nodes)
+assert(forest[0].trained()==first.trained() + 8 * 2048)
@@ -0,0 +1 @@
+../misc/threads.c
\ No newline at end of file
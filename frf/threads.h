@@ -0,0 +1 @@
+../misc/threads.h
\ No newline at end of file
@@ -8,8 +8,10 @@
 
 
 
+#include "philox.h"
 #include "learner.h"
 #include "information.h"
+#include "threads.h"
 
 #include "tree.h"
 
@@ -242,34 +244,18 @@ void Node_learn(PtrArray * store, int index, int depth, TreeParam * param, Index
 }
 
 
-Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs, void * rs_ptr)
+// Converts the store of a freshly learnt tree, with the root at position 1, into a Tree - the store and the importance are consumed...
+static Tree * Tree_pack(PtrArray * store, Importance * importance, int trained)
 {
- // Create the temporary storage of all the blocks...
-  PtrArray * store = PtrArray_new();
-  
- // Create the storage for the feature importance calculation...
-  int importance_size = sizeof(Importance) + param->x->features * sizeof(float);
-  Importance * importance = (Importance*)malloc(importance_size);
-  importance->features = param->x->features;
-  
-  int i;
-  for (i=0; i<importance->features; i++)
-  {
-   importance->gain[i] = 0.0;
-  }
-  
- // Start from the top and learn the tree with a recursive function...
-  IndexView view;
-  IndexView_init(&view, indices);
-  
-  Node_learn(store, 1, 0, param, &view, rs, rs_ptr, importance->gain);
-  
-  PtrArray_set(store, store->count, 'I', (void*)importance); // Store importance at the end so it gets stored in the next bit.
+ int i;
+ size_t importance_size = sizeof(Importance) + importance->features * sizeof(float);
+ 
+ PtrArray_set(store, store->count, 'I', (void*)importance); // Store importance at the end so it gets stored in the next bit.
  
  // Build memory block zero - the block type codes; count how many bytes all the blocks consume at the same time...
   size_t type_size = Tree_type_size(store->count);
   
-  char * types = (char*)malloc(type_size);
+  char * types = (char*)calloc(type_size, 1);
   PtrArray_set(store, 0, 'T', (void*)types);
   types[0] = 'T';
   
@@ -303,7 +289,7 @@ Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs,
   this->magic[3] = 'T';
   this->revision = FRF_REVISION;
   this->size = tree_size + total_size;
-  this->trained = view.size;
+  this->trained = trained;
   this->index = NULL;
   
   this->objects = store->count;
@@ -335,8 +321,13 @@ Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs,
      }
     }
    
-   // Copy it over...
+   // Copy it over - a node's test starts before the end of the Node structure, so zero the unused tail, otherwise the same tree could differ in its padding...
     memcpy((char*)this + offset, block, size);
+    if ((i!=0)&&(types[i]=='N'))
+    {
+     size_t used = offsetof(Node, test) + Test_size(((Node*)block)->code, (void*)((Node*)block)->test);
+     memset((char*)this + offset + used, 0, size - used);
+    }
     offset += size;
   }
  
@@ -351,8 +342,494 @@ Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs,
 }
 
 
+Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs, void * rs_ptr)
+{
+ // Create the temporary storage of all the blocks...
+  PtrArray * store = PtrArray_new();
+  
+ // Create the storage for the feature importance calculation...
+  int importance_size = sizeof(Importance) + param->x->features * sizeof(float);
+  Importance * importance = (Importance*)malloc(importance_size);
+  importance->features = param->x->features;
+  
+  int i;
+  for (i=0; i<importance->features; i++)
+  {
+   importance->gain[i] = 0.0;
+  }
+  
+ // Start from the top and learn the tree with a recursive function...
+  IndexView view;
+  IndexView_init(&view, indices);
+  
+  Node_learn(store, 1, 0, param, &view, rs, rs_ptr, importance->gain);
+  
+ // Pack it all into a single block of memory...
+  return Tree_pack(store, importance, view.size);
+}
+
+
+// Learning a single tree with several threads, getting exactly the tree Node_learn would. Each node is a NodeTask, which may optimise its features as seperate FeatureTask's, in which case whichever finishes last completes the node. Each feature task gets a copy of the view, put in the order the features before it would have left it by LearnerSet_order, so it does what it would have done in LearnerSet_optimise; the last one leaves the view in the order the node is split in. If the features are selected at random the nodes must use the LearnerSet and key in the same order as Node_learn, so they are done one after another, in the order it visits them, as a chain that moves to whichever thread finishes the last feature of a node - only the features of large nodes are then done at the same time. Otherwise large subtrees are also handed out to idle threads. The tree is built as a tree of BuildNode's, which is then walked depth first, fail half before pass half, to fill in the general array of pointers structure, as Node_learn does...
+#define TREE_TASK_SUBTREE 1024 // Subtrees with at least this many exemplars are handed to the pool, if they can be; smaller ones are done by whichever thread split them off.
+#define TREE_TASK_FEATURES 16384 // Nodes with at least this many exemplars optimise each feature as a seperate task.
+
+typedef struct BuildNode BuildNode;
+
+struct BuildNode
+{
+ char code; // 'N' for node, 'S' for summary.
+ void * block; // The Node or the SummarySet.
+ 
+ int feature; // For a node, the feature it splits and its contribution to the importance of that feature.
+ float gain;
+ 
+ BuildNode * fail;
+ BuildNode * pass;
+};
+
+
+typedef struct FeatureResult FeatureResult;
+
+struct FeatureResult
+{
+ float entropy;
+ char code;
+ size_t size;
+ void * test; // The test, malloc-ed, or NULL if the learner did not find one.
+};
+
+
+typedef struct NodeTask NodeTask;
+typedef struct FeatureTask FeatureTask;
+
+struct NodeTask
+{
+ char type; // 'N', so the pool can tell it from a FeatureTask.
+ 
+ BuildNode * out;
+ IndexView view;
+ int depth;
+ NodeTask * next; // Stack of nodes to do after this one, by whichever thread does this one - for the chain its the pass halves still waiting.
+ 
+ float entropy;
+ int features;
+ int * feat; // Features being optimised, in order.
+ 
+ int remain; // If the features are being done as seperate tasks the number that still need optimising, decrimented atomically.
+ FeatureResult * result; // Aligned with feat.
+ FeatureTask * task; // Aligned with feat.
+ int * order; // The order the last feature leaves the view in.
+ int ordered; // Set to zero by any feature task that could not put the view in the order it needed.
+ 
+ Node * node; // The chosen split, NULL if none, with its feature and information gain.
+ int feature;
+ float info_gain;
+};
+
+struct FeatureTask
+{
+ char type; // 'F'.
+ 
+ NodeTask * node;
+ int which; // Index into feat/result of the node.
+};
+
+
+typedef struct TreeBuild TreeBuild;
+
+struct TreeBuild
+{
+ TreeParam * param; // Its LearnerSet selects the features and its key is used as Node_learn would; otherwise each thread has its own LearnerSet and InfoSet, below.
+ LearnerSet ** ls;
+ InfoSet ** is;
+ int threads;
+ int chain; // Non-zero if the features are selected at random, so the nodes have to be done in order.
+ 
+ int * capacity; // Per thread buffer, for copying the IndexView into, so each feature gets its own copy to reorder.
+ int ** scratch;
+ 
+ ReportSummarisation rs;
+ void * rs_ptr;
+};
+
+
+
+// Makes the node from the LearnerSet, after a successful optimisation, if its an improvement...
+static void NodeTask_make(NodeTask * this, LearnerSet * ls)
+{
+ float split_entropy = LearnerSet_entropy(ls);
+ if (split_entropy<this->entropy)
+ {
+  this->info_gain = this->entropy - split_entropy;
+  this->feature = LearnerSet_feature(ls);
+  
+  this->node = (Node*)malloc(sizeof(Node) + LearnerSet_size(ls));
+  this->node->code = LearnerSet_code(ls);
+  LearnerSet_fetch(ls, (void*)this->node->test);
+ }
+}
+
+
+// Optimises the features of a node one after another, in this thread, exactly as Node_learn does...
+static void NodeTask_direct(TreeBuild * tb, NodeTask * this, int thread)
+{
+ LearnerSet * ls = tb->ls[thread];
+ if (LearnerSet_optimise_features(ls, this->feat, this->features, tb->is[thread], &this->view, this->depth, tb->param->key)!=0)
+ {
+  NodeTask_make(this, ls);
+ }
+}
+
+
+// Optimises a single feature of a node, recording the result...
+static void NodeTask_feature(TreeBuild * tb, NodeTask * this, int which, int thread)
+{
+ // Copy the view, as the learner is allowed to reorder it, and put it in the order it would have been given...
+  if (tb->capacity[thread]<this->view.size)
+  {
+   tb->capacity[thread] = this->view.size;
+   tb->scratch[thread] = (int*)realloc(tb->scratch[thread], tb->capacity[thread] * sizeof(int));
+  }
+  
+  IndexView view;
+  view.size = this->view.size;
+  view.vals = tb->scratch[thread];
+  memcpy(view.vals, this->view.vals, view.size * sizeof(int));
+  
+  if (LearnerSet_order(tb->ls[thread], this->feat, which+1, &view)==0)
+  {
+   __sync_fetch_and_and(&this->ordered, 0);
+  }
+ 
+ // Optimise - without a hint, as which other features it would have to beat depends on the order they finish in...
+  Learner learn = tb->ls[thread]->learn[this->feat[which]];
+  FeatureResult * res = this->result + which;
+  res->test = NULL;
+  
+  if (Learner_optimise(learn, tb->is[thread], &view, this->depth, 1e100, tb->param->key)!=0)
+  {
+   res->entropy = Learner_entropy(learn);
+   res->code = Learner_test_code(learn);
+   res->size = Learner_size(learn);
+   res->test = malloc(res->size);
+   Learner_fetch(learn, res->test);
+  }
+ 
+ // The last feature leaves the view in the order the node splits...
+  if (which==this->features-1)
+  {
+   memcpy(this->order, view.vals, view.size * sizeof(int));
+  }
+}
+
+
+// Called when all the feature tasks of a node are done - chooses the best exactly as LearnerSet_optimise_features would have, given it would have used the runner up as a hint. If any feature was not in the right order it falls back to doing them all again directly...
+static void NodeTask_gather(TreeBuild * tb, NodeTask * this, int thread)
+{
+ int i;
+ 
+ if (this->ordered!=0)
+ {
+  int best = -1;
+  float improve = 1e100;
+  float second = 1e100;
+  
+  for (i=0; i<this->features; i++)
+  {
+   // A learner only succeeds in LearnerSet_optimise_features if it beats the hint...
+    if ((this->result[i].test!=NULL)&&(this->result[i].entropy<second))
+    {
+     if (this->result[i].entropy<improve)
+     {
+      second = improve;
+      improve = this->result[i].entropy;
+      best = i;
+     }
+     else
+     {
+      second = this->result[i].entropy;
+     }
+    }
+  }
+  
+  if ((best>=0)&&(improve<this->entropy))
+  {
+   FeatureResult * res = this->result + best;
+   
+   this->info_gain = this->entropy - improve;
+   this->feature = this->feat[best];
+   
+   this->node = (Node*)malloc(sizeof(Node) + res->size);
+   this->node->code = res->code;
+   memcpy(this->node->test, res->test, res->size);
+  }
+  
+  memcpy(this->view.vals, this->order, this->view.size * sizeof(int));
+ }
+ 
+ for (i=0; i<this->features; i++) free(this->result[i].test);
+ free(this->result);
+ free(this->task);
+ free(this->order);
+ 
+ if (this->ordered==0) NodeTask_direct(tb, this, thread);
+}
+
+
+// Starts work on a node - calculates its entropy then optimises the selected features, either directly or by creating a task for each. Returns non-zero if the node is ready for NodeTask_finish, zero if its features have been handed out as tasks, in which case the last of them to finish continues...
+static int NodeTask_begin(TaskPool * pool, TreeBuild * tb, NodeTask * this, int thread)
+{
+ TreeParam * param = tb->param;
+ int i;
+ 
+ this->entropy = InfoSet_view_entropy(tb->is[thread], &this->view, this->depth);
+ this->features = 0;
+ this->feat = NULL;
+ this->node = NULL;
+ 
+ if (this->depth>=param->max_splits) return 1;
+ 
+ // Select the features with the LearnerSet in param, as Node_learn does - if they are chosen at random this moves its shuffled order and the key on, which is why the nodes are then done in order...
+  this->features = LearnerSet_select(param->ls, param->opt_features, param->key);
+  this->feat = (int*)malloc((this->features>0 ? this->features : 1) * sizeof(int));
+  for (i=0; i<this->features; i++) this->feat[i] = param->ls->feat[i];
+ 
+ // Small nodes are done right now...
+  if ((tb->threads<2)||(this->features<2)||(this->view.size<TREE_TASK_FEATURES))
+  {
+   NodeTask_direct(tb, this, thread);
+   return 1;
+  }
+ 
+ // Large nodes hand the features out as tasks, doing the first here...
+  this->remain = this->features;
+  this->result = (FeatureResult*)malloc(this->features * sizeof(FeatureResult));
+  this->task = (FeatureTask*)malloc(this->features * sizeof(FeatureTask));
+  this->order = (int*)malloc(this->view.size * sizeof(int));
+  this->ordered = 1;
+  
+  for (i=1; i<this->features; i++)
+  {
+   this->task[i].type = 'F';
+   this->task[i].node = this;
+   this->task[i].which = i;
+   task_pool_push(pool, this->task + i);
+  }
+  
+  NodeTask_feature(tb, this, 0, thread);
+  if (__sync_sub_and_fetch(&this->remain, 1)!=0) return 0;
+  
+  NodeTask_gather(tb, this, thread);
+  return 1;
+}
+
+
+// Given the chosen split, if any, this decides if the node is a split or a leaf, and creates the children as required. Consumes the NodeTask, and returns the next one this thread should do, NULL if none...
+static NodeTask * NodeTask_finish(TaskPool * pool, TreeBuild * tb, NodeTask * this, int thread)
+{
+ TreeParam * param = tb->param;
+ int i;
+ 
+ free(this->feat);
+ 
+ // Apply the node to the data, cancelling it if either half is too small...
+  Node * node = this->node;
+  IndexView pass;
+  IndexView fail;
+  
+  if (node!=NULL)
+  {
+   IndexView_split(&this->view, param->x, node->code, (void*)node->test, &pass, &fail);
+   
+   if ((pass.size<param->min_exemplars)||(fail.size<param->min_exemplars))
+   {
+    free(node);
+    node = NULL;
+   }
+  }
+ 
+ // Either record a summary, or record the node and create tasks for both halves...
+  NodeTask * next = this->next;
+  
+  if (node==NULL)
+  {
+   size_t size = SummarySet_init_size(param->y, &this->view, param->summary_codes);
+   SummarySet * ss = (SummarySet*)malloc(size);
+   SummarySet_init(ss, param->y, &this->view, param->summary_codes);
+   
+   this->out->code = 'S';
+   this->out->block = ss;
+   
+   if (tb->rs!=NULL) tb->rs(this->view.size, tb->rs_ptr);
+  }
+  else
+  {
+   BuildNode * out = this->out;
+   out->code = 'N';
+   out->block = node;
+   out->feature = this->feature;
+   out->gain = this->info_gain * this->view.size;
+   
+   // Create the pass half then the fail half, so the fail half ends up on top of the stack...
+    IndexView * child_view[2] = {&pass, &fail};
+    for (i=0; i<2; i++)
+    {
+     BuildNode * bn = (BuildNode*)malloc(sizeof(BuildNode));
+     bn->block = NULL;
+     bn->fail = NULL;
+     bn->pass = NULL;
+     
+     if (i==0) out->pass = bn;
+          else out->fail = bn;
+     
+     NodeTask * child = (NodeTask*)malloc(sizeof(NodeTask));
+     child->type = 'N';
+     child->out = bn;
+     child->view = *child_view[i];
+     child->depth = this->depth + 1;
+     
+     // Large halves go to the pool if the order does not matter, otherwise on to the stack...
+      if ((tb->chain==0)&&(tb->threads>1)&&(child->view.size>=TREE_TASK_SUBTREE))
+      {
+       child->next = NULL;
+       task_pool_push(pool, child);
+      }
+      else
+      {
+       child->next = next;
+       next = child;
+      }
+    }
+  }
+  
+ free(this);
+ return next;
+}
+
+
+// Does a node, then the stack of nodes after it, until they are all done or one is waiting for its feature tasks...
+static void NodeTask_run(TaskPool * pool, TreeBuild * tb, NodeTask * this, int thread)
+{
+ while (this!=NULL)
+ {
+  if (NodeTask_begin(pool, tb, this, thread)==0) break;
+  this = NodeTask_finish(pool, tb, this, thread);
+ }
+}
+
+
+// Function given to the task pool...
+static void tree_task(TaskPool * pool, void * data, void * task, int thread)
+{
+ TreeBuild * tb = (TreeBuild*)data;
+ 
+ if (*(char*)task=='N')
+ {
+  NodeTask_run(pool, tb, (NodeTask*)task, thread);
+ }
+ else
+ {
+  FeatureTask * ft = (FeatureTask*)task;
+  NodeTask * node = ft->node;
+  
+  NodeTask_feature(tb, node, ft->which, thread);
+  if (__sync_sub_and_fetch(&node->remain, 1)==0)
+  {
+   NodeTask_gather(tb, node, thread);
+   NodeTask_run(pool, tb, NodeTask_finish(pool, tb, node, thread), thread);
+  }
+ }
+}
+
+
+// Moves a tree of BuildNode's into the store, depth first with the fail half first, freeing the BuildNode's as it goes...
+static void BuildNode_store(BuildNode * this, PtrArray * store, int index, float * importance)
+{
+ PtrArray_set(store, index, this->code, this->block);
+ 
+ if (this->code=='N')
+ {
+  Node * node = (Node*)this->block;
+  importance[this->feature] += this->gain;
+  
+  node->fail = store->count;
+  BuildNode_store(this->fail, store, node->fail, importance);
+  
+  node->pass = store->count;
+  BuildNode_store(this->pass, store, node->pass, importance);
+ }
+ 
+ free(this);
+}
+
+
+Tree * Tree_learn_threaded(TreeParam * param, int threads, LearnerSet ** ls, InfoSet ** is, IndexSet * indices, ReportSummarisation rs, void * rs_ptr)
+{
+ int i;
+ if (threads<1) threads = 1;
+ 
+ // Prepare the shared state...
+  TreeBuild tb;
+  tb.param = param;
+  tb.ls = ls;
+  tb.is = is;
+  tb.threads = threads;
+  tb.chain = (param->opt_features<param->ls->features) ? 1 : 0;
+  tb.capacity = (int*)malloc(threads * sizeof(int));
+  tb.scratch = (int**)malloc(threads * sizeof(int*));
+  tb.rs = rs;
+  tb.rs_ptr = rs_ptr;
+  
+  for (i=0; i<threads; i++)
+  {
+   tb.capacity[i] = 0;
+   tb.scratch[i] = NULL;
+  }
+  
+ // Create the task for the root node and run the pool until the tree is complete...
+  BuildNode * root = (BuildNode*)malloc(sizeof(BuildNode));
+  root->block = NULL;
+  root->fail = NULL;
+  root->pass = NULL;
+  
+  NodeTask * first = (NodeTask*)malloc(sizeof(NodeTask));
+  first->type = 'N';
+  first->out = root;
+  IndexView_init(&first->view, indices);
+  first->depth = 0;
+  first->next = NULL;
+  
+  task_pool_run(tree_task, &tb, first, threads);
+  
+  for (i=0; i<threads; i++) free(tb.scratch[i]);
+  free(tb.scratch);
+  free(tb.capacity);
+ 
+ // Move it all into a store, calculating the feature importance...
+  PtrArray * store = PtrArray_new();
+  
+  Importance * importance = (Importance*)malloc(sizeof(Importance) + param->x->features * sizeof(float));
+  importance->features = param->x->features;
+  for (i=0; i<importance->features; i++)
+  {
+   importance->gain[i] = 0.0;
+  }
+  
+  BuildNode_store(root, store, 1, importance->gain);
+ 
+ // Pack it all into a single block of memory...
+  return Tree_pack(store, importance, indices->size);
+}
+
+
 
 // The rest of the Tree methods...
+// Returns a pointer to the given object of an initialised tree - the index stores offsets from the start of the tree rather than pointers so that it can be saved alongside the tree, and used from wherever the tree ends up in memory...
+static inline void * Tree_object(Tree * this, int object)
+{
+ return (char*)this + this->index[object];
+}
+
 int Tree_safe(Tree * this)
 {
  if ((this->magic[0]!='F')||(this->magic[1]!='R')||(this->magic[2]!='F')||(this->magic[3]!='T')||(this->revision!=FRF_REVISION))
@@ -369,21 +846,21 @@ int Tree_init(Tree * this)
 {
  if (Tree_safe(this)==0) return 0;
  
- this->index = (void**)malloc(this->objects * sizeof(void*));
+ this->index = (long long*)malloc(this->objects * sizeof(long long));
  
  size_t offset = Tree_head_size();
- this->index[0] = (char*)this + offset;
+ this->index[0] = offset;
  offset += Tree_type_size(this->objects);
  
  int i;
  for (i=1; i<this->objects; i++)
  {
-  this->index[i] = (char*)this + offset;
-  char code = ((char*)this->index[0])[i];
+  this->index[i] = offset;
+  char code = ((char*)Tree_object(this, 0))[i];
   if ('N'==code)
   {
    // Node...
-    Node * targ = (Node*)this->index[i];
+    Node * targ = (Node*)Tree_object(this, i);
     offset += sizeof(Node) + Test_size(targ->code, targ->test);
   }
   else
@@ -391,11 +868,11 @@ int Tree_init(Tree * this)
    if ('S'==code)
    {
     // Summary...
-     offset += SummarySet_size((SummarySet*)this->index[i]);
+     offset += SummarySet_size((SummarySet*)Tree_object(this, i));
    }
    else // 'I'==code
    {
-    offset += sizeof(int) + sizeof(float) * ((Importance*)this->index[i])->features;
+    offset += sizeof(int) + sizeof(float) * ((Importance*)Tree_object(this, i))->features;
    }
   }
   
@@ -419,13 +896,37 @@ int Tree_init(Tree * this)
  return 1; // Success.
 }
 
-void Tree_deinit(Tree * this)
+int Tree_init_index(Tree * this, long long * index)
 {
- free(this->index); 
-}
-
-
-
+ if (Tree_safe(this)==0) return 0;
+ 
+ // Check the index is in bounds - a full check would mean visiting every object, which is exactly what using a stored index is meant to avoid...
+  int i;
+  for (i=0; i<this->objects; i++)
+  {
+   if ((index[i]<(long long)Tree_head_size())||(index[i]>=this->size))
+   {
+    PyErr_SetString(PyExc_ValueError, "Tree index points outside of the tree - corruption.");
+    return 0;
+   }
+  }
+ 
+ this->index = index;
+ return 1;
+}
+
+long long * Tree_index(Tree * this)
+{
+ return this->index;
+}
+
+void Tree_deinit(Tree * this)
+{
+ free(this->index); 
+}
+
+
+
 size_t Tree_head_size(void)
 {
  return sizeof(Tree) + sizeof(long long) - sizeof(void*);
@@ -446,8 +947,8 @@ int Tree_objects(Tree * this)
 SummarySet * Tree_run_rec(Tree * this, int object, DataMatrix * x, int exemplar)
 {
  // Fetch the object, behavour depends on type...
-  char code = ((char*)this->index[0])[object];
-  void * block = this->index[object];
+  char code = ((char*)Tree_object(this, 0))[object];
+  void * block = Tree_object(this, object);
   
   if (code=='N')
   {
@@ -471,8 +972,8 @@ SummarySet * Tree_run(Tree * this, DataMatrix * x, int exemplar)
 void Tree_run_many_rec(Tree * this, int object, DataMatrix * x, IndexView * view, SummarySet ** out, int step)
 {
  // Fetch the object, behavour depends on type...
-  char code = ((char*)this->index[0])[object];
-  void * block = this->index[object];
+  char code = ((char*)Tree_object(this, 0))[object];
+  void * block = Tree_object(this, object);
   
   if (code=='N')
   {
@@ -508,11 +1009,130 @@ void Tree_run_many(Tree * this, DataMatrix * x, IndexSet * is, SummarySet ** out
 }
 
 
+// Helper for below - writes the given object and its children into the flat array starting at pos, returning the next free position...
+static int Tree_flatten_rec(Tree * this, int object, FlatNode * out, int pos)
+{
+ char code = ((char*)Tree_object(this, 0))[object];
+ FlatNode * targ = out + pos;
+ 
+ if (code=='N')
+ {
+  Node * node = (Node*)Tree_object(this, object);
+  
+  switch (node->code)
+  {
+   case 'C':
+   {
+    const ContinuousSplit * test = (const ContinuousSplit*)node->test;
+    targ->code = 'C';
+    targ->feature = test->feature;
+    targ->value.split = test->split;
+   }
+   break;
+   
+   case 'D':
+   {
+    const DiscreteSelect * test = (const DiscreteSelect*)node->test;
+    targ->code = 'D';
+    targ->feature = test->feature;
+    targ->value.accept = test->accept;
+   }
+   break;
+   
+   default:
+    targ->code = 'N';
+    targ->feature = object;
+    targ->value.accept = 0;
+   break;
+  }
+  
+  targ->pass = Tree_flatten_rec(this, node->fail, out, pos + 1);
+  return Tree_flatten_rec(this, node->pass, out, targ->pass);
+ }
+ else
+ {
+  targ->code = 'L';
+  targ->feature = object;
+  targ->value.accept = 0;
+  targ->pass = -1;
+  
+  return pos + 1;
+ }
+}
+
+FlatTree * Tree_flatten(Tree * this)
+{
+ // Count the nodes and leaves...
+  int i;
+  int nodes = 0;
+  for (i=1; i<this->objects; i++)
+  {
+   char code = ((char*)Tree_object(this, 0))[i];
+   if ((code=='N')||(code=='S')) nodes += 1;
+  }
+ 
+ // Create the object, aligned so a cache line contains a whole number of nodes...
+  void * ptr;
+  if (posix_memalign(&ptr, 64, sizeof(FlatTree) + nodes * sizeof(FlatNode))!=0) return NULL;
+  
+  FlatTree * ret = (FlatTree*)ptr;
+  ret->nodes = nodes;
+ 
+ // Fill it in...
+  Tree_flatten_rec(this, 1, ret->node, 0);
+  
+ return ret;
+}
+
+SummarySet * FlatTree_run(FlatTree * this, Tree * tree, DataMatrix * x, int exemplar, const float * continuous, const int * discrete)
+{
+ const FlatNode * targ = this->node;
+ 
+ while (1)
+ {
+  switch (targ->code)
+  {
+   case 'C':
+    if (continuous[targ->feature]<targ->value.split) targ += 1;
+                                                 else targ = this->node + targ->pass;
+   break;
+   
+   case 'D':
+    if (discrete[targ->feature]==targ->value.accept) targ = this->node + targ->pass;
+                                                 else targ += 1;
+   break;
+   
+   case 'L':
+    return (SummarySet*)Tree_object(tree, targ->feature);
+   
+   default:
+   {
+    Node * node = (Node*)Tree_object(tree, targ->feature);
+    if (Test(node->code, (void*)node->test, x, exemplar)==0) targ += 1;
+                                                         else targ = this->node + targ->pass;
+   }
+   break;
+  }
+ }
+}
+
+SummarySet * Tree_first_leaf(Tree * this)
+{
+ int i;
+ for (i=1; i<this->objects; i++)
+ {
+  if (((char*)Tree_object(this, 0))[i]=='S') return (SummarySet*)Tree_object(this, i);
+ }
+ 
+ return NULL;
+}
+
+
 PyObject * Tree_human_rec(Tree * this, int object)
 {
  // Fetch the object, behavour depends on type...
-  char code = ((char*)this->index[0])[object];
-  void * block = this->index[object];
+  char code = ((char*)Tree_object(this, 0))[object];
+  void * block = Tree_object(this, object);
   
   if (code=='N')
   {
@@ -540,7 +1160,7 @@ PyObject * Tree_human(Tree * this)
 
 const float * Tree_importance(Tree * this, int * length)
 {
- Importance * imp = (Importance*)this->index[this->objects-1];
+ Importance * imp = (Importance*)Tree_object(this, this->objects-1);
  
  if (length!=NULL) *length = imp->features;
  return imp->gain;
@@ -548,6 +1168,775 @@ const float * Tree_importance(Tree * this, int * length)
 
 
 
+// Online learning - the tree is rebuilt into a store as for Tree_learn, with the leaves updated and grown as it goes. First a structure of everything the recursion needs...
+typedef struct TreeUpdate TreeUpdate;
+
+struct TreeUpdate
+{
+ TreeParam * param;
+ float keep;
+ int grace;
+ float bound; // ln(1/confidence) / 2, so the Hoeffding bound for n exemplars is R sqrt(bound / n), with R the range of the information gain.
+ 
+ int splits; // Number of splits made so far.
+ float * importance;
+};
+
+
+// Stores the given leaf (which it takes ownership of) at index, unless it can be split, in which case it creates a node there and recurses to the new leaves...
+static void Node_grow(TreeUpdate * tu, PtrArray * store, int index, int depth, IndexView * view, SummarySet * leaf)
+{
+ TreeParam * param = tu->param;
+ 
+ // Try to find a split that passes the bound...
+  Node * node = NULL;
+  float info_gain = 0.0;
+ 
+  IndexView pass;
+  IndexView fail;
+ 
+  if ((view->size>=tu->grace)&&(depth<param->max_splits))
+  {
+   float entropy = InfoSet_view_entropy(param->is, view, depth);
+ 
+   if (LearnerSet_optimise(param->ls, param->is, view, param->opt_features, depth, param->key)!=0)
+   {
+    info_gain = entropy - LearnerSet_entropy(param->ls);
+    
+    // The runner up is the second best feature, or not splitting (zero gain) if that is better...
+     float runner_up = entropy - LearnerSet_runner_up(param->ls);
+     if (runner_up<0.0) runner_up = 0.0;
+    
+    // The exemplars are weighted, so use the effective sample size, (sum w)^2 / sum w^2, which is the exemplar count when they all have the same weight...
+     double sum = 0.0;
+     double sum_sqr = 0.0;
+     int i;
+     for (i=0; i<view->size; i++)
+     {
+      double w = DataMatrix_GetWeight(param->y, view->vals[i]);
+      sum += w;
+      sum_sqr += w * w;
+     }
+     double n = (sum_sqr>1e-12) ? (sum * sum / sum_sqr) : 0.0;
+    
+    // Hoeffding test - only split if the best is better than the runner up by more than the bound...
+     float range = InfoSet_range(param->is, depth);
+    
+    if ((n>0.0)&&((info_gain - runner_up)>range * sqrt(tu->bound / n)))
+    {
+     node = (Node*)malloc(sizeof(Node) + LearnerSet_size(param->ls));
+     node->code = LearnerSet_code(param->ls);
+     LearnerSet_fetch(param->ls, (void*)node->test);
+ 
+     IndexView_split(view, param->x, node->code, (void*)node->test, &pass, &fail);
+ 
+     if ((pass.size<param->min_exemplars)||(fail.size<param->min_exemplars))
+     {
+      free(node);
+      node = NULL;
+     }
+    }
+   }
+  }
+ 
+ // No split - just store the leaf...
+  if (node==NULL)
+  {
+   PtrArray_set(store, index, 'S', (void*)leaf);
+   return;
+  }
+ 
+ // Store the node and record the split...
+  PtrArray_set(store, index, 'N', (void*)node);
+ 
+  tu->importance[LearnerSet_feature(param->ls)] += info_gain * view->size;
+  tu->splits += 1;
+ 
+ // Create the two new leaves, as copies of the old one so they have the same layout, but with just the exemplars that reach them, and recurse...
+  size_t size = SummarySet_size(leaf);
+ 
+  SummarySet * child = (SummarySet*)malloc(size);
+  memcpy(child, leaf, size);
+  SummarySet_update(child, 0.0, param->y, &fail);
+ 
+  node->fail = store->count;
+  Node_grow(tu, store, node->fail, depth+1, &fail, child);
+ 
+  child = (SummarySet*)malloc(size);
+  memcpy(child, leaf, size);
+  SummarySet_update(child, 0.0, param->y, &pass);
+ 
+  node->pass = store->count;
+  Node_grow(tu, store, node->pass, depth+1, &pass, child);
+ 
+  free(leaf);
+}
+
+
+// Copies the given object of the tree, and its children, into the store at index, pushing the exemplars of view down to the leaves to update them...
+static void Node_update(Tree * this, int object, TreeUpdate * tu, PtrArray * store, int index, int depth, IndexView * view)
+{
+ char code = ((char*)Tree_object(this, 0))[object];
+ void * block = Tree_object(this, object);
+ 
+ if (code=='N')
+ {
+  // Node - copy it and recurse...
+   Node * targ = (Node*)block;
+   size_t size = sizeof(Node) + Test_size(targ->code, (void*)targ->test);
+ 
+   Node * node = (Node*)malloc(size);
+   memcpy(node, targ, size);
+   PtrArray_set(store, index, 'N', (void*)node);
+ 
+   IndexView pass;
+   IndexView fail;
+ 
+   if (view->size!=0)
+   {
+    IndexView_split(view, tu->param->x, node->code, (void*)node->test, &pass, &fail);
+   }
+   else
+   {
+    pass = *view;
+    fail = *view;
+   }
+ 
+   node->fail = store->count;
+   Node_update(this, targ->fail, tu, store, node->fail, depth+1, &fail);
+ 
+   node->pass = store->count;
+   Node_update(this, targ->pass, tu, store, node->pass, depth+1, &pass);
+ }
+ else
+ {
+  // Leaf - update a copy, then see if it wants to split...
+   SummarySet * targ = (SummarySet*)block;
+   size_t size = SummarySet_size(targ);
+ 
+   SummarySet * leaf = (SummarySet*)malloc(size);
+   memcpy(leaf, targ, size);
+   if (view->size!=0) SummarySet_update(leaf, tu->keep, tu->param->y, view);
+ 
+   Node_grow(tu, store, index, depth, view, leaf);
+ }
+}
+
+
+Tree * Tree_update(Tree * this, TreeParam * param, IndexSet * indices, float keep, int grace, float confidence, int * splits)
+{
+ // Create the store and a copy of the feature importance, which new splits add to...
+  PtrArray * store = PtrArray_new();
+ 
+  int features;
+  const float * gain = Tree_importance(this, &features);
+ 
+  Importance * importance = (Importance*)malloc(sizeof(Importance) + features * sizeof(float));
+  importance->features = features;
+  memcpy(importance->gain, gain, features * sizeof(float));
+ 
+ // Recurse through the tree...
+  TreeUpdate tu;
+  tu.param = param;
+  tu.keep = keep;
+  tu.grace = grace;
+  tu.bound = 0.5 * log(1.0 / confidence);
+  tu.splits = 0;
+  tu.importance = importance->gain;
+ 
+  IndexView view;
+  IndexView_init(&view, indices);
+ 
+  Node_update(this, 1, &tu, store, 1, 0, &view);
+ 
+ // Pack it into a tree and return...
+  if (splits!=NULL) *splits = tu.splits;
+  return Tree_pack(store, importance, this->trained + view.size);
+}
+
+
+
+// The compact format. First a growable block of bytes to write it into, which doubles as a reader with size being how much has been read and capacity how much there is...
+typedef struct ByteBuffer ByteBuffer;
+
+struct ByteBuffer
+{
+ char * data;
+ size_t size;
+ size_t capacity;
+};
+
+// Returns a pointer to write the given number of bytes to, on the end of the buffer - only valid until it is next called...
+static char * ByteBuffer_add(ByteBuffer * this, size_t size)
+{
+ if (this->size+size>this->capacity)
+ {
+  this->capacity = 2 * (this->size + size);
+  this->data = (char*)realloc(this->data, this->capacity);
+ }
+ 
+ char * ret = this->data + this->size;
+ this->size += size;
+ return ret;
+}
+
+// Returns a pointer to the given number of bytes to read, or NULL if there are not that many left...
+static const char * ByteBuffer_take(ByteBuffer * this, size_t size)
+{
+ if (size>(this->capacity - this->size)) return NULL;
+ 
+ const char * ret = this->data + this->size;
+ this->size += size;
+ return ret;
+}
+
+
+
+// A split point, for building the split tables...
+typedef struct SplitPoint SplitPoint;
+
+struct SplitPoint
+{
+ int feature;
+ float split;
+};
+
+static int SplitPoint_compare(const void * lhs, const void * rhs)
+{
+ const SplitPoint * a = (const SplitPoint*)lhs;
+ const SplitPoint * b = (const SplitPoint*)rhs;
+ 
+ if (a->feature!=b->feature) return (a->feature<b->feature) ? -1 : 1;
+ if (a->split<b->split) return -1;
+ if (a->split>b->split) return 1;
+ return 0;
+}
+
+
+#define COMPACT_TABLE_MAX 65536 // Largest split table - features with more distinct split points than this have them quantised to this many.
+
+typedef struct CompactState CompactState;
+
+struct CompactState
+{
+ ByteBuffer out;
+ float * param; // outputs * SUMMARY_PARAMS.
+ 
+ int tables;
+ int * table_feature; // Increasing.
+ int * table_start; // Offset into split.
+ int * table_count;
+ float * split; // Each table in turn, each sorted.
+};
+
+// Returns the index of the split table entry nearest to the given split, or -1 if the feature has no table...
+static int CompactState_lookup(CompactState * this, int feature, float split)
+{
+ // Find the table...
+  int low = 0;
+  int high = this->tables;
+  while (low<high)
+  {
+   int mid = (low + high) / 2;
+   if (this->table_feature[mid]<feature) low = mid + 1;
+   else high = mid;
+  }
+  if ((low==this->tables)||(this->table_feature[low]!=feature)) return -1;
+ 
+ // Find the nearest entry...
+  float * table = this->split + this->table_start[low];
+  int count = this->table_count[low];
+  
+  int l = 0;
+  int h = count;
+  while (l<h)
+  {
+   int mid = (l + h) / 2;
+   if (table[mid]<split) l = mid + 1;
+   else h = mid;
+  }
+  
+  if (l==count) return count - 1;
+  if ((l!=0)&&((split - table[l-1])<(table[l] - split))) return l - 1;
+  return l;
+}
+
+static void Tree_compact_rec(Tree * this, int object, CompactState * state)
+{
+ char code = ((char*)Tree_object(this, 0))[object];
+ void * block = Tree_object(this, object);
+ 
+ if (code=='N')
+ {
+  // A node - use the short forms of the common tests if possible...
+   Node * node = (Node*)block;
+   unsigned short value[2];
+   
+   int entry = -1;
+   if (node->code=='C')
+   {
+    ContinuousSplit * cs = (ContinuousSplit*)node->test;
+    entry = CompactState_lookup(state, cs->feature, cs->split);
+    value[0] = cs->feature;
+    value[1] = entry;
+   }
+   
+   if (node->code=='D')
+   {
+    DiscreteSelect * ds = (DiscreteSelect*)node->test;
+    if ((ds->feature>=0)&&(ds->feature<COMPACT_TABLE_MAX)&&(ds->accept>=0)&&(ds->accept<COMPACT_TABLE_MAX))
+    {
+     entry = 0;
+     value[0] = ds->feature;
+     value[1] = ds->accept;
+    }
+   }
+   
+   if (entry>=0)
+   {
+    char * targ = ByteBuffer_add(&state->out, 1 + sizeof(value));
+    targ[0] = node->code;
+    memcpy(targ + 1, value, sizeof(value));
+   }
+   else
+   {
+    size_t size = Test_size(node->code, node->test);
+    char * targ = ByteBuffer_add(&state->out, 2 + size);
+    targ[0] = 'T';
+    targ[1] = node->code;
+    memcpy(targ + 2, node->test, size);
+   }
+  
+  // Its children, fail first...
+   Tree_compact_rec(this, node->fail, state);
+   Tree_compact_rec(this, node->pass, state);
+ }
+ else
+ {
+  // A leaf...
+   SummarySet * ss = (SummarySet*)block;
+   size_t size = SummarySet_compact(ss, state->param, NULL);
+   
+   char * targ = ByteBuffer_add(&state->out, 1 + size);
+   targ[0] = 'S';
+   SummarySet_compact(ss, state->param, targ + 1);
+ }
+}
+
+
+int Tree_compacted(const void * head)
+{
+ const CompactTree * ct = (const CompactTree*)head;
+ return (ct->magic[0]=='F')&&(ct->magic[1]=='R')&&(ct->magic[2]=='F')&&(ct->magic[3]=='C')&&(ct->revision==FRF_REVISION);
+}
+
+
+CompactTree * Tree_compact(Tree * this)
+{
+ char * type = (char*)Tree_object(this, 0);
+ int i, j;
+ 
+ // Scan the objects, to get the leaf layout and parameters, plus all of the continuous split points...
+  SummarySet * first = NULL;
+  float * param = NULL;
+  
+  SplitPoint * point = (SplitPoint*)malloc(this->objects * sizeof(SplitPoint));
+  int points = 0;
+  
+  for (i=1; i<this->objects; i++)
+  {
+   if (type[i]=='N')
+   {
+    Node * node = (Node*)Tree_object(this, i);
+    if (node->code=='C')
+    {
+     ContinuousSplit * cs = (ContinuousSplit*)node->test;
+     if ((cs->feature>=0)&&(cs->feature<COMPACT_TABLE_MAX))
+     {
+      point[points].feature = cs->feature;
+      point[points].split = cs->split;
+      points += 1;
+     }
+    }
+   }
+   
+   if (type[i]=='S')
+   {
+    SummarySet * ss = (SummarySet*)Tree_object(this, i);
+    if (first==NULL)
+    {
+     first = ss;
+     param = (float*)malloc(ss->features * SUMMARY_PARAMS * sizeof(float));
+     for (j=0; j<ss->features * SUMMARY_PARAMS; j++) param[j] = 0.0;
+     SummarySet_bound(ss, param, 1);
+    }
+    else
+    {
+     if ((ss->features!=first->features)||(memcmp(SummarySet_codes(ss), SummarySet_codes(first), ss->features)!=0))
+     {
+      free(point);
+      free(param);
+      PyErr_SetString(PyExc_ValueError, "Can not compact a tree with leaves that do not all have the same layout.");
+      return NULL;
+     }
+     SummarySet_bound(ss, param, 0);
+    }
+   }
+  }
+  
+  if (first==NULL)
+  {
+   free(point);
+   PyErr_SetString(PyExc_ValueError, "Can not compact a tree without any leaves.");
+   return NULL;
+  }
+ 
+ // Build the split tables - sort and remove duplicates, then reduce any that are too big...
+  CompactState state;
+  state.out.data = NULL;
+  state.out.size = 0;
+  state.out.capacity = 0;
+  state.param = param;
+  
+  qsort(point, points, sizeof(SplitPoint), SplitPoint_compare);
+  
+  state.tables = 0;
+  state.table_feature = (int*)malloc(points * sizeof(int));
+  state.table_start = (int*)malloc(points * sizeof(int));
+  state.table_count = (int*)malloc(points * sizeof(int));
+  state.split = (float*)malloc(points * sizeof(float));
+  
+  int splits = 0;
+  for (i=0; i<points; i++)
+  {
+   if ((i==0)||(point[i].feature!=point[i-1].feature))
+   {
+    state.table_feature[state.tables] = point[i].feature;
+    state.table_start[state.tables] = splits;
+    state.table_count[state.tables] = 0;
+    state.tables += 1;
+   }
+   else
+   {
+    if (point[i].split==point[i-1].split) continue;
+   }
+   
+   state.split[splits] = point[i].split;
+   splits += 1;
+   state.table_count[state.tables-1] += 1;
+  }
+  free(point);
+  
+  for (i=0; i<state.tables; i++)
+  {
+   int count = state.table_count[i];
+   if (count>COMPACT_TABLE_MAX)
+   {
+    float * table = state.split + state.table_start[i];
+    for (j=0; j<COMPACT_TABLE_MAX; j++)
+    {
+     table[j] = table[(int)(((long long)j * (count-1)) / (COMPACT_TABLE_MAX-1))];
+    }
+    state.table_count[i] = COMPACT_TABLE_MAX;
+   }
+  }
+ 
+ // Write out the header, to be filled in at the end, and the leaf layout...
+  ByteBuffer_add(&state.out, sizeof(CompactTree));
+  
+  memcpy(ByteBuffer_add(&state.out, first->features), SummarySet_codes(first), first->features);
+  memcpy(ByteBuffer_add(&state.out, first->features * SUMMARY_PARAMS * sizeof(float)), param, first->features * SUMMARY_PARAMS * sizeof(float));
+ 
+ // The split tables...
+  for (i=0; i<state.tables; i++)
+  {
+   char * targ = ByteBuffer_add(&state.out, 2 * sizeof(int) + state.table_count[i] * sizeof(float));
+   memcpy(targ, state.table_feature + i, sizeof(int));
+   memcpy(targ + sizeof(int), state.table_count + i, sizeof(int));
+   memcpy(targ + 2 * sizeof(int), state.split + state.table_start[i], state.table_count[i] * sizeof(float));
+  }
+ 
+ // The feature importance, if the tree has it - it always will after expanding...
+  int objects = this->objects;
+  if (type[this->objects-1]=='I')
+  {
+   Importance * imp = (Importance*)Tree_object(this, this->objects-1);
+   size_t size = sizeof(Importance) + imp->features * sizeof(float);
+   memcpy(ByteBuffer_add(&state.out, size), imp, size);
+  }
+  else
+  {
+   int zero = 0;
+   memcpy(ByteBuffer_add(&state.out, sizeof(int)), &zero, sizeof(int));
+   objects += 1;
+  }
+ 
+ // The nodes, in the order Node_learn creates them...
+  Tree_compact_rec(this, 1, &state);
+ 
+ // Fill in the header...
+  CompactTree * ret = (CompactTree*)state.out.data;
+  ret->magic[0] = 'F';
+  ret->magic[1] = 'R';
+  ret->magic[2] = 'F';
+  ret->magic[3] = 'C';
+  ret->revision = FRF_REVISION;
+  ret->size = state.out.size;
+  ret->trained = this->trained;
+  ret->objects = objects;
+  ret->outputs = first->features;
+  ret->tables = state.tables;
+ 
+ // Clean up and return...
+  free(state.table_feature);
+  free(state.table_start);
+  free(state.table_count);
+  free(state.split);
+  free(param);
+  
+  return ret;
+}
+
+
+
+typedef struct ExpandState ExpandState;
+
+struct ExpandState
+{
+ ByteBuffer in;
+ 
+ int outputs;
+ const char * codes;
+ const float * param; // Copied, so its aligned.
+ 
+ int features; // Size of table, which is indexed by feature and gives the index of its split table, -1 if it has none.
+ int * table;
+ const char ** table_data; // Pointer to the (unaligned) floats of each split table.
+ int * table_count;
+};
+
+// Returns zero if the data runs out or is invalid...
+static int Tree_expand_rec(ExpandState * state, PtrArray * store, int index)
+{
+ const char * code = ByteBuffer_take(&state->in, 1);
+ if (code==NULL) return 0;
+ 
+ // Leaves...
+  if (*code=='S')
+  {
+   const char * data = state->in.data + state->in.size;
+   size_t avail = state->in.capacity - state->in.size;
+   
+   size_t used;
+   size_t size = SummarySet_expand(state->outputs, state->codes, data, avail, state->param, NULL, &used);
+   if (used>avail) return 0;
+   
+   SummarySet * ss = (SummarySet*)malloc(size);
+   SummarySet_expand(state->outputs, state->codes, data, avail, state->param, ss, &used);
+   state->in.size += used;
+   
+   PtrArray_set(store, index, 'S', (void*)ss);
+   return 1;
+  }
+ 
+ // Nodes...
+  Node * node = NULL;
+  unsigned short value[2];
+  const char * data;
+  
+  switch (*code)
+  {
+   case 'C':
+   {
+    data = ByteBuffer_take(&state->in, sizeof(value));
+    if (data==NULL) return 0;
+    memcpy(value, data, sizeof(value));
+    
+    if (value[0]>=state->features) return 0;
+    int table = state->table[value[0]];
+    if ((table<0)||(value[1]>=state->table_count[table])) return 0;
+    
+    node = (Node*)malloc(sizeof(Node) + sizeof(ContinuousSplit));
+    node->code = 'C';
+    ContinuousSplit * cs = (ContinuousSplit*)node->test;
+    cs->feature = value[0];
+    memcpy(&cs->split, state->table_data[table] + value[1] * sizeof(float), sizeof(float));
+   }
+   break;
+   
+   case 'D':
+   {
+    data = ByteBuffer_take(&state->in, sizeof(value));
+    if (data==NULL) return 0;
+    memcpy(value, data, sizeof(value));
+    
+    node = (Node*)malloc(sizeof(Node) + sizeof(DiscreteSelect));
+    node->code = 'D';
+    DiscreteSelect * ds = (DiscreteSelect*)node->test;
+    ds->feature = value[0];
+    ds->accept = value[1];
+   }
+   break;
+   
+   case 'T':
+   {
+    data = ByteBuffer_take(&state->in, 1);
+    if (data==NULL) return 0;
+    
+    size_t size;
+    if (*data=='C') size = sizeof(ContinuousSplit);
+    else
+    {
+     if (*data=='D') size = sizeof(DiscreteSelect);
+     else return 0;
+    }
+    
+    const char * test = ByteBuffer_take(&state->in, size);
+    if (test==NULL) return 0;
+    
+    node = (Node*)malloc(sizeof(Node) + size);
+    node->code = *data;
+    memcpy(node->test, test, size);
+   }
+   break;
+   
+   default:
+   return 0;
+  }
+  
+  PtrArray_set(store, index, 'N', (void*)node);
+ 
+ // Its children, fail first, in the same way as Node_learn...
+  node->fail = store->count;
+  if (Tree_expand_rec(state, store, node->fail)==0) return 0;
+  
+  node->pass = store->count;
+  return Tree_expand_rec(state, store, node->pass);
+}
+
+
+// Does the work of Tree_expand, returning zero if the data is corrupt - everything it allocates is left in state, importance and store for the caller to clean up...
+static int Tree_expand_body(CompactTree * compact, ExpandState * state, Importance ** importance, PtrArray * store)
+{
+ int i;
+ 
+ // Leaf layout...
+  state->codes = ByteBuffer_take(&state->in, state->outputs);
+  if (state->codes==NULL) return 0;
+  
+  for (i=0; i<state->outputs; i++)
+  {
+   if (CodeSummary[(unsigned char)state->codes[i]]==NULL) return 0;
+  }
+  
+  const char * data = ByteBuffer_take(&state->in, state->outputs * SUMMARY_PARAMS * sizeof(float));
+  if (data==NULL) return 0;
+  
+  float * param = (float*)malloc(state->outputs * SUMMARY_PARAMS * sizeof(float));
+  memcpy(param, data, state->outputs * SUMMARY_PARAMS * sizeof(float));
+  state->param = param;
+ 
+ // Split tables...
+  for (i=0; i<compact->tables; i++)
+  {
+   int head[2]; // Feature, count.
+   data = ByteBuffer_take(&state->in, sizeof(head));
+   if (data==NULL) return 0;
+   memcpy(head, data, sizeof(head));
+   
+   if ((head[0]<state->features)||(head[0]>=COMPACT_TABLE_MAX)||(head[1]<1)||(head[1]>COMPACT_TABLE_MAX)) return 0;
+   
+   state->table_data[i] = ByteBuffer_take(&state->in, head[1] * sizeof(float));
+   if (state->table_data[i]==NULL) return 0;
+   state->table_count[i] = head[1];
+   
+   state->table = (int*)realloc(state->table, (head[0]+1) * sizeof(int));
+   while (state->features<=head[0])
+   {
+    state->table[state->features] = -1;
+    state->features += 1;
+   }
+   state->table[head[0]] = i;
+  }
+ 
+ // Feature importance...
+  int features;
+  data = ByteBuffer_take(&state->in, sizeof(int));
+  if (data==NULL) return 0;
+  memcpy(&features, data, sizeof(int));
+  if (features<0) return 0;
+  
+  data = ByteBuffer_take(&state->in, features * sizeof(float));
+  if (data==NULL) return 0;
+  
+  *importance = (Importance*)malloc(sizeof(Importance) + features * sizeof(float));
+  (*importance)->features = features;
+  memcpy((*importance)->gain, data, features * sizeof(float));
+ 
+ // The nodes, which should use up everything that is left and match the object count (+1 for the importance)...
+  if (Tree_expand_rec(state, store, 1)==0) return 0;
+  if (state->in.size!=state->in.capacity) return 0;
+  if (store->count+1!=compact->objects) return 0;
+  
+  return 1;
+}
+
+
+Tree * Tree_expand(CompactTree * compact, size_t size)
+{
+ // Check the header...
+  if ((size<sizeof(CompactTree))||(Tree_compacted(compact)==0)||(compact->size>size)||(compact->size<sizeof(CompactTree))||(compact->outputs<0)||(compact->tables<0))
+  {
+   PyErr_SetString(PyExc_ValueError, "Compact tree has bad header.");
+   return NULL;
+  }
+  
+  if ((compact->outputs>(compact->size - sizeof(CompactTree)))||(compact->tables>((compact->size - sizeof(CompactTree)) / (2 * sizeof(int) + sizeof(float)))))
+  {
+   PyErr_SetString(PyExc_ValueError, "Compact tree header does not match its size.");
+   return NULL;
+  }
+ 
+ // Setup the state and do the work...
+  ExpandState state;
+  state.in.data = (char*)compact;
+  state.in.size = sizeof(CompactTree);
+  state.in.capacity = compact->size;
+  
+  state.outputs = compact->outputs;
+  state.codes = NULL;
+  state.param = NULL;
+  state.features = 0;
+  state.table = NULL;
+  state.table_data = (const char**)malloc(compact->tables * sizeof(const char*));
+  state.table_count = (int*)malloc(compact->tables * sizeof(int));
+  
+  Importance * importance = NULL;
+  PtrArray * store = PtrArray_new();
+  
+  int ok = Tree_expand_body(compact, &state, &importance, store);
+ 
+ // Clean up...
+  free((float*)state.param);
+  free(state.table);
+  free(state.table_data);
+  free(state.table_count);
+  
+  if (ok==0)
+  {
+   free(importance);
+   PtrArray_delete(store);
+   
+   PyErr_SetString(PyExc_ValueError, "Compact tree is corrupt.");
+   return NULL;
+  }
+ 
+ // Pack it into a tree and return...
+  return Tree_pack(store, importance, compact->trained);
+}
+
+
+
 void Setup_Tree(void)
 {
  import_array();  
@@ -55,7 +55,7 @@ struct Tree
   
  int trained; // How many exemplars were used to train this tree.
  int objects; // Number of entities.
- void ** index; // Index - gets you a pointer to each object. Has to be rebuilt after reloading. Note - first object (position 0) is an int aligned array of chars, giving types for the rest of the objects. 'N' for node, 'S' for summary. The root of the tree is always at position 1. The final object can be of type 'I', and contain feature importance, as sum of information gain multiplied by training exemplars that went through split.
+ long long * index; // Index - gets you the offset of each object from the start of the tree. Has to be rebuilt after reloading, or provided by Tree_init_index. Note - first object (position 0) is an int aligned array of chars, giving types for the rest of the objects. 'N' for node, 'S' for summary. The root of the tree is always at position 1. The final object can be of type 'I', and contain feature importance, as sum of information gain multiplied by training exemplars that went through split.
 };
 
 
@@ -66,6 +66,12 @@ typedef void (*ReportSummarisation)(int count, void * ptr);
 // Methods to learn a new tree from some data - internally this is rather complicated, but only because it has to deal with all the crazy memory stuff - all the real work is elsewhere in this library. Return value will have been malloc'ed - user needs to free. More of the parameters are in the param struct - see it for details, but a seperate index set of exemplars to use is required...
 Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs, void * rs_ptr);
 
+// As above, but spreads the work of learning a single tree over several threads - nodes with lots of exemplars optimise their features at the same time and large subtrees are handed out to idle threads. Each thread needs its own LearnerSet and InfoSet to optimise with, so these are provided as arrays indexed by thread; the LearnerSet in param still selects the features, and the key is used exactly as Tree_learn would, so the tree (and the state param is left in) is identical to the one from Tree_learn, for any thread count. If features are selected at random (opt_features is less than the feature count) the nodes have to be done in the same order as Tree_learn, so only the features of large nodes are then optimised at the same time. The report function may be called from any of the threads...
+Tree * Tree_learn_threaded(TreeParam * param, int threads, LearnerSet ** ls, InfoSet ** is, IndexSet * indices, ReportSummarisation rs, void * rs_ptr);
+
+// Updates a tree with some new exemplars, for learning online - returns a new tree, as from Tree_learn, leaving the original untouched. The exemplars are pushed down the tree, and each leaf that any of them reach has its summaries updated with them, with keep weighting the statistics it already has (see SummaryUpdate). A leaf reached by at least grace exemplars then tries to split, as Tree_learn would with the same param but using only those exemplars, and only keeps the split if it passes a Hoeffding test - the information gain of the best split must exceed that of the runner up (the best split of any other feature tried, or zero for not splitting) by more than R sqrt(ln(1/confidence) / 2n) nats, where n is the effective number of exemplars, (sum w)^2 / sum w^2 for weights w, and R the range of the information gain (see InfoSet_range - ln of the category count for a categorical output; Gaussian outputs have no finite range, so count as one nat and the test is only a heuristic for them). Features that are equally good therefore never split. The new leaves start from just the exemplars that reach them, and try to split in turn. The number of splits made is written into splits if its not NULL...
+Tree * Tree_update(Tree * this, TreeParam * param, IndexSet * indices, float keep, int grace, float confidence, int * splits);
+
 
 // Returns non-zero if it thinks its a tree - i.e. the magic numbers and revision are correct, zero if there is a problem...
 int Tree_safe(Tree * this);
@@ -73,9 +79,15 @@ int Tree_safe(Tree * this);
 // If you have just created a memory block to contain a tree then this rebuilds the index. Must be called before actually using the tree. Returns zero if it doesn't think you actually have a tree (and sets a python error), nonzero if all is good. On zero you don't call deinit...
 int Tree_init(Tree * this);
 
+// Alternative to Tree_init that uses an index that already exists, as returned by Tree_index, rather than building one - this is for trees in memory mapped files, which store the index after the tree so every process that maps the file can share it. The index must stay around for as long as the tree is in use; do not call deinit on a tree initialised with this. Only does a cheap bounds check on the index, returning zero (with a python error set) if it fails...
+int Tree_init_index(Tree * this, long long * index);
+
 // When done with a tree this cleans up the index, but not the memory of the actual Tree object...
 void Tree_deinit(Tree * this);
 
+// Returns the index of an initialised tree, an array of Tree_objects(this) offsets from the start of the tree to each object, for when saving it alongside the tree...
+long long * Tree_index(Tree * this);
+
 
 // Returns how many bytes in size the Tree object should be - could be larger than sizeof(Tree) due to 32 bit/64 bit issues. Good number of bytes to read in before calling size and creating a real memory block...
 size_t Tree_head_size(void);
@@ -93,6 +105,40 @@ SummarySet * Tree_run(Tree * this, DataMatrix * x, int exemplar);
 // Runs a Tree on many exemplars, recording the result into the provided array - step is how many to step between entries in out when writting the output, so you can interleave values from multiple trees as required by the SummarySet_merge_many_py method. Assumes that IndexSet is everything in the DataMatrix, in the sense that otherwise there will be gaps...
 void Tree_run_many(Tree * this, DataMatrix * x, IndexSet * is, SummarySet ** out, int step);
 
+// A compiled version of a Tree for fast inference, which is never saved - the nodes are in a single flat array in depth first order, such that the fail child always immediatly follows its parent, and the common tests are stored inline, so running it involves no indirect function calls or index lookups...
+typedef struct FlatNode FlatNode;
+
+struct FlatNode
+{
+ int feature; // Feature the test is on, except for codes 'L' and 'N', where it is the index of the object in the Tree.
+ union
+ {
+  float split; // For 'C'.
+  int accept; // For 'D'.
+ } value;
+ int pass; // Index of the pass child.
+ char code; // 'C' and 'D' match the test codes, 'L' is a leaf (SummarySet) and 'N' a node with any other kind of test, which is run via the Tree.
+};
+
+typedef struct FlatTree FlatTree;
+
+struct FlatTree
+{
+ int nodes; // Size of below.
+ FlatNode node[0];
+};
+
+
+// Compiles a Tree, which must have been initialised - the return value is cache line aligned, and must be freed with free()...
+FlatTree * Tree_flatten(Tree * this);
+
+// Runs a compiled Tree on a single exemplar - as well as the DataMatrix and exemplar it needs the continuous and discrete values of its features, as output by DataMatrix_GetBlock. Returns the SummarySet it lands in...
+SummarySet * FlatTree_run(FlatTree * this, Tree * tree, DataMatrix * x, int exemplar, const float * continuous, const int * discrete);
+
+// Returns the first leaf of the tree - for when you need to know the layout of a SummarySet (the same for all leaves of all trees of a forest) without running an exemplar...
+SummarySet * Tree_first_leaf(Tree * this);
+
+
 // Converts the Tree into a Python object suitable for human consumption - tests and summaries (leaf nodes) are represented as strings, whilst non-leaf nodes are represented with dictionaries, containing 'test', 'pass' and 'fail'...
 PyObject * Tree_human(Tree * this);
 
@@ -100,6 +146,35 @@ PyObject * Tree_human(Tree * this);
 const float * Tree_importance(Tree * this, int * length);
 
 
+
+// A compact, lossy, version of a Tree, for storage and distribution rather than use - it has to be expanded back into a Tree. Nodes are stored in the order Tree_learn creates them, so child indices are implicit, continuous splits are indices into per-feature tables of split points and leaf summaries are quantised by their summary types. The header is the same size as a Tree header, with the size in the same place, so the same streaming code can read either...
+typedef struct CompactTree CompactTree;
+
+struct CompactTree
+{
+ char magic[4]; // Magic number 'FRFC'
+ int revision; // FRF_REVISION.
+ long long size; // How big the entire compact blob is.
+ 
+ int trained; // As for Tree.
+ int objects; // Number of objects in the expanded Tree, for checking.
+ int outputs; // Number of features in each leaf.
+ int tables; // Number of split tables.
+ 
+ // Then, all packed without alignment - the summary codes of the leaves (outputs chars); their quantisation parameters (outputs * SUMMARY_PARAMS floats); the split tables, each an int feature, an int count and count floats, sorted by feature; the feature importance (int feature count, then a float for each); and finally the nodes, each starting with a char: 'C' for a continuous split (unsigned short feature then unsigned short index into its split table), 'D' for a discrete select (unsigned short feature then unsigned short accept), 'T' for any other test (test code then the test data) and 'S' for a leaf (SummarySet_compact output). Each node is followed by its fail subtree then its pass subtree.
+};
+
+
+// Returns nonzero if the given header (Tree_head_size() bytes) is for a CompactTree rather than a Tree...
+int Tree_compacted(const void * head);
+
+// Creates the compact version of a Tree that has been initialised, as a new block of memory that must be freed with free(). Returns NULL with a python error set if it can't...
+CompactTree * Tree_compact(Tree * this);
+
+// Expands a CompactTree back into a Tree, which will have been initialised; size is how many bytes are available at compact, for checking. Returns NULL with a python error set if the data is corrupt...
+Tree * Tree_expand(CompactTree * compact, size_t size);
+
+
 // Setup this module - for internal use only...
 void Setup_Tree(void);
 
@@ -120,6 +120,18 @@ unsigned int PhiloxRNG_next(PhiloxRNG * this)
 }
 
 
+void PhiloxRNG_stream(const unsigned int * index, unsigned int stream, unsigned int * out)
+{
+ int i;
+ for (i=0; i<4; i++) out[i] = index[i];
+ 
+ out[0] ^= stream;
+ out[1] ^= 0xa511e9b3; // So stream 0 does not start at the next block of the sequence from index.
+ 
+ philox(out);
+}
+
+
 float PhiloxRNG_uniform(PhiloxRNG * this)
 {
  return (float)PhiloxRNG_next(this) / 4294967296.0; 
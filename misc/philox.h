@@ -44,6 +44,9 @@ void PhiloxRNG_init(PhiloxRNG * this, unsigned int * index);
 // Returns the next random number...
 unsigned int PhiloxRNG_next(PhiloxRNG * this);
 
+// Outputs the starting index of stream number stream derived from the given index, without changing it. Each stream starts at a hashed position, so the streams are effectively independent of each other and of the sequence that continues from index - for when items are processed in parallel, in any order, but the output must be deterministic...
+void PhiloxRNG_stream(const unsigned int * index, unsigned int stream, unsigned int * out);
+
 // Returns a uniform draw from the rng, in [0, 1)...
 float PhiloxRNG_uniform(PhiloxRNG * this);
 
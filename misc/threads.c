@@ -0,0 +1,266 @@
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include "threads.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+
+int thread_count(int threads)
+{
+ if (threads<1)
+ {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  threads = (cores>0) ? (int)cores : 1;
+ }
+
+ return threads;
+}
+
+
+
+// State shared by all workers of a single thread_run call...
+typedef struct ThreadShared ThreadShared;
+
+struct ThreadShared
+{
+ ThreadTask task;
+ void * data;
+
+ int count;
+ int chunk;
+ int next; // Next task to hand out - updated atomically.
+};
+
+typedef struct ThreadWorker ThreadWorker;
+
+struct ThreadWorker
+{
+ ThreadShared * shared;
+ int thread;
+};
+
+
+
+// The worker loop - keeps grabbing chunks until they run out...
+static void * thread_worker(void * ptr)
+{
+ ThreadWorker * this = (ThreadWorker*)ptr;
+ ThreadShared * shared = this->shared;
+
+ while (1)
+ {
+  int start = __sync_fetch_and_add(&shared->next, shared->chunk);
+  if (start>=shared->count) break;
+
+  int end = start + shared->chunk;
+  if (end>shared->count) end = shared->count;
+
+  shared->task(shared->data, this->thread, start, end);
+ }
+
+ return NULL;
+}
+
+
+
+void thread_run(ThreadTask task, void * data, int count, int chunk, int threads)
+{
+ if (count<=0) return;
+ if (chunk<1) chunk = 1;
+
+ // No point having more threads than chunks...
+  int chunks = (count + chunk - 1) / chunk;
+  if (threads>chunks) threads = chunks;
+
+ // Single threaded case is easy...
+  if (threads<=1)
+  {
+   task(data, 0, 0, count);
+   return;
+  }
+
+ // Setup the shared state and the per-thread state...
+  ThreadShared shared;
+  shared.task = task;
+  shared.data = data;
+  shared.count = count;
+  shared.chunk = chunk;
+  shared.next = 0;
+
+  ThreadWorker * worker = (ThreadWorker*)malloc(threads * sizeof(ThreadWorker));
+  pthread_t * handle = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  char * started = (char*)malloc(threads * sizeof(char));
+
+ // Launch the extra threads - if one fails to start its work is simply picked up by the others...
+  int i;
+  for (i=0; i<threads; i++)
+  {
+   worker[i].shared = &shared;
+   worker[i].thread = i;
+  }
+
+  for (i=1; i<threads; i++)
+  {
+   started[i] = pthread_create(&handle[i], NULL, thread_worker, &worker[i])==0;
+  }
+
+ // Do work in this thread as well, then wait for the rest to finish...
+  thread_worker(&worker[0]);
+
+  for (i=1; i<threads; i++)
+  {
+   if (started[i]) pthread_join(handle[i], NULL);
+  }
+
+ // Clean up...
+  free(started);
+  free(handle);
+  free(worker);
+}
+
+
+
+// The task pool - a stack of tasks protected by a mutex, with a condition to wake idle threads when tasks are added or everything is done...
+struct TaskPool
+{
+ PoolTask func;
+ void * data;
+
+ pthread_mutex_t lock;
+ pthread_cond_t wake;
+
+ int size; // Number of tasks on the stack.
+ int capacity; // Size of the stack array.
+ void ** stack;
+
+ int active; // Number of tasks currently being done - when this and size are both zero everything is done.
+};
+
+typedef struct PoolWorker PoolWorker;
+
+struct PoolWorker
+{
+ TaskPool * pool;
+ int thread;
+};
+
+
+
+// The worker loop - keeps taking tasks until there are none and no running task can create more...
+static void * pool_worker(void * ptr)
+{
+ PoolWorker * this = (PoolWorker*)ptr;
+ TaskPool * pool = this->pool;
+
+ pthread_mutex_lock(&pool->lock);
+ while (1)
+ {
+  while ((pool->size==0)&&(pool->active!=0))
+  {
+   pthread_cond_wait(&pool->wake, &pool->lock);
+  }
+
+  if (pool->size==0) break;
+
+  pool->size -= 1;
+  void * task = pool->stack[pool->size];
+  pool->active += 1;
+
+  pthread_mutex_unlock(&pool->lock);
+  pool->func(pool, pool->data, task, this->thread);
+  pthread_mutex_lock(&pool->lock);
+
+  pool->active -= 1;
+  if ((pool->active==0)&&(pool->size==0))
+  {
+   pthread_cond_broadcast(&pool->wake);
+  }
+ }
+ pthread_mutex_unlock(&pool->lock);
+
+ return NULL;
+}
+
+
+
+void task_pool_run(PoolTask func, void * data, void * first, int threads)
+{
+ if (threads<1) threads = 1;
+
+ // Setup the pool, with the first task already on the stack...
+  TaskPool pool;
+  pool.func = func;
+  pool.data = data;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.wake, NULL);
+
+  pool.size = 1;
+  pool.capacity = 64;
+  pool.stack = (void**)malloc(pool.capacity * sizeof(void*));
+  pool.stack[0] = first;
+
+  pool.active = 0;
+
+ // Launch the extra threads - as for thread_run any that fail to start are simply not used...
+  PoolWorker * worker = (PoolWorker*)malloc(threads * sizeof(PoolWorker));
+  pthread_t * handle = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  char * started = (char*)malloc(threads * sizeof(char));
+
+  int i;
+  for (i=0; i<threads; i++)
+  {
+   worker[i].pool = &pool;
+   worker[i].thread = i;
+  }
+
+  for (i=1; i<threads; i++)
+  {
+   started[i] = pthread_create(&handle[i], NULL, pool_worker, &worker[i])==0;
+  }
+
+ // Do work in this thread as well, then wait for the rest to finish...
+  pool_worker(&worker[0]);
+
+  for (i=1; i<threads; i++)
+  {
+   if (started[i]) pthread_join(handle[i], NULL);
+  }
+
+ // Clean up...
+  free(started);
+  free(handle);
+  free(worker);
+
+  free(pool.stack);
+  pthread_cond_destroy(&pool.wake);
+  pthread_mutex_destroy(&pool.lock);
+}
+
+
+void task_pool_push(TaskPool * pool, void * task)
+{
+ pthread_mutex_lock(&pool->lock);
+
+ if (pool->size==pool->capacity)
+ {
+  pool->capacity *= 2;
+  pool->stack = (void**)realloc(pool->stack, pool->capacity * sizeof(void*));
+ }
+
+ pool->stack[pool->size] = task;
+ pool->size += 1;
+
+ pthread_cond_signal(&pool->wake);
+ pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,45 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+// Provides a simple worker pool, for when you have a big batch of independent tasks (e.g. a mean shift for each row of a matrix, or a tree for each member of a forest) that you want to spread over multiple cores. Built on pthreads. Note that the caller is responsible for releasing the Python GIL, and for making sure the tasks don't touch any Python objects (numpy data pointers are fine)...
+
+
+
+// The function that does the work - it is given the data pointer that was passed in, the index of the thread calling it (0 to threads-1, so it can index per-thread state) and the range of tasks [start, end) to do...
+typedef void (*ThreadTask)(void * data, int thread, int start, int end);
+
+
+
+// Converts a requested thread count into an actual thread count - values less than 1 mean to use every core...
+int thread_count(int threads);
+
+// Runs the task for the range [0, count), breaking it into blocks of chunk tasks that are handed out to the threads as they become free. threads should be the output of thread_count; the calling thread is one of the threads, and if threads is 1 it simply calls the task directly. Returns when all tasks are done...
+void thread_run(ThreadTask task, void * data, int count, int chunk, int threads);
+
+
+
+// For when the tasks are not known in advance, because tasks create further tasks as they run (e.g. the two halves of a recursive split) - the threads take tasks from a shared stack until it is empty and no task is running, so threads that run out of work take it from those that have more...
+typedef struct TaskPool TaskPool;
+
+// The function that does a task - it is given the pool (so it can add more tasks), the data pointer passed to task_pool_run, the task itself and the index of the thread calling it (0 to threads-1)...
+typedef void (*PoolTask)(TaskPool * pool, void * data, void * task, int thread);
+
+// Runs the pool, starting with the single task first, until every task (including those added whilst running) is done. As for thread_run threads should be the output of thread_count, the calling thread is one of the threads, and with 1 thread everything happens in the calling thread...
+void task_pool_run(PoolTask func, void * data, void * first, int threads);
+
+// Adds a task to the pool - only valid from within a task. The most recently added task is the next to be handed out...
+void task_pool_push(TaskPool * pool, void * task);
+
+
+
+#endif
@@ -0,0 +1,512 @@
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+// Standalone benchmark of the C core of the ms module - runs prob, mode, cluster, loo_nll and mult for every combination of kernel, spatial indexing structure and (for cluster) balls type, on synthetic data, and writes the results to stdout as json. Python is only initialised so numpy arrays can be created for the data matrix - nothing goes through the Python interface. Parameters are given as key=value pairs on the command line - run with help for a list. Build it with something like:
+// gcc -O3 -I<numpy include> -I<python include> benchmark.c philox.c bessel.c eigen.c mult.c kernels.c convert.c data_matrix.c spatial.c balls.c mean_shift.c threads.c -o benchmark -l<python library> -lm -lpthread
+
+
+
+#include <Python.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "philox.h"
+#include "kernels.h"
+#include "data_matrix.h"
+#include "spatial.h"
+#include "balls.h"
+#include "mean_shift.h"
+#include "mult.h"
+
+
+
+// The parameters of a run, with their defaults...
+typedef struct Params Params;
+
+struct Params
+{
+ int dims; // Dimensions of the synthetic data.
+ int size; // Number of exemplars in the density estimate.
+ int clusters; // Number of clusters the data is drawn from; 0 for uniform data.
+ float spread; // Standard deviation of each cluster, with the cluster centres drawn uniformly from the unit hyper-cube.
+ float bandwidth; // Kernel size, i.e. the reciprocal of the scale. For the directional kernels the concentration is one over this squared.
+ int queries; // Number of points given to prob and mode, and the sample limit for loo_nll.
+ int draws; // Number of samples drawn by mult - kept separate as for kernels without an analytic product each draw is very much slower than a query.
+ int mci; // Samples used by mult when it has to do Monte Carlo integration; the Python interface defaults to 1000.
+ int cluster_size; // Number of exemplars clustered by cluster - uses its own, smaller, data set as it converges every exemplar.
+ float quality;
+ unsigned int seed;
+ 
+ const char * kernel; // Only run the kernel/spatial/balls/operation with this name - NULL for all of them.
+ const char * spatial;
+ const char * balls;
+ const char * op;
+};
+
+void Params_init(Params * this)
+{
+ this->dims = 3;
+ this->size = 10000;
+ this->clusters = 8;
+ this->spread = 0.05;
+ this->bandwidth = 0.05;
+ this->queries = 1000;
+ this->draws = 100;
+ this->mci = 100;
+ this->cluster_size = 2000;
+ this->quality = 0.5;
+ this->seed = 0;
+ 
+ this->kernel = NULL;
+ this->spatial = NULL;
+ this->balls = NULL;
+ this->op = NULL;
+}
+
+// Parses a key=value pair into the parameters - returns 0 on success, non-zero if it is not recognised...
+int Params_parse(Params * this, const char * arg)
+{
+ const char * eq = strchr(arg, '=');
+ if (eq==NULL) return 1;
+ 
+ int klen = eq - arg;
+ const char * value = eq + 1;
+ 
+ #define PARAM_IS(name) ((klen==strlen(name))&&(strncmp(arg, name, klen)==0))
+  if (PARAM_IS("dims")) this->dims = atoi(value);
+  else if (PARAM_IS("size")) this->size = atoi(value);
+  else if (PARAM_IS("clusters")) this->clusters = atoi(value);
+  else if (PARAM_IS("spread")) this->spread = atof(value);
+  else if (PARAM_IS("bandwidth")) this->bandwidth = atof(value);
+  else if (PARAM_IS("queries")) this->queries = atoi(value);
+  else if (PARAM_IS("draws")) this->draws = atoi(value);
+  else if (PARAM_IS("mci")) this->mci = atoi(value);
+  else if (PARAM_IS("cluster_size")) this->cluster_size = atoi(value);
+  else if (PARAM_IS("quality")) this->quality = atof(value);
+  else if (PARAM_IS("seed")) this->seed = strtoul(value, NULL, 0);
+  else if (PARAM_IS("kernel")) this->kernel = value;
+  else if (PARAM_IS("spatial")) this->spatial = value;
+  else if (PARAM_IS("balls")) this->balls = value;
+  else if (PARAM_IS("op")) this->op = value;
+  else return 1;
+ #undef PARAM_IS
+ 
+ if ((this->dims<1)||(this->size<1)||(this->queries<1)||(this->draws<1)||(this->mci<1)||(this->cluster_size<1)||(this->bandwidth<=0.0)) return 1;
+ return 0;
+}
+
+
+
+// Returns the time in seconds, from an arbitrary starting point...
+double now(void)
+{
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC, &ts);
+ return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+
+// Creates a synthetic data set, as a numpy array [exemplar, feature] of float32 - each exemplar is drawn from a randomly selected cluster, or uniformly if there are no clusters. If directional is non-zero each exemplar is normalised to be a unit vector, which the directional kernels require...
+PyArrayObject * synthetic(const Params * params, int size, int directional, PhiloxRNG * rng)
+{
+ int dims = params->dims;
+ int clusters = params->clusters;
+ 
+ float * centre = (float*)malloc((clusters>0?clusters:1) * dims * sizeof(float));
+ int i, j;
+ for (i=0; i<clusters*dims; i++) centre[i] = PhiloxRNG_uniform(rng);
+ 
+ npy_intp shape[2] = {size, dims};
+ PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, shape, NPY_FLOAT32);
+ 
+ for (j=0; j<size; j++)
+ {
+  float * row = (float*)PyArray_GETPTR2(ret, j, 0);
+ 
+  if (clusters>0)
+  {
+   int c = PhiloxRNG_next(rng) % clusters;
+   for (i=0; i<dims; i++) row[i] = centre[c*dims + i] + params->spread * PhiloxRNG_Gaussian(rng, NULL);
+  }
+  else
+  {
+   for (i=0; i<dims; i++) row[i] = PhiloxRNG_uniform(rng);
+  }
+ 
+  if (directional)
+  {
+   // Centre on the origin first, so the directions are spread out...
+    float len = 0.0;
+    for (i=0; i<dims; i++)
+    {
+     row[i] -= 0.5;
+     len += row[i] * row[i];
+    }
+ 
+    len = (len>1e-12) ? (1.0 / sqrt(len)) : 1.0;
+    for (i=0; i<dims; i++) row[i] *= len;
+  }
+ }
+ 
+ free(centre);
+ return ret;
+}
+
+
+
+// Everything an operation needs - the density estimate plus the query points, already scaled to the internal space...
+typedef struct Bench Bench;
+
+struct Bench
+{
+ const Params * params;
+ 
+ const Kernel * kernel;
+ KernelConfig config;
+ 
+ DataMatrix * dm;
+ Spatial spatial;
+ float norm;
+ 
+ int queries;
+ float * query; // [query, feature], in the internal space.
+ 
+ const BallsType * balls; // Only used by cluster.
+ int modes; // Output of cluster - how many modes it found.
+ 
+ Counters counters; // Work done by the queries of the operation.
+};
+
+typedef void (*BenchOp)(Bench * this);
+
+void op_prob(Bench * this)
+{
+ Query query;
+ Query_init(&query, this->spatial, &this->counters);
+ 
+ int feats = DataMatrix_features(this->dm);
+ int j;
+ volatile float sum = 0.0; // Stops the compiler getting clever.
+ for (j=0; j<this->queries; j++)
+ {
+  sum += prob(&query, this->kernel, this->config, this->query + j*feats, this->norm, this->params->quality);
+ }
+ 
+ Query_deinit(&query);
+}
+
+void op_mode(Bench * this)
+{
+ Query query;
+ Query_init(&query, this->spatial, &this->counters);
+ 
+ int feats = DataMatrix_features(this->dm);
+ float * fv = (float*)malloc(feats * sizeof(float));
+ float * temp = (float*)malloc(feats * sizeof(float));
+ 
+ int i, j;
+ for (j=0; j<this->queries; j++)
+ {
+  for (i=0; i<feats; i++) fv[i] = this->query[j*feats + i];
+  mode(&query, this->kernel, this->config, fv, temp, this->params->quality, 1e-3, 1024);
+ }
+ 
+ free(temp);
+ free(fv);
+ Query_deinit(&query);
+}
+
+void op_cluster(Bench * this)
+{
+ Query query;
+ Query_init(&query, this->spatial, &this->counters);
+ 
+ int feats = DataMatrix_features(this->dm);
+ Balls balls = Balls_new(this->balls, feats, 0.5);
+ int * out = (int*)malloc(DataMatrix_exemplars(this->dm) * sizeof(int));
+ 
+ cluster(&query, this->kernel, this->config, balls, out, this->params->quality, 1e-3, 1024, 0.3, 0.5, 4);
+ this->modes = Balls_count(balls);
+ 
+ free(out);
+ Balls_delete(balls);
+ Query_deinit(&query);
+}
+
+void op_loo_nll(Bench * this)
+{
+ Query query;
+ Query_init(&query, this->spatial, &this->counters);
+ 
+ unsigned int index[4] = {this->params->seed, 1, 0, 0};
+ PhiloxRNG rng;
+ PhiloxRNG_init(&rng, index);
+ 
+ volatile float nll = loo_nll(&query, this->kernel, this->config, this->norm, this->params->quality, 1e-16, this->queries, &rng);
+ (void)nll;
+ 
+ Query_deinit(&query);
+}
+
+void op_mult(Bench * this)
+{
+ // Multiplies the density estimate with itself...
+  Query query[2];
+  Query_init(&query[0], this->spatial, &this->counters);
+  Query_init(&query[1], this->spatial, &this->counters);
+ 
+  KernelConfig config[2] = {this->config, this->config};
+ 
+  unsigned int index[4] = {this->params->seed, 2, 0, 0};
+  PhiloxRNG rng;
+  PhiloxRNG_init(&rng, index);
+ 
+  MultCache mc;
+  MultCache_new(&mc);
+  mc.rng = &rng;
+  mc.mci_samples = this->params->mci;
+ 
+  int exemplars = DataMatrix_exemplars(this->dm);
+  int feats = DataMatrix_features(this->dm);
+  int * temp1 = (int*)malloc(exemplars * sizeof(int));
+  float * temp2 = (float*)malloc(exemplars * sizeof(float));
+  float * out = (float*)malloc(feats * sizeof(float));
+ 
+ // Draw...
+  int j;
+  for (j=0; j<this->params->draws; j++)
+  {
+   mult(this->kernel, (this->config!=NULL)?config:NULL, 2, query, out, &mc, temp1, temp2, this->params->quality, 0);
+  }
+ 
+ // Clean up...
+  free(out);
+  free(temp2);
+  free(temp1);
+  MultCache_delete(&mc);
+  Query_deinit(&query[1]);
+  Query_deinit(&query[0]);
+}
+
+
+
+// Runs an operation, timing it, then writes a json record of the result, including its counters. items is how many things the operation processes, for the per item rates...
+void run(Bench * this, const char * op_name, BenchOp op, int items, int * first)
+{
+ Counters_zero(&this->counters);
+ 
+ double start = now();
+ op(this);
+ double seconds = now() - start;
+ 
+ int feats = DataMatrix_features(this->dm);
+ Counters * c = &this->counters;
+ 
+ printf("%s\n  {\"kernel\" : \"%s\", \"spatial\" : \"%s\", ", (*first)?"":",", this->kernel->name, Spatial_type(this->spatial)->name);
+ if (this->balls!=NULL) printf("\"balls\" : \"%s\", ", this->balls->name);
+                   else printf("\"balls\" : null, ");
+ printf("\"op\" : \"%s\", \"items\" : %i, \"seconds\" : %g, \"per_second\" : %g, \"spatial_bytes\" : %lu", op_name, items, seconds, (seconds>0.0) ? (items / seconds) : 0.0, (unsigned long)Spatial_byte_size(this->spatial));
+ 
+ // Bytes touched is an estimate - the feature vectors and weights of the exemplars visited, ignoring the spatial structure itself...
+  double visits = c->exemplars / (double)items;
+  printf(", \"neighbours\" : %g, \"bytes\" : %g", visits, visits * (feats + 1) * sizeof(float));
+  printf(", \"searches\" : %g, \"nodes\" : %g, \"kernels\" : %g", c->searches / (double)items, c->nodes / (double)items, c->kernels / (double)items);
+ 
+ if (c->converges!=0) printf(", \"iters\" : %g, \"capped\" : %lli", c->iters / (double)c->converges, c->capped);
+ if (op==op_cluster) printf(", \"modes\" : %i, \"merged\" : %lli, \"created\" : %lli", this->modes, c->merged, c->created);
+ printf("}");
+ fflush(stdout);
+ 
+ *first = 0;
+}
+
+
+
+// Fills in a kernel configuration string for the given kernel, or returns NULL if it can't be used with the given parameters...
+const char * kernel_config(const Kernel * kernel, const Params * params, char * buf, int size)
+{
+ if (kernel->configuration==NULL) return "";
+
+ if ((kernel==&Fisher)||(kernel==&MirrorFisher))
+ {
+  if (params->dims<2) return NULL;
+  snprintf(buf, size, "(%g)", 1.0 / (params->bandwidth * params->bandwidth));
+  return buf;
+ }
+
+ if (kernel==&Composite)
+ {
+  if (params->dims<2) return NULL;
+  snprintf(buf, size, "(1:gaussian,%i:epanechnikov)", params->dims-1);
+  return buf;
+ }
+
+ return ""; // Kernels where the configuration is optional.
+}
+
+// Returns non-zero if the kernel expects unit vectors...
+int kernel_directional(const Kernel * kernel)
+{
+ return (kernel==&Fisher)||(kernel==&MirrorFisher);
+}
+
+
+
+int main(int argc, char ** argv)
+{
+ // Parse the parameters...
+  Params params;
+  Params_init(&params);
+
+  int i, j, k;
+  for (i=1; i<argc; i++)
+  {
+   if (Params_parse(&params, argv[i])!=0)
+   {
+    fprintf(stderr, "Unrecognised or invalid parameter: %s\n", argv[i]);
+    fprintf(stderr, "Parameters, as key=value: dims, size, clusters (0 for uniform data), spread, bandwidth, queries, draws, mci, cluster_size, quality, seed plus kernel, spatial, balls and op to only run the given one.\n");
+    return 1;
+   }
+  }
+
+ // Setup Python, so numpy can be used...
+  Py_Initialize();
+  import_array1(1);
+
+ // Generate the data sets - Euclidean and directional, each with a large version for the density estimate and a small version for clustering...
+  unsigned int index[4] = {params.seed, 0, 0, 0};
+  PhiloxRNG rng;
+  PhiloxRNG_init(&rng, index);
+
+  PyArrayObject * data[2][2];
+  DataMatrix dm[2][2];
+  DimType dt[2] = {DIM_DATA, DIM_FEATURE};
+
+  for (i=0; i<2; i++)
+  {
+   for (j=0; j<2; j++)
+   {
+    data[i][j] = synthetic(&params, (j==0) ? params.size : params.cluster_size, i, &rng);
+    DataMatrix_init(&dm[i][j]);
+    DataMatrix_set(&dm[i][j], data[i][j], dt, -1, NULL);
+   }
+  }
+
+  PyArrayObject * query_ext[2];
+  for (i=0; i<2; i++) query_ext[i] = synthetic(&params, params.queries, i, &rng);
+
+  float * scale = (float*)malloc(params.dims * sizeof(float));
+  float * query = (float*)malloc(params.queries * params.dims * sizeof(float));
+
+ // Output the parameters...
+  printf("{\"params\" : {\"dims\" : %i, \"size\" : %i, \"clusters\" : %i, \"spread\" : %g, \"bandwidth\" : %g, \"queries\" : %i, \"draws\" : %i, \"mci\" : %i, \"cluster_size\" : %i, \"quality\" : %g, \"seed\" : %u},\n", params.dims, params.size, params.clusters, params.spread, params.bandwidth, params.queries, params.draws, params.mci, params.cluster_size, params.quality, params.seed);
+  printf(" \"results\" : [");
+  int first = 1;
+
+ // Loop every kernel and spatial, running every operation...
+  char buf[256];
+  for (k=0; ListKernel[k]!=NULL; k++)
+  {
+   const Kernel * kernel = ListKernel[k];
+   if ((params.kernel!=NULL)&&(strcmp(params.kernel, kernel->name)!=0)) continue;
+ 
+   const char * conf = kernel_config(kernel, &params, buf, sizeof(buf));
+   if (conf==NULL) continue;
+ 
+   int dir = kernel_directional(kernel);
+   float s = dir ? 1.0 : (1.0 / params.bandwidth);
+   for (i=0; i<params.dims; i++) scale[i] = s;
+ 
+   for (j=0; j<2; j++) DataMatrix_set_scale(&dm[dir][j], scale, 1.0);
+   KernelConfig config = kernel->config_new(params.dims, conf);
+ 
+   for (j=0; j<params.queries; j++)
+   {
+    for (i=0; i<params.dims; i++) query[j*params.dims + i] = *(float*)PyArray_GETPTR2(query_ext[dir], j, i) * s;
+   }
+ 
+   int sp;
+   for (sp=0; ListSpatial[sp]!=NULL; sp++)
+   {
+    const SpatialType * st = ListSpatial[sp];
+    if ((params.spatial!=NULL)&&(strcmp(params.spatial, st->name)!=0)) continue;
+ 
+    Bench bench;
+    bench.params = &params;
+    bench.kernel = kernel;
+    bench.config = config;
+    bench.queries = params.queries;
+    bench.query = query;
+    bench.balls = NULL;
+    bench.modes = 0;
+ 
+    // Operations on the main data set...
+     bench.dm = &dm[dir][0];
+     bench.spatial = Spatial_new(st, bench.dm, 0.1);
+     bench.norm = calc_norm(bench.dm, kernel, config, calc_weight(bench.dm));
+ 
+     if ((params.op==NULL)||(strcmp(params.op, "prob")==0)) run(&bench, "prob", op_prob, params.queries, &first);
+     if ((params.op==NULL)||(strcmp(params.op, "mode")==0)) run(&bench, "mode", op_mode, params.queries, &first);
+     if ((params.op==NULL)||(strcmp(params.op, "loo_nll")==0)) run(&bench, "loo_nll", op_loo_nll, params.queries, &first);
+     if ((params.op==NULL)||(strcmp(params.op, "mult")==0)) run(&bench, "mult", op_mult, params.draws, &first);
+ 
+     Spatial_delete(bench.spatial);
+ 
+    // Clustering, on the smaller data set, for each balls type...
+     if ((params.op==NULL)||(strcmp(params.op, "cluster")==0))
+     {
+      bench.dm = &dm[dir][1];
+      bench.spatial = Spatial_new(st, bench.dm, 0.1);
+      bench.norm = calc_norm(bench.dm, kernel, config, calc_weight(bench.dm));
+ 
+      int b;
+      for (b=0; ListBalls[b]!=NULL; b++)
+      {
+       if ((params.balls!=NULL)&&(strcmp(params.balls, ListBalls[b]->name)!=0)) continue;
+ 
+       bench.balls = ListBalls[b];
+       run(&bench, "cluster", op_cluster, params.cluster_size, &first);
+      }
+ 
+      Spatial_delete(bench.spatial);
+     }
+   }
+ 
+   kernel->config_release(config);
+  }
+
+  printf("\n ]\n}\n");
+
+ // Clean up...
+  free(query);
+  free(scale);
+
+  for (i=0; i<2; i++)
+  {
+   Py_DECREF(query_ext[i]);
+   for (j=0; j<2; j++)
+   {
+    DataMatrix_deinit(&dm[i][j]);
+    Py_DECREF(data[i][j]);
+   }
+  }
+
+  Py_Finalize();
+
+ return 0;
+}
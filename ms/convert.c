@@ -21,6 +21,12 @@ void NoOp_to(const float * before, float * after)
  after[0] = before[0]; 
 }
 
+void NoOp_to_int_block(int count, const float * external, int ext_stride, float * internal, int int_stride)
+{
+ int j;
+ for (j=0; j<count; j++) internal[j*int_stride] = external[j*ext_stride];
+}
+
 
 const Convert NoOp =
 {
@@ -30,7 +36,8 @@ const Convert NoOp =
  1,
  1,
  NoOp_to,
- NoOp_to
+ NoOp_to,
+ NoOp_to_int_block
 };
 
 
@@ -55,7 +62,8 @@ const Convert Delete =
  1,
  0,
  Delete_to_int,
- Delete_to_ext
+ Delete_to_ext,
+ NULL
 };
 
 
@@ -72,6 +80,33 @@ void Angle_to_ext(const float * internal, float * external)
  external[0] = atan2(internal[1], internal[0]);
 }
 
+void Angle_to_int_block(int count, const float * external, int ext_stride, float * internal, int int_stride)
+{
+ float a[CONVERT_BLOCK];
+ float c[CONVERT_BLOCK];
+ float s[CONVERT_BLOCK];
+ 
+ int base, j;
+ for (base=0; base<count; base+=CONVERT_BLOCK)
+ {
+  int n = count - base;
+  if (n>CONVERT_BLOCK) n = CONVERT_BLOCK;
+  const float * ext = external + base*ext_stride;
+  float * out = internal + base*int_stride;
+  
+  for (j=0; j<n; j++) a[j] = ext[j*ext_stride];
+  
+  for (j=0; j<n; j++) c[j] = cos(a[j]);
+  for (j=0; j<n; j++) s[j] = sin(a[j]);
+  
+  for (j=0; j<n; j++)
+  {
+   out[j*int_stride] = c[j];
+   out[j*int_stride + 1] = s[j];
+  }
+ }
+}
+
 
 const Convert Angle =
 {
@@ -81,7 +116,8 @@ const Convert Angle =
  1,
  2,
  Angle_to_int,
- Angle_to_ext
+ Angle_to_ext,
+ Angle_to_int_block
 };
 
 
@@ -99,6 +135,38 @@ void Radial_to_ext(const float * internal, float * external)
  external[1] = sqrt(internal[0] * internal[0] + internal[1]*internal[1]);
 }
 
+void Radial_to_int_block(int count, const float * external, int ext_stride, float * internal, int int_stride)
+{
+ float a[CONVERT_BLOCK];
+ float r[CONVERT_BLOCK];
+ float x[CONVERT_BLOCK];
+ float y[CONVERT_BLOCK];
+ 
+ int base, j;
+ for (base=0; base<count; base+=CONVERT_BLOCK)
+ {
+  int n = count - base;
+  if (n>CONVERT_BLOCK) n = CONVERT_BLOCK;
+  const float * ext = external + base*ext_stride;
+  float * out = internal + base*int_stride;
+  
+  for (j=0; j<n; j++)
+  {
+   a[j] = ext[j*ext_stride];
+   r[j] = ext[j*ext_stride + 1];
+  }
+  
+  for (j=0; j<n; j++) x[j] = cos(a[j]) * r[j];
+  for (j=0; j<n; j++) y[j] = sin(a[j]) * r[j];
+  
+  for (j=0; j<n; j++)
+  {
+   out[j*int_stride] = x[j];
+   out[j*int_stride + 1] = y[j];
+  }
+ }
+}
+
 
 const Convert Radial =
 {
@@ -108,7 +176,8 @@ const Convert Radial =
  2,
  2,
  Radial_to_int,
- Radial_to_ext
+ Radial_to_ext,
+ Radial_to_int_block
 };
 
 
@@ -129,6 +198,43 @@ void SphericalAngle_to_ext(const float * internal, float * external)
  external[1] = acos(internal[2]);
 }
 
+void SphericalAngle_to_int_block(int count, const float * external, int ext_stride, float * internal, int int_stride)
+{
+ float phi[CONVERT_BLOCK];
+ float theta[CONVERT_BLOCK];
+ float sin_theta[CONVERT_BLOCK];
+ float x[CONVERT_BLOCK];
+ float y[CONVERT_BLOCK];
+ float z[CONVERT_BLOCK];
+ 
+ int base, j;
+ for (base=0; base<count; base+=CONVERT_BLOCK)
+ {
+  int n = count - base;
+  if (n>CONVERT_BLOCK) n = CONVERT_BLOCK;
+  const float * ext = external + base*ext_stride;
+  float * out = internal + base*int_stride;
+  
+  for (j=0; j<n; j++)
+  {
+   phi[j] = ext[j*ext_stride];
+   theta[j] = ext[j*ext_stride + 1];
+  }
+  
+  for (j=0; j<n; j++) sin_theta[j] = sin(theta[j]);
+  for (j=0; j<n; j++) x[j] = sin_theta[j] * cos(phi[j]);
+  for (j=0; j<n; j++) y[j] = sin_theta[j] * sin(phi[j]);
+  for (j=0; j<n; j++) z[j] = cos(theta[j]);
+  
+  for (j=0; j<n; j++)
+  {
+   out[j*int_stride] = x[j];
+   out[j*int_stride + 1] = y[j];
+   out[j*int_stride + 2] = z[j];
+  }
+ }
+}
+
 
 const Convert SphericalAngle =
 {
@@ -138,7 +244,8 @@ const Convert SphericalAngle =
  2,
  3,
  SphericalAngle_to_int,
- SphericalAngle_to_ext
+ SphericalAngle_to_ext,
+ SphericalAngle_to_int_block
 };
 
 
@@ -161,6 +268,45 @@ void SphericalCoord_to_ext(const float * internal, float * external)
  external[1] = acos(internal[2] / external[2]);
 }
 
+void SphericalCoord_to_int_block(int count, const float * external, int ext_stride, float * internal, int int_stride)
+{
+ float phi[CONVERT_BLOCK];
+ float theta[CONVERT_BLOCK];
+ float r[CONVERT_BLOCK];
+ float sin_theta[CONVERT_BLOCK];
+ float x[CONVERT_BLOCK];
+ float y[CONVERT_BLOCK];
+ float z[CONVERT_BLOCK];
+ 
+ int base, j;
+ for (base=0; base<count; base+=CONVERT_BLOCK)
+ {
+  int n = count - base;
+  if (n>CONVERT_BLOCK) n = CONVERT_BLOCK;
+  const float * ext = external + base*ext_stride;
+  float * out = internal + base*int_stride;
+  
+  for (j=0; j<n; j++)
+  {
+   phi[j] = ext[j*ext_stride];
+   theta[j] = ext[j*ext_stride + 1];
+   r[j] = ext[j*ext_stride + 2];
+  }
+  
+  for (j=0; j<n; j++) sin_theta[j] = sin(theta[j]);
+  for (j=0; j<n; j++) x[j] = r[j] * sin_theta[j] * cos(phi[j]);
+  for (j=0; j<n; j++) y[j] = r[j] * sin_theta[j] * sin(phi[j]);
+  for (j=0; j<n; j++) z[j] = r[j] * cos(theta[j]);
+  
+  for (j=0; j<n; j++)
+  {
+   out[j*int_stride] = x[j];
+   out[j*int_stride + 1] = y[j];
+   out[j*int_stride + 2] = z[j];
+  }
+ }
+}
+
 
 const Convert SphericalCoord =
 {
@@ -170,7 +316,8 @@ const Convert SphericalCoord =
  3,
  3,
  SphericalCoord_to_int,
- SphericalCoord_to_ext
+ SphericalCoord_to_ext,
+ SphericalCoord_to_int_block
 };
 
 
@@ -206,6 +353,38 @@ void AngleAxis_to_ext(const float * internal, float * external)
  }
 }
 
+void AngleAxis_to_int_block(int count, const float * external, int ext_stride, float * internal, int int_stride)
+{
+ float v[3][CONVERT_BLOCK];
+ float angle[CONVERT_BLOCK];
+ float sin_half_angle[CONVERT_BLOCK];
+ float cos_half_angle[CONVERT_BLOCK];
+ 
+ int base, j, i;
+ for (base=0; base<count; base+=CONVERT_BLOCK)
+ {
+  int n = count - base;
+  if (n>CONVERT_BLOCK) n = CONVERT_BLOCK;
+  const float * ext = external + base*ext_stride;
+  float * out = internal + base*int_stride;
+  
+  for (j=0; j<n; j++)
+  {
+   for (i=0; i<3; i++) v[i][j] = ext[j*ext_stride + i];
+  }
+  
+  for (j=0; j<n; j++) angle[j] = sqrt(v[0][j] * v[0][j] + v[1][j] * v[1][j] + v[2][j] * v[2][j]);
+  for (j=0; j<n; j++) sin_half_angle[j] = sin(0.5*angle[j]);
+  for (j=0; j<n; j++) cos_half_angle[j] = cos(0.5*angle[j]);
+  
+  for (j=0; j<n; j++)
+  {
+   for (i=0; i<3; i++) out[j*int_stride + i] = sin_half_angle[j] * v[i][j] / angle[j];
+   out[j*int_stride + 3] = cos_half_angle[j];
+  }
+ }
+}
+
 
 const Convert AngleAxis =
 {
@@ -215,7 +394,8 @@ const Convert AngleAxis =
  3,
  4,
  AngleAxis_to_int,
- AngleAxis_to_ext
+ AngleAxis_to_ext,
+ AngleAxis_to_int_block
 };
 
 
@@ -237,6 +417,42 @@ void Euler_to_int(const float * external, float * internal)
  internal[3] = cz * cy * cx - sz * sy * sx;
 }
 
+void Euler_to_int_block(int count, const float * external, int ext_stride, float * internal, int int_stride)
+{
+ float angle[3][CONVERT_BLOCK];
+ float c[3][CONVERT_BLOCK];
+ float s[3][CONVERT_BLOCK];
+ 
+ int base, j, i;
+ for (base=0; base<count; base+=CONVERT_BLOCK)
+ {
+  int n = count - base;
+  if (n>CONVERT_BLOCK) n = CONVERT_BLOCK;
+  const float * ext = external + base*ext_stride;
+  float * out = internal + base*int_stride;
+  
+  for (j=0; j<n; j++)
+  {
+   for (i=0; i<3; i++) angle[i][j] = ext[j*ext_stride + i];
+  }
+  
+  for (i=0; i<3; i++)
+  {
+   for (j=0; j<n; j++) c[i][j] = cos(0.5 * angle[i][j]);
+   for (j=0; j<n; j++) s[i][j] = sin(0.5 * angle[i][j]);
+  }
+  
+  for (j=0; j<n; j++)
+  {
+   float * q = out + j*int_stride;
+   q[0] = s[2][j] * s[1][j] * c[0][j] + c[2][j] * c[1][j] * s[0][j];
+   q[1] = s[2][j] * c[1][j] * c[0][j] + c[2][j] * s[1][j] * s[0][j];
+   q[2] = c[2][j] * s[1][j] * c[0][j] - s[2][j] * c[1][j] * s[0][j];
+   q[3] = c[2][j] * c[1][j] * c[0][j] - s[2][j] * s[1][j] * s[0][j];
+  }
+ }
+}
+
 void Euler_to_ext(const float * internal, float * external)
 {
  external[0] = atan2(2*internal[0]*internal[3] - 2*internal[1]*internal[2], 1 - 2*internal[0]*internal[0] - 2*internal[2]*internal[2]);
@@ -253,11 +469,28 @@ const Convert Euler =
  3,
  4,
  Euler_to_int,
- Euler_to_ext
+ Euler_to_ext,
+ Euler_to_int_block
 };
 
 
 
+// Helper for using the block conversion...
+void Convert_to_int_block(const Convert * this, int count, const float * external, int ext_stride, float * internal, int int_stride)
+{
+ if (this->to_int_block!=NULL)
+ {
+  this->to_int_block(count, external, ext_stride, internal, int_stride);
+ }
+ else
+ {
+  int j;
+  for (j=0; j<count; j++) this->to_int(external + j*ext_stride, internal + j*int_stride);
+ }
+}
+
+
+
 // The list of known convertors...
 const Convert * ListConvert[] =
 {
@@ -25,6 +25,11 @@ typedef void (*ConvertToInt)(const float * external, float * internal);
 // Converts from the kernel-suitable representation back to the original. Pointers to float arrays must be long enough...
 typedef void (*ConvertToExt)(const float * internal, float * external);
 
+// Optional (can be NULL) - as ConvertToInt, but for count vectors at once, with vector j read from external + j*ext_stride and written to internal + j*int_stride. Works through them CONVERT_BLOCK at a time, gathering the inputs into contiguous arrays so the expensive trigonometry is a simple loop the compiler can vectorise. Must give exactly the same output as calling to_int on each vector...
+typedef void (*ConvertToIntBlock)(int count, const float * external, int ext_stride, float * internal, int int_stride);
+
+#define CONVERT_BLOCK 64
+
 
 
 // Define the struct that defines a convertor type...
@@ -41,10 +46,16 @@ struct Convert
  
  ConvertToInt to_int;
  ConvertToExt to_ext;
+ ConvertToIntBlock to_int_block;
 };
 
 
 
+// Calls the to_int_block method of the given convertor, or to_int for each vector if it does not have one...
+void Convert_to_int_block(const Convert * this, int count, const float * external, int ext_stride, float * internal, int int_stride);
+
+
+
 // Convertors provided by this code...
 
 // NoOp - just copies across a single value...
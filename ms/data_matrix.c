@@ -12,6 +12,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 
 
@@ -141,6 +144,13 @@ void DataMatrix_init(DataMatrix * dm)
   dm->fv_conv = NULL;
   dm->ops_conv = 0;
   dm->conv = NULL;
+  dm->simple = 0;
+  dm->cache = NULL;
+  dm->cache_ready = NULL;
+  dm->cache_bytes = 0;
+  dm->converted = NULL;
+  dm->store = NULL;
+  dm->capacity = 0;
 }
 
 
@@ -177,6 +187,14 @@ void DataMatrix_deinit(DataMatrix * dm)
  dm->ops_conv = 0;
  free(dm->conv);
  dm->conv = NULL;
+ 
+ dm->simple = 0;
+ DataMatrix_cache_off(dm);
+ DataMatrix_convert_off(dm);
+ 
+ Py_XDECREF(dm->store);
+ dm->store = NULL;
+ dm->capacity = 0;
 }
 
 
@@ -252,6 +270,12 @@ void DataMatrix_set(DataMatrix * dm, PyArrayObject * array, DimType * dt, int we
  // Store a function pointer in the to_float variable that matches this array type...
   dm->to_float = KindToFunc(PyArray_DESCR(dm->array));
   
+ // Detect the simple case, of a 2D float32 matrix with contiguous rows, that can be fetched with a copy...
+  if ((PyArray_NDIM(dm->array)==2)&&(dm->dt[0]==DIM_DATA)&&(dm->dt[1]==DIM_FEATURE)&&(PyArray_DESCR(dm->array)->kind=='f')&&(PyArray_DESCR(dm->array)->elsize==sizeof(float))&&(PyArray_STRIDES(dm->array)[1]==sizeof(float)))
+  {
+   dm->simple = 1;
+  }
+  
  // Prepare the conversion system...
   if (conv_str!=NULL)
   {
@@ -314,22 +338,435 @@ void DataMatrix_set_scale(DataMatrix * dm, float * scale, float weight_scale)
  int i;
  for (i=0; i<dm->feats_conv; i++) dm->mult[i] = scale[i];
  dm->weight_scale = weight_scale;
+ 
+ DataMatrix_scale_changed(dm);
+}
+
+
+void DataMatrix_scale_changed(DataMatrix * dm)
+{
+ if (dm->cache!=NULL)
+ {
+  memset(dm->cache_ready, 0, (dm->exemplars + DATA_MATRIX_BLOCK - 1) / DATA_MATRIX_BLOCK);
+ }
+}
+
+
+
+int DataMatrix_cache(DataMatrix * dm, const char * fn)
+{
+ DataMatrix_cache_off(dm);
+ if (dm->exemplars==0) return 0;
+ 
+ // Create the memory map, either anonymous or of the given file...
+  dm->cache_bytes = (size_t)dm->exemplars * (dm->feats_conv + 1) * sizeof(float);
+  void * ptr;
+  
+  if (fn==NULL)
+  {
+   ptr = mmap(NULL, dm->cache_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  }
+  else
+  {
+   int fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0600);
+   if (fd<0) return 0;
+   
+   if (ftruncate(fd, dm->cache_bytes)!=0)
+   {
+    close(fd);
+    return 0;
+   }
+   
+   ptr = mmap(NULL, dm->cache_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd); // The map keeps the file alive.
+  }
+  
+  if (ptr==MAP_FAILED)
+  {
+   dm->cache_bytes = 0;
+   return 0;
+  }
+  
+ // Record it, with every block marked as invalid...
+  dm->cache = (float*)ptr;
+  dm->cache_ready = (char*)calloc((dm->exemplars + DATA_MATRIX_BLOCK - 1) / DATA_MATRIX_BLOCK, sizeof(char));
+  
+ return 1;
+}
+
+
+void DataMatrix_cache_off(DataMatrix * dm)
+{
+ if (dm->cache!=NULL)
+ {
+  munmap(dm->cache, dm->cache_bytes);
+  dm->cache = NULL;
+ }
+ 
+ free(dm->cache_ready);
+ dm->cache_ready = NULL;
+ dm->cache_bytes = 0;
+}
+
+
+// Converts the n (at most CONVERT_BLOCK) exemplars starting at start to the internal format, before scaling, writing them into out with the given stride, each followed by its weight. ext must have space for CONVERT_BLOCK external feature vectors...
+void DataMatrix_convert_chunk(DataMatrix * dm, int start, int n, float * ext, float * out, int stride)
+{
+ float weight[CONVERT_BLOCK];
+ 
+ int j;
+ for (j=0; j<n; j++)
+ {
+  DataMatrix_ext_fv_temp(dm, start+j, &weight[j], ext + j*dm->feats);
+ }
+ 
+ if (dm->fv_conv==NULL)
+ {
+  for (j=0; j<n; j++) memcpy(out + j*stride, ext + j*dm->feats, dm->feats * sizeof(float));
+ }
+ else
+ {
+  int i;
+  for (i=0; i<dm->ops_conv; i++)
+  {
+   Convert_to_int_block(dm->conv[i].conv, n, ext + dm->conv[i].offset_external, dm->feats, out + dm->conv[i].offset_internal, stride);
+  }
+ }
+ 
+ for (j=0; j<n; j++) out[j*stride + dm->feats_conv] = weight[j];
+}
+
+
+// Converts the exemplars in [start, end) into the converted copy, which must be large enough - the weight_scale is set to 1 while doing so, so the stored weights are independent of it...
+void DataMatrix_convert_range(DataMatrix * dm, int start, int end)
+{
+ int stride = dm->feats_conv + 1;
+ float * ext = (float*)malloc(CONVERT_BLOCK * dm->feats * sizeof(float));
+ 
+ float weight_scale = dm->weight_scale;
+ dm->weight_scale = 1.0;
+ 
+ int base;
+ for (base=start; base<end; base+=CONVERT_BLOCK)
+ {
+  int n = end - base;
+  if (n>CONVERT_BLOCK) n = CONVERT_BLOCK;
+  DataMatrix_convert_chunk(dm, base, n, ext, dm->converted + (size_t)base * stride, stride);
+ }
+ 
+ dm->weight_scale = weight_scale;
+ free(ext);
+}
+
+
+int DataMatrix_convert_all(DataMatrix * dm)
+{
+ DataMatrix_convert_off(dm);
+ if (dm->fv_conv==NULL) return 0;
+ 
+ dm->converted = (float*)malloc((size_t)(dm->exemplars>0 ? dm->exemplars : 1) * (dm->feats_conv + 1) * sizeof(float));
+ DataMatrix_convert_range(dm, 0, dm->exemplars);
+ 
+ return 1;
+}
+
+
+void DataMatrix_convert_off(DataMatrix * dm)
+{
+ free(dm->converted);
+ dm->converted = NULL;
+}
+
+
+
+int DataMatrix_editable(DataMatrix * dm)
+{
+ return (dm->array!=NULL)&&(PyArray_NDIM(dm->array)==2)&&(dm->dt[0]==DIM_DATA)&&(dm->dt[1]==DIM_FEATURE);
+}
+
+
+// Replaces the array with a view of the first exemplars rows of the store...
+void DataMatrix_view_store(DataMatrix * dm)
+{
+ npy_intp dims[2];
+ dims[0] = dm->exemplars;
+ dims[1] = PyArray_DIMS(dm->store)[1];
+ 
+ PyArray_Descr * descr = PyArray_DESCR(dm->store);
+ Py_INCREF(descr);
+ PyArrayObject * view = (PyArrayObject*)PyArray_NewFromDescr(&PyArray_Type, descr, 2, dims, PyArray_STRIDES(dm->store), PyArray_DATA(dm->store), NPY_ARRAY_CARRAY, NULL);
+ 
+ Py_INCREF(dm->store);
+ PyArray_SetBaseObject(view, (PyObject*)dm->store);
+ 
+ Py_DECREF(dm->array);
+ dm->array = view;
+ 
+ dm->simple = (PyArray_DESCR(dm->array)->kind=='f')&&(PyArray_DESCR(dm->array)->elsize==sizeof(float));
+}
+
+
+// Makes sure the data matrix is using a store, with space for at least the given number of exemplars, growing it if need be...
+void DataMatrix_reserve(DataMatrix * dm, int exemplars)
+{
+ if ((dm->store!=NULL)&&(dm->capacity>=exemplars)) return;
+ 
+ // Create the new store...
+  int capacity = dm->capacity * 2;
+  if (capacity<exemplars) capacity = exemplars;
+  if (capacity<DATA_MATRIX_BLOCK) capacity = DATA_MATRIX_BLOCK;
+  
+  npy_intp dims[2];
+  dims[0] = capacity;
+  dims[1] = PyArray_DIMS(dm->array)[1];
+  PyArrayObject * store = (PyArrayObject*)PyArray_SimpleNew(2, dims, PyArray_TYPE(dm->array));
+  
+ // Copy across the current contents - goes via a view so the array can have any layout...
+  Py_XDECREF(dm->store);
+  dm->store = store;
+  dm->capacity = capacity;
+  
+  PyArrayObject * old = dm->array;
+  Py_INCREF(old);
+  DataMatrix_view_store(dm);
+  
+  PyArray_CopyInto(dm->array, old);
+  Py_DECREF(old);
+}
+
+
+void DataMatrix_append(DataMatrix * dm, const void * rows, int count)
+{
+ int start = dm->exemplars;
+ DataMatrix_reserve(dm, start + count);
+ 
+ // Copy the rows in and update the view...
+  size_t row_bytes = PyArray_STRIDES(dm->store)[0];
+  memcpy(PyArray_GETPTR2(dm->store, start, 0), rows, count * row_bytes);
+  
+  dm->exemplars += count;
+  DataMatrix_view_store(dm);
+  
+ // Convert the new rows, if keeping a converted copy...
+  if (dm->converted!=NULL)
+  {
+   dm->converted = (float*)realloc(dm->converted, (size_t)dm->exemplars * (dm->feats_conv + 1) * sizeof(float));
+   DataMatrix_convert_range(dm, start, dm->exemplars);
+  }
+  
+ // The cache is now stale - drop it before anything below fetches a feature vector...
+  DataMatrix_cache_off(dm);
+  
+ // Extend the cumulative weights, if they have been calculated...
+  if (dm->weight_cum!=NULL)
+  {
+   dm->weight_cum = (float*)realloc(dm->weight_cum, dm->exemplars * sizeof(float));
+   
+   float sum = (start>0) ? dm->weight_cum[start-1] : 0.0;
+   int i;
+   for (i=start; i<dm->exemplars; i++)
+   {
+    float weight;
+    DataMatrix_fv(dm, i, &weight);
+    sum += weight;
+    dm->weight_cum[i] = sum;
+   }
+  }
+}
+
+
+void DataMatrix_remove(DataMatrix * dm, int index)
+{
+ DataMatrix_reserve(dm, dm->exemplars);
+ 
+ // Move the last row into the hole and update the view...
+  int last = dm->exemplars - 1;
+  if (index!=last)
+  {
+   size_t row_bytes = PyArray_STRIDES(dm->store)[0];
+   memcpy(PyArray_GETPTR2(dm->store, index, 0), PyArray_GETPTR2(dm->store, last, 0), row_bytes);
+  }
+  
+  dm->exemplars -= 1;
+  DataMatrix_view_store(dm);
+  
+  if ((dm->converted!=NULL)&&(index!=last))
+  {
+   int stride = dm->feats_conv + 1;
+   memcpy(dm->converted + (size_t)index * stride, dm->converted + (size_t)last * stride, stride * sizeof(float));
+  }
+  
+ // The cache is now stale - drop it before anything below fetches a feature vector...
+  DataMatrix_cache_off(dm);
+ 
+ // Update the cumulative weights from the hole onwards, if they have been calculated...
+  if (dm->weight_cum!=NULL)
+  {
+   if (dm->exemplars==0)
+   {
+    free(dm->weight_cum);
+    dm->weight_cum = NULL;
+   }
+   else
+   {
+    float sum = (index>0) ? dm->weight_cum[index-1] : 0.0;
+    int i;
+    for (i=index; i<dm->exemplars; i++)
+    {
+     float weight;
+     DataMatrix_fv(dm, i, &weight);
+     sum += weight;
+     dm->weight_cum[i] = sum;
+    }
+   }
+  }
+}
+
+
+
+// Fills in the given block of the cache. Can be called by several threads at once for the same block, as they will all write the same values - only final values are ever written into the cache...
+void DataMatrix_cache_fill(DataMatrix * dm, int block)
+{
+ int stride = dm->feats_conv + 1;
+ float * ext = NULL;
+ float * chunk = NULL;
+ if (dm->converted==NULL)
+ {
+  ext = (float*)malloc(CONVERT_BLOCK * dm->feats * sizeof(float));
+  chunk = (float*)malloc(CONVERT_BLOCK * stride * sizeof(float));
+ }
+ 
+ int start = block * DATA_MATRIX_BLOCK;
+ int end = start + DATA_MATRIX_BLOCK;
+ if (end>dm->exemplars) end = dm->exemplars;
+ 
+ int base, i, j;
+ for (base=start; base<end; base+=CONVERT_BLOCK)
+ {
+  int n = end - base;
+  if (n>CONVERT_BLOCK) n = CONVERT_BLOCK;
+  
+  // Get the converted but unscaled rows, from the converted copy if available...
+   const float * in;
+   float weight_scale;
+   if (dm->converted!=NULL)
+   {
+    in = dm->converted + (size_t)base * stride;
+    weight_scale = dm->weight_scale;
+   }
+   else
+   {
+    DataMatrix_convert_chunk(dm, base, n, ext, chunk, stride);
+    in = chunk;
+    weight_scale = 1.0; // Already applied.
+   }
+  
+  // Scale them into the cache...
+   float * out = dm->cache + (size_t)base * stride;
+   for (j=0; j<n; j++)
+   {
+    for (i=0; i<dm->feats_conv; i++) out[j*stride + i] = in[j*stride + i] * dm->mult[i];
+    out[j*stride + dm->feats_conv] = in[j*stride + dm->feats_conv] * weight_scale;
+   }
+ }
+ 
+ free(chunk);
+ free(ext);
+ 
+ // Release, so a thread that sees the flag set (with an acquire load) also sees the rows written above...
+  __atomic_store_n(dm->cache_ready + block, 1, __ATOMIC_RELEASE);
+}
+
+
+// Fetches an internal feature vector from the cache, filling in its block first if needed...
+float * DataMatrix_cache_fv(DataMatrix * dm, int index, float * weight, float * out)
+{
+ int block = index / DATA_MATRIX_BLOCK;
+ if (__atomic_load_n(dm->cache_ready + block, __ATOMIC_ACQUIRE)==0) DataMatrix_cache_fill(dm, block);
+ 
+ const float * row = dm->cache + (size_t)index * (dm->feats_conv + 1);
+ memcpy(out, row, dm->feats_conv * sizeof(float));
+ if (weight!=NULL) *weight = row[dm->feats_conv];
+ 
+ return out;
+}
+
+
+
+// Fetches an internal feature vector from the converted copy, scaling it...
+float * DataMatrix_converted_fv(DataMatrix * dm, int index, float * weight, float * out)
+{
+ const float * row = dm->converted + (size_t)index * (dm->feats_conv + 1);
+ 
+ int i;
+ for (i=0; i<dm->feats_conv; i++) out[i] = row[i] * dm->mult[i];
+ if (weight!=NULL) *weight = dm->weight_scale * row[dm->feats_conv];
+ 
+ return out;
 }
 
 
 
 float * DataMatrix_fv(DataMatrix * dm, int index, float * weight)
 {
- float * ret = DataMatrix_ext_fv(dm, index, weight);
+ if (dm->cache!=NULL) return DataMatrix_cache_fv(dm, index, weight, (dm->fv_conv!=NULL) ? dm->fv_conv : dm->fv);
+ if (dm->converted!=NULL) return DataMatrix_converted_fv(dm, index, weight, dm->fv_conv);
+ 
+ float * ret = DataMatrix_ext_fv_temp(dm, index, weight, dm->fv);
  ret = DataMatrix_to_int(dm, ret, dm->fv_conv); 
  return ret;
 }
 
 
 float * DataMatrix_ext_fv(DataMatrix * dm, int index, float * weight)
+{
+ return DataMatrix_ext_fv_temp(dm, index, weight, dm->fv);
+}
+
+
+float * DataMatrix_fv_temp(DataMatrix * dm, int index, float * weight, float * temp)
+{
+ if (dm->cache!=NULL) return DataMatrix_cache_fv(dm, index, weight, temp);
+ if (dm->converted!=NULL) return DataMatrix_converted_fv(dm, index, weight, temp);
+ 
+ float * ret = DataMatrix_ext_fv_temp(dm, index, weight, temp);
+ ret = DataMatrix_to_int(dm, ret, temp + dm->feats); 
+ return ret;
+}
+
+
+int DataMatrix_temp_size(DataMatrix * dm)
+{
+ if (dm->fv_conv==NULL) return dm->feats;
+                   else return dm->feats + dm->feats_conv;
+}
+
+
+float * DataMatrix_ext_fv_temp(DataMatrix * dm, int index, float * weight, float * temp)
 {
  int i;
  char * base = PyArray_DATA(dm->array);
+ 
+ // Fast path for the simple case - a row of floats to copy...
+  if (dm->simple!=0)
+  {
+   const float * row = (const float*)(base + PyArray_STRIDES(dm->array)[0] * (npy_intp)index);
+   
+   if (dm->weight_index<0)
+   {
+    memcpy(temp, row, dm->feats * sizeof(float));
+    if (weight!=NULL) *weight = dm->weight_scale;
+   }
+   else
+   {
+    memcpy(temp, row, dm->weight_index * sizeof(float));
+    memcpy(temp + dm->weight_index, row + dm->weight_index + 1, (dm->feats - dm->weight_index) * sizeof(float));
+    if (weight!=NULL) *weight = dm->weight_scale * row[dm->weight_index];
+   }
+   
+   return temp;
+  }
+  
  int next_dual_feat = dm->dual_feats-1;
    
  if (weight!=NULL) *weight = dm->weight_scale;
@@ -348,7 +785,7 @@ float * DataMatrix_ext_fv(DataMatrix * dm, int index, float * weight)
     }
     else
     {
-     dm->fv[next_dual_feat] = step;
+     temp[next_dual_feat] = step;
     }
     next_dual_feat -= 1;
    }
@@ -365,7 +802,7 @@ float * DataMatrix_ext_fv(DataMatrix * dm, int index, float * weight)
   {
    for (i=dm->weight_index; i<dm->dual_feats-1; i++)
    {
-    dm->fv[i] = dm->fv[i+1];
+    temp[i] = temp[i+1];
    }
   }
  
@@ -396,7 +833,7 @@ float * DataMatrix_ext_fv(DataMatrix * dm, int index, float * weight)
    // Translate the various possibilities - the use of a function pointer makes this relativly efficient...
     if (i!=(dm->weight_index-dm->dual_feats))
     {
-     dm->fv[oi] = dm->to_float(pos);
+     temp[oi] = dm->to_float(pos);
      oi += 1;
     }
     else
@@ -405,12 +842,30 @@ float * DataMatrix_ext_fv(DataMatrix * dm, int index, float * weight)
     }
   }
 
- // Return the internal storage we have written the information into...
-  return dm->fv;
+ // Return the storage we have written the information into...
+  return temp;
 }
 
 
 
+void DataMatrix_prepare_draw(DataMatrix * dm)
+{
+ if ((dm->weight_index<0)||(dm->weight_cum!=NULL)) return;
+ 
+ dm->weight_cum = (float*)malloc(dm->exemplars * sizeof(float));
+ 
+ float sum = 0.0;
+ int i;
+ for (i=0; i<dm->exemplars; i++)
+ {
+  float weight;
+  DataMatrix_fv(dm, i, &weight); // Inefficient - could write code to get just the weight out, but its as painful as the called function. May do later.
+  sum += weight;
+  dm->weight_cum[i] = sum;
+ }
+}
+
+
 int DataMatrix_draw(DataMatrix * dm, PhiloxRNG * rng)
 {
  // Two scenarios - all samples have the same weight, or they don't, resulting in different approaches...
@@ -425,20 +880,7 @@ int DataMatrix_draw(DataMatrix * dm, PhiloxRNG * rng)
   else // Samples have variable weights
   {
    // Build the array of cumulative weights if it has not already been cached...
-    if (dm->weight_cum==NULL)
-    {
-     dm->weight_cum = (float*)malloc(dm->exemplars * sizeof(float));
-     
-     float sum = 0.0;
-     int i;
-     for (i=0; i<dm->exemplars; i++)
-     {
-      float weight;
-      DataMatrix_fv(dm, i, &weight); // Inefficient - could write code to get just the weight out, but its as painful as the called function. May do later.
-      sum += weight;
-      dm->weight_cum[i] = sum;
-     }
-    }
+    DataMatrix_prepare_draw(dm);
     
    // Uniform draw multiplied by the total weight, as given by weight_cum...
     float pos = dm->weight_cum[dm->exemplars-1] * PhiloxRNG_uniform(rng);
@@ -519,6 +961,32 @@ float * DataMatrix_to_ext(DataMatrix * dm, float * internal, float * external)
 }
 
 
+void DataMatrix_to_int_block(DataMatrix * dm, int count, const float * external, int ext_stride, float * internal, int int_stride)
+{
+ int i, j;
+ 
+ // Conversion, or a copy if there is none...
+  if (dm->fv_conv==NULL)
+  {
+   for (j=0; j<count; j++) memcpy(internal + j*int_stride, external + j*ext_stride, dm->feats * sizeof(float));
+  }
+  else
+  {
+   for (i=0; i<dm->ops_conv; i++)
+   {
+    Convert_to_int_block(dm->conv[i].conv, count, external + dm->conv[i].offset_external, ext_stride, internal + dm->conv[i].offset_internal, int_stride);
+   }
+  }
+  
+ // Scale...
+  for (j=0; j<count; j++)
+  {
+   float * fv = internal + j*int_stride;
+   for (i=0; i<dm->feats_conv; i++) fv[i] *= dm->mult[i];
+  }
+}
+
+
 size_t DataMatrix_byte_size(DataMatrix * dm)
 {
  size_t mem = sizeof(DataMatrix);
@@ -530,6 +998,9 @@ size_t DataMatrix_byte_size(DataMatrix * dm)
  if (dm->feat_indices!=NULL) mem += dm->feat_dims * sizeof(int);
  if (dm->fv_conv!=NULL) mem += dm->feats_conv * sizeof(float);
  if (dm->conv!=NULL) mem += dm->ops_conv * sizeof(ConvertOp);
+ if (dm->cache!=NULL) mem += dm->cache_bytes + (dm->exemplars + DATA_MATRIX_BLOCK - 1) / DATA_MATRIX_BLOCK;
+ if (dm->converted!=NULL) mem += (size_t)dm->exemplars * (dm->feats_conv + 1) * sizeof(float);
+ if (dm->store!=NULL) mem += (dm->capacity - dm->exemplars) * PyArray_STRIDES(dm->store)[0]; // Just the spare capacity - the rest is counted as the array.
 
  return mem;  
 }
@@ -93,10 +93,30 @@ struct DataMatrix
   
   int ops_conv; // Number of below - conversion is to loop and apply each in turn.
   ConvertOp * conv;
+  
+ // Non-zero if the array is a simple 2D float32 matrix, [exemplar, feature], with contiguous rows - feature vectors are then copied out directly rather than going through to_float for every element...
+  int simple;
+  
+ // Optional cache of every feature vector in the internal format (converted and scaled), followed by its weight, so [exemplar, feats_conv+1]. Filled in lazily, in blocks of DATA_MATRIX_BLOCK rows, with ready indicating which blocks are valid. Lives in a memory map, optionally of a file, so it can be larger than ram and be paged out. NULL if not in use...
+  float * cache;
+  char * cache_ready;
+  size_t cache_bytes;
+  
+ // Optional copy of every feature vector after conversion, but before scaling, followed by its weight without weight_scale, so [exemplar, feats_conv+1]. Filled in all at once, with the block convertors, so the conversion (typically trigonometry) is done once rather than every time an exemplar is fetched. As it is unscaled it survives changes to the scale, and append/remove keep it up to date. NULL if not in use; never used if there is no conversion...
+  float * converted;
+  
+ // Once the data matrix has been edited (Exemplars added or removed) it stops using the array it was given and switches to a copy it owns, with spare capacity for adding more; array is then a view of the first exemplars rows of store. NULL if not edited...
+  PyArrayObject * store;
+  int capacity;
 };
 
 
 
+// Number of rows in each block of the cache...
+#define DATA_MATRIX_BLOCK 1024
+
+
+
 // For initialising the pointers within the data matrix object, and deinitialising them when done...
 void DataMatrix_init(DataMatrix * dm);
 void DataMatrix_deinit(DataMatrix * dm);
@@ -115,6 +135,33 @@ int DataMatrix_ext_features(DataMatrix * dm); // External feature count, before
 // Allows you to set the multipliers for the features - the scale array passed in better have the right length, as returned by the feats method. You should also provide a weight_scale...
 void DataMatrix_set_scale(DataMatrix * dm, float * scale, float weight_scale);
 
+// If you edit mult or weight_scale directly, rather than via the above, you must call this afterwards so the cache (if any) is invalidated...
+void DataMatrix_scale_changed(DataMatrix * dm);
+
+
+// Turns on the cache of scaled feature vectors - makes fetching feature vectors much faster, at the cost of storing a copy of the data. If fn is NULL it goes in anonymous memory; otherwise the given file is created/truncated and used as backing storage, so it can be larger than ram (The file is left behind, for the caller to delete). Returns non-zero on success, zero on failure, in which case the cache is off. Must be called after DataMatrix_set, as that turns the cache off...
+int DataMatrix_cache(DataMatrix * dm, const char * fn);
+
+// Turns the cache off, releasing its memory...
+void DataMatrix_cache_off(DataMatrix * dm);
+
+
+// Converts every exemplar into the internal format, storing the result (before scaling) so conversion never has to be done again. Does nothing and returns zero if the data matrix has no conversion, otherwise returns non-zero. Must be called after DataMatrix_set, as that turns it off...
+int DataMatrix_convert_all(DataMatrix * dm);
+
+// Turns the above off, releasing its memory...
+void DataMatrix_convert_off(DataMatrix * dm);
+
+
+// Returns non-zero if the data matrix can be edited with the below, which requires a 2D array indexed [exemplar, feature] - i.e. set with the dimension types 'df'...
+int DataMatrix_editable(DataMatrix * dm);
+
+// Adds count exemplars to the end of the data matrix, given as rows of the external feature vector (including the weight, if there is a weight index) in the same type as the array the data matrix was set with, packed together. The first time the data matrix is edited it copies the array it was set with, so the callers array is never modified. Keeps weight_cum valid, but turns the cache off...
+void DataMatrix_append(DataMatrix * dm, const void * rows, int count);
+
+// Removes the exemplar with the given index, by moving the last exemplar into its slot - so removing changes the index of the last exemplar, unless it is the one being removed. Keeps weight_cum valid, but turns the cache off...
+void DataMatrix_remove(DataMatrix * dm, int index);
+
 
 // Fetches a feature vector, using a single index to do row-major indexing into all dimensions marked as data or dual. Note that the returned pointer is to internal storage, that is replaced every time this method is called. The dual dimensions will always be first, followed by all the feature dimensions in row major flattened order. If you want the weight as well provide a pointer and it will be filled...
 float * DataMatrix_fv(DataMatrix * dm, int index, float * weight);
@@ -122,9 +169,19 @@ float * DataMatrix_fv(DataMatrix * dm, int index, float * weight);
 // As above, but in the external format, without conversion or scaling...
 float * DataMatrix_ext_fv(DataMatrix * dm, int index, float * weight);
 
+// Thread safe versions of the above two - instead of using internal storage they write into the provided temp, which must be at least DataMatrix_temp_size floats long. The returned pointer will be somewhere within temp...
+float * DataMatrix_fv_temp(DataMatrix * dm, int index, float * weight, float * temp);
+float * DataMatrix_ext_fv_temp(DataMatrix * dm, int index, float * weight, float * temp);
+
+// Returns how many floats long the temp passed to the above must be...
+int DataMatrix_temp_size(DataMatrix * dm);
+
 // Draws the index of a random exemplar from the datamatrix, using the philox random number generator (If exemplars are weighted it will be a weighted draw)...
 int DataMatrix_draw(DataMatrix * dm, PhiloxRNG * rng);
 
+// The above builds weight_cum the first time it is called, which is not thread safe - call this first if you are going to call it from several threads at once...
+void DataMatrix_prepare_draw(DataMatrix * dm);
+
 
 // Converts an external vector to an internal vector, noting that if no conversion happens it just returns the pointer to the provided external array rather than copying the data across (in the no-conversion case its safe for internal to be NULL!) This means conversion and multiplication by scale. Effectivly destructive to external...
 float * DataMatrix_to_int(DataMatrix * dm, float * external, float * internal);
@@ -132,6 +189,9 @@ float * DataMatrix_to_int(DataMatrix * dm, float * external, float * internal);
 // As above, other direction...
 float * DataMatrix_to_ext(DataMatrix * dm, float * internal, float * external);
 
+// Converts count external vectors to internal vectors at once, using the block convertors, including the scaling - vector j is read from external + j*ext_stride and written to internal + j*int_stride. Unlike DataMatrix_to_int it always writes to internal and does not modify external...
+void DataMatrix_to_int_block(DataMatrix * dm, int count, const float * external, int ext_stride, float * internal, int int_stride);
+
 
 // Returns how many bytes are consumed by the DataMatrix object, excluding the numpy array it points at...
 size_t DataMatrix_byte_size(DataMatrix * dm);
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <float.h>
 
 #include "philox.h"
 #include "bessel.h"
@@ -47,6 +48,11 @@ size_t Kernel_byte_size(int dims, KernelConfig config, int * ref_count)
  return 0; 
 }
 
+float Kernel_error(int dims, KernelConfig config)
+{
+ return 0.0;
+}
+
 
 
 // Most kernels have the same to offset method, as provided by this implimentation...
@@ -84,6 +90,197 @@ void Kernel_next(int dims, KernelConfig config, int state, float * fv)
 
 
 
+// Support for the batch weight methods - they are written so the compiler can vectorise their loops, and where supported are compiled for several instruction sets, with the best for the cpu selected when the module is loaded...
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define KERNEL_SIMD __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define KERNEL_SIMD
+#endif
+
+// Most kernels are a function of the squared distance from the centre only - this calculates it for a block of offsets, into out...
+KERNEL_SIMD void Kernel_dist_sqr(int dims, int count, const float * offset, int stride, float * out)
+{
+ int i, j;
+ for (j=0; j<count; j++) out[j] = 0.0;
+ 
+ for (i=0; i<dims; i++)
+ {
+  const float * row = offset + i*stride;
+  for (j=0; j<count; j++) out[j] += row[j] * row[j];
+ }
+}
+
+void kernel_weights(const Kernel * kernel, int dims, KernelConfig config, int count, const float * offset, int stride, float * out, float * temp)
+{
+ if (kernel->weights!=NULL)
+ {
+  kernel->weights(dims, config, count, offset, stride, out);
+ }
+ else
+ {
+  int i, j;
+  for (j=0; j<count; j++)
+  {
+   for (i=0; i<dims; i++) temp[i] = offset[i*stride + j];
+   out[j] = kernel->weight(dims, config, temp);
+  }
+ }
+}
+
+
+
+// Support for kernels that are a function of distance from the centre only, and can optionally replace that function with a lookup table that is linearly interpolated - the table is the kernels configuration, NULL if not in use...
+typedef float (*KernelTableFunc)(float x);
+
+#define KERNEL_TABLE_MARGIN 1.25 // Multiplier of the measured error of a table, to get the reported bound.
+
+typedef struct KernelTable KernelTable;
+
+struct KernelTable
+{
+ int ref_count;
+ KernelTableFunc func; // Function being tabulated, used beyond the end of the table.
+ int root; // 0 if the table is indexed by squared distance, 1 if by distance (for functions that are not smooth in squared distance at the centre).
+ float limit; // Table covers [0, limit].
+ float mult; // (size-1) / limit.
+ float error; // Maximum absolute error, as a fraction of the value at 0.
+ int size;
+ float table[0];
+};
+
+
+
+// Parses an optional table specification at the start of config - either "table" or "table=<size>". Returns how many characters it consumed, 0 if there was no specification or -1 if it was malformed or the size is outside [2, KERNEL_TABLE_MAX]. size is set to the table size, or the default if there is no specification...
+int KernelTable_parse(const char * config, int * size)
+{
+ *size = KERNEL_TABLE_SIZE;
+ if (strncmp(config, "table", 5)!=0) return 0;
+ 
+ const char * end = config + 5;
+ if (*end=='=')
+ {
+  char * num_end;
+  long val = strtol(end+1, &num_end, 0);
+  if ((num_end==end+1)||(val<2)||(val>KERNEL_TABLE_MAX)) return -1;
+  
+  *size = val;
+  end = num_end;
+ }
+ 
+ return end - config;
+}
+
+// Verification for kernels that use the table - no configuration, or (table) or (table=<size>)...
+const char * KernelTable_config_verify(int dims, const char * config, int * length)
+{
+ if (config[0]!='(')
+ {
+  if (length!=NULL) *length = 0;
+  return NULL;
+ }
+ 
+ int size;
+ int used = KernelTable_parse(config+1, &size);
+ if (used<=0) return "kernel configuration should be (table) or (table=<size>), where size is at least 2 and at most 16777216.";
+ if (config[1+used]!=')') return "kernel configuration did not end with a ).";
+ 
+ if (length!=NULL) *length = used + 2;
+ return NULL;
+}
+
+// Creates the table, or returns NULL if the configuration does not ask for one...
+KernelConfig KernelTable_new(const char * config, KernelTableFunc func, float limit, int root)
+{
+ if (config[0]!='(') return NULL;
+ 
+ int size;
+ KernelTable_parse(config+1, &size);
+ 
+ KernelTable * ret = (KernelTable*)malloc(sizeof(KernelTable) + size * sizeof(float));
+ ret->ref_count = 1;
+ ret->func = func;
+ ret->root = root;
+ ret->limit = limit;
+ ret->mult = (size-1) / limit;
+ ret->size = size;
+ 
+ int i, j;
+ for (i=0; i<size; i++) ret->table[i] = func(i / ret->mult);
+ 
+ // Measure the error by sampling within each cell, which for smooth functions is close to the maximum - add a safety margin plus float rounding so it can be treated as a bound...
+  float peak = fabs(ret->table[0]);
+  ret->error = 0.0;
+  for (i=0; i<size-1; i++)
+  {
+   for (j=1; j<8; j++)
+   {
+    float t = 0.125 * j;
+    float approx = (1.0-t) * ret->table[i] + t * ret->table[i+1];
+    float err = fabs(approx - func((i+t) / ret->mult));
+    if (err>ret->error) ret->error = err;
+   }
+  }
+  if (peak>0.0) ret->error /= peak;
+  ret->error = KERNEL_TABLE_MARGIN * ret->error + FLT_EPSILON;
+ 
+ return (KernelConfig)ret;
+}
+
+void KernelTable_config_acquire(KernelConfig config)
+{
+ KernelTable * self = (KernelTable*)config;
+ if (self!=NULL) self->ref_count += 1;
+}
+
+void KernelTable_config_release(KernelConfig config)
+{
+ KernelTable * self = (KernelTable*)config;
+ if (self!=NULL)
+ {
+  self->ref_count -= 1;
+  if (self->ref_count==0) free(self);
+ }
+}
+
+size_t KernelTable_byte_size(int dims, KernelConfig config, int * ref_count)
+{
+ KernelTable * self = (KernelTable*)config;
+ if (self==NULL) return Kernel_byte_size(dims, config, ref_count);
+ 
+ if (ref_count!=NULL) *ref_count = self->ref_count;
+ return sizeof(KernelTable) + self->size * sizeof(float);
+}
+
+float KernelTable_error(int dims, KernelConfig config)
+{
+ KernelTable * self = (KernelTable*)config;
+ return (self!=NULL) ? self->error : 0.0;
+}
+
+// Returns the tabulated value for the given squared distance...
+float KernelTable_lookup(KernelTable * self, float dist_sqr)
+{
+ float x = self->root ? sqrt(dist_sqr) : dist_sqr;
+ if (x>=self->limit) return self->func(x);
+ 
+ float pos = x * self->mult;
+ int i = (int)pos;
+ float t = pos - i;
+ return (1.0-t) * self->table[i] + t * self->table[i+1];
+}
+
+// Batch version of the above, replacing each squared distance in data with its tabulated value...
+KERNEL_SIMD void KernelTable_lookups(KernelTable * self, int count, float * data)
+{
+ int j;
+ for (j=0; j<count; j++)
+ {
+  data[j] = KernelTable_lookup(self, data[j]);
+ }
+}
+
+
+
 // The discrete kernel type...
 float Discrete_weight(int dims, KernelConfig config, float * offset)
 {
@@ -95,6 +292,21 @@ float Discrete_weight(int dims, KernelConfig config, float * offset)
  return 1.0;
 }
 
+KERNEL_SIMD void Discrete_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ int i, j;
+ for (j=0; j<count; j++) out[j] = 1.0;
+ 
+ for (i=0; i<dims; i++)
+ {
+  const float * row = offset + i*stride;
+  for (j=0; j<count; j++)
+  {
+   if ((row[j]<=-0.5)||(row[j]>0.5)) out[j] = 0.0;
+  }
+ }
+}
+
 float Discrete_norm(int dims, KernelConfig config)
 {
  return 1.0; // The values have already been normalised.
@@ -150,6 +362,7 @@ const Kernel Discrete =
  Kernel_config_acquire,
  Kernel_config_release,
  Discrete_weight,
+ Discrete_weights,
  Discrete_norm,
  Discrete_range,
  Kernel_to_offset,
@@ -160,6 +373,7 @@ const Kernel Discrete =
  Kernel_states,
  Kernel_next,
  Kernel_byte_size,
+ Kernel_error,
 };
 
 
@@ -179,6 +393,17 @@ float Uniform_weight(int dims, KernelConfig config, float * offset)
  return 1.0;
 }
 
+KERNEL_SIMD void Uniform_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ Kernel_dist_sqr(dims, count, offset, stride, out);
+ 
+ int j;
+ for (j=0; j<count; j++)
+ {
+  out[j] = (out[j]>1.0) ? 0.0 : 1.0;
+ }
+}
+
 float Uniform_norm(int dims, KernelConfig config)
 {
  if ((dims&1)==0)
@@ -286,6 +511,7 @@ const Kernel Uniform =
  Kernel_config_acquire,
  Kernel_config_release,
  Uniform_weight,
+ Uniform_weights,
  Uniform_norm,
  Uniform_range,
  Kernel_to_offset,
@@ -296,6 +522,7 @@ const Kernel Uniform =
  Kernel_states,
  Kernel_next,
  Kernel_byte_size,
+ Kernel_error,
 };
 
 
@@ -315,6 +542,17 @@ float Triangular_weight(int dims, KernelConfig config, float * offset)
  return 1.0 - sqrt(dist_sqr);
 }
 
+KERNEL_SIMD void Triangular_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ Kernel_dist_sqr(dims, count, offset, stride, out);
+ 
+ int j;
+ for (j=0; j<count; j++)
+ {
+  out[j] = (out[j]>1.0) ? 0.0 : (1.0 - sqrt(out[j]));
+ }
+}
+
 float Triangular_norm(int dims, KernelConfig config)
 {
  return (dims + 1.0) * Uniform_norm(dims, NULL);
@@ -395,6 +633,7 @@ const Kernel Triangular =
  Kernel_config_acquire,
  Kernel_config_release,
  Triangular_weight,
+ Triangular_weights,
  Triangular_norm,
  Triangular_range,
  Kernel_to_offset,
@@ -405,6 +644,7 @@ const Kernel Triangular =
  Kernel_states,
  Kernel_next,
  Kernel_byte_size,
+ Kernel_error,
 };
 
 
@@ -424,6 +664,17 @@ float Epanechnikov_weight(int dims, KernelConfig config, float * offset)
  return 1.0 - dist_sqr;
 }
 
+KERNEL_SIMD void Epanechnikov_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ Kernel_dist_sqr(dims, count, offset, stride, out);
+ 
+ int j;
+ for (j=0; j<count; j++)
+ {
+  out[j] = (out[j]>1.0) ? 0.0 : (1.0 - out[j]);
+ }
+}
+
 float Epanechnikov_norm(int dims, KernelConfig config)
 {
  return 0.5 * (dims + 2.0) * Uniform_norm(dims, NULL);
@@ -505,6 +756,7 @@ const Kernel Epanechnikov =
  Kernel_config_acquire,
  Kernel_config_release,
  Epanechnikov_weight,
+ Epanechnikov_weights,
  Epanechnikov_norm,
  Epanechnikov_range,
  Kernel_to_offset,
@@ -515,11 +767,22 @@ const Kernel Epanechnikov =
  Kernel_states,
  Kernel_next,
  Kernel_byte_size,
+ Kernel_error,
 };
 
 
 
 // The cosine kernel type...
+float Cosine_func(float dist_sqr)
+{
+ return (dist_sqr>1.0) ? 0.0 : cos(0.5 * M_PI * sqrt(dist_sqr));
+}
+
+KernelConfig Cosine_config_new(int dims, const char * config)
+{
+ return KernelTable_new(config, Cosine_func, 1.0, 0);
+}
+
 float Cosine_weight(int dims, KernelConfig config, float * offset)
 {
  float dist_sqr = 0.0;
@@ -531,9 +794,27 @@ float Cosine_weight(int dims, KernelConfig config, float * offset)
   if (dist_sqr>1.0) return 0.0;
  }
  
+ if (config!=NULL) return KernelTable_lookup((KernelTable*)config, dist_sqr);
  return cos(0.5 * M_PI * sqrt(dist_sqr));
 }
 
+KERNEL_SIMD void Cosine_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ Kernel_dist_sqr(dims, count, offset, stride, out);
+ 
+ if (config!=NULL)
+ {
+  KernelTable_lookups((KernelTable*)config, count, out);
+  return;
+ }
+ 
+ int j;
+ for (j=0; j<count; j++)
+ {
+  out[j] = (out[j]>1.0) ? 0.0 : cos(0.5 * M_PI * sqrt(out[j]));
+ }
+}
+
 float Cosine_norm(int dims, KernelConfig config)
 {
  float mult = Uniform_norm(dims, NULL) / dims;
@@ -634,12 +915,13 @@ const Kernel Cosine =
 {
  "cosine",
  "Kernel based on the cosine function, such that it hits zero at the edge of the unit hyper-sphere. Probably the smoothest of the kernels that have a hard edge beyond which they are zero; expensive to compute however.",
- NULL,
- Kernel_config_new,
- Kernel_config_verify,
- Kernel_config_acquire,
- Kernel_config_release,
+ "Optionally configured as cosine(table) to replace the cosine with a linearly interpolated lookup table over squared distance, or cosine(table=<size>) to choose the table size, which defaults to 1024. The get_error method reports the resulting error.",
+ Cosine_config_new,
+ KernelTable_config_verify,
+ KernelTable_config_acquire,
+ KernelTable_config_release,
  Cosine_weight,
+ Cosine_weights,
  Cosine_norm,
  Cosine_range,
  Kernel_to_offset,
@@ -649,7 +931,8 @@ const Kernel Cosine =
  Cosine_mult_draw,
  Kernel_states,
  Kernel_next,
- Kernel_byte_size,
+ KernelTable_byte_size,
+ KernelTable_error,
 };
 
 
@@ -668,6 +951,17 @@ float Gaussian_weight(int dims, KernelConfig config, float * offset)
  return exp(-0.5 * dist_sqr);
 }
 
+KERNEL_SIMD void Gaussian_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ Kernel_dist_sqr(dims, count, offset, stride, out);
+ 
+ int j;
+ for (j=0; j<count; j++)
+ {
+  out[j] = exp(-0.5 * out[j]);
+ }
+}
+
 float Gaussian_norm(int dims, KernelConfig config)
 {
  return pow(2.0 * M_PI, -0.5*dims);
@@ -716,6 +1010,7 @@ const Kernel Gaussian =
  Kernel_config_acquire,
  Kernel_config_release,
  Gaussian_weight,
+ Gaussian_weights,
  Gaussian_norm,
  Gaussian_range,
  Kernel_to_offset,
@@ -726,11 +1021,22 @@ const Kernel Gaussian =
  Kernel_states,
  Kernel_next,
  Kernel_byte_size,
+ Kernel_error,
 };
 
 
 
 // The Cauchy kernel type...
+float Cauchy_func(float dist_sqr)
+{
+ return 1.0 / (1.0 + dist_sqr);
+}
+
+KernelConfig Cauchy_config_new(int dims, const char * config)
+{
+ return KernelTable_new(config, Cauchy_func, 36.0, 0); // Covers the range of high quality.
+}
+
 float Cauchy_weight(int dims, KernelConfig config, float * offset)
 {
  float dist_sqr = 0.0;
@@ -741,9 +1047,27 @@ float Cauchy_weight(int dims, KernelConfig config, float * offset)
   dist_sqr += offset[i] * offset[i];
  }
  
+ if (config!=NULL) return KernelTable_lookup((KernelTable*)config, dist_sqr);
  return 1.0 / (1.0 + dist_sqr);
 }
 
+KERNEL_SIMD void Cauchy_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ Kernel_dist_sqr(dims, count, offset, stride, out);
+ 
+ if (config!=NULL)
+ {
+  KernelTable_lookups((KernelTable*)config, count, out);
+  return;
+ }
+ 
+ int j;
+ for (j=0; j<count; j++)
+ {
+  out[j] = 1.0 / (1.0 + out[j]);
+ }
+}
+
 float Cauchy_norm(int dims, KernelConfig config)
 {
  float ret = 0.0;
@@ -830,12 +1154,13 @@ const Kernel Cauchy =
 {
  "cauchy",
  "Uses the Cauchy distribution pdf on distance from the origin in the hypersphere. A fatter distribution than the Gaussian due to its long tails. Requires very large ranges, making is quite expensive in practise, but its good at avoiding being overconfident.",
- NULL,
- Kernel_config_new,
- Kernel_config_verify,
- Kernel_config_acquire,
- Kernel_config_release,
+ "Optionally configured as cauchy(table) to use a linearly interpolated lookup table over squared distance, or cauchy(table=<size>) to choose the table size, which defaults to 1024. The table covers the high quality range, and the exact function is used beyond it. Note that the Cauchy weight is cheap to compute anyway, so the table rarely helps. The get_error method reports the resulting error.",
+ Cauchy_config_new,
+ KernelTable_config_verify,
+ KernelTable_config_acquire,
+ KernelTable_config_release,
  Cauchy_weight,
+ Cauchy_weights,
  Cauchy_norm,
  Cauchy_range,
  Kernel_to_offset,
@@ -845,12 +1170,24 @@ const Kernel Cauchy =
  Cauchy_mult_draw,
  Kernel_states,
  Kernel_next,
- Kernel_byte_size,
+ KernelTable_byte_size,
+ KernelTable_error,
 };
 
 
 
 // The logistic kernel...
+float Logistic_func(float dist)
+{
+ float exp_dist = exp(-dist);
+ return exp_dist / ((1.0 + exp_dist) * (1.0 + exp_dist));
+}
+
+KernelConfig Logistic_config_new(int dims, const char * config)
+{
+ return KernelTable_new(config, Logistic_func, 10.0, 1); // Indexed by distance as its not smooth in squared distance at the centre; covers the range of high quality.
+}
+
 float Logistic_weight(int dims, KernelConfig config, float * offset)
 {
  float dist_sqr = 0.0;
@@ -861,11 +1198,31 @@ float Logistic_weight(int dims, KernelConfig config, float * offset)
   dist_sqr += offset[i] * offset[i];
  }
  
+ if (config!=NULL) return KernelTable_lookup((KernelTable*)config, dist_sqr);
+ 
  float exp_dist = exp(-sqrt(dist_sqr));
  
  return exp_dist / ((1.0 + exp_dist) * (1.0 + exp_dist));
 }
 
+KERNEL_SIMD void Logistic_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ Kernel_dist_sqr(dims, count, offset, stride, out);
+ 
+ if (config!=NULL)
+ {
+  KernelTable_lookups((KernelTable*)config, count, out);
+  return;
+ }
+ 
+ int j;
+ for (j=0; j<count; j++)
+ {
+  float exp_dist = exp(-sqrt(out[j]));
+  out[j] = exp_dist / ((1.0 + exp_dist) * (1.0 + exp_dist));
+ }
+}
+
 float Logistic_norm(int dims, KernelConfig config)
 {
  float ret = 0.0;
@@ -952,12 +1309,13 @@ const Kernel Logistic =
 {
  "logistic",
  "Uses the Logistic distribution pdf on distance from the origin in the hypersphere. An alternative to the Cauchy, and even more computationally intensive. To understand which bell distribution to choose (Gaussian, Cauchy or Logistic) consider the behaviour of multiplying two distributions when only the tails overlap. If that doesn't matter then you might as well go Gaussian, as its computationally cheaper.",
- NULL,
- Kernel_config_new,
- Kernel_config_verify,
- Kernel_config_acquire,
- Kernel_config_release,
+ "Optionally configured as logistic(table) to replace the exponential with a linearly interpolated lookup table over distance, or logistic(table=<size>) to choose the table size, which defaults to 1024. The table covers the high quality range, and the exact function is used beyond it. The get_error method reports the resulting error.",
+ Logistic_config_new,
+ KernelTable_config_verify,
+ KernelTable_config_acquire,
+ KernelTable_config_release,
  Logistic_weight,
+ Logistic_weights,
  Logistic_norm,
  Logistic_range,
  Kernel_to_offset,
@@ -967,12 +1325,32 @@ const Kernel Logistic =
  Logistic_mult_draw,
  Kernel_states,
  Kernel_next,
- Kernel_byte_size,
+ KernelTable_byte_size,
+ KernelTable_error,
 };
 
 
 
 // The von-Mises Fisher kernel...
+float Fisher_func(FisherConfig * self, float cos_ang, int approximate)
+{
+ if (approximate) return exp(-0.5 * self->alpha * (1.0 - cos_ang*cos_ang) + self->log_norm); // Without the zeroing of the far side, as the mirrored version uses it.
+ else return exp(self->alpha * cos_ang + self->log_norm);
+}
+
+float Fisher_lookup(FisherConfig * self, float cos_ang)
+{
+ float pos = (cos_ang + 1.0) * 0.5 * (self->table_size-1);
+ if (pos<0.0) pos = 0.0;
+ 
+ int i = (int)pos;
+ if (i>self->table_size-2) i = self->table_size - 2;
+ float t = pos - i;
+ if (t>1.0) t = 1.0;
+ 
+ return (1.0-t) * self->table[i] + t * self->table[i+1];
+}
+
 KernelConfig Fisher_config_new(int dims, const char * config)
 {
  FisherConfig * ret = (FisherConfig*)malloc(sizeof(FisherConfig));
@@ -1084,6 +1462,40 @@ KernelConfig Fisher_config_new(int dims, const char * config)
     free(culm);
   }
   
+ // If requested create a lookup table over the dot product, for the weight, noting that the approximation is even so the table holds the mirrored branch as well...
+  ret->table_size = 0;
+  ret->table = NULL;
+  ret->table_error = 0.0;
+  
+  if (end!=NULL)
+  {
+   if ((*end=='a')||(*end=='c')) ++end;
+   if (*end==',')
+   {
+    KernelTable_parse(end+1, &ret->table_size);
+    ret->table = (float*)malloc(ret->table_size * sizeof(float));
+    
+    float step = 2.0 / (ret->table_size-1);
+    for (i=0; i<ret->table_size; i++)
+    {
+     ret->table[i] = Fisher_func(ret, -1.0 + i*step, approximate);
+    }
+    
+    int j;
+    for (i=0; i<ret->table_size-1; i++)
+    {
+     for (j=1; j<8; j++)
+     {
+      float t = 0.125 * j;
+      float approx = (1.0-t) * ret->table[i] + t * ret->table[i+1];
+      float err = fabs(approx - Fisher_func(ret, -1.0 + (i+t)*step, approximate));
+      if (err>ret->table_error) ret->table_error = err;
+     }
+    }
+    ret->table_error = KERNEL_TABLE_MARGIN * ret->table_error + FLT_EPSILON * ret->table[ret->table_size-1];
+   }
+  }
+  
  // Create the order array, for use when drawing...
   ret->order = (int*)malloc(dims*sizeof(int));
   for (i=0; i<dims; i++)
@@ -1112,6 +1524,14 @@ const char * Fisher_config_verify(int dims, const char * config, int * length)
   ++end; // Skip a mode forcer.
  }
  
+ if ((end!=NULL)&&(*end==','))
+ {
+  int size;
+  int used = KernelTable_parse(end+1, &size);
+  if (used<=0) return "von-Mises Fisher configuration can only have table or table=<size>, where size is at least 2 and at most 16777216, after the comma.";
+  end += 1 + used;
+ }
+ 
  if ((end==NULL)||(*end!=')')) return "von-Mises Fisher configuration did not end with a ).";
  
  if (length!=NULL)
@@ -1140,6 +1560,7 @@ void Fisher_config_release(KernelConfig config)
  if (self->ref_count==0)
  {
   free(self->order);
+  free(self->table);
   free(self->inv_culm);
   free(self);
  }
@@ -1164,6 +1585,7 @@ float Fisher_weight(int dims, KernelConfig config, float * offset)
    // Use the Gaussian approximation, by halucinating that it is a vector of the form [a, b, 0...] and the direction of the distribution is [1, 0...] - this allows all the terms of the Gaussian to be calculated and a probability generated...
     if (cos_ang>0.0)
     {
+     if (self->table!=NULL) return Fisher_lookup(self, cos_ang);
      return exp(-0.5 * self->alpha * (1.0 - cos_ang*cos_ang) + self->log_norm);
     }
     else
@@ -1174,10 +1596,44 @@ float Fisher_weight(int dims, KernelConfig config, float * offset)
   else
   {
    // Correct version...
+    if (self->table!=NULL) return Fisher_lookup(self, cos_ang);
     return exp(self->alpha * cos_ang + self->log_norm);
   }
 }
 
+KERNEL_SIMD void Fisher_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ FisherConfig * self = (FisherConfig*)config;
+ Kernel_dist_sqr(dims, count, offset, stride, out);
+ 
+ int j;
+ if (self->table!=NULL)
+ {
+  int approximate = self->inv_culm==NULL;
+  for (j=0; j<count; j++)
+  {
+   float cos_ang = 1.0 - 0.5*out[j];
+   out[j] = ((cos_ang>0.0)||(approximate==0)) ? Fisher_lookup(self, cos_ang) : 0.0;
+  }
+ }
+ else if (self->inv_culm==NULL)
+ {
+  for (j=0; j<count; j++)
+  {
+   float cos_ang = 1.0 - 0.5*out[j];
+   out[j] = (cos_ang>0.0) ? exp(-0.5 * self->alpha * (1.0 - cos_ang*cos_ang) + self->log_norm) : 0.0;
+  }
+ }
+ else
+ {
+  for (j=0; j<count; j++)
+  {
+   float cos_ang = 1.0 - 0.5*out[j];
+   out[j] = exp(self->alpha * cos_ang + self->log_norm);
+  }
+ }
+}
+
 float Fisher_norm(int dims, KernelConfig config)
 {
  return 1.0; // We return normalised values directly, for reasons of numerical stability.
@@ -1276,29 +1732,33 @@ void Fisher_draw(int dims, KernelConfig config, PhiloxRNG * rng, const float * c
     for (i=1; i<dims; i++) out[i] *= radius;
   }
   
- // Find the order of the indices, in self->order, such that center goes from highest absolute value to lowest - needed for numerical stability in the next bit. Use insertion sort as the indices count is typically very low, making quick sort a bad choice (Note that we start from the previous order, as draw is often called repeatedly for the same centre value - fast escape)...
+ // Find the order of the indices such that center goes from highest absolute value to lowest - needed for numerical stability in the next bit. Use insertion sort as the indices count is typically very low, making quick sort a bad choice. Sorted in a local copy of self->order, so draw can be called from several threads at once (mult does this)...
+  int order_local[FISHER_ORDER_LOCAL];
+  int * order = (dims<=FISHER_ORDER_LOCAL) ? order_local : (int*)malloc(dims * sizeof(int));
+  for (i=0; i<dims; i++) order[i] = self->order[i];
+  
   for (i=0;i<dims-1; i++)
   {
-   float abs_val_i = fabs(center[self->order[i]]);
+   float abs_val_i = fabs(center[order[i]]);
    int j;
    for (j=i+1; j<dims; j++)
    {
-    float abs_val = fabs(center[self->order[j]]); 
+    float abs_val = fabs(center[order[j]]); 
     if (abs_val>abs_val_i)
     {
-     int temp = self->order[i];
-     self->order[i] = self->order[j];
-     self->order[j] = temp;
+     int temp = order[i];
+     order[i] = order[j];
+     order[j] = temp;
      abs_val_i = abs_val; 
     }
    }
   }
   
  // Might need to swap the value of the first one...
-  if (self->order[0]!=0)
+  if ((dims>0)&&(order[0]!=0))
   {
-   float temp = out[self->order[0]];
-   out[self->order[0]] = out[0];
+   float temp = out[order[0]];
+   out[order[0]] = out[0];
    out[0] = temp;
   }
   
@@ -1307,8 +1767,8 @@ void Fisher_draw(int dims, KernelConfig config, PhiloxRNG * rng, const float * c
   for (i=0; i<dims-1; i++)
   {
    // The positions we are working with - for numerical stability...
-   int pos = self->order[i];
-   int npos = self->order[i+1];
+   int pos = order[i];
+   int npos = order[i+1];
    
    // Calculate the rotation matrix that leaves tail at the value in the center vector...
     float cos_theta = center[pos] / tail;
@@ -1335,10 +1795,12 @@ void Fisher_draw(int dims, KernelConfig config, PhiloxRNG * rng, const float * c
     out[npos] = sin_theta * oi + cos_theta * oi1;
   }
   
-  if ((tail * center[self->order[dims-1]]) < 0.0)
+  if ((tail * center[order[dims-1]]) < 0.0)
   {
-   out[self->order[dims-1]] *= -1.0;
+   out[order[dims-1]] *= -1.0;
   }
+  
+  if (order!=order_local) free(order);
 }
 
 
@@ -1354,12 +1816,21 @@ void Fisher_mult_draw(int dims, KernelConfig * config, int terms, const float **
 }
 
 
+float Fisher_error(int dims, KernelConfig config)
+{
+ FisherConfig * self = (FisherConfig*)config;
+ if (self->table==NULL) return 0.0;
+ 
+ return self->table_error / self->table[self->table_size-1];
+}
+
 size_t Fisher_byte_size(int dims, KernelConfig config, int * ref_count)
 {
  FisherConfig * self = (FisherConfig*)config;
  
  size_t mem = sizeof(FisherConfig);
  mem += self->inv_culm_size * sizeof(float);
+ mem += self->table_size * sizeof(float);
  mem += dims * sizeof(int);
  
  if (ref_count!=NULL) *ref_count = self->ref_count;
@@ -1372,12 +1843,13 @@ const Kernel Fisher =
 {
  "fisher",
  "A kernel for dealing with directional data, using the von-Mises Fisher distribution as a kernel (Fisher is technically 3 dimensions only, but I like short names! - this will do anything from 2 dimensions upwards. Dimensions is the embeding space, as in the length of the unit vector, to match the rest of the system - the degrees of freedom is one less.). Requires that all feature vectors be on the unit-hypersphere (does not check this - gigo), plus it uses the alpha parameter provided to the kernel as the concentration parameter of the distribution. Be careful with the merge_range parameter when using this kernel - unlike the other kernels it won't default to anything sensible, and will have to be manually set.",
- "Specified as fisher(alpha), e.g. fisher(10), where alpha is the concentration parameter. Can optionally include a letter immediatly after the alpha value - either 'a' to force approximate mode or 'c' to force correct mode, e.g. 'fisher(64.0a)'. Note that this is generally not a good idea - the approximation breaks down for low concentration and the correct approach numerically explodes for high concentration - the default behaviour automatically takes this into account and selects the right one.",
+ "Specified as fisher(alpha), e.g. fisher(10), where alpha is the concentration parameter. Can optionally include a letter immediatly after the alpha value - either 'a' to force approximate mode or 'c' to force correct mode, e.g. 'fisher(64.0a)'. Note that this is generally not a good idea - the approximation breaks down for low concentration and the correct approach numerically explodes for high concentration - the default behaviour automatically takes this into account and selects the right one. You can also add ',table' or ',table=<size>' before the closing bracket, e.g. 'fisher(64.0,table=4096)', to replace the exponential in the weight with a linearly interpolated lookup table over the dot product, of 1024 entries by default - get_error reports the resulting error.",
  Fisher_config_new,
  Fisher_config_verify,
  Fisher_config_acquire,
  Fisher_config_release,
  Fisher_weight,
+ Fisher_weights,
  Fisher_norm,
  Fisher_range,
  Kernel_to_offset,
@@ -1388,6 +1860,7 @@ const Kernel Fisher =
  Kernel_states,
  Kernel_next,
  Fisher_byte_size,
+ Fisher_error,
 };
 
 
@@ -1403,6 +1876,12 @@ float MirrorFisher_weight(int dims, KernelConfig config, float * offset)
  
  float cos_ang = 1.0 - 0.5*d_sqr; // Uses the law of cosines - how to calculate the dot product of unit vectors given their difference.
  
+ if (self->table!=NULL)
+ {
+  if (self->inv_culm==NULL) return 0.5 * Fisher_lookup(self, cos_ang);
+  else return 0.5 * Fisher_lookup(self, cos_ang) + 0.5 * Fisher_lookup(self, -cos_ang);
+ }
+ 
  if (self->inv_culm==NULL)
  {
   // Ammusingly the approximation is actually marginally simpler in the mirrored case!..
@@ -1414,6 +1893,48 @@ float MirrorFisher_weight(int dims, KernelConfig config, float * offset)
  }
 }
 
+KERNEL_SIMD void MirrorFisher_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ FisherConfig * self = (FisherConfig*)config;
+ Kernel_dist_sqr(dims, count, offset, stride, out);
+ 
+ int j;
+ if (self->table!=NULL)
+ {
+  float other = (self->inv_culm==NULL) ? 0.0 : 0.5; // Approximation is even, so the table already includes the other direction.
+  for (j=0; j<count; j++)
+  {
+   float cos_ang = 1.0 - 0.5*out[j];
+   out[j] = 0.5 * Fisher_lookup(self, cos_ang) + other * Fisher_lookup(self, -cos_ang);
+  }
+ }
+ else if (self->inv_culm==NULL)
+ {
+  for (j=0; j<count; j++)
+  {
+   float cos_ang = 1.0 - 0.5*out[j];
+   out[j] = 0.5 * exp(-0.5 * self->alpha * (1.0 - cos_ang*cos_ang) + self->log_norm);
+  }
+ }
+ else
+ {
+  for (j=0; j<count; j++)
+  {
+   float cos_ang = 1.0 - 0.5*out[j];
+   out[j] = 0.5 * exp(self->alpha * cos_ang + self->log_norm) + 0.5 * exp(-self->alpha * cos_ang + self->log_norm);
+  }
+ }
+}
+
+float MirrorFisher_error(int dims, KernelConfig config)
+{
+ FisherConfig * self = (FisherConfig*)config;
+ if (self->table==NULL) return 0.0;
+ 
+ if (self->inv_culm==NULL) return self->table_error / self->table[self->table_size-1];
+ else return self->table_error / (0.5 * (self->table[self->table_size-1] + self->table[0]));
+}
+
 float MirrorFisher_range(int dims, KernelConfig config, float quality)
 {
  return 2.001; // Due to the nature of the distribution this optimisation is not possible - greater than 2 effectivly switches it off.
@@ -1486,12 +2007,13 @@ const Kernel MirrorFisher =
 {
  "mirror_fisher",
  "A kernel for dealing with directional data where a 180 degree rotation is meaningless; one specific use case is for rotations expressed with unit quaternions. It wraps the Fisher distribution such that it is an even mixture of two of them - one with the correct unit vector, one with its negation. All other behaviours and requirements are basically the same as a Fisher distribution however.",
- "Specified as mirror_fisher(alpha), e.g. mirror_fisher(10), where alpha is the concentration parameter used for both of the von-Mises Fisher distributions. Same as fisher you can immediatly postcede the concentration with 'a' to force it to be approximate or 'c' to force it to be correct.",
+ "Specified as mirror_fisher(alpha), e.g. mirror_fisher(10), where alpha is the concentration parameter used for both of the von-Mises Fisher distributions. Same as fisher you can immediatly postcede the concentration with 'a' to force it to be approximate or 'c' to force it to be correct, and add ',table' or ',table=<size>' to use a lookup table.",
  Fisher_config_new,
  Fisher_config_verify,
  Fisher_config_acquire,
  Fisher_config_release,
  MirrorFisher_weight,
+ MirrorFisher_weights,
  Fisher_norm,
  MirrorFisher_range,
  MirrorFisher_to_offset,
@@ -1502,6 +2024,7 @@ const Kernel MirrorFisher =
  MirrorFisher_states,
  MirrorFisher_next,
  Fisher_byte_size,
+ MirrorFisher_error,
 };
 
 
@@ -1706,6 +2229,36 @@ float Composite_weight(int dims, KernelConfig config, float * offset)
  return ret;
 }
 
+void Composite_weights(int dims, KernelConfig config, int count, const float * offset, int stride, float * out)
+{
+ CompositeConfig * self = (CompositeConfig*)config;
+ 
+ // Structure of arrays makes this easy - each child gets a contiguous set of rows. Done in chunks so the child output can go on the stack...
+  int j, base;
+  for (j=0; j<count; j++) out[j] = 1.0;
+  
+  float part[64];
+  for (base=0; base<count; base+=64)
+  {
+   int size = count - base;
+   if (size>64) size = 64;
+   
+   const float * child_offset = offset + base;
+   int child;
+   for (child=0; child<self->children; child++)
+   {
+    const CompositeChild * c = &self->child[child];
+    
+    float temp[c->dims];
+    kernel_weights(c->kernel, c->dims, c->config, size, child_offset, stride, part, temp);
+    
+    for (j=0; j<size; j++) out[base+j] *= part[j];
+    
+    child_offset += c->dims * stride;
+   }
+  }
+}
+
 float Composite_norm(int dims, KernelConfig config)
 {
  CompositeConfig * self = (CompositeConfig*)config;
@@ -1926,6 +2479,23 @@ void Composite_next(int dims, KernelConfig config, int state, float * fv)
 
 
 
+float Composite_error(int dims, KernelConfig config)
+{
+ CompositeConfig * self = (CompositeConfig*)config;
+ 
+ // The weight is a product, so to first order the relative errors add...
+  float ret = 0.0;
+  int i;
+  for (i=0; i<self->children; i++)
+  {
+   ret += self->child[i].kernel->error(self->child[i].dims, self->child[i].config);
+  }
+ 
+ return ret;
+}
+
+
+
 size_t Composite_byte_size(int dims, KernelConfig config, int * ref_count)
 {
  CompositeConfig * self = (CompositeConfig*)config;
@@ -1956,6 +2526,7 @@ const Kernel Composite =
  Composite_config_acquire,
  Composite_config_release,
  Composite_weight,
+ Composite_weights,
  Composite_norm,
  Composite_range,
  Composite_to_offset,
@@ -1966,6 +2537,7 @@ const Kernel Composite =
  Composite_states,
  Composite_next,
  Composite_byte_size,
+ Composite_error,
 };
 
 
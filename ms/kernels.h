@@ -43,6 +43,9 @@ typedef void (*KernelConfigRelease)(KernelConfig config);
 // Given a configuration and the offsets of a point from the kernel centre (Pointer to an array of length dim, noting that they will have been scaled for a kernel size of 1), this returns the weight of the point in the calculation. Does not need to be normalised. alpha is an arbitrary parameter that the kernel can interprete at will, noting that most kernels ignore it...
 typedef float (*KernelWeight)(int dims, KernelConfig config, float * offset);
 
+// Batch version of the above, for evaluating a block of offsets at once - they are stored structure of arrays style, so offset[i*stride + j] is feature i of offset j, with the weight of each of the count offsets written to out. Matches calling KernelWeight on each offset (to within rounding), but avoids a function call per offset and allows the compiler to vectorise. Optional - can be NULL, use kernel_weights (below) to call it, which deals with that case...
+typedef void (*KernelWeights)(int dims, KernelConfig config, int count, const float * offset, int stride, float * out);
+
 // Given the number of dimensions and alpha this returns the multiplicative constant to acheive normalisation that is missing from weight. Can be negative if it is not defined / the kernel coder is lazy...
 typedef float (*KernelNorm)(int dims, KernelConfig config);
 
@@ -73,6 +76,9 @@ typedef void (*KernelNext)(int dims, KernelConfig config, int state, float * fv)
 // Returns the size in bytes of the kernel, in most cases this is zero. You can optionally provide ref_count, which will be filled in with how many MeanShift objects use the given configuration, so you can amortize their memory between them...
 typedef size_t (*KernelByteSize)(int dims, KernelConfig config, int * ref_count);
 
+// Returns a bound on the error of the weight method, as a fraction of the weight at the centre of the kernel - zero unless the configuration asks for the weight to be approximated, e.g. with a lookup table...
+typedef float (*KernelError)(int dims, KernelConfig config);
+
 
 
 // Define the struct that defines a kernel type...
@@ -90,6 +96,7 @@ struct Kernel
  KernelConfigRelease config_release;
  
  KernelWeight   weight;
+ KernelWeights  weights;
  KernelNorm     norm;
  KernelRange    range;
  KernelToOffset to_offset;
@@ -103,12 +110,22 @@ struct Kernel
  KernelNext next;
  
  KernelByteSize byte_size;
+ KernelError error;
 };
 
 
 
 // Random constant used by Fisher and MirrorFisher kernels...
 #define CONC_SWITCH 256.0 // When the concentration excedes this value it switches to a Gaussian approximation.
+#define FISHER_ORDER_LOCAL 64 // Fisher draws with at most this many dimensions sort on the stack rather than the heap.
+
+
+
+// Default number of entries in the lookup table of a kernel that has been asked to tabulate its weight, e.g. cosine(table). Can be overriden in the configuration string, e.g. cosine(table=4096)...
+#define KERNEL_TABLE_SIZE 1024
+
+// Largest table size the configuration can ask for - larger requests are rejected rather than attempting an enormous malloc (also keeps the size well inside an int)...
+#define KERNEL_TABLE_MAX (1<<24)
 
 
 
@@ -126,7 +143,7 @@ extern const Kernel Triangular;
 // Basically triangular where the distance is squared - creates a nice bump...
 extern const Kernel Epanechnikov;
 
-// Uses a  consine curve - a slightly smoother version of epanechnikov, though considerably more expensive to compute...
+// Uses a  consine curve - a slightly smoother version of epanechnikov, though considerably more expensive to compute. This and the Cauchy and Logistic kernels can optionally be configured to use a lookup table, e.g. cosine(table), to avoid the expensive functions...
 extern const Kernel Cosine;
 
 // Probably the most popular kernel - the Gaussian, in this case symmetric as its on the distance from the centre. Cutoff is required for this kernel...
@@ -156,6 +173,14 @@ extern const Kernel * ListKernel[];
 
 
 
+// The to_offset method used by most kernels, simple subtraction - exposed so code can detect kernels where offsets scale with the data...
+void Kernel_to_offset(int dims, KernelConfig config, float * fv, const float * base_fv);
+
+// Calls the weights method of the kernel, or if its NULL does the same thing using the weight method, one offset at a time - temp must be of length dims...
+void kernel_weights(const Kernel * kernel, int dims, KernelConfig config, int count, const float * offset, int stride, float * out, float * temp);
+
+
+
 // Would normally be kept private, but the multiplication system requires access to this...
 typedef struct FisherConfig FisherConfig;
 
@@ -168,7 +193,11 @@ struct FisherConfig
  int inv_culm_size; // Length of below.
  float * inv_culm; // Array containing the inverse culmative of the distribution over the dot product result.
  
- int * order; // Array of length dims that contains the integers 0..dims-1; used when drawing.
+ int table_size; // Length of below.
+ float * table; // NULL, or a lookup table of the weight over the dot product, from -1 to 1 inclusive. For the mirrored version it is the weight of one of the two directions.
+ float table_error; // Maximum absolute error of linear interpolation in the above.
+ 
+ int * order; // Array of length dims that contains the integers 0..dims-1; used when drawing, as the starting point for sorting the dimensions (never modified, so drawing is thread safe).
 };
 
 
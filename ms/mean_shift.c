@@ -9,6 +9,7 @@
 
 
 #include "mean_shift.h"
+#include "threads.h"
 
 #include "eigen.h"
 
@@ -46,34 +47,283 @@ float calc_norm(DataMatrix * dm, const Kernel * kernel, KernelConfig config, flo
 
 
 
-float prob(Spatial spatial, const Kernel * kernel, KernelConfig config, const float * fv, float norm, float quality)
+int next_block(Query * query, const Kernel * kernel, KernelConfig config, const float * fv)
+{
+ int feats = DataMatrix_features(query->dm);
+ 
+ // Fill the block...
+  int count = Query_next_block(query);
+  
+ // Convert to offsets - directly if its the usual subtraction, otherwise one at a time...
+  int i, j;
+  if (kernel->to_offset==Kernel_to_offset)
+  {
+   for (i=0; i<feats; i++)
+   {
+    float * row = query->block + i*QUERY_BLOCK;
+    for (j=0; j<count; j++) row[j] -= fv[i];
+   }
+  }
+  else
+  {
+   for (j=0; j<count; j++)
+   {
+    for (i=0; i<feats; i++) query->temp[i] = query->block[i*QUERY_BLOCK + j];
+    kernel->to_offset(feats, config, query->temp, fv);
+    for (i=0; i<feats; i++) query->block[i*QUERY_BLOCK + j] = query->temp[i];
+   }
+  }
+  
+ // Evaluate the kernel for the entire block...
+  if (count!=0)
+  {
+   kernel_weights(kernel, feats, config, count, query->block, QUERY_BLOCK, query->block_out, query->temp);
+   query->counters.kernels += count;
+  }
+  
+ return count;
+}
+
+
+
+float prob(Query * query, const Kernel * kernel, KernelConfig config, const float * fv, float norm, float quality)
 {
  // Extract a bunch of things...
-  DataMatrix * dm = Spatial_dm(spatial);
+  DataMatrix * dm = query->dm;
   
   int feats = DataMatrix_features(dm);
   float range = kernel->range(feats, config, quality);
   
  // Loop and sum the return value...
   float ret = 0.0;
-  Spatial_start(spatial, fv, range);
+  Query_start(query, fv, range);
   
   while (1)
   {
-   int targ = Spatial_next(spatial);
-   if (targ<0) break;
+   int count = next_block(query, kernel, config, fv);
+   if (count==0) break;
    
-   float w;
-   float * loc = DataMatrix_fv(dm, targ, &w);
+   int j;
+   for (j=0; j<count; j++)
+   {
+    ret += query->block_weight[j] * query->block_out[j] * norm;
+   }
+  }
+  
+ return ret;
+}
+
+
+
+void TileCache_init(TileCache * this, int feats)
+{
+ this->feats = feats;
+ 
+ this->size = 0;
+ this->capacity = 256;
+ this->fv = (float*)malloc(this->capacity * feats * sizeof(float));
+ this->weight = (float*)malloc(this->capacity * sizeof(float));
+ 
+ this->offset = (float*)malloc(this->capacity * feats * sizeof(float));
+ this->offset_weight = (float*)malloc(this->capacity * sizeof(float));
+ this->offset_out = (float*)malloc(this->capacity * sizeof(float));
+ 
+ this->centre = (float*)malloc(feats * sizeof(float));
+ this->temp = (float*)malloc(feats * sizeof(float));
+}
+
+
+void TileCache_deinit(TileCache * this)
+{
+ free(this->temp);
+ free(this->centre);
+ free(this->offset_out);
+ free(this->offset_weight);
+ free(this->offset);
+ free(this->weight);
+ free(this->fv);
+}
+
+
+// Adds a candidate to the cache, growing it if needed...
+void TileCache_add(TileCache * this, const float * fv, float weight)
+{
+ if (this->size==this->capacity)
+ {
+  this->capacity *= 2;
+  this->fv = (float*)realloc(this->fv, this->capacity * this->feats * sizeof(float));
+  this->weight = (float*)realloc(this->weight, this->capacity * sizeof(float));
+  
+  free(this->offset);
+  free(this->offset_weight);
+  free(this->offset_out);
+  this->offset = (float*)malloc(this->capacity * this->feats * sizeof(float));
+  this->offset_weight = (float*)malloc(this->capacity * sizeof(float));
+  this->offset_out = (float*)malloc(this->capacity * sizeof(float));
+ }
+ 
+ float * targ = this->fv + this->size * this->feats;
+ int i;
+ for (i=0; i<this->feats; i++) targ[i] = fv[i];
+ this->weight[this->size] = weight;
+ 
+ this->size += 1;
+}
+
+
+
+// Helper for tile_order...
+typedef struct TileSort TileSort;
 
-   kernel->to_offset(feats, config, loc, fv);
-   w *= kernel->weight(feats, config, loc);
+struct TileSort
+{
+ int pos;
+ float feat;
+};
+
+int tile_sort_cmp(const void * lhs, const void * rhs)
+{
+ const TileSort * l = (const TileSort*)lhs;
+ const TileSort * r = (const TileSort*)rhs;
+ 
+ if (l->feat < r->feat) return -1;
+ if (l->feat > r->feat) return 1;
+ return 0;
+}
+
+
+void tile_order_rec(int count, int feats, const float * fv, int * order, int tile, TileSort * scratch)
+{
+ if (count<=tile) return;
+ 
+ // Find the dimension with the greatest range...
+  int split_feat = 0;
+  float split_range = -1.0;
+  
+  int i, j;
+  for (j=0; j<feats; j++)
+  {
+   float low = fv[order[0]*feats + j];
+   float high = low;
+   for (i=1; i<count; i++)
+   {
+    float v = fv[order[i]*feats + j];
+    if (v<low) low = v;
+    if (v>high) high = v;
+   }
    
-   w *= norm;
-   ret += w;
+   if ((high-low)>split_range)
+   {
+    split_feat = j;
+    split_range = high - low;
+   }
   }
   
- return ret;
+ // Sort along it...
+  for (i=0; i<count; i++)
+  {
+   scratch[i].pos = order[i];
+   scratch[i].feat = fv[order[i]*feats + split_feat];
+  }
+  
+  qsort(scratch, count, sizeof(TileSort), tile_sort_cmp);
+  
+  for (i=0; i<count; i++) order[i] = scratch[i].pos;
+  
+ // Split at a multiple of tile near the middle and recurse...
+  int tiles = (count + tile - 1) / tile;
+  int half = (tiles / 2) * tile;
+  
+  tile_order_rec(half, feats, fv, order, tile, scratch);
+  tile_order_rec(count - half, feats, fv, order + half, tile, scratch);
+}
+
+
+void tile_order(int count, int feats, const float * fv, int * order, int tile)
+{
+ if (tile<1) tile = 1;
+ 
+ TileSort * scratch = (TileSort*)malloc(count * sizeof(TileSort));
+ tile_order_rec(count, feats, fv, order, tile, scratch);
+ free(scratch);
+}
+
+
+
+void probs_tile(Query * query, const Kernel * kernel, KernelConfig config, int count, const int * index, const float * fv, float norm, float quality, float * out, TileCache * tc)
+{
+ if (count<=0) return;
+ 
+ int feats = tc->feats;
+ float range = kernel->range(feats, config, quality);
+ 
+ // Calculate the bounding box of the tile, as a centre and the largest half width...
+  int i, j, k;
+  float half = 0.0;
+  for (j=0; j<feats; j++)
+  {
+   float low = fv[index[0]*feats + j];
+   float high = low;
+   for (i=1; i<count; i++)
+   {
+    float v = fv[index[i]*feats + j];
+    if (v<low) low = v;
+    if (v>high) high = v;
+   }
+   
+   tc->centre[j] = 0.5 * (low + high);
+   if ((0.5*(high-low))>half) half = 0.5 * (high - low);
+  }
+ 
+ // Search the spatial index once for the entire tile, caching every candidate...
+  tc->size = 0;
+  Query_start(query, tc->centre, range + half);
+  
+  while (1)
+  {
+   float w;
+   float * loc = Query_next(query, NULL, &w);
+   if (loc==NULL) break;
+   
+   TileCache_add(tc, loc, w);
+  }
+  
+ // Process each point in the tile against the candidates...
+  for (i=0; i<count; i++)
+  {
+   const float * base = fv + index[i]*feats;
+   
+   // Collect the candidates within the hyper-cube of this point, as a block of offsets...
+    int size = 0;
+    for (k=0; k<tc->size; k++)
+    {
+     const float * cand = tc->fv + k*feats;
+     for (j=0; j<feats; j++)
+     {
+      float delta = cand[j] - base[j];
+      if ((delta>range)||(delta<-range)) break;
+     }
+     if (j!=feats) continue;
+     
+     for (j=0; j<feats; j++) tc->temp[j] = cand[j];
+     kernel->to_offset(feats, config, tc->temp, base);
+     for (j=0; j<feats; j++) tc->offset[j*tc->capacity + size] = tc->temp[j];
+     
+     tc->offset_weight[size] = tc->weight[k];
+     size += 1;
+    }
+   
+   // Evaluate the kernel over the block and sum...
+    kernel_weights(kernel, feats, config, size, tc->offset, tc->capacity, tc->offset_out, tc->temp);
+    
+    float ret = 0.0;
+    for (k=0; k<size; k++)
+    {
+     ret += tc->offset_weight[k] * tc->offset_out[k];
+    }
+    
+    out[index[i]] = ret * norm;
+  }
 }
 
 
@@ -94,10 +344,10 @@ void draw(DataMatrix * dm, const Kernel * kernel, KernelConfig config, PhiloxRNG
 
 
 
-float loo_nll(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng)
+float loo_nll(Query * query, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng)
 {
  // Extract a bunch of things...
-  DataMatrix * dm = Spatial_dm(spatial);
+  DataMatrix * dm = query->dm;
   
   int exemplars = DataMatrix_exemplars(dm);
   int features = DataMatrix_features(dm);
@@ -135,49 +385,558 @@ float loo_nll(Spatial spatial, const Kernel * kernel, KernelConfig config, float
    
    // Get exemplar i, so we can play with it...
     float wi;
-    float * fv = DataMatrix_fv(dm, ii, &wi);
+    float * fv = Query_fv(query, ii, &wi);
     for (j=0; j<features; j++) fvi[j] = fv[j];
     
    // Calculate the probability of exemplar i, ignoring entry i...
     float prob = 0.0;
-    Spatial_start(spatial, fvi, range);
+    Query_start(query, fvi, range);
     
     while (1)
     {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-     if (targ==ii) continue; // Skip the one we are currently analysing!
+     int count = next_block(query, kernel, config, fvi);
+     if (count==0) break;
+     
+     for (j=0; j<count; j++)
+     {
+      if (query->block_index[j]==ii) continue; // Skip the one we are currently analysing!
+      prob += query->block_weight[j] * query->block_out[j] * norm;
+     }
+    }
+    
+   // Update the return cost...
+    if (prob<limit) prob = limit;
+    ret -= wi * log(prob);
+  }
+  
+  free(fvi);
+  
+ return ret;
+}
+
+
+
+int loo_nll_scales_valid(const Kernel * kernel, KernelConfig config)
+{
+ return kernel->to_offset==Kernel_to_offset;
+}
+
+
+int loo_nll_scales(Query * query, const Kernel * kernel, KernelConfig config, int count, const float * scales, const float * norms, float quality, float limit, int sample_clamp, PhiloxRNG * rng, float * out, Progress progress, void * progress_data)
+{
+ // Extract a bunch of things...
+  DataMatrix * dm = query->dm;
+  
+  int exemplars = DataMatrix_exemplars(dm);
+  int features = DataMatrix_features(dm);
+  float range = kernel->range(features, config, quality);
+  
+  int sample_count;
+  if (exemplars<=sample_clamp)
+  {
+   rng = NULL;
+   sample_count = exemplars;
+  }
+  else
+  {
+   if (rng!=NULL)
+   {
+    sample_count = sample_clamp; 
+   }
+   else
+   {
+    sample_count = exemplars;
+   }
+  }
+  
+ // Calculate the ratio between each scale and the base scale, which is what the deltas need to be multiplied by...
+  int i, ii, j, k;
+  float * ratio = (float*)malloc(count * features * sizeof(float));
+  for (k=0; k<count; k++)
+  {
+   for (j=0; j<features; j++)
+   {
+    ratio[k*features + j] = scales[k*features + j] / dm->mult[j];
+   }
+  }
+  
+ // Storage for the neighbours of the current exemplar - their deltas in the base space, structure of arrays, plus their weights...
+  int capacity = 256;
+  float * delta = (float*)malloc(features * capacity * sizeof(float));
+  float * weight = (float*)malloc(capacity * sizeof(float));
+  float * offset = (float*)malloc(features * capacity * sizeof(float));
+  float * kw = (float*)malloc(capacity * sizeof(float));
+  float * sw = (float*)malloc(capacity * sizeof(float));
+  
+  float * fvi = (float*)malloc(features * sizeof(float));
+  
+  for (k=0; k<count; k++) out[k] = 0.0;
+  
+  int step = 0;
+  int abort = 0;
+  
+ // Loop and do each exemplar in the data set in turn... 
+  for (i=0; i<sample_count; i++)
+  {
+   // Report progress, as count steps spread evenly through the exemplars...
+    if (progress!=NULL)
+    {
+     while ((abort==0)&&(step<count)&&(((long long)step)*sample_count<((long long)(i+1))*count))
+     {
+      abort = progress(progress_data, step, count);
+      step += 1;
+     }
+     if (abort!=0) break;
+    }
+    
+   // Handle if we are doing random selection...
+    if (rng==NULL) ii = i;
+              else ii = (int)(exemplars * PhiloxRNG_uniform(rng));
    
+   // Get exemplar i, so we can play with it...
+    float wi;
+    float * fv = Query_fv(query, ii, &wi);
+    for (j=0; j<features; j++) fvi[j] = fv[j];
+    
+   // Collect its neighbours, ignoring itself, with a single search at the base scale...
+    int size = 0;
+    Query_start(query, fvi, range);
+    
+    while (1)
+    {
+     int targ;
      float w;
-     float * fv = DataMatrix_fv(dm, targ, &w);
+     float * loc = Query_next(query, &targ, &w);
+     if (loc==NULL) break;
+     if (targ==ii) continue;
+     
+     if (size==capacity)
+     {
+      // Grow the storage - structure of arrays so need to move the rows...
+       float * nd = (float*)malloc(features * capacity * 2 * sizeof(float));
+       int n;
+       for (j=0; j<features; j++)
+       {
+        for (n=0; n<size; n++) nd[j*capacity*2 + n] = delta[j*capacity + n];
+       }
+       free(delta);
+       delta = nd;
+       
+       capacity *= 2;
+       weight = (float*)realloc(weight, capacity * sizeof(float));
+       kw = (float*)realloc(kw, capacity * sizeof(float));
+       sw = (float*)realloc(sw, capacity * sizeof(float));
+       free(offset);
+       offset = (float*)malloc(features * capacity * sizeof(float));
+     }
+     
+     for (j=0; j<features; j++) delta[j*capacity + size] = loc[j] - fvi[j];
+     weight[size] = w;
+     size += 1;
+    }
+    
+   // Evaluate the probability for each scale in turn...
+    for (k=0; k<count; k++)
+    {
+     // Scale the deltas, keeping only those inside the range at this scale so it matches doing a search at this scale - compacting them means the kernel is only evaluated for the ones that matter...
+      const float * r = ratio + k*features;
+      int n, used = 0;
+      for (n=0; n<size; n++)
+      {
+       for (j=0; j<features; j++)
+       {
+        float o = delta[j*capacity + n] * r[j];
+        if ((o>range)||(o<-range)) break;
+        offset[j*capacity + used] = o;
+       }
+       
+       if (j==features)
+       {
+        sw[used] = weight[n];
+        used += 1;
+       }
+      }
+      
+      kernel_weights(kernel, features, config, used, offset, capacity, kw, query->temp);
+      
+      float prob = 0.0;
+      for (n=0; n<used; n++) prob += sw[n] * kw[n];
+      prob *= norms[k];
+      
+     // Update the return cost...
+      if (prob<limit) prob = limit;
+      out[k] -= wi * log(prob);
+    }
+  }
+  
+ // Clean up...
+  free(fvi);
+  free(sw);
+  free(kw);
+  free(offset);
+  free(weight);
+  free(delta);
+  free(ratio);
+  
+ return abort;
+}
 
-     kernel->to_offset(features, config, fv, fvi);
-     w *= kernel->weight(features, config, fv);
-   
-     w *= norm;
-     prob += w;
+
+
+float entropy(Query * query, const Kernel * kernel, KernelConfig config, float norm, float quality, int sample_clamp, PhiloxRNG * rng)
+{
+ // Extract a bunch of things...
+  DataMatrix * dm = query->dm;
+  
+  int exemplars = DataMatrix_exemplars(dm);
+  int features = DataMatrix_features(dm);
+  float range = kernel->range(features, config, quality);
+  
+  int sample_count;
+  if (exemplars<=sample_clamp)
+  {
+   rng = NULL;
+   sample_count = exemplars;
+  }
+  else
+  {
+   if (rng!=NULL)
+   {
+    sample_count = sample_clamp; 
+   }
+   else
+   {
+    sample_count = exemplars;
+   }
+  }
+
+ // Loop and do each exemplar in the data set in turn... 
+  float ret = 0.0;
+  float samples = 0.0;
+  
+  float * fvi = (float*)malloc(features * sizeof(float));
+  
+  int i, ii, j;
+  for (i=0; i<sample_count; i++)
+  {
+   // Handle if we are doing random selection...
+    if (rng==NULL) ii = i;
+              else ii = (int)(exemplars * PhiloxRNG_uniform(rng));
+
+   // Get exemplar i, so we can play with it...
+    float wi;
+    float * fv = Query_fv(query, ii, &wi);
+    for (j=0; j<features; j++) fvi[j] = fv[j];
+    
+   // Calculate the probability of exemplar i...
+    float prob = 0.0;
+    Query_start(query, fvi, range);
+    
+    while (1)
+    {
+     int count = next_block(query, kernel, config, fvi);
+     if (count==0) break;
+     
+     for (j=0; j<count; j++)
+     {
+      prob += query->block_weight[j] * query->block_out[j] * norm;
+     }
     }
     
-   // Update the return cost...
+   // Update the return cost - incrimental mean...
+    samples += wi;
+    ret += wi * (log(prob) - ret) / samples;
+  }
+  
+  free(fvi);
+  
+ return -ret;
+}
+
+
+
+// Support for the approximate methods...
+int kernel_radial(const Kernel * kernel)
+{
+ return (kernel==&Uniform) || (kernel==&Triangular) || (kernel==&Epanechnikov) || (kernel==&Cosine) || (kernel==&Gaussian) || (kernel==&Cauchy) || (kernel==&Logistic) || (kernel==&Fisher);
+}
+
+
+typedef struct Approx Approx;
+
+struct Approx
+{
+ Query * query;
+ const Kernel * kernel;
+ KernelConfig config;
+ int feats;
+ 
+ const SpatialNode * root;
+ const int * indices;
+ float tolerance;
+ 
+ float * temp; // For evaluating the kernel at a given distance.
+ 
+ // Current point being evaluated...
+  const float * fv;
+  float range;
+  int skip; // Exemplar to skip, for leave one out; negative for none.
+ 
+ // Output of the current point - sum of weight * kernel, lower bound on it and bound on the error in it...
+  double sum;
+  double lower;
+  double error;
+};
+
+
+void Approx_init(Approx * this, Query * query, const Kernel * kernel, KernelConfig config, float quality, float tolerance)
+{
+ this->query = query;
+ this->kernel = kernel;
+ this->config = config;
+ this->feats = DataMatrix_features(query->dm);
+ 
+ this->root = Spatial_tree(query->spatial, &this->indices);
+ this->tolerance = tolerance;
+ 
+ this->temp = (float*)malloc(this->feats * sizeof(float));
+ 
+ this->fv = NULL;
+ this->range = kernel->range(this->feats, config, quality);
+ this->skip = -1;
+}
+
+void Approx_deinit(Approx * this)
+{
+ free(this->temp);
+}
+
+
+// Kernel value at the given squared distance...
+float Approx_kernel(Approx * this, float dist_sqr)
+{
+ int i;
+ this->temp[0] = sqrt(dist_sqr);
+ for (i=1; i<this->feats; i++) this->temp[i] = 0.0;
+ 
+ return this->kernel->weight(this->feats, this->config, this->temp);
+}
+
+
+// Calculates the range of kernel values for the exemplars in a node, kmin to kmax - returns 0 if the node is outside the search range, 1 if it can be approximated and 2 if it can't (contains the point)...
+int Approx_bounds(Approx * this, const SpatialNode * node, float * kmin, float * kmax)
+{
+ float min_sqr = 0.0;
+ float max_sqr = 0.0;
+ int inside = 1;
+ 
+ int i;
+ for (i=0; i<this->feats; i++)
+ {
+  float low = node->range[i*2];
+  float high = node->range[i*2+1];
+  float v = this->fv[i];
+  
+  if ((high<(v-this->range))||(low>(v+this->range))) return 0;
+  if ((low<(v-this->range))||(high>(v+this->range))) inside = 0;
+  
+  float near = 0.0;
+  if (v<low) near = low - v;
+  if (v>high) near = v - high;
+  float far = ((v-low)>(high-v)) ? (v-low) : (high-v);
+  
+  min_sqr += near * near;
+  max_sqr += far * far;
+ }
+ 
+ *kmax = Approx_kernel(this, min_sqr);
+ *kmin = (inside!=0) ? Approx_kernel(this, max_sqr) : 0.0; // If not entirely within range the exact calculation may skip some of its exemplars.
+ 
+ return (min_sqr>0.0) ? 1 : 2;
+}
+
+
+// Processes a node, for which the lower bound contribution (weight * kmin) has already been included...
+void Approx_node(Approx * this, const SpatialNode * node, float kmin, float kmax, int state)
+{
+ // Approximate if the error introduced is within tolerance, relative to the lower bound on the total - each node is allowed its share of the tolerance in proportion to its weight...
+  if ((state==1) && ((kmax-kmin) * this->root->weight <= 2.0 * this->tolerance * this->lower))
+  {
+   this->sum += 0.5 * node->weight * (kmin + kmax);
+   this->error += 0.5 * node->weight * (kmax - kmin);
+   return;
+  }
+  
+  this->lower -= node->weight * kmin;
+  
+ // If its a leaf calculate exactly...
+  if (node->child_low==NULL)
+  {
+   int i;
+   for (i=node->low; i<node->high; i++)
+   {
+    int targ = this->indices[i];
+    if (targ==this->skip) continue;
+    
+    float w;
+    float * loc = Query_fv(this->query, targ, &w);
+    this->kernel->to_offset(this->feats, this->config, loc, this->fv);
+    w *= this->kernel->weight(this->feats, this->config, loc);
+    
+    this->sum += w;
+    this->lower += w;
+   }
+   
+   return;
+  }
+  
+ // Otherwise recurse to the children, the one with the highest potential first...
+  float kmin_low, kmax_low, kmin_high, kmax_high;
+  int state_low = Approx_bounds(this, node->child_low, &kmin_low, &kmax_low);
+  int state_high = Approx_bounds(this, node->child_high, &kmin_high, &kmax_high);
+  
+  if (state_low!=0) this->lower += node->child_low->weight * kmin_low;
+  if (state_high!=0) this->lower += node->child_high->weight * kmin_high;
+  
+  if (kmax_high>kmax_low)
+  {
+   if (state_high!=0) Approx_node(this, node->child_high, kmin_high, kmax_high, state_high);
+   if (state_low!=0) Approx_node(this, node->child_low, kmin_low, kmax_low, state_low);
+  }
+  else
+  {
+   if (state_low!=0) Approx_node(this, node->child_low, kmin_low, kmax_low, state_low);
+   if (state_high!=0) Approx_node(this, node->child_high, kmin_high, kmax_high, state_high);
+  }
+}
+
+
+// Evaluates a point, leaving the result in sum, with its error bound in error...
+void Approx_point(Approx * this, const float * fv, int skip)
+{
+ this->fv = fv;
+ this->skip = skip;
+ 
+ this->sum = 0.0;
+ this->lower = 0.0;
+ this->error = 0.0;
+ 
+ float kmin, kmax;
+ int state = Approx_bounds(this, this->root, &kmin, &kmax);
+ if (state!=0)
+ {
+  this->lower = this->root->weight * kmin;
+  Approx_node(this, this->root, kmin, kmax, state);
+ }
+}
+
+
+// Given a probability, a bound on its error and a clamp on how low it can go this returns a bound on the error of the log of the probability. The clamp must be positive, or the bound can be infinite...
+float log_bound(float p, float error, float limit)
+{
+ float low = p - error;
+ float high = p + error;
+ if (p<limit) p = limit;
+ if (low<limit) low = limit;
+ if (high<limit) high = limit;
+ 
+ float below = log(p) - log(low);
+ float above = log(high) - log(p);
+ return (below>above) ? below : above;
+}
+
+
+
+float loo_nll_approx(Query * query, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng, float tolerance, float * bound)
+{
+ // Fallback to the exact version if we can't do the approximation...
+  if ((Spatial_tree(query->spatial, NULL)==NULL)||(kernel_radial(kernel)==0))
+  {
+   *bound = 0.0;
+   return loo_nll(query, kernel, config, norm, quality, limit, sample_clamp, rng);
+  }
+  
+ // Extract a bunch of things...
+  DataMatrix * dm = query->dm;
+  
+  int exemplars = DataMatrix_exemplars(dm);
+  int features = DataMatrix_features(dm);
+  
+  int sample_count;
+  if (exemplars<=sample_clamp)
+  {
+   rng = NULL;
+   sample_count = exemplars;
+  }
+  else
+  {
+   if (rng!=NULL)
+   {
+    sample_count = sample_clamp; 
+   }
+   else
+   {
+    sample_count = exemplars;
+   }
+  }
+  
+ // Loop and do each exemplar in the data set in turn... 
+  Approx approx;
+  Approx_init(&approx, query, kernel, config, quality, tolerance);
+  
+  float ret = 0.0;
+  *bound = 0.0;
+  
+  float * fvi = (float*)malloc(features * sizeof(float));
+  
+  int i, ii, j;
+  for (i=0; i<sample_count; i++)
+  {
+   // Handle if we are doing random selection...
+    if (rng==NULL) ii = i;
+              else ii = (int)(exemplars * PhiloxRNG_uniform(rng));
+   
+   // Get exemplar i, so we can play with it...
+    float wi;
+    float * fv = Query_fv(query, ii, &wi);
+    for (j=0; j<features; j++) fvi[j] = fv[j];
+    
+   // Calculate the probability of exemplar i, ignoring entry i...
+    Approx_point(&approx, fvi, ii);
+    float prob = approx.sum * norm;
+    
+   // Update the return cost and its bound...
+    *bound += wi * log_bound(prob, approx.error * norm, limit);
+    
     if (prob<limit) prob = limit;
     ret -= wi * log(prob);
   }
   
   free(fvi);
+  Approx_deinit(&approx);
   
  return ret;
 }
 
 
 
-float entropy(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, int sample_clamp, PhiloxRNG * rng)
+// Clamp on probability used when bounding the error of entropy_approx, which has no limit parameter - without one a probability whose error is as large as itself gives an infinite bound, and the running mean then goes to NaN...
+#define ENTROPY_BOUND_LIMIT 1e-16
+
+float entropy_approx(Query * query, const Kernel * kernel, KernelConfig config, float norm, float quality, int sample_clamp, PhiloxRNG * rng, float tolerance, float * bound)
 {
+ // Fallback to the exact version if we can't do the approximation...
+  if ((Spatial_tree(query->spatial, NULL)==NULL)||(kernel_radial(kernel)==0))
+  {
+   *bound = 0.0;
+   return entropy(query, kernel, config, norm, quality, sample_clamp, rng);
+  }
+  
  // Extract a bunch of things...
-  DataMatrix * dm = Spatial_dm(spatial);
+  DataMatrix * dm = query->dm;
   
   int exemplars = DataMatrix_exemplars(dm);
   int features = DataMatrix_features(dm);
-  float range = kernel->range(features, config, quality);
   
   int sample_count;
   if (exemplars<=sample_clamp)
@@ -198,8 +957,12 @@ float entropy(Spatial spatial, const Kernel * kernel, KernelConfig config, float
   }
 
  // Loop and do each exemplar in the data set in turn... 
+  Approx approx;
+  Approx_init(&approx, query, kernel, config, quality, tolerance);
+  
   float ret = 0.0;
   float samples = 0.0;
+  *bound = 0.0;
   
   float * fvi = (float*)malloc(features * sizeof(float));
   
@@ -212,45 +975,31 @@ float entropy(Spatial spatial, const Kernel * kernel, KernelConfig config, float
 
    // Get exemplar i, so we can play with it...
     float wi;
-    float * fv = DataMatrix_fv(dm, ii, &wi);
+    float * fv = Query_fv(query, ii, &wi);
     for (j=0; j<features; j++) fvi[j] = fv[j];
     
    // Calculate the probability of exemplar i...
-    float prob = 0.0;
-    Spatial_start(spatial, fvi, range);
-    
-    while (1)
-    {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-   
-     float w;
-     float * fv = DataMatrix_fv(dm, targ, &w);
-
-     kernel->to_offset(features, config, fv, fvi);
-     w *= kernel->weight(features, config, fv);
-   
-     w *= norm;
-     prob += w;
-    }
+    Approx_point(&approx, fvi, -1);
+    float prob = approx.sum * norm;
     
-   // Update the return cost - incrimental mean...
+   // Update the return cost and its bound - incrimental means...
     samples += wi;
     ret += wi * (log(prob) - ret) / samples;
+    *bound += wi * (log_bound(prob, approx.error * norm, ENTROPY_BOUND_LIMIT) - *bound) / samples;
   }
   
   free(fvi);
+  Approx_deinit(&approx);
   
  return -ret;
 }
 
 
 
-float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig config_p, float norm_p, float quality_p, Spatial spatial_q, const Kernel * kernel_q, KernelConfig config_q, float norm_q, float quality_q, float limit, int sample_clamp, PhiloxRNG * rng)
+float kl_divergence(Query * query_p, const Kernel * kernel_p, KernelConfig config_p, float norm_p, float quality_p, Query * query_q, const Kernel * kernel_q, KernelConfig config_q, float norm_q, float quality_q, float limit, int sample_clamp, PhiloxRNG * rng)
 {
  // Extract a bunch of things...
-  DataMatrix * dm_p = Spatial_dm(spatial_p);
-  DataMatrix * dm_q = Spatial_dm(spatial_q);
+  DataMatrix * dm_p = query_p->dm;
   
   int exemplars = DataMatrix_exemplars(dm_p);
   int features = DataMatrix_features(dm_p);
@@ -290,20 +1039,18 @@ float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig con
 
    // Get exemplar i, so we can play with it...
     float wi;
-    float * fv = DataMatrix_fv(dm_p, ii, &wi);
+    float * fv = Query_fv(query_p, ii, &wi);
     for (j=0; j<features; j++) fvi[j] = fv[j];
     
    // Calculate the probability of exemplar i in p...
     float prob_p = 0.0;
-    Spatial_start(spatial_p, fvi, range_p);
+    Query_start(query_p, fvi, range_p);
     
     while (1)
     {
-     int targ = Spatial_next(spatial_p);
-     if (targ<0) break;
-   
      float w;
-     float * fv = DataMatrix_fv(dm_p, targ, &w);
+     float * fv = Query_next(query_p, NULL, &w);
+     if (fv==NULL) break;
 
      kernel_p->to_offset(features, config_p, fv, fvi);
      w *= kernel_p->weight(features, config_p, fv);
@@ -314,15 +1061,13 @@ float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig con
    
    // Calculate the probability of exemplar i in q...
     float prob_q = 0.0;
-    Spatial_start(spatial_q, fvi, range_q);
+    Query_start(query_q, fvi, range_q);
     
     while (1)
     {
-     int targ = Spatial_next(spatial_q);
-     if (targ<0) break;
-   
      float w;
-     float * fv = DataMatrix_fv(dm_q, targ, &w);
+     float * fv = Query_next(query_q, NULL, &w);
+     if (fv==NULL) break;
 
      kernel_q->to_offset(features, config_q, fv, fvi);
      w *= kernel_q->weight(features, config_q, fv);
@@ -345,10 +1090,20 @@ float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig con
 
 
 
-void mode(Spatial spatial, const Kernel * kernel, KernelConfig config, float * fv, float * temp, float quality, float epsilon, int iter_cap)
+// Helper for the functions that converge a feature vector - records it in the counters of the query, including if it stopped because it hit the iteration cap...
+void count_converge(Query * query, int iters, int iter_cap, float delta, float epsilon)
+{
+ query->counters.converges += 1;
+ query->counters.iters += iters;
+ if ((iters>=iter_cap)&&(delta>epsilon)) query->counters.capped += 1;
+}
+
+
+
+void mode(Query * query, const Kernel * kernel, KernelConfig config, float * fv, float * temp, float quality, float epsilon, int iter_cap)
 {
  // Extract the many things we need... 
-  DataMatrix * dm = Spatial_dm(spatial);
+  DataMatrix * dm = query->dm;
   
   int feats = DataMatrix_features(dm);
   float range = kernel->range(feats, config, quality);
@@ -364,22 +1119,21 @@ void mode(Spatial spatial, const Kernel * kernel, KernelConfig config, float * f
     for (i=0; i<feats; i++) temp[i] = 0.0;
    
    // Iterate all relevant samples, to calculate the mean...
-    Spatial_start(spatial, fv, range);
+    Query_start(query, fv, range);
     while (1)
     {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-     
-     float w;
-     float * loc = DataMatrix_fv(dm, targ, &w);
-
-     kernel->to_offset(feats, config, loc, fv);
-     w *= kernel->weight(feats, config, loc);
+     int count = next_block(query, kernel, config, fv);
+     if (count==0) break;
      
-     if (w>1e-6)
+     int j;
+     for (j=0; j<count; j++)
      {
-      weight += w;
-      for (i=0; i<feats; i++) temp[i] += w * (loc[i] - temp[i]) / weight;
+      float w = query->block_weight[j] * query->block_out[j];
+      if (w>1e-6)
+      {
+       weight += w;
+       for (i=0; i<feats; i++) temp[i] += w * (query->block[i*QUERY_BLOCK + j] - temp[i]) / weight;
+      }
      }
     }
    
@@ -389,14 +1143,17 @@ void mode(Spatial spatial, const Kernel * kernel, KernelConfig config, float * f
    // We just iterated...
     iters += 1;
   }
+  
+ // Record what happened...
+  count_converge(query, iters, iter_cap, delta, epsilon);
 }
 
 
 
-int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, float merge_range, int check_step)
+int mode_merge(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, float merge_range, int check_step)
 {
  // Extract some things that we need... 
-  DataMatrix * dm = Spatial_dm(spatial);
+  DataMatrix * dm = query->dm;
   int feats = DataMatrix_features(dm);
   float range = kernel->range(feats, config, quality);
   int states = kernel->states(feats, config);
@@ -436,22 +1193,21 @@ int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Ball
     for (i=0; i<feats; i++) temp[i] = 0.0;
    
    // Iterate all relevant samples, to calculate the mean...
-    Spatial_start(spatial, fv, range);
+    Query_start(query, fv, range);
     while (1)
     {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-     
-     float w;
-     float * loc = DataMatrix_fv(dm, targ, &w);
-       
-     kernel->to_offset(feats, config, loc, fv);
-     w *= kernel->weight(feats, config, loc);
+     int count = next_block(query, kernel, config, fv);
+     if (count==0) break;
      
-     if (w>1e-6)
+     int j;
+     for (j=0; j<count; j++)
      {
-      weight += w;
-      for (i=0; i<feats; i++) temp[i] += w * (loc[i] - temp[i]) / weight;
+      float w = query->block_weight[j] * query->block_out[j];
+      if (w>1e-6)
+      {
+       weight += w;
+       for (i=0; i<feats; i++) temp[i] += w * (query->block[i*QUERY_BLOCK + j] - temp[i]) / weight;
+      }
      }
     }
    
@@ -462,6 +1218,8 @@ int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Ball
     iters += 1; 
   }
   
+  count_converge(query, iters, iter_cap, delta, epsilon);
+  
  // If it has not merged with an existing mode create a new one to assign it to...
   if (out<0)
   {
@@ -485,8 +1243,11 @@ int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Ball
     if (out<0)
     {
      out = Balls_create(balls, fv, merge_range);
+     query->counters.created += 1;
     }
+    else query->counters.merged += 1;
   }
+  else query->counters.merged += 1;
   
  // Return the assigned cluster...  
   return out; 
@@ -494,20 +1255,180 @@ int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Ball
 
 
 
-void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step)
+int cluster_converge(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, float ident_dist, int check_step, ClusterSame * same)
 {
  // Extract some things that we need... 
-  DataMatrix * dm = Spatial_dm(spatial);
+  DataMatrix * dm = query->dm;
   
-  int exemplars = DataMatrix_exemplars(dm);
   int feats = DataMatrix_features(dm);
   float range = kernel->range(feats, config, quality);
   int states = kernel->states(feats, config);
+  
+  int out = -1;
+  int start = same->size;
+  
+ // Converge it, with breaks every check_step-s to find out if its hit a mode or not...
+  float delta = 2.0 * epsilon;
+  int iters = 0;
+  int i;
+    
+  while ((delta>epsilon)&&(iters<iter_cap))
+  {
+   // Check if there is anyone going to the same destination as us - if so record them to be assigned to the same destination...
+    if (ident_dist>1e-6)
+    {
+     Query_start(query, fv, ident_dist);
+     while (1)
+     {
+      int targ;
+      float * loc = Query_next(query, &targ, NULL);
+      if (loc==NULL) break;
+      
+      float distSqr = 0.0;
+      for (i=0; i<feats; i++)
+      {
+       float delta = loc[i] - fv[i];
+       distSqr += delta*delta;
+      }
+      
+      if (distSqr<=ident_dist*ident_dist)
+      {
+       // We have an exemplar that is close enough - we need to record that it is going to the same destination, noting we are not allowed to record duplicates...
+        int store = 1;
+        for (i=start; i<same->size; i++)
+        {
+         if (same->index[i]==targ)
+         {
+          store = 0;
+          break;
+         }
+        }
+        
+        if (store!=0)
+        {
+         if (same->size==same->capacity)
+         {
+          same->capacity *= 2;
+          same->index = (int*)realloc(same->index, same->capacity * sizeof(int));
+         }
+         
+         same->index[same->size] = targ;
+         same->size += 1;
+        }
+      }
+     }
+    }
+   
+   // Check if we collided with a mode that already exists...
+    if ((iters%check_step)==0)
+    {
+     if (states>1)
+     {
+      int s;
+      for (s=0; s<states; s++)
+      {
+       out = Balls_within(balls, fv);
+       if (out>=0) break;
+       kernel->next(feats, config, s, fv);
+      }
+     }
+     else
+     {
+      out = Balls_within(balls, fv);
+     }
+     
+     if (out>=0) break;
+    }
+   
+   // Prepare the temporary for incrimental mean calculation...
+    float weight = 0.0;
+    for (i=0; i<feats; i++) temp[i] = 0.0;
+ 
+   // Iterate all relevant samples, to calculate the mean...
+    Query_start(query, fv, range);
+    while (1)
+    {
+     int count = next_block(query, kernel, config, fv);
+     if (count==0) break;
+     
+     int j;
+     for (j=0; j<count; j++)
+     {
+      float w = query->block_weight[j] * query->block_out[j];
+      if (w>1e-6)
+      {
+       weight += w;
+       for (i=0; i<feats; i++) temp[i] += w * (query->block[i*QUERY_BLOCK + j] - temp[i]) / weight;
+      }
+     }
+    }
+ 
+   // Copy into the fv, calculating delta as well...
+    delta = kernel->offset(feats, config, fv, temp);
+    
+   // We just iterated...
+    iters += 1; 
+  }
+  
+ count_converge(query, iters, iter_cap, delta, epsilon);
+ if (out>=0) query->counters.merged += 1;
+  
+ return out;
+}
+
+
+
+int cluster_final(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float merge_range)
+{
+ int feats = Balls_dims(balls);
+ int states = kernel->states(feats, config);
+ int out = -1;
+ 
+ // Check if it got to the point it should merge in the last few iterations...
+  if (states>1)
+  {
+   int s;
+   for (s=0; s<states; s++)
+   {
+    out = Balls_within(balls, fv);
+    if (out>=0) break;
+    kernel->next(feats, config, s, fv);
+   }
+  }
+  else
+  {
+   out = Balls_within(balls, fv);
+  }
+  
+ // If not we have no choice but to create a mode...
+  if (out<0)
+  {
+   out = Balls_create(balls, fv, merge_range);
+   query->counters.created += 1;
+  }
+  else query->counters.merged += 1;
+  
+ return out;
+}
+
+
+
+void cluster(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step)
+{
+ // Extract some things that we need... 
+  DataMatrix * dm = query->dm;
+  
+  int exemplars = DataMatrix_exemplars(dm);
+  int feats = DataMatrix_features(dm);
  
  // Create some temporary storage...
   float * fv   = (float*)malloc(feats * sizeof(float));
   float * temp = (float*)malloc(feats * sizeof(float));
-  int * same_dest = (int*)malloc(exemplars * sizeof(int));
+  
+  ClusterSame same;
+  same.size = 0;
+  same.capacity = 64;
+  same.index = (int*)malloc(same.capacity * sizeof(int));
   
  // Set all memeber of the output to -1, to indicate that they are not yet assigned...
   int ei;
@@ -520,154 +1441,199 @@ void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls
    
    // Get the exemplar, noting that we do not process exempars if their weight is 0...
     float w;
-    float * loc = DataMatrix_fv(dm, ei, &w);
+    float * loc = Query_fv(query, ei, &w);
     if (w<1e-3) continue; 
 
     int i;
     for (i=0; i<feats; i++) fv[i] = loc[i];
     
-   // Converge it, with breaks every check_step-s to find out if its hit a mode or not...
-    float delta = 2.0 * epsilon;
-    int iters = 0;
-    int same_dest_count = 0;
+   // Converge it, and if it has not merged with an existing mode create a new one to assign it to...
+    same.size = 0;
+    out[ei] = cluster_converge(query, kernel, config, balls, fv, temp, quality, epsilon, iter_cap, ident_dist, check_step, &same);
     
-    while ((delta>epsilon)&&(iters<iter_cap))
-    {
-     // Check if there is anyone going to the same destination as us - if so record them to be assigned to the same destination...
-      if (ident_dist>1e-6)
-      {
-       Spatial_start(spatial, fv, ident_dist);
-       while (1)
-       {
-        int targ = Spatial_next(spatial);
-        if (targ<0) break;
-        
-        loc = DataMatrix_fv(dm, targ, NULL);
-        float distSqr = 0.0;
-        for (i=0; i<feats; i++)
-        {
-         float delta = loc[i] - fv[i];
-         distSqr += delta*delta;
-        }
-        
-        if (distSqr<=ident_dist*ident_dist)
-        {
-         // We have an exemplar that is close enough - we need to record that it is going to the same destination, noting we are not allowed to record duplicates...
-          int store = 1;
-          for (i=0; i<same_dest_count; i++)
-          {
-           if (same_dest[i]==targ)
-           {
-            store = 0;
-            break;
-           }
-          }
-          
-          if (store!=0)
-          {
-           same_dest[same_dest_count] = targ;
-           same_dest_count += 1;
-          }
-        }
-       }
-      }
-     
-     // Check if we collided with a mode that already exists...
-      if ((iters%check_step)==0)
-      {
-       if (states>1)
-       {
-        int s;
-        for (s=0; s<states; s++)
-        {
-         out[ei] = Balls_within(balls, fv);
-         if (out[ei]>=0) break;
-         kernel->next(feats, config, s, fv);
-        }
-       }
-       else
-       {
-        out[ei] = Balls_within(balls, fv);
-       }
-       
-       if (out[ei]>=0) break;
-      }
-     
-     // Prepare the temporary for incrimental mean calculation...
-      float weight = 0.0;
-      for (i=0; i<feats; i++) temp[i] = 0.0;
-   
-     // Iterate all relevant samples, to calculate the mean...
-      Spatial_start(spatial, fv, range);
-      while (1)
-      {
-       int targ = Spatial_next(spatial);
-       if (targ<0) break;
-       
-       loc = DataMatrix_fv(dm, targ, &w);
-       
-       kernel->to_offset(feats, config, loc, fv);
-       w *= kernel->weight(feats, config, loc);
-     
-       if (w>1e-6)
-       {
-        weight += w;
-        for (i=0; i<feats; i++) temp[i] += w * (loc[i] - temp[i]) / weight;
-       }
-      }
-   
-     // Copy into the fv, calculating delta as well...
-      delta = kernel->offset(feats, config, fv, temp);
-      
-     // We just iterated...
-      iters += 1; 
-    }
-   
-   // If it has not merged with an existing mode create a new one to assign it to...
     if (out[ei]<0)
     {
-     // Check if it got to the point it should merge in the last few iterations...
-      if (states>1)
-      {
-       int s;
-       for (s=0; s<states; s++)
-       {
-        out[ei] = Balls_within(balls, fv);
-        if (out[ei]>=0) break;
-        kernel->next(feats, config, s, fv);
-       }
-      }
-      else
-      {
-       out[ei] = Balls_within(balls, fv);
-      }
-      
-     // If not we have no choice but to create a mode...
-      if (out[ei]<0)
-      {
-       out[ei] = Balls_create(balls, fv, merge_range);
-      }
+     out[ei] = cluster_final(query, kernel, config, balls, fv, merge_range);
     }
     
    // Go through and record its destination for all exemplars that are assumed to go to the same location...
-    for (i=0; i<same_dest_count; i++)
+    for (i=0; i<same.size; i++)
     {
-     if (out[same_dest[i]]<0) out[same_dest[i]] = out[ei];
+     if (out[same.index[i]]<0) out[same.index[i]] = out[ei];
     }
   }
   
  // Clean up...
-  free(same_dest);
+  free(same.index);
   free(temp);
   free(fv);
 }
 
 
 
-int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, int check_step)
+// State shared by the threads of cluster_threaded during a round...
+typedef struct ClusterRound ClusterRound;
+
+struct ClusterRound
+{
+ Query * query; // One per thread.
+ const Kernel * kernel;
+ KernelConfig config;
+ Balls balls;
+ 
+ float quality;
+ float epsilon;
+ int iter_cap;
+ float ident_dist;
+ int check_step;
+ 
+ int feats;
+ int * todo; // Exemplar index of each slot in the round.
+ float * fv; // [slot, feature] - converged position of each slot.
+ int * res; // Ball each slot converged into, or -1 if it needs the final check.
+ float * temp; // [thread, feature]
+ 
+ ClusterSame * same; // One per thread.
+ int * same_thread; // For each slot which same list its entries went into...
+ int * same_start; // ...where they start...
+ int * same_end; // ...and where they end.
+};
+
+
+
+void cluster_round_task(void * data, int thread, int start, int end)
+{
+ ClusterRound * this = (ClusterRound*)data;
+ Query * query = &this->query[thread];
+ float * temp = this->temp + thread * this->feats;
+ ClusterSame * same = &this->same[thread];
+ 
+ int s, i;
+ for (s=start; s<end; s++)
+ {
+  float * fv = this->fv + s * this->feats;
+  float * loc = Query_fv(query, this->todo[s], NULL);
+  for (i=0; i<this->feats; i++) fv[i] = loc[i];
+  
+  this->same_thread[s] = thread;
+  this->same_start[s] = same->size;
+  this->res[s] = cluster_converge(query, this->kernel, this->config, this->balls, fv, temp, this->quality, this->epsilon, this->iter_cap, this->ident_dist, this->check_step, same);
+  this->same_end[s] = same->size;
+ }
+}
+
+
+
+void cluster_threaded(Query * query, int threads, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step)
+{
+ // Extract some things that we need... 
+  DataMatrix * dm = query[0].dm;
+  
+  int exemplars = DataMatrix_exemplars(dm);
+  int feats = DataMatrix_features(dm);
+  
+ // Setup the round state...
+  ClusterRound round;
+  round.query = query;
+  round.kernel = kernel;
+  round.config = config;
+  round.balls = balls;
+  round.quality = quality;
+  round.epsilon = epsilon;
+  round.iter_cap = iter_cap;
+  round.ident_dist = ident_dist;
+  round.check_step = check_step;
+  round.feats = feats;
+  
+  round.todo = (int*)malloc(CLUSTER_ROUND_MAX * sizeof(int));
+  round.fv = (float*)malloc(CLUSTER_ROUND_MAX * feats * sizeof(float));
+  round.res = (int*)malloc(CLUSTER_ROUND_MAX * sizeof(int));
+  round.temp = (float*)malloc(threads * feats * sizeof(float));
+  
+  round.same = (ClusterSame*)malloc(threads * sizeof(ClusterSame));
+  round.same_thread = (int*)malloc(CLUSTER_ROUND_MAX * sizeof(int));
+  round.same_start = (int*)malloc(CLUSTER_ROUND_MAX * sizeof(int));
+  round.same_end = (int*)malloc(CLUSTER_ROUND_MAX * sizeof(int));
+  
+  int t;
+  for (t=0; t<threads; t++)
+  {
+   round.same[t].size = 0;
+   round.same[t].capacity = 64;
+   round.same[t].index = (int*)malloc(round.same[t].capacity * sizeof(int));
+  }
+  
+ // Set all memeber of the output to -1, to indicate that they are not yet assigned...
+  int ei;
+  for (ei=0; ei<exemplars; ei++) out[ei] = -1;
+  
+ // Do rounds until every exemplar has been assigned - round size starts small and grows as the set of balls fills in...
+  int size = CLUSTER_ROUND_MIN;
+  ei = 0;
+  
+  while (ei<exemplars)
+  {
+   // Collect the next batch of exemplars that need processing, in order...
+    int count = 0;
+    while ((ei<exemplars)&&(count<size))
+    {
+     if (out[ei]<0)
+     {
+      float w;
+      Query_fv(&query[0], ei, &w);
+      if (w>=1e-3)
+      {
+       round.todo[count] = ei;
+       count += 1;
+      }
+     }
+     ei += 1;
+    }
+    
+   // Converge them all in parallel, against the balls as they were at the start of the round...
+    for (t=0; t<threads; t++) round.same[t].size = 0;
+    thread_run(cluster_round_task, &round, count, 4, threads);
+    
+   // Merge the results in exemplar order, creating balls as needed...
+    int s, i;
+    for (s=0; s<count; s++)
+    {
+     int targ = round.todo[s];
+     if (out[targ]>=0) continue; // Assigned by the same destination logic of an earlier slot in this round.
+     
+     if (round.res[s]>=0) out[targ] = round.res[s];
+     else out[targ] = cluster_final(&query[0], kernel, config, balls, round.fv + s * feats, merge_range);
+     
+     ClusterSame * same = &round.same[round.same_thread[s]];
+     for (i=round.same_start[s]; i<round.same_end[s]; i++)
+     {
+      if (out[same->index[i]]<0) out[same->index[i]] = out[targ];
+     }
+    }
+    
+   // Grow the round size...
+    size *= 2;
+    if (size>CLUSTER_ROUND_MAX) size = CLUSTER_ROUND_MAX;
+  }
+  
+ // Clean up...
+  for (t=0; t<threads; t++) free(round.same[t].index);
+  free(round.same_end);
+  free(round.same_start);
+  free(round.same_thread);
+  free(round.same);
+  free(round.temp);
+  free(round.res);
+  free(round.fv);
+  free(round.todo);
+}
+
+
+
+int assign_cluster(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, int check_step)
 {
  // Extract some things that we need... 
-  DataMatrix * dm = Spatial_dm(spatial);
+  DataMatrix * dm = query->dm;
   
   int feats = DataMatrix_features(dm);
   float range = kernel->range(feats, config, quality);
@@ -688,14 +1654,22 @@ int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config,
       for (s=0; s<states; s++)
       {
        int ret = Balls_within(balls, fv);
-       if (ret>=0) return ret;
+       if (ret>=0)
+       {
+        count_converge(query, iters, iter_cap, delta, epsilon);
+        return ret;
+       }
        kernel->next(feats, config, s, fv);
       }
      }
      else
      {
       int ret = Balls_within(balls, fv);
-      if (ret>=0) return ret;
+      if (ret>=0)
+      {
+       count_converge(query, iters, iter_cap, delta, epsilon);
+       return ret;
+      }
      }
     }
      
@@ -705,22 +1679,21 @@ int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config,
     for (i=0; i<feats; i++) temp[i] = 0.0;
    
    // Iterate all relevant samples, to calculate the mean...
-    Spatial_start(spatial, fv, range);
+    Query_start(query, fv, range);
     while (1)
     {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-     
-     float w;
-     float * loc = DataMatrix_fv(dm, targ, &w);
-
-     kernel->to_offset(feats, config, loc, fv);
-     w *= kernel->weight(feats, config, loc);
+     int count = next_block(query, kernel, config, fv);
+     if (count==0) break;
      
-     if (w>1e-6)
+     int j;
+     for (j=0; j<count; j++)
      {
-      weight += w;
-      for (i=0; i<feats; i++) temp[i] += w * (loc[i] - temp[i]) / weight;
+      float w = query->block_weight[j] * query->block_out[j];
+      if (w>1e-6)
+      {
+       weight += w;
+       for (i=0; i<feats; i++) temp[i] += w * (query->block[i*QUERY_BLOCK + j] - temp[i]) / weight;
+      }
      }
     }
    
@@ -731,6 +1704,8 @@ int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config,
     iters += 1; 
   }
   
+ count_converge(query, iters, iter_cap, delta, epsilon);
+  
  if (states>1)
  {
   int s;
@@ -750,12 +1725,12 @@ int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config,
 
 
 
-void manifold(Spatial spatial, int degrees, float * fv, float * grad, float * hess, float * eigen_val, float * eigen_vec, float quality, float epsilon, int iter_cap, int always_hessian)
+void manifold(Query * query, int degrees, float * fv, float * grad, float * hess, float * eigen_val, float * eigen_vec, float quality, float epsilon, int iter_cap, int always_hessian)
 {
  int i, j;
  
  // Extract some things that we need... 
-  DataMatrix * dm = Spatial_dm(spatial);
+  DataMatrix * dm = query->dm;
   
   int feats = DataMatrix_features(dm);
   float range = Gaussian.range(feats, NULL, quality);
@@ -779,14 +1754,12 @@ void manifold(Spatial spatial, int degrees, float * fv, float * grad, float * he
      }
      
     // Loop all relevant exemplars in the dataset...
-     Spatial_start(spatial, fv, range);
+     Query_start(query, fv, range);
      while (1)
      {
-      int targ = Spatial_next(spatial);
-      if (targ<0) break;
-      
       float w;
-      float * loc = DataMatrix_fv(dm, targ, &w);
+      float * loc = Query_next(query, NULL, &w);
+      if (loc==NULL) break;
       
       for (i=0; i<feats; i++) loc[i] -= fv[i];
       w *= norm * Gaussian.weight(feats, NULL, loc);
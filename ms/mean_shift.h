@@ -19,6 +19,8 @@
 
 // Note: All of the below functions require that feature vectors (fv) are given in transformed space, i.e. have been multiplied by the vector in the data matrix.
 
+// Note: Functions that search the density estimate take a Query, which wraps the Spatial with the state of the search - they are thread safe as long as each thread has its own Query (and the Balls object is not being created, i.e. cluster and mode_merge can't run in parallel on the same Balls - see cluster_threaded for a parallel version).
+
 // Returns the total weight within the given data matrix - normally each exemplar is weighted as 1 and this is the exmeplar count, but that is not always the case...
 float calc_weight(DataMatrix * dm);
 
@@ -29,8 +31,46 @@ float calc_norm(DataMatrix * dm, const Kernel * kernel, KernelConfig config, flo
 
 
 
-// This calculates the probability of a given feature vector, as defined by the kernel density estimate defined by the provided spatial and kernel (with an associated alpha). You also provide the normalising multiplier, as that can be cached to save repeated calculation, and quality to define the search range around the kernel. The norm parameter must be the kernel normalising constant divided by the weight of the samples and factoring in the scale change - as calc_norm does. Note that this is strange as it expects fv in scaled space and then outputs a probability in unscaled space!..
-float prob(Spatial spatial, const Kernel * kernel, KernelConfig config, const float * fv, float norm, float quality);
+// Helper used by the below - fetches the next block of up to QUERY_BLOCK results from a search, converting them into offsets from fv (using the kernels to_offset method) and storing them in the block storage of the Query, before evaluating the kernel weights for all of them at once into block_out. Returns how many it got, 0 when the search is done. Adds the kernel evaluations to the counters of the query...
+int next_block(Query * query, const Kernel * kernel, KernelConfig config, const float * fv);
+
+
+
+// This calculates the probability of a given feature vector, as defined by the kernel density estimate defined by the provided query (spatial) and kernel (with an associated alpha). You also provide the normalising multiplier, as that can be cached to save repeated calculation, and quality to define the search range around the kernel. The norm parameter must be the kernel normalising constant divided by the weight of the samples and factoring in the scale change - as calc_norm does. Note that this is strange as it expects fv in scaled space and then outputs a probability in unscaled space!..
+float prob(Query * query, const Kernel * kernel, KernelConfig config, const float * fv, float norm, float quality);
+
+
+
+// Batched version of prob, for when you have a lot of points to evaluate. The points are first put in an order where consecutive blocks of them (tiles) are close together, via tile_order. Each tile is then evaluated with probs_tile - it searches the spatial index just once, for the bounding box of the tile expanded by the kernel range, and caches the feature vectors found. Each point in the tile is then evaluated against this block of candidates, after discarding those outside its own hyper-cube. The sum only includes exemplars that pass this test, which is the range the spatial index promises to return, so the result can differ from prob, which sums everything the index happens to return - see probs_tile for how much...
+
+// Workspace for probs_tile - reused between tiles to avoid mallocs, one per thread...
+typedef struct TileCache TileCache;
+
+struct TileCache
+{
+ int feats;
+ 
+ int size; // Number of candidates currently stored.
+ int capacity; // Number of candidates that can be stored before a realloc.
+ float * fv; // Feature vectors of the candidates, [capacity, feats].
+ float * weight; // Weights of the candidates (exemplar weight), [capacity].
+ 
+ float * offset; // Offsets of the candidates that pass for the current point, structure of arrays, [feats, capacity].
+ float * offset_weight; // Weight of each entry in offset, [capacity].
+ float * offset_out; // Kernel weights for each entry in offset, [capacity].
+ 
+ float * centre; // Centre of the tile bounding box, [feats].
+ float * temp; // [feats].
+};
+
+void TileCache_init(TileCache * this, int feats);
+void TileCache_deinit(TileCache * this);
+
+// Reorders the indices in order (length count, indexing into fv, which is [?, feats]) so that every block of tile consecutive entries is compact in space - recursively splits the points on the dimension with the largest range until each block is no larger than tile, with the splits at multiples of tile so only the last block can be short...
+void tile_order(int count, int feats, const float * fv, int * order, int tile);
+
+// Calculates the probability of a tile of points, putting the results into out. Only exemplars within the hyper-cube of the kernel range (for the given quality) around each point are summed, whilst prob sums everything the spatial index returns, which includes those but can include more (all of them for brute_force) - the two agree to within floating point rounding for kernels with finite support, but for the gaussian, cauchy and logistic kernels this result is lower by the truncated tail, which can be tens of percent for cauchy at the default quality (raise quality to shrink it). fv is an array of feature vectors [?, feats], and index gives which count of them to process, e.g. a block from the output of tile_order; out is indexed the same way as fv...
+void probs_tile(Query * query, const Kernel * kernel, KernelConfig config, int count, const int * index, const float * fv, float norm, float quality, float * out, TileCache * tc);
 
 
 
@@ -41,38 +81,71 @@ void draw(DataMatrix * dm, const Kernel * kernel, KernelConfig config, PhiloxRNG
 
 // Calculates the log probability of all the items in the data set, leave one out style - allows for model comparison so you can optimise any of the parameters, such as scale or kernel type. Parameters match up with the prob function, except it gets the feature vectors from spatial and returns a negative log probability. It includes three extra parameters - a minimum probability to assign to any given exemplar, to limit the damage of outliers, and a sample clamp - if less than the exemplar count it will randomly select this many (with repetition) and return that instead. In this case the provided rng is needed...
 // (Note that it does not correctly adjust the total weight for each exemplar probability calculation, which technically can bias things a bit if they all have different weights, but not really enough to worry about, and it would prevent the use of the norm optimisation.)
-float loo_nll(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng);
+float loo_nll(Query * query, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng);
+
+
+
+// Version of loo_nll that calculates it for many scales at once, sharing a single search of the spatial index for each exemplar between all of them (It also avoids rebuilding the spatial index for each scale). The query must be for a data matrix that has been set to the base scale, which in every feature must be no larger than that of any of the scales being evaluated - the per-feature minimum works. This is so a search at the base scale, which is the widest kernel, finds every neighbour needed by every scale. scales is [count, features], the scales to evaluate, whilst norms is the normalising constant of each (e.g. as calc_norm would return with that scale set). The loo_nll of each scale is written into out, which is of length count. Other parameters are as for loo_nll, noting that the same exemplars are used for every scale if using sample_clamp. Only valid if the kernel offsets scale linearly with the data, which loo_nll_scales_valid checks (true for all kernels except mirror_fisher and composite). Neighbours are cut at the kernel range of each scale exactly, whilst loo_nll includes whole leaves of the kd-tree, so for kernels with infinite support (Gaussian) the two differ slightly in the tails. progress, if not NULL, is called count times, with step going from 0 to count-1, spread evenly through the exemplars - as all scales are evaluated together this is the fraction of the work done rather than the scale being done. If it returns nonzero the calculation is abandoned, and this returns nonzero, with out incomplete; otherwise it returns 0...
+typedef int (*Progress)(void * data, int step, int steps);
+
+int loo_nll_scales_valid(const Kernel * kernel, KernelConfig config);
+int loo_nll_scales(Query * query, const Kernel * kernel, KernelConfig config, int count, const float * scales, const float * norms, float quality, float limit, int sample_clamp, PhiloxRNG * rng, float * out, Progress progress, void * progress_data);
 
 
 
 // Calculates and returns an approximation of the entropy of the distribution, using the samples that the datamatrix contains as a sample from the distribution so its super efficient to calculate. Has the same sample_clamp/rng idea as loo_nll...
-float entropy(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, int sample_clamp, PhiloxRNG * rng);
+float entropy(Query * query, const Kernel * kernel, KernelConfig config, float norm, float quality, int sample_clamp, PhiloxRNG * rng);
+
+
+
+// Approximate versions of loo_nll and entropy, for broad kernels where the exact versions approach O(N^2). Rather than visiting every exemplar in range each probability is calculated by traversing the tree of the spatial index, where any node that does not contain the point being evaluated can be approximated as all of its weight sitting at the average of the kernel value at its nearest and furthest points, if the error this could introduce is within tolerance (relative, e.g. 0.01 for 1%) of a lower bound on the probability. A bound on the absolute error of the return, relative to the exact function, is written into bound - it is guaranteed, ignoring floating point error. Requires a spatial index that exposes a tree (kd_tree) and a kernel that is a decreasing function of distance from its centre (all except discrete, mirror_fisher and composite) - if either is missing it calls through to the exact version, and the bound is zero...
+float loo_nll_approx(Query * query, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng, float tolerance, float * bound);
+float entropy_approx(Query * query, const Kernel * kernel, KernelConfig config, float norm, float quality, int sample_clamp, PhiloxRNG * rng, float tolerance, float * bound);
 
 
 // Calculates the Kullback-Leibler divergance of q from p D(P||Q), as in the average number of extra nats required to encode draws from p given an encoder that assumes draws from q. Same approach as entropy, using the samples in the KDE as both samples and to define the distribution. Note that the constraint the the KL-divergance be positive is broken by this estimate - you can get negative values out. What to do about this is left to the user. limit is a clamp on how low probability of q values are allowed to get, to avoid divide by zero. Supports the bootystrap optimisation of loo_nll...
-float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig config_p, float norm_p, float quality_p, Spatial spatial_q, const Kernel * kernel_q, KernelConfig config_q, float norm_q, float quality_q, float limit, int sample_clamp, PhiloxRNG * rng);
+float kl_divergence(Query * query_p, const Kernel * kernel_p, KernelConfig config_p, float norm_p, float quality_p, Query * query_q, const Kernel * kernel_q, KernelConfig config_q, float norm_q, float quality_q, float limit, int sample_clamp, PhiloxRNG * rng);
 
 
 
-// Given a kernel (with an alpha parameter), spatial indexing data structure and a feature vector this updates that feature vector to be its mean shift converged point. A temporary vector of the same length as the feature must also be provided. The quality parameter goes from 0 to 1, and maps to the low and high spatial ranges provided by the kernel. There is also an epsilon parameter - it stops when movement drops below it, typically something like 1e-3 is good. The iteration cap ensures that no infinite loops cna occur if epsilon is too low. If the spatial has an ignore entry in the feature vector it uses that as a weight (Will call the get method of spatial.)...
-void mode(Spatial spatial, const Kernel * kernel, KernelConfig config, float * fv, float * temp, float quality, float epsilon, int iter_cap);
+// Given a kernel (with an alpha parameter), spatial indexing data structure and a feature vector this updates that feature vector to be its mean shift converged point. A temporary vector of the same length as the feature must also be provided. The quality parameter goes from 0 to 1, and maps to the low and high spatial ranges provided by the kernel. There is also an epsilon parameter - it stops when movement drops below it, typically something like 1e-3 is good. The iteration cap ensures that no infinite loops cna occur if epsilon is too low. If the spatial has an ignore entry in the feature vector it uses that as a weight (Will call the get method of spatial.) Records the iterations it did in the counters of the query (see Counters in spatial.h), as do mode_merge, cluster and assign_cluster...
+void mode(Query * query, const Kernel * kernel, KernelConfig config, float * fv, float * temp, float quality, float epsilon, int iter_cap);
 
 
 // Like mode, except its trying to find the relevant cluster in a provided Balls object to merge with, noting that if it doesn't do so it will create a new ball. Returns the index of the ball it reaches. Parameters match up with those for mode and cluster - this really is a half-way house between them (though no path shortening), for when you want to cluster data using a different set of exemplars to define the desnity estimate...
-int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, float merge_range, int check_step);
+int mode_merge(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, float merge_range, int check_step);
 
 // Given a Spatial, a Kernel (with its alpha parameter) and an (empty) Balls this assigns modes to every single point in the data matrix contained within the Spatial - after running the Balls object contains the modes, and the output array, aligned with the exemplar index of the data matrix, contains the indices of the modes for each data point (check_step is how many iterations to do between checking if its intersected a hyper-sphere that indicates convergance - exists because that check is much slower than doing a bunch of iterations.) Note that if spatial has an ignored vector then the same vector must be ignored by balls...
-void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step);
+void cluster(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step);
+
+// Multithreaded version of cluster - query is an array of Query objects, one for each thread (all for the same Spatial). Works in rounds: each round takes the next block of unassigned exemplars (in order), converges them all in parallel against the balls that existed at the start of the round (read only, so no locking is needed), then merges the results in exemplar order, which is when new balls are created. Rounds start at CLUSTER_ROUND_MIN exemplars and double up to CLUSTER_ROUND_MAX, so the early rounds find the major modes before the large rounds start. The output is deterministic and independent of the thread count, but can differ slightly from cluster, which creates balls as soon as each exemplar converges...
+void cluster_threaded(Query * query, int threads, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step);
+
+#define CLUSTER_ROUND_MIN 64
+#define CLUSTER_ROUND_MAX 16384
+
+// The two halves of cluster, exposed for the above. cluster_converge converges fv, stopping early if it enters a ball, in which case it returns its index; otherwise it returns -1. If ident_dist is positive it also appends the exemplars that pass within that distance of the path to same, so they can be assigned the same cluster without being processed. cluster_final is then called on anything that returned -1 - it does a final check for a ball, and if that fails creates a new one, returning its index. Only the counters of its query are used, which for cluster_threaded is the first...
+typedef struct ClusterSame ClusterSame;
+
+struct ClusterSame
+{
+ int size;
+ int capacity;
+ int * index;
+};
+
+int cluster_converge(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, float ident_dist, int check_step, ClusterSame * same);
+int cluster_final(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float merge_range);
 
 
 
 // Given that a clustering has occured this takes a feature vector and calculates to which cluster it belongs, or returns -1 if its does not belong to any of them...
-int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, int check_step);
+int assign_cluster(Query * query, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, int check_step);
 
 
 
 // This uses subspace constrained mean shift to project a given feature vector to a manifold. The degrees parameter indicates the degrees of freedom of the surface to converge to - 0 is standard mean shift (Don't do this - its much faster to do the normal thing), 1 will extract lines (1D surfaces), 2 will extract a 2D manifold and so on. Requires the spatial to define the density estimate, plus the feature vector, which is modified in place until it converges - output is in effect a point on the manifold. Also requires four temporaries - grad, for the gradient (Same size as fv); hess, for the hessian (Size of fv squared); eigen_vec, for the eigen vectors of the hessian (Size of fv squared); and eigen_val, for the eigen values (Size of fv). Additionally there are various parameters, for determining accuracy when evaluating the kernels and detecting convergance. The always_hessian parameter should be non-zero for the correct algorithm, but if 0 then it just calculates the hessain once at the start, which saves a lot of time and still works for clean data. Note that this is coded to only work with the unit isotropic Gaussian kernel, hence the kernel is not a parameter...
-void manifold(Spatial spatial, int degrees, float * fv, float * grad, float * hess, float * eigen_val, float * eigen_vec, float quality, float epsilon, int iter_cap, int always_hessian);
+void manifold(Query * query, int degrees, float * fv, float * grad, float * hess, float * eigen_val, float * eigen_vec, float quality, float epsilon, int iter_cap, int always_hessian);
 
 
 
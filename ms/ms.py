@@ -13,7 +13,7 @@ try:
   from utils.make import make_mod
   import os.path
 
-  make_mod('ms_c', os.path.dirname(__file__), ['philox.h', 'philox.c', 'bessel.h', 'bessel.c', 'eigen.h', 'eigen.c', 'mult.h', 'mult.c', 'kernels.h', 'kernels.c', 'convert.h', 'convert.c', 'data_matrix.h', 'data_matrix.c', 'spatial.h', 'spatial.c', 'balls.h', 'balls.c', 'mean_shift.h', 'mean_shift.c', 'ms_c.h', 'ms_c.c'], numpy=True)
+  make_mod('ms_c', os.path.dirname(__file__), ['philox.h', 'philox.c', 'bessel.h', 'bessel.c', 'eigen.h', 'eigen.c', 'mult.h', 'mult.c', 'kernels.h', 'kernels.c', 'convert.h', 'convert.c', 'data_matrix.h', 'data_matrix.c', 'spatial.h', 'spatial.c', 'balls.h', 'balls.c', 'mean_shift.h', 'mean_shift.c', 'threads.h', 'threads.c', 'ms_c.h', 'ms_c.c'], numpy=True)
 except: pass
 
 
@@ -38,8 +38,21 @@ class MeanShift(MeanShiftC):
     return clusters[numpy.argmax(probs),:]
     
     
+  def set_data_mmap(self, fn, feats, weight = None, conv = None, cache = True, cache_fn = None):
+    """Sets the data matrix to be a flat file of float32 values, in row major order, with feats columns (including the weight column, if any), which is memory mapped rather than loaded. This allows data sets larger than memory to be used, with the operating system paging the data in and out as needed. weight and conv are as for the third and fourth parameters of set_data. By default it also turns on the cache (see set_cache) - set cache to False to disable, or provide cache_fn to have the cache stored in a file, which is required if the data is larger than memory. Returns the numpy memmap object, which is also what get_dm returns."""
+    data = numpy.memmap(fn, dtype=numpy.float32, mode='r')
+    data = data.reshape((-1, feats))
+    
+    self.set_data(data, 'df', weight, conv if conv!=None else '')
+    
+    if cache:
+      self.set_cache(True, cache_fn if cache_fn!=None else '')
+    
+    return data
+
+
   def scale_loo_nll(self, low = 0.01, high = 2.0, steps = 64, callback = None, prob_limit = 1e-6, sample_limit = None):
-    """Does a sweep of the scale, from low to high, on a logarithmic scale with the given number of steps. Sets the scale to the one with the lowest loo_nll score. If low/high are provided as multipliers then these are multipliers of the silverman scale; otherwise they can by arbitrary vectors. After the main parameters there is callback, for reporting progress, prob_limit and sample_limit, which are passed though to loo_nll and control outlier robustness and a sub-sampling speed optimisation respectivly."""
+    """Does a sweep of the scale, from low to high, on a logarithmic scale with the given number of steps. Sets the scale to the one with the lowest loo_nll score. If low/high are provided as multipliers then these are multipliers of the silverman scale; otherwise they can by arbitrary vectors. After the main parameters there is callback, for reporting progress, prob_limit and sample_limit, which are passed though to loo_nll and control outlier robustness and a sub-sampling speed optimisation respectivly. Uses sweep_scales internally, so the spatial index is only built once. Not supported for the directional kernels (fisher and mirror_fisher), where scale has no effect - use scale_loo_nll_array instead."""
     
     # Select values for low and high as needed...
     if isinstance(low, float) or isinstance(high, float):
@@ -54,33 +67,23 @@ class MeanShift(MeanShiftC):
       if isinstance(high, float):
         high = silverman * high
 
-    # Iterate, recording the scale with the best score thus far...
+    # Generate the scales to try...
     if steps<2: steps = 2
     
     log_low = numpy.log(low)
     log_step = (numpy.log(high) - log_low) / (steps-1)
     
-    best_score = None
-    best_scale = None
+    scales = numpy.array([numpy.exp(log_low + i*log_step) for i in xrange(steps)], dtype=numpy.float32)
     
-    for i in xrange(steps):
-      if callback!=None:
-        callback(i, steps)
-
-      scale = numpy.exp(log_low + i*log_step)
-      
-      self.set_scale(scale)
-      score = self.loo_nll(prob_limit, sample_limit if isinstance(sample_limit, int) else -1)
-      
-      if best_score==None or score < best_score:
-        best_score = score
-        best_scale = scale
+    # Evaluate them all in one go, sharing the spatial index and neighbour search...
+    scores = self.sweep_scales(scales, prob_limit, sample_limit if isinstance(sample_limit, int) else -1, callback)
     
     # Set it to the best...
-    self.set_scale(best_scale)
-    return best_score
-  
-  
+    best = numpy.argmin(scores)
+    self.set_scale(scales[best,:])
+    return float(scores[best])
+
+
   def scale_loo_nll_array(self, choices, callback = None, prob_limit = 1e-6, sample_limit = None):
     """Given an array of MS objects this copies in the configuration of each object in turn into this object and finds the one that minimises the leave one out error. Quite simple really - mostly for use in cases when the kernel type doesn't support scale in the usual way, i.e. the directional kernels. For copying across it uses a call to copy_all and a call to copy_scale, which between them get near as everything. Note that the array of choices will need some dummy data set, so the system knows the number of dimensions. After the main parameters there is callback, for reporting progress, prob_limit and sample_limit, which are passed though to loo_nll and control outlier robustness and a sub-sampling speed optimisation respectivly."""
     best_choice = None
@@ -105,7 +108,7 @@ class MeanShift(MeanShiftC):
 
 
   def hierarchy(self, low = 1.0, high = 512.0, steps = 64, callback = None):
-    """Does a sweep of scale, exactly like scale_loo_nll (same behaviour for low and high with vector vs single value), except it clusters the data at each level and builds a hierarchy of clusters, noting which cluster at a lower level ends up in which cluster at the next level. Note that low and high are inverted before use so that they equate to the typical mean shift parameters. Return is a list indexed by level, with index 0 representing the original data (where every data point is its own segment). Each level is represented by a tuple: (modes - array of [segment, feature], parents - array of [segment], giving the index of its parent segment in the next level. None in the highest level, sizes - array of [segment] giving the total weight of all exemplars in that segment.)"""
+    """Does a sweep of scale, exactly like scale_loo_nll (same behaviour for low and high with vector vs single value), except it clusters the data at each level and builds a hierarchy of clusters, noting which cluster at a lower level ends up in which cluster at the next level. Note that low and high are inverted before use so that they equate to the typical mean shift parameters. Uses cluster_scales internally, which calls callback at the start of each level. Returns a list indexed by level, with index 0 representing the original data (where every data point is its own segment). Each level is represented by a tuple: (modes - array of [segment, feature], parents - array of [segment], giving the index of its parent segment in the next level. None in the highest level, sizes - array of [segment] giving the total weight of all exemplars in that segment.)"""
     
     # Select values for low and high as needed...
     if isinstance(low, float) or isinstance(high, float):
@@ -120,35 +123,21 @@ class MeanShift(MeanShiftC):
       if isinstance(high, float):
         high = silverman * high
         
-    # Stuff needed for the below...
+    # Generate the scales of each level...
     if steps<2: steps = 2
     
     log_low = numpy.log(low)
     log_step = (numpy.log(high) - log_low) / (steps-1)
     
-    ret = [[self.fetch_dm(), None, self.fetch_weight()]] # Start with level 0 only.
+    scales = numpy.array([1.0 / numpy.exp(log_low + i*log_step) for i in xrange(steps)], dtype=numpy.float32)
     
-    # Iterate, recording the clustering at each scale...
-    for i in xrange(steps):
-      if callback!=None:
-        callback(i, steps)
-
-      scale = 1.0 / numpy.exp(log_low + i*log_step)
-      self.set_scale(scale)
-      
-      # Different behaviour for first level...
-      if i==0:
-        clusters, parents = self.cluster()
-        parents = parents.flatten()
-        safe = parents>=0
-        sizes = numpy.bincount(parents[safe], weights=self.fetch_weight()[safe], minlength=clusters.shape[0])
-      else:
-        #clusters, _ = self.cluster()
-        #parents = self.assign_clusters(ret[-1][0])
-        clusters, parents = self.cluster_on(ret[-1][0])
-        safe = parents>=0
-        sizes = numpy.bincount(parents[safe], weights=ret[-1][2][safe], minlength=clusters.shape[0])
-      
+    # Cluster every level in one go, each seeded from the modes of the previous level...
+    levels = self.cluster_scales(scales, callback)
+    
+    # Convert into the hierarchy, starting with level 0, the original data...
+    ret = [[self.fetch_dm(), None, self.fetch_weight()]]
+    
+    for clusters, parents, sizes in levels:
       ret[-1][1] = parents
       ret.append([clusters, None, sizes])
     
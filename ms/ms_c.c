@@ -39,6 +39,9 @@ void MeanShift_new(MeanShift * this)
  this->ident_dist = 0.0;
  this->merge_range = 0.5;
  this->merge_check_step = 4;
+ this->threads = 1;
+ 
+ Counters_zero(&this->counters);
  
  this->rng_link = NULL;
  int i;
@@ -124,6 +127,14 @@ static PyObject * MeanShift_get_range_py(MeanShift * self, PyObject * args)
 }
 
 
+static PyObject * MeanShift_get_error_py(MeanShift * self, PyObject * args)
+{
+ int dims = DataMatrix_features(&self->dm);
+ float error = self->kernel->error(dims, self->config);
+ return Py_BuildValue("f", error);
+}
+
+
 static PyObject * MeanShift_set_kernel_py(MeanShift * self, PyObject * args)
 {
  // Parse the parameters...
@@ -265,7 +276,8 @@ static PyObject * MeanShift_set_spatial_py(MeanShift * self, PyObject * args)
 {
  // Parse the parameters...
   char * sname;
-  if (!PyArg_ParseTuple(args, "s", &sname)) return NULL;
+  float param = 0.1;
+  if (!PyArg_ParseTuple(args, "s|f", &sname, &param)) return NULL;
  
  // Try and find the relevant indexing method - if found assign it and return...
   int i = 0;
@@ -274,6 +286,7 @@ static PyObject * MeanShift_set_spatial_py(MeanShift * self, PyObject * args)
    if (strcmp(ListSpatial[i]->name, sname)==0)
    {
     self->spatial_type = ListSpatial[i];
+    self->spatial_param = param;
     
     if (self->spatial!=NULL)
     {
@@ -490,6 +503,7 @@ static PyObject * MeanShift_copy_all_py(MeanShift * self, PyObject * args)
   self->ident_dist = other->ident_dist;
   self->merge_range = other->merge_range;
   self->merge_check_step = other->merge_check_step;
+  self->threads = other->threads;
   
  // Return None...
   Py_INCREF(Py_None);
@@ -576,7 +590,8 @@ static PyObject * MeanShift_set_data_py(MeanShift * self, PyObject * args)
   char * dim_types;
   PyObject * weight_index = NULL;
   char * conv_codes = NULL;
-  if (!PyArg_ParseTuple(args, "O!s|Os", &PyArray_Type, &data, &dim_types, &weight_index, &conv_codes)) return NULL;
+  PyObject * convert_all = NULL;
+  if (!PyArg_ParseTuple(args, "O!s|OsO", &PyArray_Type, &data, &dim_types, &weight_index, &conv_codes, &convert_all)) return NULL;
   
   if ((conv_codes!=NULL)&&(conv_codes[0]==0)) conv_codes = NULL;
   
@@ -685,6 +700,11 @@ static PyObject * MeanShift_set_data_py(MeanShift * self, PyObject * args)
   DataMatrix_set(&self->dm, data, dt, weight_i, conv_codes);
   free(dt);
   
+  if ((convert_all!=NULL)&&(PyObject_IsTrue(convert_all)))
+  {
+   DataMatrix_convert_all(&self->dm);
+  }
+  
  // Setup the temporaries kept with the mean shift object...
   self->fv_int = (float*)realloc(self->fv_int, DataMatrix_features(&self->dm) * sizeof(float));
   self->fv_ext = (float*)realloc(self->fv_ext, DataMatrix_ext_features(&self->dm) * sizeof(float));
@@ -713,6 +733,186 @@ static PyObject * MeanShift_set_data_py(MeanShift * self, PyObject * args)
 }
 
 
+static PyObject * MeanShift_set_cache_py(MeanShift * self, PyObject * args)
+{
+ // Extract the parameters...
+  PyObject * enable;
+  char * fn = NULL;
+  if (!PyArg_ParseTuple(args, "O|s", &enable, &fn)) return NULL;
+  
+  if ((fn!=NULL)&&(fn[0]==0)) fn = NULL;
+  
+ // Turn it on or off as requested...
+  if (PyObject_IsTrue(enable))
+  {
+   if (self->dm.array==NULL)
+   {
+    PyErr_SetString(PyExc_RuntimeError, "set_data must be called before set_cache.");
+    return NULL;
+   }
+   
+   if (DataMatrix_cache(&self->dm, fn)==0)
+   {
+    PyErr_SetString(PyExc_RuntimeError, "failed to create the memory map for the cache.");
+    return NULL;
+   }
+  }
+  else
+  {
+   DataMatrix_cache_off(&self->dm);
+  }
+ 
+ // Return None...
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+// Helper for the below - if the spatial can not be edited it has to go, to be rebuilt when next needed...
+void MeanShift_edit_spatial(MeanShift * self)
+{
+ if ((self->spatial!=NULL)&&(Spatial_editable(self->spatial)==0))
+ {
+  Spatial_delete(self->spatial);
+  self->spatial = NULL;
+ }
+}
+
+
+static PyObject * MeanShift_add_py(MeanShift * self, PyObject * args)
+{
+ // Extract the parameters...
+  PyObject * obj;
+  if (!PyArg_ParseTuple(args, "O", &obj)) return NULL;
+  
+  if (DataMatrix_editable(&self->dm)==0)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "add requires a data matrix set with dimension types 'df'.");
+   return NULL;
+  }
+  
+ // Convert to the type of the data matrix and check the shape - a single row is allowed...
+  PyArrayObject * rows = (PyArrayObject*)PyArray_FROM_OTF(obj, PyArray_TYPE(self->dm.array), NPY_ARRAY_IN_ARRAY);
+  if (rows==NULL) return NULL;
+  
+  npy_intp cols = PyArray_DIMS(self->dm.array)[1];
+  int count = 0;
+  
+  if ((PyArray_NDIM(rows)==1)&&(PyArray_DIMS(rows)[0]==cols)) count = 1;
+  if ((PyArray_NDIM(rows)==2)&&(PyArray_DIMS(rows)[1]==cols)) count = PyArray_DIMS(rows)[0];
+  
+  if ((count==0)&&(PyArray_SIZE(rows)!=0))
+  {
+   Py_DECREF(rows);
+   PyErr_SetString(PyExc_RuntimeError, "rows to add must be a 2D array with the same number of columns as the data matrix, or a single row.");
+   return NULL;
+  }
+  
+ // Add them to the data matrix...
+  int start = DataMatrix_exemplars(&self->dm);
+  DataMatrix_append(&self->dm, PyArray_DATA(rows), count);
+  Py_DECREF(rows);
+  
+ // Update the spatial and the weight...
+  MeanShift_edit_spatial(self);
+  
+  int i;
+  for (i=start; i<start+count; i++)
+  {
+   if (self->spatial!=NULL) Spatial_add(self->spatial, i);
+   
+   if (self->weight>=0.0)
+   {
+    float w;
+    DataMatrix_fv(&self->dm, i, &w);
+    self->weight += w;
+   }
+  }
+  
+  self->norm = -1.0; // Recalculated from the weight when next needed.
+ 
+ // Return None...
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+int compare_intp_descending(const void * lhs, const void * rhs)
+{
+ npy_intp l = *(const npy_intp*)lhs;
+ npy_intp r = *(const npy_intp*)rhs;
+ 
+ if (l>r) return -1;
+ if (l<r) return 1;
+ return 0;
+}
+
+
+static PyObject * MeanShift_remove_py(MeanShift * self, PyObject * args)
+{
+ // Extract the parameters...
+  PyObject * obj;
+  if (!PyArg_ParseTuple(args, "O", &obj)) return NULL;
+  
+  if (DataMatrix_editable(&self->dm)==0)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "remove requires a data matrix set with dimension types 'df'.");
+   return NULL;
+  }
+  
+ // Get the indices, sorted from highest to lowest, and check they are all valid...
+  PyArrayObject * indices = (PyArrayObject*)PyArray_FROM_OTF(obj, NPY_INTP, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSURECOPY);
+  if (indices==NULL) return NULL;
+  
+  int count = PyArray_SIZE(indices);
+  npy_intp * index = (npy_intp*)PyArray_DATA(indices);
+  qsort(index, count, sizeof(npy_intp), compare_intp_descending);
+  
+  int exemplars = DataMatrix_exemplars(&self->dm);
+  if ((count!=0)&&((index[0]>=exemplars)||(index[count-1]<0)))
+  {
+   Py_DECREF(indices);
+   PyErr_SetString(PyExc_IndexError, "exemplar index to remove is out of range.");
+   return NULL;
+  }
+  
+ // Remove them in turn, skipping duplicates - because we go from highest to lowest the exemplar moved into each hole is never one that is yet to be removed...
+  MeanShift_edit_spatial(self);
+  
+  int i;
+  for (i=0; i<count; i++)
+  {
+   if ((i!=0)&&(index[i]==index[i-1])) continue;
+   
+   int last = DataMatrix_exemplars(&self->dm) - 1;
+   
+   if (self->weight>=0.0)
+   {
+    float w;
+    DataMatrix_fv(&self->dm, index[i], &w);
+    self->weight -= w;
+   }
+   
+   if (self->spatial!=NULL)
+   {
+    Spatial_remove(self->spatial, index[i]);
+    if (index[i]!=last) Spatial_remove(self->spatial, last);
+   }
+   
+   DataMatrix_remove(&self->dm, index[i]);
+   
+   if ((self->spatial!=NULL)&&(index[i]!=last)) Spatial_add(self->spatial, index[i]);
+  }
+  
+  Py_DECREF(indices);
+  self->norm = -1.0;
+ 
+ // Return None...
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
 static PyObject * MeanShift_get_dm_py(MeanShift * self, PyObject * args)
 {
  if (self->dm.array!=NULL) // Verify that there is a data matrix to in fact return!
@@ -1018,6 +1218,7 @@ static PyObject * MeanShift_scale_silverman_py(MeanShift * self, PyObject * args
   int features = DataMatrix_features(&self->dm);
   
   for (i=0; i<features; i++) self->dm.mult[i] = 1.0;
+  DataMatrix_scale_changed(&self->dm);
   
  // Use Silverman's rule of thumb to calculate scale values...
   float weight = 0.0;
@@ -1098,6 +1299,7 @@ static PyObject * MeanShift_scale_scott_py(MeanShift * self, PyObject * args)
   int features = DataMatrix_features(&self->dm);
   
   for (i=0; i<features; i++) self->dm.mult[i] = 1.0;
+  DataMatrix_scale_changed(&self->dm);
  
  // Use Silverman's rule fo thumb to calculate scale values...   
   float weight = 0.0;
@@ -1189,18 +1391,23 @@ static PyObject * MeanShift_loo_nll_py(MeanShift * self, PyObject * args)
   }
   
  // Calculate the probability...
+  Query query;
+  Query_init(&query, self->spatial, &self->counters);
+  
   float nll;
   if (sample_limit>0)
   {
    PhiloxRNG rng;
    PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
  
-   nll = loo_nll(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, sample_limit, &rng);
+   nll = loo_nll(&query, self->kernel, self->config, self->norm, self->quality, limit, sample_limit, &rng);
   }
   else
   {
-   nll = loo_nll(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, 0, NULL);
+   nll = loo_nll(&query, self->kernel, self->config, self->norm, self->quality, limit, 0, NULL);
   }
+  
+  Query_deinit(&query);
  
  // Return it...
   return Py_BuildValue("f", nll);
@@ -1227,87 +1434,176 @@ static PyObject * MeanShift_entropy_py(MeanShift * self, PyObject * args)
   }
   
  // Calculate and return...
+  Query query;
+  Query_init(&query, self->spatial, &self->counters);
+  
   float ret;
   if (sample_limit>0)
   {
    PhiloxRNG rng;
    PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
  
-   ret = entropy(self->spatial, self->kernel, self->config, self->norm, self->quality, sample_limit, &rng);
+   ret = entropy(&query, self->kernel, self->config, self->norm, self->quality, sample_limit, &rng);
   }
   else
   {
-   ret = entropy(self->spatial, self->kernel, self->config, self->norm, self->quality, 0, NULL);
+   ret = entropy(&query, self->kernel, self->config, self->norm, self->quality, 0, NULL);
   }
   
+  Query_deinit(&query);
+  
   return Py_BuildValue("f", ret);
 }
 
 
-static PyObject * MeanShift_kl_py(MeanShift * self, PyObject * args)
+// Progress callback for loo_nll_scales that calls a Python callable, abandoning the calculation if it raises an exception...
+static int sweep_progress(void * data, int step, int steps)
 {
- // Get the parameters - another mean shift object and an optional limit...
-  MeanShift * other;
+ PyObject * ret = PyObject_CallFunction((PyObject*)data, "ii", step, steps);
+ if (ret==NULL) return 1;
+ Py_DECREF(ret);
+ return 0;
+}
+
+
+static PyObject * MeanShift_sweep_scales_py(MeanShift * self, PyObject * args)
+{
+ // Extract the parameters...
+  PyArrayObject * scales;
   float limit = 1e-16;
   int sample_limit = -1;
-  if (!PyArg_ParseTuple(args, "O!|fi", &MeanShiftType, &other, &limit, &sample_limit)) return NULL;
+  PyObject * callback = NULL;
+  if (!PyArg_ParseTuple(args, "O!|fiO", &PyArray_Type, &scales, &limit, &sample_limit, &callback)) return NULL;
+  if (callback==Py_None) callback = NULL;
   
- // Make sure the required data structures for self are ready...
-  if (self->spatial==NULL)
+  if ((self->kernel==&Fisher)||(self->kernel==&MirrorFisher))
   {
-   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+   PyErr_SetString(PyExc_RuntimeError, "sweep_scales does not support the directional kernels (fisher and mirror_fisher), as scaling the data does not change their width - vary the concentration instead, e.g. with scale_loo_nll_array.");
+   return NULL;
   }
   
-  if (self->norm<0.0)
+  int features = DataMatrix_features(&self->dm);
+  if ((PyArray_NDIM(scales)!=2)||(PyArray_DIMS(scales)[1]!=features))
   {
-   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+   PyErr_SetString(PyExc_RuntimeError, "scales must be a 2D numpy array, [scale, feature], with the number of features after any conversion.");
+   return NULL;
   }
   
- // Ditto for other...
-  if (other->spatial==NULL)
+ // Extract the scales, and calculate the base scale - the minimum of each feature...
+  int count = PyArray_DIMS(scales)[0];
+  ToFloat atof = KindToFunc(PyArray_DESCR(scales));
+  
+  float * scale = (float*)malloc(count * features * sizeof(float));
+  float * base = (float*)malloc(features * sizeof(float));
+  float * norm = (float*)malloc(count * sizeof(float));
+  float * old = (float*)malloc(features * sizeof(float));
+  
+  int i, j;
+  for (j=0; j<features; j++) base[j] = 0.0;
+  for (i=0; i<count; i++)
   {
-   other->spatial = Spatial_new(other->spatial_type, &other->dm, self->spatial_param); 
+   for (j=0; j<features; j++)
+   {
+    scale[i*features + j] = atof(PyArray_GETPTR2(scales, i, j));
+    if ((i==0)||(scale[i*features + j]<base[j])) base[j] = scale[i*features + j];
+   }
   }
   
-  if (other->norm<0.0)
+  for (j=0; j<features; j++) old[j] = self->dm.mult[j];
+  
+ // Calculate the normalising constant for each scale, same as calc_norm...
+  float weight = MeanShift_weight(self);
+  float kernel_norm = self->kernel->norm(features, self->config);
+  for (i=0; i<count; i++)
   {
-   other->norm = calc_norm(&other->dm, other->kernel, other->config, MeanShift_weight(other));
+   norm[i] = kernel_norm / weight;
+   for (j=0; j<features; j++) norm[i] *= scale[i*features + j];
   }
- 
- // Calculate and return...
-  float ret;
-  if (sample_limit>0)
+  
+ // Create the output...
+  npy_intp dims = count;
+  PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(1, &dims, NPY_FLOAT32);
+  float * out = (float*)PyArray_DATA(ret);
+  
+ // Do the work - if the kernel supports it with a single spatial index at the base scale, otherwise by brute force...
+  PhiloxRNG rng;
+  PhiloxRNG * rng_ptr = NULL;
+  if (sample_limit>0) rng_ptr = &rng;
+  else sample_limit = 0;
+  
+  int abort = 0;
+  
+  if (loo_nll_scales_valid(self->kernel, self->config))
   {
-   PhiloxRNG rng;
+   DataMatrix_set_scale(&self->dm, base, self->dm.weight_scale);
+   Spatial spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param);
+   
+   Query query;
+   Query_init(&query, spatial, &self->counters);
+   
    PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
- 
-   ret = kl_divergence(self->spatial, self->kernel, self->config, self->norm, self->quality, other->spatial, other->kernel, other->config, other->norm, other->quality, limit, sample_limit, &rng);
+   abort = loo_nll_scales(&query, self->kernel, self->config, count, scale, norm, self->quality, limit, sample_limit, rng_ptr, out, (callback!=NULL) ? sweep_progress : NULL, callback);
+   
+   Query_deinit(&query);
+   Spatial_delete(spatial);
   }
   else
   {
-   ret = kl_divergence(self->spatial, self->kernel, self->config, self->norm, self->quality, other->spatial, other->kernel, other->config, other->norm, other->quality, limit, 0, NULL);
+   for (i=0; i<count; i++)
+   {
+    if (callback!=NULL)
+    {
+     abort = sweep_progress(callback, i, count);
+     if (abort!=0) break;
+    }
+    
+    DataMatrix_set_scale(&self->dm, scale + i*features, self->dm.weight_scale);
+    Spatial spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param);
+    
+    Query query;
+    Query_init(&query, spatial, &self->counters);
+    
+    PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
+    out[i] = loo_nll(&query, self->kernel, self->config, norm[i], self->quality, limit, sample_limit, rng_ptr);
+    
+    Query_deinit(&query);
+    Spatial_delete(spatial);
+   }
+  }
+  
+ // Put the scale back, so the cached spatial etc remain valid, and clean up...
+  DataMatrix_set_scale(&self->dm, old, self->dm.weight_scale);
+  
+  free(old);
+  free(norm);
+  free(base);
+  free(scale);
+  
+  if (abort!=0)
+  {
+   Py_DECREF(ret);
+   return NULL;
   }
   
-  return Py_BuildValue("f", ret);
+ return (PyObject*)ret;
 }
 
 
 
-static PyObject * MeanShift_prob_py(MeanShift * self, PyObject * args)
+static PyObject * MeanShift_loo_nll_approx_py(MeanShift * self, PyObject * args)
 {
- // Get the argument - a feature vector... 
-  PyArrayObject * start;
-  if (!PyArg_ParseTuple(args, "O!", &PyArray_Type, &start)) return NULL;
+ // Extract the tolerance and limits from the parameters...
+  float tolerance;
+  float limit = 1e-16;
+  int sample_limit = -1;
+  if (!PyArg_ParseTuple(args, "f|fi", &tolerance, &limit, &sample_limit)) return NULL;
   
- // Check the input is acceptable...
-  npy_intp feats = DataMatrix_ext_features(&self->dm);
-  if ((PyArray_NDIM(start)!=1)||(PyArray_DIMS(start)[0]!=feats))
+  if (limit<=0.0)
   {
-   PyErr_SetString(PyExc_RuntimeError, "input vector must be 1D with the same length as the number of features.");
+   PyErr_SetString(PyExc_RuntimeError, "minimum probability must be positive, or the bound is infinite");
    return NULL;
   }
-  ToFloat atof = KindToFunc(PyArray_DESCR(start));
-  
+ 
  // If spatial is null create it...
   if (self->spatial==NULL)
   {
@@ -1319,41 +1615,40 @@ static PyObject * MeanShift_prob_py(MeanShift * self, PyObject * args)
   {
    self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
   }
+  
+ // Calculate the probability...
+  Query query;
+  Query_init(&query, self->spatial, &self->counters);
+  
+  float nll;
+  float bound;
+  if (sample_limit>0)
+  {
+   PhiloxRNG rng;
+   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
  
- // Create a temporary to hold the feature vector; handle conversion...
-  int i;
-  for (i=0; i<feats; i++)
+   nll = loo_nll_approx(&query, self->kernel, self->config, self->norm, self->quality, limit, sample_limit, &rng, tolerance, &bound);
+  }
+  else
   {
-   self->fv_ext[i] = atof(PyArray_GETPTR1(start, i));
+   nll = loo_nll_approx(&query, self->kernel, self->config, self->norm, self->quality, limit, 0, NULL, tolerance, &bound);
   }
   
-  float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
-  
- // Calculate the probability...
-  float p = prob(self->spatial, self->kernel, self->config, fv, self->norm, self->quality);
+  Query_deinit(&query);
  
- // Return the calculated probability...
-  return Py_BuildValue("f", p);
+ // Return it, with its bound...
+  return Py_BuildValue("(ff)", nll, bound);
 }
 
 
 
-static PyObject * MeanShift_probs_py(MeanShift * self, PyObject * args)
+static PyObject * MeanShift_entropy_approx_py(MeanShift * self, PyObject * args)
 {
- // Get the argument - a data matrix... 
-  PyArrayObject * start;
-  float clamp = 0.0;
-  if (!PyArg_ParseTuple(args, "O!|f", &PyArray_Type, &start, &clamp)) return NULL;
-
- // Check the input is acceptable...
-  npy_intp feats = DataMatrix_ext_features(&self->dm);
-  if ((PyArray_NDIM(start)!=2)||(PyArray_DIMS(start)[1]!=feats))
-  {
-   PyErr_SetString(PyExc_RuntimeError, "input matrix must be 2D with the same length as the number of features in the second dimension");
-   return NULL;
-  }
-  ToFloat atof = KindToFunc(PyArray_DESCR(start));
-
+ // Extract the tolerance and limit from the parameters...
+  float tolerance;
+  int sample_limit = -1;
+  if (!PyArg_ParseTuple(args, "f|i", &tolerance, &sample_limit)) return NULL;
+  
  // If spatial is null create it...
   if (self->spatial==NULL)
   {
@@ -1366,45 +1661,515 @@ static PyObject * MeanShift_probs_py(MeanShift * self, PyObject * args)
    self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
   }
   
- // Create the output array... 
-  PyArrayObject * out = (PyArrayObject*)PyArray_SimpleNew(1, PyArray_DIMS(start), NPY_FLOAT32);
-  
+ // Calculate and return, with its bound...
+  Query query;
+  Query_init(&query, self->spatial, &self->counters);
   
- // Run the algorithm...
-  int i;
-  for (i=0; i<PyArray_DIMS(start)[0]; i++)
+  float ret;
+  float bound;
+  if (sample_limit>0)
   {
-   // Copy the feature vector into the temporary storage...
-    int j;
-    for (j=0; j<feats; j++)
-    {
-     self->fv_ext[j] = atof(PyArray_GETPTR2(start, i, j));
-    }
-    
-   // Convert...
-    float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
-   
-   // Calculate the probability...
-    float p = prob(self->spatial, self->kernel, self->config, fv, self->norm, self->quality);
-   
-   // Store it...
-    if (p>clamp)
-    {
-     *(float*)PyArray_GETPTR1(out, i) = p;
-    }
-    else
-    {
-     *(float*)PyArray_GETPTR1(out, i) = clamp;
-    }
-  }
+   PhiloxRNG rng;
+   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
  
- // Return the assigned clusters...
-  return (PyObject*)out;
+   ret = entropy_approx(&query, self->kernel, self->config, self->norm, self->quality, sample_limit, &rng, tolerance, &bound);
+  }
+  else
+  {
+   ret = entropy_approx(&query, self->kernel, self->config, self->norm, self->quality, 0, NULL, tolerance, &bound);
+  }
+  
+  Query_deinit(&query);
+  
+  return Py_BuildValue("(ff)", ret, bound);
 }
 
 
-
-static PyObject * MeanShift_draw_py(MeanShift * self, PyObject * args)
+static PyObject * MeanShift_kl_py(MeanShift * self, PyObject * args)
+{
+ // Get the parameters - another mean shift object and an optional limit...
+  MeanShift * other;
+  float limit = 1e-16;
+  int sample_limit = -1;
+  if (!PyArg_ParseTuple(args, "O!|fi", &MeanShiftType, &other, &limit, &sample_limit)) return NULL;
+  
+ // Make sure the required data structures for self are ready...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+  }
+  
+  if (self->norm<0.0)
+  {
+   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+  }
+  
+ // Ditto for other...
+  if (other->spatial==NULL)
+  {
+   other->spatial = Spatial_new(other->spatial_type, &other->dm, self->spatial_param); 
+  }
+  
+  if (other->norm<0.0)
+  {
+   other->norm = calc_norm(&other->dm, other->kernel, other->config, MeanShift_weight(other));
+  }
+ 
+ // Calculate and return...
+  Query query_p;
+  Query_init(&query_p, self->spatial, &self->counters);
+  
+  Query query_q;
+  Query_init(&query_q, other->spatial, &other->counters);
+  
+  float ret;
+  if (sample_limit>0)
+  {
+   PhiloxRNG rng;
+   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
+ 
+   ret = kl_divergence(&query_p, self->kernel, self->config, self->norm, self->quality, &query_q, other->kernel, other->config, other->norm, other->quality, limit, sample_limit, &rng);
+  }
+  else
+  {
+   ret = kl_divergence(&query_p, self->kernel, self->config, self->norm, self->quality, &query_q, other->kernel, other->config, other->norm, other->quality, limit, 0, NULL);
+  }
+  
+  Query_deinit(&query_q);
+  Query_deinit(&query_p);
+  
+  return Py_BuildValue("f", ret);
+}
+
+
+
+// Support for the batch methods, which process many feature vectors at once and spread them over multiple threads - each thread gets its own Query and temporaries. The Python GIL is released whilst they run, so no Python objects may be touched, but reading/writing numpy arrays through their data pointers is fine...
+typedef struct BatchThread BatchThread;
+
+struct BatchThread
+{
+ Query query;
+ 
+ float * fv_ext; // Length of an external feature vector.
+ float * fv_int; // Length of an internal feature vector.
+ float * temp; // Length of an internal feature vector.
+ float * ext_block; // CONVERT_BLOCK external feature vectors, for Batch_convert.
+ 
+ float * hess; // Only for manifold - length of an internal feature vector squared.
+ float * eigen_vec; // "
+ float * eigen_val; // Only for manifold - length of an internal feature vector.
+ 
+ TileCache tc; // Only for tiled probs.
+};
+
+typedef struct Batch Batch;
+
+struct Batch
+{
+ MeanShift * self;
+ int threads;
+ 
+ PyArrayObject * in; // Input matrix of feature vectors, NULL if processing the data matrix.
+ ToFloat atof; // For the above.
+ PyArrayObject * out; // Output array.
+ 
+ float clamp; // For probs.
+ int tile; // For probs - tile size if tiling, 0 to do each point independently.
+ float * fv_block; // Every input feature vector in internal format, [rows, internal features] - see Batch_convert. NULL if not converted in advance.
+ int * order; // For tiled probs - the tile ordering of the rows.
+ int degrees; // For manifolds.
+ int always_hessian; // "
+ 
+ BatchThread * thread;
+};
+
+
+
+void Batch_init(Batch * this, MeanShift * self, PyArrayObject * in, PyArrayObject * out, int manifold)
+{
+ this->self = self;
+ this->threads = thread_count(self->threads);
+ 
+ this->in = in;
+ this->atof = (in!=NULL) ? KindToFunc(PyArray_DESCR(in)) : NULL;
+ this->out = out;
+ 
+ this->clamp = 0.0;
+ this->tile = 0;
+ this->fv_block = NULL;
+ this->order = NULL;
+ this->degrees = 0;
+ this->always_hessian = 1;
+ 
+ int feats_ext = DataMatrix_ext_features(&self->dm);
+ int feats_int = DataMatrix_features(&self->dm);
+ 
+ this->thread = (BatchThread*)malloc(this->threads * sizeof(BatchThread));
+ 
+ int i;
+ for (i=0; i<this->threads; i++)
+ {
+  BatchThread * bt = &this->thread[i];
+  
+  Query_init(&bt->query, self->spatial, &self->counters);
+  bt->fv_ext = (float*)malloc(feats_ext * sizeof(float));
+  bt->fv_int = (float*)malloc(feats_int * sizeof(float));
+  bt->temp = (float*)malloc(feats_int * sizeof(float));
+  bt->ext_block = (float*)malloc(CONVERT_BLOCK * feats_ext * sizeof(float));
+  TileCache_init(&bt->tc, feats_int);
+  
+  if (manifold!=0)
+  {
+   bt->hess = (float*)malloc(feats_int * feats_int * sizeof(float));
+   bt->eigen_vec = (float*)malloc(feats_int * feats_int * sizeof(float));
+   bt->eigen_val = (float*)malloc(feats_int * sizeof(float));
+  }
+  else
+  {
+   bt->hess = NULL;
+   bt->eigen_vec = NULL;
+   bt->eigen_val = NULL;
+  }
+ }
+}
+
+
+void Batch_deinit(Batch * this)
+{
+ int i;
+ for (i=0; i<this->threads; i++)
+ {
+  BatchThread * bt = &this->thread[i];
+  
+  free(bt->eigen_val);
+  free(bt->eigen_vec);
+  free(bt->hess);
+  TileCache_deinit(&bt->tc);
+  free(bt->ext_block);
+  free(bt->temp);
+  free(bt->fv_int);
+  free(bt->fv_ext);
+  Query_deinit(&bt->query);
+ }
+ 
+ free(this->thread);
+ free(this->order);
+ free(this->fv_block);
+}
+
+
+// Runs the given task over count items, with the GIL released...
+void Batch_run(Batch * this, ThreadTask task, int count, int chunk)
+{
+ Py_BEGIN_ALLOW_THREADS
+  thread_run(task, this, count, chunk, this->threads);
+ Py_END_ALLOW_THREADS
+}
+
+
+// Returns row j of the input matrix, in the internal format - the returned pointer is to storage in the BatchThread, or into fv_block if the input has been converted in advance; either way it can be edited...
+float * Batch_in(Batch * this, BatchThread * bt, int j)
+{
+ if (this->fv_block!=NULL) return this->fv_block + j * DataMatrix_features(&this->self->dm);
+ 
+ int feats_ext = DataMatrix_ext_features(&this->self->dm);
+ 
+ int i;
+ for (i=0; i<feats_ext; i++)
+ {
+  bt->fv_ext[i] = this->atof(PyArray_GETPTR2(this->in, j, i));
+ }
+ 
+ return DataMatrix_to_int(&this->self->dm, bt->fv_ext, bt->fv_int);
+}
+
+
+// Fetches exemplar j from the data matrix into bt->fv_int...
+float * Batch_dm(Batch * this, BatchThread * bt, int j)
+{
+ int feats_int = DataMatrix_features(&this->self->dm);
+ float * fv = Query_fv(&bt->query, j, NULL);
+ 
+ int i;
+ for (i=0; i<feats_int; i++) bt->fv_int[i] = fv[i];
+ 
+ return bt->fv_int;
+}
+
+
+// Converts an internal feature vector back to external and writes it into row j of the output, which is assumed to be 2D, or, if flat is non-zero, a contiguous block of rows...
+void Batch_out(Batch * this, BatchThread * bt, int j, float * fv, int flat)
+{
+ int feats_ext = DataMatrix_ext_features(&this->self->dm);
+ fv = DataMatrix_to_ext(&this->self->dm, fv, bt->fv_ext);
+ 
+ int i;
+ if (flat!=0)
+ {
+  float * out = (float*)PyArray_DATA(this->out) + j * feats_ext;
+  for (i=0; i<feats_ext; i++) out[i] = fv[i];
+ }
+ else
+ {
+  for (i=0; i<feats_ext; i++)
+  {
+   *(float*)PyArray_GETPTR2(this->out, j, i) = fv[i];
+  }
+ }
+}
+
+
+
+// The tasks for the various batch methods...
+void probs_task(void * data, int thread, int start, int end)
+{
+ Batch * this = (Batch*)data;
+ BatchThread * bt = &this->thread[thread];
+ MeanShift * self = this->self;
+ 
+ int j;
+ for (j=start; j<end; j++)
+ {
+  float * fv = Batch_in(this, bt, j);
+  float p = prob(&bt->query, self->kernel, self->config, fv, self->norm, self->quality);
+  
+  *(float*)PyArray_GETPTR1(this->out, j) = (p>this->clamp) ? p : this->clamp;
+ }
+}
+
+
+// Converts the input rows into the internal format, storing them in fv_block - done CONVERT_BLOCK rows at a time, so the block convertors can be used...
+void convert_task(void * data, int thread, int start, int end)
+{
+ Batch * this = (Batch*)data;
+ BatchThread * bt = &this->thread[thread];
+ int feats_ext = DataMatrix_ext_features(&this->self->dm);
+ int feats_int = DataMatrix_features(&this->self->dm);
+ 
+ int base, j, i;
+ for (base=start; base<end; base+=CONVERT_BLOCK)
+ {
+  int n = end - base;
+  if (n>CONVERT_BLOCK) n = CONVERT_BLOCK;
+  
+  for (j=0; j<n; j++)
+  {
+   for (i=0; i<feats_ext; i++)
+   {
+    bt->ext_block[j*feats_ext + i] = this->atof(PyArray_GETPTR2(this->in, base+j, i));
+   }
+  }
+  
+  DataMatrix_to_int_block(&this->self->dm, n, bt->ext_block, feats_ext, this->fv_block + base * feats_int, feats_int);
+ }
+}
+
+
+// Converts every row of the input matrix in advance, in bulk, so the tasks can fetch them from fv_block...
+void Batch_convert(Batch * this)
+{
+ int rows = PyArray_DIMS(this->in)[0];
+ int feats_int = DataMatrix_features(&this->self->dm);
+ 
+ this->fv_block = (float*)malloc(rows * feats_int * sizeof(float));
+ Batch_run(this, convert_task, rows, 1024);
+}
+
+
+
+// Each task is an entire tile...
+void probs_tile_task(void * data, int thread, int start, int end)
+{
+ Batch * this = (Batch*)data;
+ BatchThread * bt = &this->thread[thread];
+ MeanShift * self = this->self;
+ 
+ int rows = PyArray_DIMS(this->in)[0];
+ float * out = (float*)PyArray_DATA(this->out);
+ 
+ int t, i;
+ for (t=start; t<end; t++)
+ {
+  int begin = t * this->tile;
+  int count = rows - begin;
+  if (count>this->tile) count = this->tile;
+  
+  probs_tile(&bt->query, self->kernel, self->config, count, this->order + begin, this->fv_block, self->norm, self->quality, out, &bt->tc);
+  
+  for (i=begin; i<begin+count; i++)
+  {
+   int j = this->order[i];
+   if (out[j]<this->clamp) out[j] = this->clamp;
+  }
+ }
+}
+
+
+void modes_task(void * data, int thread, int start, int end)
+{
+ Batch * this = (Batch*)data;
+ BatchThread * bt = &this->thread[thread];
+ MeanShift * self = this->self;
+ 
+ int j;
+ for (j=start; j<end; j++)
+ {
+  float * fv = (this->in!=NULL) ? Batch_in(this, bt, j) : Batch_dm(this, bt, j);
+  mode(&bt->query, self->kernel, self->config, fv, bt->temp, self->quality, self->epsilon, self->iter_cap);
+  Batch_out(this, bt, j, fv, this->in==NULL);
+ }
+}
+
+
+void assign_clusters_task(void * data, int thread, int start, int end)
+{
+ Batch * this = (Batch*)data;
+ BatchThread * bt = &this->thread[thread];
+ MeanShift * self = this->self;
+ 
+ int j;
+ for (j=start; j<end; j++)
+ {
+  float * fv = Batch_in(this, bt, j);
+  *(int*)PyArray_GETPTR1(this->out, j) = assign_cluster(&bt->query, self->kernel, self->config, self->balls, fv, bt->temp, self->quality, self->epsilon, self->iter_cap, self->merge_check_step);
+ }
+}
+
+
+void manifolds_task(void * data, int thread, int start, int end)
+{
+ Batch * this = (Batch*)data;
+ BatchThread * bt = &this->thread[thread];
+ MeanShift * self = this->self;
+ 
+ int j;
+ for (j=start; j<end; j++)
+ {
+  float * fv = (this->in!=NULL) ? Batch_in(this, bt, j) : Batch_dm(this, bt, j);
+  manifold(&bt->query, this->degrees, fv, bt->temp, bt->hess, bt->eigen_val, bt->eigen_vec, self->quality, self->epsilon, self->iter_cap, this->always_hessian);
+  Batch_out(this, bt, j, fv, this->in==NULL);
+ }
+}
+
+
+
+static PyObject * MeanShift_prob_py(MeanShift * self, PyObject * args)
+{
+ // Get the argument - a feature vector... 
+  PyArrayObject * start;
+  if (!PyArg_ParseTuple(args, "O!", &PyArray_Type, &start)) return NULL;
+  
+ // Check the input is acceptable...
+  npy_intp feats = DataMatrix_ext_features(&self->dm);
+  if ((PyArray_NDIM(start)!=1)||(PyArray_DIMS(start)[0]!=feats))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "input vector must be 1D with the same length as the number of features.");
+   return NULL;
+  }
+  ToFloat atof = KindToFunc(PyArray_DESCR(start));
+  
+ // If spatial is null create it...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+  }
+  
+ // Calculate the normalising term if needed...
+  if (self->norm<0.0)
+  {
+   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+  }
+ 
+ // Create a temporary to hold the feature vector; handle conversion...
+  int i;
+  for (i=0; i<feats; i++)
+  {
+   self->fv_ext[i] = atof(PyArray_GETPTR1(start, i));
+  }
+  
+  float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
+  
+ // Calculate the probability...
+  Query query;
+  Query_init(&query, self->spatial, &self->counters);
+  
+  float p = prob(&query, self->kernel, self->config, fv, self->norm, self->quality);
+  
+  Query_deinit(&query);
+ 
+ // Return the calculated probability...
+  return Py_BuildValue("f", p);
+}
+
+
+
+static PyObject * MeanShift_probs_py(MeanShift * self, PyObject * args)
+{
+ // Get the argument - a data matrix... 
+  PyArrayObject * start;
+  float clamp = 0.0;
+  int tile = 0;
+  if (!PyArg_ParseTuple(args, "O!|fi", &PyArray_Type, &start, &clamp, &tile)) return NULL;
+
+ // Check the input is acceptable...
+  npy_intp feats = DataMatrix_ext_features(&self->dm);
+  if ((PyArray_NDIM(start)!=2)||(PyArray_DIMS(start)[1]!=feats))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "input matrix must be 2D with the same length as the number of features in the second dimension");
+   return NULL;
+  }
+
+ // If spatial is null create it...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+  }
+  
+ // Calculate the normalising term if needed...
+  if (self->norm<0.0)
+  {
+   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+  }
+  
+ // Create the output array... 
+  PyArrayObject * out = (PyArrayObject*)PyArray_SimpleNew(1, PyArray_DIMS(start), NPY_FLOAT32);
+  
+ // Run the algorithm, spread over the threads...
+  Batch batch;
+  Batch_init(&batch, self, start, out, 0);
+  batch.clamp = clamp;
+  Batch_convert(&batch);
+  
+  int rows = PyArray_DIMS(start)[0];
+  if (tile<=0)
+  {
+   Batch_run(&batch, probs_task, rows, 64);
+  }
+  else
+  {
+   // Tiled version - convert everything, put it in tile order then do each tile as a task...
+    int feats_int = DataMatrix_features(&self->dm);
+    batch.tile = tile;
+    batch.order = (int*)malloc(rows * sizeof(int));
+    
+    Py_BEGIN_ALLOW_THREADS
+     int i;
+     for (i=0; i<rows; i++) batch.order[i] = i;
+     tile_order(rows, feats_int, batch.fv_block, batch.order, tile);
+    Py_END_ALLOW_THREADS
+    
+    Batch_run(&batch, probs_tile_task, (rows + tile - 1) / tile, 1);
+  }
+  
+  Batch_deinit(&batch);
+ 
+ // Return the probabilities...
+  return (PyObject*)out;
+}
+
+
+
+static PyObject * MeanShift_draw_py(MeanShift * self, PyObject * args)
 {
  // Setup the rng...
   PhiloxRNG rng;
@@ -1537,8 +2302,12 @@ static PyObject * MeanShift_mode_py(MeanShift * self, PyObject * args)
   int feats_int = DataMatrix_features(&self->dm);
   float * temp = (float*)malloc(feats_int * sizeof(float));
   
-  mode(self->spatial, self->kernel, self->config, fv, temp, self->quality, self->epsilon, self->iter_cap);
+  Query query;
+  Query_init(&query, self->spatial, &self->counters);
+  
+  mode(&query, self->kernel, self->config, fv, temp, self->quality, self->epsilon, self->iter_cap);
   
+  Query_deinit(&query);
   free(temp);
   
  // Convert back and write into the output...
@@ -1571,7 +2340,6 @@ static PyObject * MeanShift_modes_py(MeanShift * self, PyObject * args)
    PyErr_SetString(PyExc_RuntimeError, "input matrix must be 2D with the same length as the number of features in the second dimension");
    return NULL;
   }
-  ToFloat atof = KindToFunc(PyArray_DESCR(start));
   
  // If spatial is null create it...
   if (self->spatial==NULL)
@@ -1582,35 +2350,14 @@ static PyObject * MeanShift_modes_py(MeanShift * self, PyObject * args)
  // Create an output matrix...  
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
   
- // Calculate each mode in turn, including conversion both ways...
-  int feats_int = DataMatrix_features(&self->dm);
-  float * temp = (float*)malloc(feats_int * sizeof(float));
-  
-  int j;
-  for (j=0; j<dims[0]; j++)
-  {
-   // Extratc data and convert to internal format...
-    int i;
-    for (i=0; i<dims[1]; i++)
-    {
-     self->fv_ext[i] = atof(PyArray_GETPTR2(start, j, i));
-    }
-  
-    float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
-  
-   // Find the mode...
-    mode(self->spatial, self->kernel, self->config, fv, temp, self->quality, self->epsilon, self->iter_cap);
-   
-   // Convert back and write out...
-    fv = DataMatrix_to_ext(&self->dm, fv, self->fv_ext);
+ // Calculate each mode, including conversion both ways, spread over the threads...
+  Batch batch;
+  Batch_init(&batch, self, start, ret, 0);
+  Batch_convert(&batch);
   
-    for (i=0; i<dims[1]; i++)
-    {
-     *(float*)PyArray_GETPTR2(ret, j, i) = fv[i];
-    }
-  }
+  Batch_run(&batch, modes_task, dims[0], 16);
   
-  free(temp); 
+  Batch_deinit(&batch);
   
  // Return the matrix of modes...
   return (PyObject*)ret;
@@ -1652,37 +2399,15 @@ static PyObject * MeanShift_modes_data_py(MeanShift * self, PyObject * args)
  // Create the output matrix...
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(nd, dims, NPY_FLOAT32);
  
- // Iterate and do each entry in turn...
-  int feats_int = DataMatrix_features(&self->dm);
-  float * temp = (float*)malloc(feats_int * sizeof(float));
+ // Converge each exemplar in turn, spread over the threads - output is written as a contiguous block of feature vectors, one per exemplar...
+  Batch batch;
+  Batch_init(&batch, self, NULL, ret, 0);
   
-  float * out = (float*)PyArray_DATA(ret);
-  int loc = 0;
-  
-  while (loc<DataMatrix_exemplars(&self->dm))
-  {
-   // Get the relevent feature vector...
-    float * fv = DataMatrix_fv(&self->dm, loc, NULL);
-    for (i=0; i<feats_int; i++) self->fv_int[i] = fv[i];
-   
-   // Converge mean shift...
-    mode(self->spatial, self->kernel, self->config, self->fv_int, temp, self->quality, self->epsilon, self->iter_cap);
-    
-   // Undo conversion and copy into out...
-    fv = DataMatrix_to_ext(&self->dm, self->fv_int, self->fv_ext);
+  Batch_run(&batch, modes_task, DataMatrix_exemplars(&self->dm), 16);
   
-    for (i=0; i<dims[nd-1]; i++)
-    {
-     out[i] = fv[i];
-    }
-    
-   // Move to next position, detecting when we are done... 
-    loc += 1;
-    out += dims[nd-1];
-  }
+  Batch_deinit(&batch);
  
  // Clean up...
-  free(temp);
   free(dims);
  
  // Return...
@@ -1728,8 +2453,29 @@ static PyObject * MeanShift_cluster_py(MeanShift * self, PyObject * args)
  // Create the output matrix...
   PyArrayObject * index = (PyArrayObject*)PyArray_SimpleNew(nd, dims, NPY_INT32);
  
- // Do the work...
-  cluster(self->spatial, self->kernel, self->config, self->balls, (int*)PyArray_DATA(index), self->quality, self->epsilon, self->iter_cap, self->ident_dist, self->merge_range, self->merge_check_step);
+ // Do the work - the single threaded version unless threads has been changed from the default of 1...
+  if (self->threads==1)
+  {
+   Query query;
+   Query_init(&query, self->spatial, &self->counters);
+  
+   cluster(&query, self->kernel, self->config, self->balls, (int*)PyArray_DATA(index), self->quality, self->epsilon, self->iter_cap, self->ident_dist, self->merge_range, self->merge_check_step);
+  
+   Query_deinit(&query);
+  }
+  else
+  {
+   int threads = thread_count(self->threads);
+   Query * query = (Query*)malloc(threads * sizeof(Query));
+   for (i=0; i<threads; i++) Query_init(&query[i], self->spatial, &self->counters);
+   
+   Py_BEGIN_ALLOW_THREADS
+    cluster_threaded(query, threads, self->kernel, self->config, self->balls, (int*)PyArray_DATA(index), self->quality, self->epsilon, self->iter_cap, self->ident_dist, self->merge_range, self->merge_check_step);
+   Py_END_ALLOW_THREADS
+   
+   for (i=0; i<threads; i++) Query_deinit(&query[i]);
+   free(query);
+  }
  
  // Extract the modes, which happen to be the centers of the balls...
   dims[0] = Balls_count(self->balls);
@@ -1806,8 +2552,12 @@ static PyObject * MeanShift_assign_cluster_py(MeanShift * self, PyObject * args)
  // Run the algorithm...
   float * temp = (float*)malloc(DataMatrix_features(&self->dm) * sizeof(float));
   
-  int cluster = assign_cluster(self->spatial, self->kernel, self->config, self->balls, fv, temp, self->quality, self->epsilon, self->iter_cap, self->merge_check_step);
+  Query query;
+  Query_init(&query, self->spatial, &self->counters);
   
+  int cluster = assign_cluster(&query, self->kernel, self->config, self->balls, fv, temp, self->quality, self->epsilon, self->iter_cap, self->merge_check_step);
+  
+  Query_deinit(&query);
   free(temp);
  
  // Return the assigned cluster...
@@ -1829,7 +2579,6 @@ static PyObject * MeanShift_assign_clusters_py(MeanShift * self, PyObject * args
    PyErr_SetString(PyExc_RuntimeError, "input vector must be 2D with the second dimension the same length as the number of features.");
    return NULL;
   }
-  ToFloat atof = KindToFunc(PyArray_DESCR(start));
   
  // Verify that cluster has been run...
   if (self->balls==NULL)
@@ -1843,35 +2592,18 @@ static PyObject * MeanShift_assign_clusters_py(MeanShift * self, PyObject * args
   {
    self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
   }
-  
- // Create a temporary array of floats...
-  float * temp = (float*)malloc(DataMatrix_features(&self->dm) * sizeof(float));
 
  // Create the output array... 
   PyArrayObject * cluster = (PyArrayObject*)PyArray_SimpleNew(1, PyArray_DIMS(start), NPY_INT32);
   
- // Run the algorithm...
-  int j;
-  for (j=0; j<PyArray_DIMS(start)[0]; j++)
-  {
-   // Fetch and convert the feature vector...
-    int i;
-    for (i=0; i<feats_ext; i++)
-    {
-     self->fv_ext[i] = atof(PyArray_GETPTR2(start, j, i));
-    }
-    
-    float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
-   
-   // Run it...
-    int c = assign_cluster(self->spatial, self->kernel, self->config, self->balls, fv, temp, self->quality, self->epsilon, self->iter_cap, self->merge_check_step);
-   
-   // Store the result...
-    *(int*)PyArray_GETPTR1(cluster, j) = c;
-  }
+ // Run the algorithm, spread over the threads...
+  Batch batch;
+  Batch_init(&batch, self, start, cluster, 0);
+  Batch_convert(&batch);
   
- // Clean up...
-  free(temp);
+  Batch_run(&batch, assign_clusters_task, PyArray_DIMS(start)[0], 16);
+  
+  Batch_deinit(&batch);
  
  // Return the assigned clusters...
   return (PyObject*)cluster;
@@ -1910,6 +2642,9 @@ static PyObject * MeanShift_cluster_on_py(MeanShift * self, PyObject * args)
   int feats_int = DataMatrix_features(&self->dm);
   float * temp = (float*)malloc(feats_int * sizeof(float));
   
+  Query query;
+  Query_init(&query, self->spatial, &self->counters);
+  
   int j, i;
   for (j=0; j<exemplars; j++)
   {
@@ -1922,7 +2657,7 @@ static PyObject * MeanShift_cluster_on_py(MeanShift * self, PyObject * args)
     float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
     
    // Process...
-    *(int*)PyArray_GETPTR1(index, j) = mode_merge(self->spatial, self->kernel, self->config, balls, fv, temp, self->quality, self->epsilon, self->iter_cap, self->merge_range, self->merge_check_step);
+    *(int*)PyArray_GETPTR1(index, j) = mode_merge(&query, self->kernel, self->config, balls, fv, temp, self->quality, self->epsilon, self->iter_cap, self->merge_range, self->merge_check_step);
   }
   
  // Extract the modes, which are the centers of the balls...
@@ -1952,6 +2687,7 @@ static PyObject * MeanShift_cluster_on_py(MeanShift * self, PyObject * args)
   }
   
  // Clean up...
+  Query_deinit(&query);
   free(temp);
   Balls_delete(balls);
   
@@ -1961,6 +2697,194 @@ static PyObject * MeanShift_cluster_on_py(MeanShift * self, PyObject * args)
 
 
 
+static PyObject * MeanShift_cluster_scales_py(MeanShift * self, PyObject * args)
+{
+ // Extract the parameters...
+  PyArrayObject * scales;
+  PyObject * callback = NULL;
+  if (!PyArg_ParseTuple(args, "O!|O", &PyArray_Type, &scales, &callback)) return NULL;
+  if (callback==Py_None) callback = NULL;
+  
+  int feats_int = DataMatrix_features(&self->dm);
+  int feats_ext = DataMatrix_ext_features(&self->dm);
+  if ((PyArray_NDIM(scales)!=2)||(PyArray_DIMS(scales)[1]!=feats_int)||(PyArray_DIMS(scales)[0]<1))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "scales must be a 2D numpy array, [level, feature], with at least one level and the number of features after any conversion.");
+   return NULL;
+  }
+  
+  int exemplars = DataMatrix_exemplars(&self->dm);
+  if (exemplars==0)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "no exemplars to cluster");
+   return NULL;
+  }
+  
+  int levels = PyArray_DIMS(scales)[0];
+  ToFloat atof = KindToFunc(PyArray_DESCR(scales));
+  
+ // Storage for the seeds of each level, which are the modes of the previous level with the scale divided out, so they can be moved to the next scale without going via the external format - starts out unused as the first level clusters the data itself...
+  int seeds = 0;
+  float * seed = NULL;
+  float * seed_size = NULL;
+  float * temp = (float*)malloc(feats_int * sizeof(float));
+  
+ // Create the return list and loop the levels, clustering each in turn...
+  PyObject * ret = PyList_New(levels);
+  
+  int level, i, j;
+  for (level=0; level<levels; level++)
+  {
+   // Report progress, giving up if the callback raises an exception - the object is left at the scale of the last complete level...
+    if (callback!=NULL)
+    {
+     PyObject * r = PyObject_CallFunction(callback, "ii", level, levels);
+     if (r==NULL)
+     {
+      free(temp);
+      free(seed_size);
+      free(seed);
+      Py_DECREF(ret);
+      
+      self->weight = -1.0;
+      self->norm = -1.0;
+      return NULL;
+     }
+     Py_DECREF(r);
+    }
+    
+   // Set the scale; the spatial index and balls have to be rebuilt for it...
+    for (i=0; i<feats_int; i++) self->fv_int[i] = atof(PyArray_GETPTR2(scales, level, i));
+    DataMatrix_set_scale(&self->dm, self->fv_int, self->dm.weight_scale);
+    
+    if (self->spatial!=NULL) Spatial_delete(self->spatial);
+    self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param);
+    
+    if (self->balls!=NULL) Balls_delete(self->balls);
+    self->balls = Balls_new(self->balls_type, feats_int, self->merge_range);
+    
+   // Do the clustering - the data for the first level, the previous levels modes after that...
+    PyArrayObject * parents;
+    if (level==0)
+    {
+     npy_intp size = exemplars;
+     parents = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_INT32);
+     
+     if (self->threads==1)
+     {
+      Query query;
+      Query_init(&query, self->spatial, &self->counters);
+      
+      cluster(&query, self->kernel, self->config, self->balls, (int*)PyArray_DATA(parents), self->quality, self->epsilon, self->iter_cap, self->ident_dist, self->merge_range, self->merge_check_step);
+      
+      Query_deinit(&query);
+     }
+     else
+     {
+      int threads = thread_count(self->threads);
+      Query * query = (Query*)malloc(threads * sizeof(Query));
+      for (i=0; i<threads; i++) Query_init(&query[i], self->spatial, &self->counters);
+      
+      Py_BEGIN_ALLOW_THREADS
+       cluster_threaded(query, threads, self->kernel, self->config, self->balls, (int*)PyArray_DATA(parents), self->quality, self->epsilon, self->iter_cap, self->ident_dist, self->merge_range, self->merge_check_step);
+      Py_END_ALLOW_THREADS
+      
+      for (i=0; i<threads; i++) Query_deinit(&query[i]);
+      free(query);
+     }
+    }
+    else
+    {
+     npy_intp size = seeds;
+     parents = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_INT32);
+     
+     Query query;
+     Query_init(&query, self->spatial, &self->counters);
+     
+     for (j=0; j<seeds; j++)
+     {
+      for (i=0; i<feats_int; i++) self->fv_int[i] = seed[j*feats_int + i] * self->dm.mult[i];
+      
+      *(int*)PyArray_GETPTR1(parents, j) = mode_merge(&query, self->kernel, self->config, self->balls, self->fv_int, temp, self->quality, self->epsilon, self->iter_cap, self->merge_range, self->merge_check_step);
+     }
+     
+     Query_deinit(&query);
+    }
+   
+   // Sum the weight that ends up in each mode...
+    int modes = Balls_count(self->balls);
+    npy_intp size = modes;
+    PyArrayObject * sizes = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_FLOAT32);
+    float * s = (float*)PyArray_DATA(sizes);
+    for (j=0; j<modes; j++) s[j] = 0.0;
+    
+    if (level==0)
+    {
+     for (j=0; j<exemplars; j++)
+     {
+      int p = *(int*)PyArray_GETPTR1(parents, j);
+      if (p>=0)
+      {
+       float w;
+       DataMatrix_ext_fv(&self->dm, j, &w);
+       s[p] += w;
+      }
+     }
+    }
+    else
+    {
+     for (j=0; j<seeds; j++)
+     {
+      int p = *(int*)PyArray_GETPTR1(parents, j);
+      if (p>=0) s[p] += seed_size[j];
+     }
+    }
+   
+   // Extract the modes, in the external format for the return and in the unscaled internal format as the seeds of the next level...
+    npy_intp dims[2];
+    dims[0] = modes;
+    dims[1] = feats_ext;
+    PyArrayObject * out = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
+    
+    seed = (float*)realloc(seed, (modes>0?modes:1) * feats_int * sizeof(float));
+    seed_size = (float*)realloc(seed_size, (modes>0?modes:1) * sizeof(float));
+    
+    for (j=0; j<modes; j++)
+    {
+     const float * loc = Balls_pos(self->balls, j);
+     for (i=0; i<feats_int; i++)
+     {
+      self->fv_int[i] = loc[i];
+      seed[j*feats_int + i] = loc[i] / self->dm.mult[i];
+     }
+     seed_size[j] = s[j];
+     
+     float * fv = DataMatrix_to_ext(&self->dm, self->fv_int, self->fv_ext);
+     for (i=0; i<feats_ext; i++)
+     {
+      *(float*)PyArray_GETPTR2(out, j, i) = fv[i];
+     }
+    }
+    seeds = modes;
+   
+   // Record the level...
+    PyList_SET_ITEM(ret, level, Py_BuildValue("(N,N,N)", out, parents, sizes));
+  }
+ 
+ // Clean up - the spatial index and balls of the last level are left in place, as they match the scale the object is left with...
+  free(temp);
+  free(seed_size);
+  free(seed);
+  
+  self->weight = -1.0;
+  self->norm = -1.0;
+  
+ // Return the list of levels...
+  return ret;
+}
+
+
+
 static PyObject * MeanShift_manifold_py(MeanShift * self, PyObject * args)
 {
  // Get the argument - a feature vector and degrees of freedom for the manifold... 
@@ -2010,8 +2934,12 @@ static PyObject * MeanShift_manifold_py(MeanShift * self, PyObject * args)
   float * eigen_vec = (float*)malloc(feats_int * feats_int * sizeof(float));
   float * eigen_val = (float*)malloc(feats_int * sizeof(float));
   
-  manifold(self->spatial, degrees, fv, grad, hess, eigen_val, eigen_vec, self->quality, self->epsilon, self->iter_cap, (always_hessian==Py_False) ? 0 : 1);
+  Query query;
+  Query_init(&query, self->spatial, &self->counters);
+  
+  manifold(&query, degrees, fv, grad, hess, eigen_val, eigen_vec, self->quality, self->epsilon, self->iter_cap, (always_hessian==Py_False) ? 0 : 1);
   
+  Query_deinit(&query);
   free(eigen_val);
   free(eigen_vec);
   free(hess);
@@ -2055,7 +2983,6 @@ static PyObject * MeanShift_manifolds_py(MeanShift * self, PyObject * args)
    PyErr_SetString(PyExc_RuntimeError, "input matrix must be 2D with the same length as the number of features in the second dimension");
    return NULL;
   }
-  ToFloat atof = KindToFunc(PyArray_DESCR(start));
   
  // If spatial is null create it...
   if (self->spatial==NULL)
@@ -2066,41 +2993,16 @@ static PyObject * MeanShift_manifolds_py(MeanShift * self, PyObject * args)
  // Create an output matrix...  
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
   
- // Calculate each mode in turn, including undo any scale changes...
-  int feats_int = DataMatrix_features(&self->dm);
-  
-  float * grad = (float*)malloc(feats_int * sizeof(float));
-  float * hess = (float*)malloc(feats_int * feats_int * sizeof(float));
-  float * eigen_vec = (float*)malloc(feats_int * feats_int * sizeof(float));
-  float * eigen_val = (float*)malloc(feats_int * sizeof(float));
+ // Calculate each convergance point, including undo any scale changes, spread over the threads...
+  Batch batch;
+  Batch_init(&batch, self, start, ret, 1);
+  Batch_convert(&batch);
+  batch.degrees = degrees;
+  batch.always_hessian = (always_hessian==Py_False) ? 0 : 1;
   
-  int j, i;
-  for (j=0; j<dims[0]; j++)
-  {
-   // Obtain and convert the feature vector...
-    for (i=0; i<dims[1]; i++)
-    {
-     self->fv_ext[i] = atof(PyArray_GETPTR2(start, j, i));
-    }
-    
-    float * fv =  DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
-   
-   // Find convergance point...
-    manifold(self->spatial, degrees, fv, grad, hess, eigen_val, eigen_vec, self->quality, self->epsilon, self->iter_cap, (always_hessian==Py_False) ? 0 : 1);
-    
-   // Convert back and store...
-    fv = DataMatrix_to_ext(&self->dm, fv, self->fv_ext);
-   
-    for (i=0; i<dims[1]; i++)
-    {
-     *(float*)PyArray_GETPTR2(ret, j, i) = fv[i]; 
-    }
-  }
+  Batch_run(&batch, manifolds_task, dims[0], 4);
   
-  free(eigen_val);
-  free(eigen_vec);
-  free(hess);
-  free(grad);
+  Batch_deinit(&batch);
   
  // Return the matrix of modes...
   return (PyObject*)ret;
@@ -2153,39 +3055,17 @@ static PyObject * MeanShift_manifolds_data_py(MeanShift * self, PyObject * args)
  // Create the output matrix...
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(nd, dims, NPY_FLOAT32);
  
- // Iterate and do each entry in turn...
-  int feats_int = DataMatrix_features(&self->dm);
+ // Converge each exemplar in turn, spread over the threads - output is written as a contiguous block of feature vectors, one per exemplar...
+  Batch batch;
+  Batch_init(&batch, self, NULL, ret, 1);
+  batch.degrees = degrees;
+  batch.always_hessian = (always_hessian==Py_False) ? 0 : 1;
   
-  float * grad = (float*)malloc(feats_int * sizeof(float));
-  float * hess = (float*)malloc(feats_int * feats_int * sizeof(float));
-  float * eigen_vec = (float*)malloc(feats_int * feats_int * sizeof(float));
-  float * eigen_val = (float*)malloc(feats_int * sizeof(float));
+  Batch_run(&batch, manifolds_task, DataMatrix_exemplars(&self->dm), 4);
   
-  float * out = (float*)PyArray_DATA(ret);
-  int loc = 0;
-  while (loc<DataMatrix_exemplars(&self->dm))
-  {
-   // Obtain the relevant feature vector in internal space...
-    float * fv = DataMatrix_fv(&self->dm, loc, NULL);
-    for (i=0; i<feats_int; i++) self->fv_int[i] = fv[i];
-    
-   // Converge mean shift...
-    manifold(self->spatial, degrees, self->fv_int, grad, hess, eigen_val, eigen_vec, self->quality, self->epsilon, self->iter_cap, (always_hessian==Py_False) ? 0 : 1);
-    
-   // Convert to external space and store in output...
-    fv = DataMatrix_to_ext(&self->dm, self->fv_int, self->fv_ext);
-    for (i=0; i<dims[nd-1]; i++) out[i] = fv[i];
-
-   // Move to next position, detecting when we are done... 
-    loc += 1;
-    out += dims[nd-1];
-  }
+  Batch_deinit(&batch);
  
  // Clean up...
-  free(eigen_val);
-  free(eigen_vec);
-  free(hess);
-  free(grad);
   free(dims);
  
  // Return...
@@ -2194,6 +3074,200 @@ static PyObject * MeanShift_manifolds_data_py(MeanShift * self, PyObject * args)
 
 
 
+// Support for doing multiplication with multiple threads - each thread gets its own MultCache and Query objects, whilst each output row gets its own rng stream, so the output does not depend on the thread count...
+typedef struct MultThread MultThread;
+
+struct MultThread
+{
+ MultCache mc;
+ PhiloxRNG rng;
+ unsigned int index[4]; // Index for the above.
+ 
+ Query * ql; // One for each term; NULL if there is only one term.
+ int * temp1;
+ float * temp2;
+ 
+ float * fv_int; // Length of an internal feature vector.
+ float * fv_ext; // Length of an external feature vector.
+ float * temp; // DataMatrix_temp_size of the first term.
+};
+
+typedef struct MultBatch MultBatch;
+
+struct MultBatch
+{
+ MeanShift * self; // First term, which sets the kernel and the output space.
+ int terms;
+ MeanShift ** term;
+ KernelConfig * config;
+ 
+ PyArrayObject * output;
+ unsigned int key[4]; // Index that the rng stream of each row is derived from.
+ int fake;
+ 
+ MultThread * thread;
+};
+
+
+void mult_task(void * data, int thread, int start, int end)
+{
+ MultBatch * this = (MultBatch*)data;
+ MultThread * mt = &this->thread[thread];
+ MeanShift * self = this->self;
+ 
+ int feats_ext = DataMatrix_ext_features(&self->dm);
+ int feats_int = DataMatrix_features(&self->dm);
+ char cd = PyArray_DESCR(this->output)->elsize!=4;
+ 
+ int i, j;
+ for (j=start; j<end; j++)
+ {
+  // Setup the rng for this row...
+   PhiloxRNG_stream(this->key, j, mt->index);
+   PhiloxRNG_init(&mt->rng, mt->index);
+  
+  // Generate the sample, as for the single threaded version...
+   float * fv;
+   if (this->terms==1)
+   {
+    int ind = DataMatrix_draw(&self->dm, &mt->rng);
+    
+    if (this->fake==0)
+    {
+     fv = DataMatrix_fv_temp(&self->dm, ind, NULL, mt->temp);
+     self->kernel->draw(feats_int, self->config, &mt->rng, fv, mt->fv_int);
+     fv = DataMatrix_to_ext(&self->dm, mt->fv_int, mt->fv_ext);
+    }
+    else
+    {
+     fv = DataMatrix_ext_fv_temp(&self->dm, ind, NULL, mt->temp);
+    }
+   }
+   else
+   {
+    mult(self->kernel, this->config, this->terms, mt->ql, mt->fv_int, &mt->mc, mt->temp1, mt->temp2, self->quality, this->fake);
+    
+    for (i=0; i<feats_int; i++)
+    {
+     mt->fv_int[i] *= self->dm.mult[i]; 
+    }
+    
+    fv = DataMatrix_to_ext(&self->dm, mt->fv_int, mt->fv_ext);
+   }
+  
+  // Copy output to actual output array...
+   if (cd)
+   {
+    for (i=0; i<feats_ext; i++)
+    {
+     *(double*)PyArray_GETPTR2(this->output, j, i) = fv[i];
+    }
+   }
+   else
+   {
+    for (i=0; i<feats_ext; i++)
+    {
+     *(float*)PyArray_GETPTR2(this->output, j, i) = fv[i];
+    }
+   }
+ }
+}
+
+
+// Does the work of MeanShift_mult_py with multiple threads, once it has verified its parameters. Takes the rng of the first term, which it advances by one block so repeated calls differ...
+void mult_threaded(MeanShift ** term, int terms, PyArrayObject * output, int gibbs, int mci, int mh, int fake, int longest, int threads, PhiloxRNG * rng)
+{
+ MeanShift * self = term[0];
+ int i, t;
+ 
+ // Setup the shared state - every spatial must exist and every weight_cum be built before the threads start...
+  MultBatch mb;
+  mb.self = self;
+  mb.terms = terms;
+  mb.term = term;
+  mb.output = output;
+  mb.fake = fake;
+  
+  for (i=0; i<4; i++) mb.key[i] = rng->index[i];
+  PhiloxRNG_next(rng);
+  
+  mb.config = NULL;
+  if ((self->config!=NULL)&&(terms>1))
+  {
+   mb.config = (KernelConfig*)malloc(terms * sizeof(KernelConfig));
+   for (t=0; t<terms; t++) mb.config[t] = term[t]->config;
+  }
+  
+  for (t=0; t<terms; t++)
+  {
+   if ((terms>1)&&(term[t]->spatial==NULL))
+   {
+    term[t]->spatial = Spatial_new(term[t]->spatial_type, &term[t]->dm, self->spatial_param);
+   }
+   
+   DataMatrix_prepare_draw(&term[t]->dm);
+  }
+ 
+ // Per-thread state...
+  int feats_ext = DataMatrix_ext_features(&self->dm);
+  int feats_int = DataMatrix_features(&self->dm);
+  
+  mb.thread = (MultThread*)malloc(threads * sizeof(MultThread));
+  for (i=0; i<threads; i++)
+  {
+   MultThread * mt = &mb.thread[i];
+   
+   MultCache_new(&mt->mc);
+   mt->mc.rng = &mt->rng;
+   mt->mc.gibbs_samples = gibbs;
+   mt->mc.mci_samples = mci;
+   mt->mc.mh_proposals = mh;
+   
+   mt->ql = NULL;
+   if (terms>1)
+   {
+    mt->ql = (Query*)malloc(terms * sizeof(Query));
+    for (t=0; t<terms; t++) Query_init(&mt->ql[t], term[t]->spatial, &term[t]->counters);
+   }
+   
+   mt->temp1 = (int*)malloc(longest * sizeof(int));
+   mt->temp2 = (float*)malloc(longest * sizeof(float));
+   mt->fv_int = (float*)malloc(feats_int * sizeof(float));
+   mt->fv_ext = (float*)malloc(feats_ext * sizeof(float));
+   mt->temp = (float*)malloc(DataMatrix_temp_size(&self->dm) * sizeof(float));
+  }
+ 
+ // Do the work, with the GIL released...
+  Py_BEGIN_ALLOW_THREADS
+   thread_run(mult_task, &mb, PyArray_DIMS(output)[0], 16, threads);
+  Py_END_ALLOW_THREADS
+ 
+ // Clean up...
+  for (i=0; i<threads; i++)
+  {
+   MultThread * mt = &mb.thread[i];
+   
+   free(mt->temp);
+   free(mt->fv_ext);
+   free(mt->fv_int);
+   free(mt->temp2);
+   free(mt->temp1);
+   
+   if (mt->ql!=NULL)
+   {
+    for (t=0; t<terms; t++) Query_deinit(&mt->ql[t]);
+    free(mt->ql);
+   }
+   
+   MultCache_delete(&mt->mc);
+  }
+  
+  free(mb.thread);
+  free(mb.config);
+}
+
+
+
 static PyObject * MeanShift_mult_py(MeanShift * self, PyObject * args, PyObject * kw)
 {
  // Handle the parameters...
@@ -2318,6 +3392,20 @@ static PyObject * MeanShift_mult_py(MeanShift * self, PyObject * args, PyObject
   PhiloxRNG rng;
   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
   
+ // If the first object asks for multiple threads hand over to the threaded version...
+  int threads = thread_count(self->threads);
+  if ((threads>1)&&(PyArray_DIMS(output)[0]>1))
+  {
+   MeanShift ** term = (MeanShift**)malloc(terms * sizeof(MeanShift*));
+   for (i=0; i<terms; i++) term[i] = (MeanShift*)PySequence_GetItem(multiplicands, i);
+   
+   mult_threaded(term, terms, output, gibbs, mci, mh, fake, longest, threads, &rng);
+   free(term);
+   
+   Py_INCREF(Py_None);
+   return Py_None;
+  }
+  
  // Check for the degenerate situation of only one multiplicand, in which case we can just draw from it to generate the output...
   int j;
   if (terms==1)
@@ -2374,8 +3462,8 @@ static PyObject * MeanShift_mult_py(MeanShift * self, PyObject * args, PyObject
   mc.mci_samples = mci;
   mc.mh_proposals = mh;
   
- // Make sure all the MeanShift objects have a Spatial initialised; create the list of Spatials; also get the kernel configuration list setup at the same time...
-  Spatial * sl = (Spatial)malloc(terms * sizeof(Spatial));
+ // Make sure all the MeanShift objects have a Spatial initialised; create a Query for each; also get the kernel configuration list setup at the same time...
+  Query * ql = (Query*)malloc(terms * sizeof(Query));
   
   KernelConfig * config = NULL;
   if (self->config!=NULL)
@@ -2392,7 +3480,7 @@ static PyObject * MeanShift_mult_py(MeanShift * self, PyObject * args, PyObject
     targ->spatial = Spatial_new(targ->spatial_type, &targ->dm, self->spatial_param);
    }
     
-   sl[i] = targ->spatial;
+   Query_init(&ql[i], targ->spatial, &targ->counters);
    if (config!=NULL) config[i] = targ->config;
   }
  
@@ -2405,7 +3493,7 @@ static PyObject * MeanShift_mult_py(MeanShift * self, PyObject * args, PyObject
   for (j=0; j<PyArray_DIMS(output)[0]; j++)
   {
    // Do multiplication...
-    mult(self->kernel, config, terms, sl, self->fv_int, &mc, temp1, temp2, self->quality, fake);
+    mult(self->kernel, config, terms, ql, self->fv_int, &mc, temp1, temp2, self->quality, fake);
     
    // Multiply it back to self's space...
     for (i=0; i<feats_int; i++)
@@ -2437,7 +3525,8 @@ static PyObject * MeanShift_mult_py(MeanShift * self, PyObject * args, PyObject
   free(temp2);
   free(temp1);
   free(config);
-  free(sl);
+  for (i=0; i<terms; i++) Query_deinit(&ql[i]);
+  free(ql);
   MultCache_delete(&mc);
  
  // Return None...
@@ -2500,6 +3589,27 @@ static PyObject * MeanShift_memory_py(MeanShift * self, PyObject * args)
 
 
 
+static PyObject * MeanShift_stats_counters_py(MeanShift * self, PyObject * args)
+{
+ // Get the optional reset flag...
+  PyObject * reset = NULL;
+  if (!PyArg_ParseTuple(args, "|O", &reset)) return NULL;
+ 
+ // Build the dictionary...
+  Counters * c = &self->counters;
+  PyObject * ret = Py_BuildValue("{sLsLsLsLsLsLsLsLsL}", "searches", c->searches, "nodes", c->nodes, "exemplars", c->exemplars, "kernels", c->kernels, "converges", c->converges, "iters", c->iters, "capped", c->capped, "merged", c->merged, "created", c->created);
+  
+ // Reset if requested...
+  if ((ret!=NULL)&&(reset!=NULL)&&(PyObject_IsTrue(reset)))
+  {
+   Counters_zero(c);
+  }
+ 
+ return ret;
+}
+
+
+
 static Py_ssize_t MeanShift_Length(MeanShift * self)
 {
  return DataMatrix_exemplars(&self->dm);
@@ -2559,6 +3669,7 @@ static PyMemberDef MeanShift_members[] =
  {"spatial_param", T_FLOAT, offsetof(MeanShift, spatial_param), 0, "A parameter passed through to the spatial data structure. Currently only used by the kd tree spatial, as the minimum dimension range that it will split - it defaults to 0.1, which almost switches this off. (There is also a depth limit and 8 node per leaf limit)"},
  {"ident_dist", T_FLOAT, offsetof(MeanShift, ident_dist), 0, "If two exemplars are found at any point to have a distance less than this from each other whilst clustering it is assumed they will go to the same destination, saving computation."},
  {"merge_range", T_FLOAT, offsetof(MeanShift, merge_range), 0, "Controls how close two mean shift locations have to be to be merged in the clustering method."},
+ {"threads", T_INT, offsetof(MeanShift, threads), 0, "Number of threads used by the batch methods - probs, modes, modes_data, assign_clusters, manifolds and manifolds_data, plus cluster (see its documentation). Defaults to 1; set it to 0 (or anything less than 1) to use one thread per core. The Python GIL is released whilst they run, so other Python threads can continue. Output is identical regardless of the thread count, except for cluster, as noted."},
  {"merge_check_step", T_INT, offsetof(MeanShift, merge_check_step), 0, "When clustering this controls how many mean shift iterations it does between checking for convergance - simply a tradeoff between wasting time doing mean shift when it has already converged and doing proximity checks for convergance. Should only affect runtime."},
  {"rng0", T_UINT, offsetof(MeanShift, rng[0]), 0, "Lets you set the random number generators position index - defaults to 0. Position 0 - the highest 32 bits."},
  {"rng1", T_UINT, offsetof(MeanShift, rng[1]), 0, "Lets you set the random number generators position index - defaults to 0. Position 1."},
@@ -2575,6 +3686,7 @@ static PyMethodDef MeanShift_methods[] =
  {"kernels", (PyCFunction)MeanShift_kernels_py, METH_NOARGS | METH_STATIC, "A static method that returns a list of kernel types, as strings."},
  {"get_kernel", (PyCFunction)MeanShift_get_kernel_py, METH_NOARGS, "Returns the string that identifies the current kernel; for complex kernels this may be a complex string containing parameters etc."},
  {"get_range", (PyCFunction)MeanShift_get_range_py, METH_NOARGS, "Returns the range of the current kernel, taking into account the current quality value - this is how far out it searches for relevant exemplars from a point in space, eucledian distance. Note that the range is the raw internal value - you need to divide by the scale vector to get the true scale for each dimension. Provided for diagnostic purposes."},
+ {"get_error", (PyCFunction)MeanShift_get_error_py, METH_NOARGS, "Returns a bound on the error of the kernel weights, as a fraction of the weight at the centre of the kernel. This is 0 unless the kernel has been configured to approximate its weight with a lookup table - see info_config for the kernels that support this."},
  {"set_kernel", (PyCFunction)MeanShift_set_kernel_py, METH_VARARGS, "Sets the current kernel, as identified by a string. For complex kernels this will probably need to include extra information - e.g. the fisher kernel is given as fisher(alpha) where alpha is a floating point concentration parameter. Note that some kernels (e.g. fisher) take into account the number of features in the data when set - in such cases you must set the kernel type after calling set_data (An error will be thrown if set_data was never called)."},
  {"copy_kernel", (PyCFunction)MeanShift_copy_kernel_py, METH_VARARGS, "Given another MeanShift object this copies the settings from it. This is highly recomended when speed matters and you have lots of kernels, as it copies pointers to the internal configuration object and reference counts - for objects with complex configurations this can be an order of magnitude faster. It can also save a lot of memory, via shared caches."},
  
@@ -2583,14 +3695,14 @@ static PyMethodDef MeanShift_methods[] =
  
  {"spatials", (PyCFunction)MeanShift_spatials_py, METH_NOARGS | METH_STATIC, "A static method that returns a list of spatial indexing structures you can use, as strings."},
  {"get_spatial", (PyCFunction)MeanShift_get_spatial_py, METH_NOARGS, "Returns the string that identifies the current spatial indexing structure."},
- {"set_spatial", (PyCFunction)MeanShift_set_spatial_py, METH_VARARGS, "Sets the current spatial indexing structure, as identified by a string."},
+ {"set_spatial", (PyCFunction)MeanShift_set_spatial_py, METH_VARARGS, "Sets the current spatial indexing structure, as identified by a string. An optional second parameter is passed to the structure when it is built - see the spatial descriptions for what it means; defaults to 0.1, which is the minimum cell size for kd_tree and gives the default leaf size for kd_flat."},
  
  {"balls", (PyCFunction)MeanShift_balls_py, METH_NOARGS | METH_STATIC, "Returns a list of ball indexing techneques - this is the structure used when clustering to represent the hyper-sphere around the mode that defines a cluster in terms of merging distance."},
  {"get_balls", (PyCFunction)MeanShift_get_balls_py, METH_NOARGS, "Returns the current ball indexing structure, as a string."},
  {"set_balls", (PyCFunction)MeanShift_set_balls_py, METH_VARARGS, "Sets the current ball indexing structure, as identified by a string."},
  
  {"info", (PyCFunction)MeanShift_info_py, METH_VARARGS | METH_STATIC, "A static method that is given the name of a kernel, spatial or ball. It then returns a human readable description of that entity."},
- {"info_config", (PyCFunction)MeanShift_info_config_py, METH_VARARGS | METH_STATIC, "Given the name of a kernel this returns None if the kernel does not require any configuration, or a string describing how to configure it if it does."},
+ {"info_config", (PyCFunction)MeanShift_info_config_py, METH_VARARGS | METH_STATIC, "Given the name of a kernel this returns None if the kernel does not take any configuration, or a string describing how to configure it if it does - for some kernels the configuration is optional."},
  
  {"copy_all", (PyCFunction)MeanShift_copy_all_py, METH_VARARGS, "Copies everything from another mean shift object except for the data structure - kernel, spatial, balls and all exposed parameters. Faster than doing things manually, including the sharing of caches - if you are making lots of MeanShift objects with the same parameters it is strongly recomended to use this."},
  {"reset", (PyCFunction)MeanShift_reset_py, METH_VARARGS, "Changing the contents of the numpy array that contains the samples wrapped by a MeanShift object will break things, potentially even causing a crash. However, you can change the contents of the array then call this - it will reset all data structures that are built on assumptions about the numpy array. Note that this only works for changing the contents - resizing it will not do anything as the MeanShift object will still have a pointer to the original."},
@@ -2598,7 +3710,10 @@ static PyMethodDef MeanShift_methods[] =
  {"converters", (PyCFunction)MeanShift_converters_py, METH_NOARGS | METH_STATIC, "Returns a list of converters that can be passed into the set_data method, as their single-character code strings. The converter method allows you to get details."},
  {"converter", (PyCFunction)MeanShift_converter_py, METH_VARARGS | METH_STATIC, "Given the code for a converter this returns None if its not recognised or a dictionary: {'code' : The code used to select it, single character string., 'name' : Name, provided for documentation purposes - no real use., 'description' : A human-consumable text description of the converter., 'external' : How many features it expects the external representation to have (as provided in the data matrix)., 'internal' : How many features it provides to the actual kernel - the scale and kernel itself match up with this.}."},
  
- {"set_data", (PyCFunction)MeanShift_set_data_py, METH_VARARGS, "Sets the data matrix, which defines the probability distribution via a kernel density estimate that everything is using. The data matrix is used directly, so it should not be modified during use as it could break the data structures created to accelerate question answering (unless you call reset after modification). First parameter is a numpy matrix (Any normal numerical type), the second a string with its length matching the number of dimensions of the matrix. The characters in the string define the meaning of each dimension: 'd' (data) - changing the index into this dimension changes which exemplar you are indexing; 'f' (feature) - changing the index into this dimension changes which feature you are indexing; 'b' (both) - same as d, except it also contributes an item to the feature vector, which is essentially the position in that dimension (used on the dimensions of an image for instance, to include pixel position in the feature vector). The system unwraps all data indices and all feature indices in row major order to hallucinate a standard data matrix, with all 'both' features at the start of the feature vector. Note that calling this resets scale. A third optional parameter sets an index into the original feature vector (Including the dual dimensions, so you can use one of them to provide weight) that is to be the weight of the feature vector - this effectivly reduces the length of the feature vector, as used by all other methods, by one. A fourth optional parameter can provide conversion codes, for a conversion provided after weight extraction but before scaling and the kernel is applied, so you can hallucinate the data is in a different format that is more amenable to a pdf being applied. Most common use is angles, which need to be converted into vectors for the directional kernels to make sense. The conversion is applied for all inputs and outputs so you only have to worry about the conversion when setting up scale and the kernel. There are static methods to query the conversion options."},
+ {"set_data", (PyCFunction)MeanShift_set_data_py, METH_VARARGS, "Sets the data matrix, which defines the probability distribution via a kernel density estimate that everything is using. The data matrix is used directly, so it should not be modified during use as it could break the data structures created to accelerate question answering (unless you call reset after modification). First parameter is a numpy matrix (Any normal numerical type), the second a string with its length matching the number of dimensions of the matrix. The characters in the string define the meaning of each dimension: 'd' (data) - changing the index into this dimension changes which exemplar you are indexing; 'f' (feature) - changing the index into this dimension changes which feature you are indexing; 'b' (both) - same as d, except it also contributes an item to the feature vector, which is essentially the position in that dimension (used on the dimensions of an image for instance, to include pixel position in the feature vector). The system unwraps all data indices and all feature indices in row major order to hallucinate a standard data matrix, with all 'both' features at the start of the feature vector. Note that calling this resets scale. A third optional parameter sets an index into the original feature vector (Including the dual dimensions, so you can use one of them to provide weight) that is to be the weight of the feature vector - this effectivly reduces the length of the feature vector, as used by all other methods, by one. A fourth optional parameter can provide conversion codes, for a conversion provided after weight extraction but before scaling and the kernel is applied, so you can hallucinate the data is in a different format that is more amenable to a pdf being applied. Most common use is angles, which need to be converted into vectors for the directional kernels to make sense. The conversion is applied for all inputs and outputs so you only have to worry about the conversion when setting up scale and the kernel. There are static methods to query the conversion options. A fifth optional parameter, if True, converts every exemplar when set_data is called, keeping the result, so the conversion is never repeated - makes every access to the data matrix faster when there is conversion (it does nothing otherwise), at the cost of storing a copy of the converted data. Unlike set_cache the copy is unscaled, so it survives changes to the scale, and it is kept up to date by add and remove."},
+ {"set_cache", (PyCFunction)MeanShift_set_cache_py, METH_VARARGS, "Turns on (True) or off (False) a cache of the data matrix, stored in the internal format - converted and scaled. Every feature vector is then fetched with a single copy rather than being converted one element at a time, which speeds up everything, at the cost of storing a copy of the data matrix. It is filled in lazily, in blocks of rows, and refilled whenever the scale changes. An optional second parameter gives a filename to use as backing storage, so the cache can be larger than memory and be paged in and out by the operating system; it is created (or truncated) and left behind after use. Without it the cache lives in anonymous memory. Calling set_data turns the cache off."},
+ {"add", (PyCFunction)MeanShift_add_py, METH_VARARGS, "Adds exemplars to the data matrix, which must have been set with the dimension types 'df'. Takes a 2D array of rows, or a single row, with the same columns as the array given to set_data (so including the weight column, if any), converted to its type. The first edit copies the data matrix, so the array given to set_data is never modified; get_dm returns the copy from then on. Spatial indexing structures that support it (brute_force and kd_tree) are updated rather than rebuilt, and the weight is kept current. Turns the cache off."},
+ {"remove", (PyCFunction)MeanShift_remove_py, METH_VARARGS, "Removes exemplars from the data matrix, which must have been set with the dimension types 'df'. Takes an array of exemplar indices (duplicates are ignored). Each hole is filled by moving the last exemplar into it, working from the highest index to the lowest - this means the indices of exemplars that are not removed can change, exactly as if the last row was moved into each hole in turn. Like add, it updates the spatial indexing structure when possible, keeps the weight current and turns the cache off."},
  {"get_dm", (PyCFunction)MeanShift_get_dm_py, METH_NOARGS, "Returns the current data matrix, which will be some kind of numpy ndarray."},
  {"get_dim", (PyCFunction)MeanShift_get_dim_py, METH_NOARGS, "Returns the string that gives the meaning of each dimension, as matched to the number of dimensions in the data matrix."},
  {"get_weight_dim", (PyCFunction)MeanShift_get_weight_dim_py, METH_NOARGS, "Returns the feature vector index that provides the weight of each sample, or None if there is not one and they are all fixed to 1."},
@@ -2622,10 +3737,13 @@ static PyMethodDef MeanShift_methods[] =
  {"loo_nll", (PyCFunction)MeanShift_loo_nll_py, METH_VARARGS, "Calculate the negative log liklihood of the model where it leaves out the sample whos probability is being calculated and then muliplies together the probability of all samples calculated independently. This can be used for model comparison, to see which is better out of several configurations, be that kernel size, kernel type etc. Takes two optional parameters: First, the lower bound on probability, to avoid outliers causing problems - defaults to 1e-16. Second, a limit on how many exemplars to use, rather than the default of using all of them (a negative value) - allows for an even more approximate calculation in considerably less time. The exemplars are drawn with uniform probability and replacement."},
  
  {"entropy", (PyCFunction)MeanShift_entropy_py, METH_VARARGS, "Calculates and returns an approximation of the entropy of the distribution represented by this object. As it uses the samples contained within its accuracy will improve with the number of them, much like for the rest of the system. Uses the natural logarithm, so the return is measured in nats. Has one optional parameter - a limit on how many exemplars to use, which will make it take a bootstrap draw from the exemplars and calculate the entropy from that, rather using all exemplars. This makes it more noisy, but can save a lot of computation."},
+ {"sweep_scales", (PyCFunction)MeanShift_sweep_scales_py, METH_VARARGS, "Given a 2D array of scales, [scale, feature], this calculates loo_nll for each, as though set_scale had been called with each row in turn, returning a 1D array of the scores. Much faster than doing that as it builds a single spatial index, with the minimum scale of each feature, and does a single search for the neighbours of each exemplar that is then shared between every scale. Has the same two optional parameters as loo_nll (minimum probability and sample limit), noting that the same samples are used for every scale, then an optional callback, for reporting progress, which is called once per scale with (step, steps) - when the scales share a search it tracks the fraction of exemplars done, as every scale is evaluated at once. Does not change the scale of the object. Does not support the directional kernels, fisher and mirror_fisher, as scale does not change them. If the kernel does not support sharing the search (composite) it falls back to brute force, which is no faster than doing it manually. Neighbours are cut exactly at the kernel range of each scale, so for kernels with infinite support, e.g. Gaussian, values can differ slightly from loo_nll, which includes whole leaves of the spatial index."},
+ {"loo_nll_approx", (PyCFunction)MeanShift_loo_nll_approx_py, METH_VARARGS, "Approximate version of loo_nll, for when the kernel is broad and the exact calculation is too slow. Takes a tolerance as its first parameter, then the same two optional parameters as loo_nll, except the minimum probability must be positive. The tolerance is relative, e.g. 0.01 allows each probability to be off by 1%. Returns a tuple of (negative log liklihood, bound), where the bound is a guaranteed limit on how far the returned value is from what loo_nll would return (ignoring floating point error). Requires that the spatial indexing structure be kd_tree and the kernel a function of distance only - anything other than discrete, mirror_fisher and composite. If these requirements are not met it does the exact calculation and the bound is 0."},
+ {"entropy_approx", (PyCFunction)MeanShift_entropy_approx_py, METH_VARARGS, "Approximate version of entropy, matching loo_nll_approx - takes a tolerance as its first parameter, then the optional sample limit parameter of entropy. Returns a tuple of (entropy, bound), where the bound is a guaranteed limit on how far the return is from what entropy would return, with probabilities clamped to be at least 1e-16 when calculating the bound so it stays finite. Same requirements as loo_nll_approx."},
  {"kl", (PyCFunction)MeanShift_kl_py, METH_VARARGS, "Calculates and returns an approximation of the kullback leibler divergance, of the first parameter from self - D(self||arg1). In other words, it returns the average number of extra nats for encoding draws from p if you encode them optimally under the assumption they come from the density estimate of the mean shift object given as the first parameter. Uses the samples within self and solves using them as a sample from the distribution - consequntially the constraint the the KL-divergance be positive is broken by this estimate and you can get negative values out. What to do about this is left to the user. An optional second parameter provides a clamp on how low probability calculations for arg1 values are allowed to get, to avoid divide by zero - it defaults to 1e-16. An optional third parameter switches it from using all exemplars in its estiamte to using a bootstrap draw of the given size instead - saves time at the expense of more noise in the estimate."},
  
  {"prob", (PyCFunction)MeanShift_prob_py, METH_VARARGS, "Given a feature vector returns its probability, as calculated by the kernel density estimate that is defined by the data and kernel. Be warned that the return value can be zero."},
- {"probs", (PyCFunction)MeanShift_probs_py, METH_VARARGS, "Given a data matrix returns an array (1D) containing the probability of each feature, as calculated by the kernel density estimate that is defined by the data and kernel. Be warned that the return values can include zeros, but you can provide an optional second parameter which will clamp no output value to be lower than it."},
+ {"probs", (PyCFunction)MeanShift_probs_py, METH_VARARGS, "Given a data matrix returns an array (1D) containing the probability of each feature, as calculated by the kernel density estimate that is defined by the data and kernel. Be warned that the return values can include zeros, but you can provide an optional second parameter which will clamp no output value to be lower than it. An optional third parameter switches on tiled evaluation, and is the tile size (64 is a good choice; the default of 0 means off) - the points are sorted into spatially compact tiles and the spatial index is searched once per tile, with every point in the tile evaluated against the one block of candidates. Much faster when scoring lots of points that are dense relative to the kernel size. Only exemplars within the kernel range of each point are summed, whilst the untiled path sums whatever the spatial index returns - the same to within floating point rounding for kernels with finite support, but for the gaussian, cauchy and logistic kernels the tiled output drops the tail beyond the range set by quality, which is a few percent for gaussian and can be tens of percent for cauchy at the default quality."},
  
  {"draw", (PyCFunction)MeanShift_draw_py, METH_NOARGS, "Allows you to draw from the distribution represented by the kernel density estimate. Returns a vector and makes use of the internal RNG."},
  {"draws", (PyCFunction)MeanShift_draws_py, METH_VARARGS, "Allows you to draw from the distribution represented by the kernel density estimate. Same as draw except it returns a matrix - you provide a single argument of how many draws to make. Returns an array, <# draws>X<# features> and makes use of the internal RNG."},
@@ -2635,19 +3753,21 @@ static PyMethodDef MeanShift_methods[] =
  {"modes", (PyCFunction)MeanShift_modes_py, METH_VARARGS, "Given a data matrix [exemplar, feature] returns a matrix of the same size, where each feature has been replaced by its mode, as calculated using mean shift."},
  {"modes_data", (PyCFunction)MeanShift_modes_data_py, METH_NOARGS, "Runs mean shift on the contained data set, returning a feature vector for each data point. The return value will be indexed in the same way as the provided data matrix, but without the feature dimensions, with an extra dimension at the end to index features. Note that the resulting output will contain a lot of effective duplication, making this a very inefficient method - your better off using the cluster method."},
  
- {"cluster", (PyCFunction)MeanShift_cluster_py, METH_NOARGS, "Clusters the exemplars provided by the data matrix - returns a two tuple (data matrix of all the modes in the dataset, indexed [mode, feature], A matrix of integers, indicating which mode each one has been assigned to by indexing the mode array. Indexing of this array is identical to the provided data matrix, with any feature dimensions removed.). The clustering is replaced each time this is called - do not expect cluster indices to remain consistant after calling this."},
+ {"cluster", (PyCFunction)MeanShift_cluster_py, METH_NOARGS, "Clusters the exemplars provided by the data matrix - returns a two tuple (data matrix of all the modes in the dataset, indexed [mode, feature], A matrix of integers, indicating which mode each one has been assigned to by indexing the mode array. Indexing of this array is identical to the provided data matrix, with any feature dimensions removed.). The clustering is replaced each time this is called - do not expect cluster indices to remain consistant after calling this. If threads is not 1 it converges blocks of exemplars in parallel, merging the results in exemplar order - the result is then deterministic and the same for any thread count other than 1, but can differ slightly from the single threaded result."},
  {"assign_cluster", (PyCFunction)MeanShift_assign_cluster_py, METH_VARARGS, "After the cluster method has been called this can be called with a single feature vector. It will then return the index of the cluster to which it has been assigned, noting that this will map to the mode array returned by the cluster method. In the event it does not map to a pre-existing cluster it will return a negative integer - this usually means it is so far from the provided data that the kernel does not include any samples."},
  {"assign_clusters", (PyCFunction)MeanShift_assign_clusters_py, METH_VARARGS, "After the cluster method has been called this can be called with a data matrix. It will then return the indices of the clusters to which each feature vector has been assigned, as a 1D numpy array, noting that this will map to the mode array returned by the cluster method. In the event any entry does not map to a pre-existing cluster it will return a negative integer for it - this usually means it is so far from the provided data that the kernel does not include any samples."},
  {"cluster_on", (PyCFunction)MeanShift_cluster_on_py, METH_VARARGS, "Acts like cluster, but instead of clustering the contained data it clusters the exemplars provided as a data matrix (only parameter) on the surface of the contained data. This can be thought of as calling the modes method on the provided data matrix and then merging modes that are sufficiently close together to obtain a set of clusters. It returns the same output as cluster, specifically a two tuple: (data matrix of all the modes on the dataset that are represented within the given exemplars, indexed [mode, feature], A matrix of integers, matching the number of provided exemplars, indicating which mode they landed in.). Note that if a provided exemplar is too far away from the given data it will form a cluster where it started; the provided exemplars only interact via cluster merging and are not included in the KDE for which modes are being found. Mode numbers will not match anything else, either other calls to this or calls to cluster."},
+ {"cluster_scales", (PyCFunction)MeanShift_cluster_scales_py, METH_VARARGS, "Clusters the data at a sequence of scales, building a hierarchy - takes a 2D array of scales, [level, feature], as though each row was passed to set_scale in turn (the current weight scale is kept). The first level clusters the data, as the cluster method does; every level after that clusters the modes of the previous level, as cluster_on does, so each level only converges the few modes of the level before rather than every exemplar. Returns a list indexed by level of tuples (modes, an [mode, feature] array in the external format, parents, a 1D array indexed by the segments of the previous level - the exemplars for the first level - giving the mode each landed in, sizes, a 1D array giving the total exemplar weight that landed in each mode). Leaves the object with the scale of the last level, and its clustering, so assign_cluster and assign_clusters are relative to it. Honours threads for the first level only, which is the expensive one. An optional second parameter is a callback, for reporting progress, which is called at the start of each level with (level, levels). Used by the hierarchy method."},
  
  {"manifold", (PyCFunction)MeanShift_manifold_py, METH_VARARGS, "Given a feature vector and the dimensionality of the manifold projects the feature vector onto the manfold using subspace constrained mean shift. Returns an array with the same shape as the input. A further optional boolean parameter allows you to enable calculation of the hessain for every iteration (The default, True, correct algorithm), or only do it once at the start (False, incorrect but works for clean data.)."},
  {"manifolds", (PyCFunction)MeanShift_manifolds_py, METH_VARARGS, "Given a data matrix [exemplar, feature] and the dimensionality of the manifold projects the feature vectors onto the manfold using subspace constrained mean shift. Returns a data matrix with the same shape as the input. A further optional boolean parameter allows you to enable calculation of the hessain for every iteration (The default, True, correct algorithm), or only do it once at the start (False, incorrect but works for clean data.)."},
  {"manifolds_data", (PyCFunction)MeanShift_manifolds_data_py, METH_VARARGS, "Given the dimensionality of the manifold projects the feature vectors that are defining the density estimate onto the manfold using subspace constrained mean shift. The return value will be indexed in the same way as the provided data matrix, but without the feature dimensions, with an extra dimension at the end to index features. A further optional boolean parameter allows you to enable calculation of the hessain for every iteration (The default, True, correct algorithm), or only do it once at the start (False, incorrect but works for clean data.)."},
  
- {"mult", (PyCFunction)MeanShift_mult_py, METH_KEYWORDS | METH_VARARGS | METH_STATIC, "A static method that allows you to multiply a bunch of kernel density estimates, and draw some samples from the resulting distribution, outputing the samples into an array. The first input must be a list of MeanShift objects (At least of length 1, though if length 1 it just resamples the input), the second a numpy array for the output - it must be 2D and have the same number of columns as all the MeanShift objects have features/dims; must be float or double. Its row count is how many samples will be drawn from the distribution implied by multiplying the KDEs together. Note that the first object in the MeanShift object list gets to set the kernel - it is assumed that all further objects have the same kernel, and if thats not the case expect problems. Note that this is same structure - different scales and the same kernel with different parameters (e.g. different concentration parameter for a Fisher) is fine. Further to the first two inputs dictionary parameters it allows parameters to be set by name: {'gibbs': Number of Gibbs samples to do, noting its multiplied by the length of the multiplication list and is the number of complete passes through the state, 'mci': Number of samples to do if it has to do monte carlo integration, 'mh': Number of Metropolis-Hastings steps it will do if it has to, multiplied by the length of the multiplicand list, 'fake': Allows you to request an incorrect-but-useful result - the default of 0 is the correct output, 1 is a mode from the Gibbs sampled mixture component instead of a draw, whilst 2 is the average position of the components that made up the selected mixture component.}. Note that this method makes extensive use of the built in rng."},
+ {"mult", (PyCFunction)MeanShift_mult_py, METH_KEYWORDS | METH_VARARGS | METH_STATIC, "A static method that allows you to multiply a bunch of kernel density estimates, and draw some samples from the resulting distribution, outputing the samples into an array. The first input must be a list of MeanShift objects (At least of length 1, though if length 1 it just resamples the input), the second a numpy array for the output - it must be 2D and have the same number of columns as all the MeanShift objects have features/dims; must be float or double. Its row count is how many samples will be drawn from the distribution implied by multiplying the KDEs together. Note that the first object in the MeanShift object list gets to set the kernel - it is assumed that all further objects have the same kernel, and if thats not the case expect problems. Note that this is same structure - different scales and the same kernel with different parameters (e.g. different concentration parameter for a Fisher) is fine. Further to the first two inputs dictionary parameters it allows parameters to be set by name: {'gibbs': Number of Gibbs samples to do, noting its multiplied by the length of the multiplication list and is the number of complete passes through the state, 'mci': Number of samples to do if it has to do monte carlo integration, 'mh': Number of Metropolis-Hastings steps it will do if it has to, multiplied by the length of the multiplicand list, 'fake': Allows you to request an incorrect-but-useful result - the default of 0 is the correct output, 1 is a mode from the Gibbs sampled mixture component instead of a draw, whilst 2 is the average position of the components that made up the selected mixture component.}. Note that this method makes extensive use of the built in rng. If the threads member of the first object is not 1 the rows are drawn in parallel, with the GIL released - each row then gets its own rng stream, derived from the rng of the first object, so the output is the same for any thread count (but differs from the single threaded output)."},
  
  {"__sizeof__", (PyCFunction)MeanShift_sizeof_py, METH_NOARGS, "Returns the number of bytes used the complete object. This is a non-trivial calculation, as data can be shared etc. - all the data that it definitely owns is included, as is the byte count for the numpy array that it contains a pointer to. If the kernel type includes a chache that is shared between objects it amortises it - divides the number of bytes by how many objects are using it and rounds up. This set of asusmptions means that if each MeanShoft object has its own numpy array and you sum them all up for a running program then the result is probably reasonable; in other situations it may not be. Also note that it counts all the caches etc. - many of these are not initalised until first used, or resized at various times, so size can vary a lot as you use an object."},
  {"memory", (PyCFunction)MeanShift_memory_py, METH_NOARGS, "Does the same thing as __sizeof__, except it returns a dictionary that breaks down all the byte counts that sum together to create the final value, as well as the final value. Output is {'data' : Size of contained data matrix, 'kernel' : Size of any data from the kernel (for most kernels this is 0), 'kernel_ref_count' : Data from the kernel can be shared between multiple instances - this is that count so you can amortise it if that makes sense, 'dm' : Size of data matrix information without the actual data matrix!, 'spatial' : Size of the spatial data structure, 'balls' : Size of the balls structure, 'self' : Size of just the object without all the stuff its holding pointers to, includes some internal caches, 'total' : Final output, what __sizeof__ returns.}"},
+ {"stats_counters", (PyCFunction)MeanShift_stats_counters_py, METH_VARARGS, "Returns a dictionary of counters of the work done by this object since it was created or the counters were last reset, to help with tuning quality, spatial_param, merge_check_step and the like. Optionally takes a boolean, which if True resets the counters to zero after reading them. Output is {'searches' : Searches of the spatial indexing structure, 'nodes' : Nodes of the spatial indexing structure visited by those searches (always 0 for brute_force and iter_dual), 'exemplars' : Exemplars returned by those searches, 'kernels' : Kernel evaluations by the mean shift/probability code, 'converges' : Number of feature vectors converged by the mode finding/clustering methods, 'iters' : Total iterations of those convergences, 'capped' : How many of those convergences stopped because they hit iter_cap, 'merged' : Converging feature vectors that merged with an existing cluster, 'created' : Converging feature vectors that created a new cluster}. The counters are incremented by each thread separately and summed when it finishes, so they are cheap enough to always be on. Work done by mult is counted by the object that owns each term, and a kl divergence counts the searches of the other object against it."},
  
  {NULL}
 };
@@ -2716,7 +3836,7 @@ static PyMethodDef ms_c_methods[] =
 
 PyMODINIT_FUNC initms_c(void)
 {
- PyObject * mod = Py_InitModule3("ms_c", ms_c_methods, "Primarily provides a mean shift implementation, but also includes kernel density estimation and subspace constrained mean shift using the same object, such that they are all using the same underlying density estimate. Includes multiple spatial indexing schemes and kernel types, including support for directional data. Clustering is supported, with a choice of cluster intersection tests, as well as the ability to interpret exemplar indexing dimensions of the data matrix as extra features, so it can handle the traditional image segmentation scenario efficiently. Exemplars can also be weighted. There is extensive support for particle filters as well, including multiplication of distributions for non-parametric belief propagation. Note that this module is not multithread safe - use multiprocessing instead.");
+ PyObject * mod = Py_InitModule3("ms_c", ms_c_methods, "Primarily provides a mean shift implementation, but also includes kernel density estimation and subspace constrained mean shift using the same object, such that they are all using the same underlying density estimate. Includes multiple spatial indexing schemes and kernel types, including support for directional data. Clustering is supported, with a choice of cluster intersection tests, as well as the ability to interpret exemplar indexing dimensions of the data matrix as extra features, so it can handle the traditional image segmentation scenario efficiently. Exemplars can also be weighted. There is extensive support for particle filters as well, including multiplication of distributions for non-parametric belief propagation. The batch methods (probs, modes, assign_clusters etc.) can use several threads internally, as set by the threads member of a MeanShift object, and release the GIL whilst they run; each search of the spatial index has its own cursor, so the index is shared read-only between them. A single MeanShift object is not otherwise thread safe - it must not be used by more than one Python thread at once, as even queries can lazily build internal state, such as the spatial index - but separate objects can be used from separate Python threads.");
  
  import_array();
  
@@ -20,6 +20,7 @@
 #include <numpy/arrayobject.h>
 
 #include "mean_shift.h"
+#include "threads.h"
 
 
 
@@ -63,6 +64,11 @@ struct MeanShift
   float merge_range;
   int merge_check_step;
   
+ int threads; // Number of threads the batch methods use - less than 1 means one per core.
+  
+ // Counters of the work done by every method, for tuning - see stats_counters...
+  Counters counters;
+  
  // For the rng...
   MeanShift * rng_link; // Allows the rng between MeanShift objects to be linked; this is subject to proper reference counting.
   unsigned int rng[4];
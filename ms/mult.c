@@ -468,10 +468,10 @@ void mult_draw_gaussian(int dims, int terms, const float ** fv, const float ** s
 
 
 
-void mult(const Kernel * kernel, KernelConfig * config, int terms, Spatial * spatials, float * out, MultCache * cache, int * index, float * prob, float quality, int fake)
+void mult(const Kernel * kernel, KernelConfig * config, int terms, Query * queries, float * out, MultCache * cache, int * index, float * prob, float quality, int fake)
 {
  // Make sure the cache is large enough, and will not need to be resized at all...
-  int dims = DataMatrix_features(Spatial_dm(spatials[0]));
+  int dims = DataMatrix_features(queries[0].dm);
   MultCache_ensure(cache, dims, terms);
   
  // Various assorted values we need...
@@ -484,12 +484,12 @@ void mult(const Kernel * kernel, KernelConfig * config, int terms, Spatial * spa
   int t;
   for (t=0; t<terms; t++)
   {
-   cache->scale[t] = Spatial_dm(spatials[t])->mult;
+   cache->scale[t] = queries[t].dm->mult;
   }
   
  // Randomly draw our starting point from the first distribution - this is a straight draw...
-  i = DataMatrix_draw(Spatial_dm(spatials[0]), cache->rng);
-  cache->fv[0] = DataMatrix_fv(Spatial_dm(spatials[0]), i, NULL);
+  i = DataMatrix_draw(queries[0].dm, cache->rng);
+  cache->fv[0] = Query_fv(&queries[0], i, NULL);
  
  // Iterate and sample in turn, noting that the first pass is rigged to incrimentally initialise...
   int s;
@@ -504,15 +504,13 @@ void mult(const Kernel * kernel, KernelConfig * config, int terms, Spatial * spa
      for (i=0; i<dims; i++) cache->scaled[i] = cache->fv[other][i] * (cache->scale[t][i] / cache->scale[other][i]);
      
      int pos = 0;
-     Spatial_start(spatials[t], cache->scaled, range);
+     Query_start(&queries[t], cache->scaled, range);
      while (1)
      {
-      int targ = Spatial_next(spatials[t]);
-      if (targ<0) break;
-      index[pos] = targ;
-      
       float weight;
-      cache->fv[t] = DataMatrix_fv(Spatial_dm(spatials[t]), index[pos], &weight);
+      cache->fv[t] = Query_next(&queries[t], &index[pos], &weight);
+      if (cache->fv[t]==NULL) break;
+      
       prob[pos] = weight * kernel->mult_mass(dims, config, (s==0)?(t+1):terms, cache->fv, cache->scale, cache);
 
       if (pos!=0) prob[pos] += prob[pos-1];
@@ -522,8 +520,8 @@ void mult(const Kernel * kernel, KernelConfig * config, int terms, Spatial * spa
      if (pos==0)
      {
       // Problem - no neighbours found - almost certainly means its gone sideways - attempt to recover by putting something random in...
-       i = DataMatrix_draw(Spatial_dm(spatials[t]), cache->rng);
-       cache->fv[t] = DataMatrix_fv(Spatial_dm(spatials[t]), i, NULL);
+       i = DataMatrix_draw(queries[t].dm, cache->rng);
+       cache->fv[t] = Query_fv(&queries[t], i, NULL);
   
       continue;
      }
@@ -546,7 +544,7 @@ void mult(const Kernel * kernel, KernelConfig * config, int terms, Spatial * spa
      }
     
     // Record it...
-     cache->fv[t] = DataMatrix_fv(Spatial_dm(spatials[t]), index[low], NULL);
+     cache->fv[t] = Query_fv(&queries[t], index[low], NULL);
    }
   }
   
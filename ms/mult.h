@@ -96,9 +96,9 @@ void mult_draw_gaussian(int dims, int terms, const float ** fv, const float ** s
 
 
 
-// This generates a sample from the multiplication of an arbitrary number of kernel density estimates, under the constraint that they all have the same kernel. You provide the kernel and its configuration, then a list of spatials of length terms, where each spatial represents a kernel density estimate. The output is dropped into the so named variable, whilst the MultCache provides caches, indices for deterministic random number generation and parameters for any sampling that may occur. The two temps are arrays, length equal to the largest number of exemplars amung the provided Spatial inputs. quality is the parameter for the kernel range method, fake is the parameter passed to the KernelMultDraw method. config is an array of configurations for each term; can be NULL for no configuration at all...
+// This generates a sample from the multiplication of an arbitrary number of kernel density estimates, under the constraint that they all have the same kernel. You provide the kernel and its configuration, then a list of queries of length terms, where each query (a wrapped spatial) represents a kernel density estimate - they must all be different Query objects, even if the spatials match. The output is dropped into the so named variable, whilst the MultCache provides caches, indices for deterministic random number generation and parameters for any sampling that may occur. The two temps are arrays, length equal to the largest number of exemplars amung the provided Spatial inputs. quality is the parameter for the kernel range method, fake is the parameter passed to the KernelMultDraw method. config is an array of configurations for each term; can be NULL for no configuration at all...
 // (Note: Assumes no repetitions - if any of the spatials has the same data matrix it will break.)
-void mult(const Kernel * kernel, KernelConfig * config, int terms, Spatial * spatials, float * out, MultCache * cache, int * temp1, float * temp2, float quality, int fake);
+void mult(const Kernel * kernel, KernelConfig * config, int terms, Query * queries, float * out, MultCache * cache, int * temp1, float * temp2, float quality, int fake);
 
 
 
@@ -11,6 +11,8 @@
 #include "spatial.h"
 
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
 
 
 
@@ -39,16 +41,47 @@ DataMatrix * Spatial_dm(Spatial this)
 }
 
 
-void Spatial_start(Spatial this, const float * centre, float range)
+size_t Spatial_cursor_size(Spatial this)
 {
  const SpatialType * type = *(const SpatialType**)this;
- type->start(this, centre, range);
+ return type->cursor_size(this);
 }
 
-int Spatial_next(Spatial this)
+void Spatial_start(Spatial this, SpatialCursor cursor, const float * centre, float range)
 {
  const SpatialType * type = *(const SpatialType**)this;
- return type->next(this); 
+ type->start(this, cursor, centre, range);
+}
+
+int Spatial_next(Spatial this, SpatialCursor cursor)
+{
+ const SpatialType * type = *(const SpatialType**)this;
+ return type->next(this, cursor); 
+}
+
+const SpatialNode * Spatial_tree(Spatial this, const int ** indices)
+{
+ const SpatialType * type = *(const SpatialType**)this;
+ if (type->tree==NULL) return NULL;
+ return type->tree(this, indices);
+}
+
+int Spatial_editable(Spatial this)
+{
+ const SpatialType * type = *(const SpatialType**)this;
+ return (type->add!=NULL)&&(type->remove!=NULL);
+}
+
+void Spatial_add(Spatial this, int index)
+{
+ const SpatialType * type = *(const SpatialType**)this;
+ type->add(this, index);
+}
+
+void Spatial_remove(Spatial this, int index)
+{
+ const SpatialType * type = *(const SpatialType**)this;
+ type->remove(this, index);
 }
 
 size_t Spatial_byte_size(Spatial this)
@@ -58,6 +91,139 @@ size_t Spatial_byte_size(Spatial this)
 }
 
 
+SpatialCursor Spatial_cursor_new(Spatial this)
+{
+ return malloc(Spatial_cursor_size(this));
+}
+
+void Spatial_cursor_delete(SpatialCursor cursor)
+{
+ free(cursor);
+}
+
+
+
+// The counters...
+void Counters_zero(Counters * this)
+{
+ memset(this, 0, sizeof(Counters));
+}
+
+void Counters_add(Counters * this, const Counters * other)
+{
+ this->searches += other->searches;
+ this->nodes += other->nodes;
+ this->exemplars += other->exemplars;
+ this->kernels += other->kernels;
+ 
+ this->converges += other->converges;
+ this->iters += other->iters;
+ this->capped += other->capped;
+ 
+ this->merged += other->merged;
+ this->created += other->created;
+}
+
+
+
+// The query object...
+void Query_init(Query * this, Spatial spatial, Counters * total)
+{
+ this->spatial = spatial;
+ this->dm = Spatial_dm(spatial);
+ this->cursor = Spatial_cursor_new(spatial);
+ this->temp = (float*)malloc(DataMatrix_temp_size(this->dm) * sizeof(float));
+ 
+ this->block = (float*)malloc(DataMatrix_features(this->dm) * QUERY_BLOCK * sizeof(float));
+ this->block_weight = (float*)malloc(QUERY_BLOCK * sizeof(float));
+ this->block_index = (int*)malloc(QUERY_BLOCK * sizeof(int));
+ this->block_out = (float*)malloc(QUERY_BLOCK * sizeof(float));
+ 
+ Counters_zero(&this->counters);
+ this->total = total;
+ this->searching = 0;
+}
+
+// Helper - adds the nodes visited by the current search to the counters...
+void Query_count_nodes(Query * this)
+{
+ if (this->searching!=0)
+ {
+  const SpatialType * type = Spatial_type(this->spatial);
+  if (type->nodes!=NULL) this->counters.nodes += type->nodes(this->spatial, this->cursor);
+  this->searching = 0;
+ }
+}
+
+void Query_deinit(Query * this)
+{
+ if (this->total!=NULL)
+ {
+  Query_count_nodes(this);
+  Counters_add(this->total, &this->counters);
+ }
+ 
+ Spatial_cursor_delete(this->cursor);
+ free(this->temp);
+ 
+ free(this->block);
+ free(this->block_weight);
+ free(this->block_index);
+ free(this->block_out);
+}
+
+
+void Query_start(Query * this, const float * centre, float range)
+{
+ Query_count_nodes(this);
+ 
+ Spatial_start(this->spatial, this->cursor, centre, range);
+ this->searching = 1;
+ this->counters.searches += 1;
+}
+
+float * Query_next(Query * this, int * index, float * weight)
+{
+ int targ = Spatial_next(this->spatial, this->cursor);
+ if (targ<0) return NULL;
+ this->counters.exemplars += 1;
+ 
+ if (index!=NULL) *index = targ;
+ return DataMatrix_fv_temp(this->dm, targ, weight, this->temp);
+}
+
+float * Query_fv(Query * this, int index, float * weight)
+{
+ return DataMatrix_fv_temp(this->dm, index, weight, this->temp);
+}
+
+int Query_next_block(Query * this)
+{
+ const SpatialType * type = Spatial_type(this->spatial);
+ if (type->next_block!=NULL)
+ {
+  int count = type->next_block(this->spatial, this->cursor, QUERY_BLOCK, this->block, QUERY_BLOCK, this->block_weight, this->block_index);
+  this->counters.exemplars += count;
+  return count;
+ }
+ 
+ int feats = DataMatrix_features(this->dm);
+ int count = 0;
+ while (count<QUERY_BLOCK)
+ {
+  float * loc = Query_next(this, &this->block_index[count], &this->block_weight[count]);
+  if (loc==NULL) break;
+  
+  int i;
+  for (i=0; i<feats; i++) this->block[i*QUERY_BLOCK + count] = loc[i];
+  
+  count += 1;
+ }
+ 
+ return count;
+}
+
+
 
 // Implimentation of the brute force spatial indexer...
 typedef struct BruteForce BruteForce;
@@ -67,7 +233,12 @@ struct BruteForce
  const SpatialType * type;
  
  DataMatrix * dm;
- 
+};
+
+typedef struct BruteForceCursor BruteForceCursor;
+
+struct BruteForceCursor
+{
  int next;
 };
 
@@ -79,7 +250,6 @@ Spatial BruteForce_new(DataMatrix * dm, float param)
  
  this->type = &BruteForceType;
  this->dm = dm;
- this->next = -1;
  
  return this;
 }
@@ -98,24 +268,33 @@ DataMatrix * BruteForce_dm(Spatial self)
 }
 
 
-void BruteForce_start(Spatial self, const float * centre, float range)
+size_t BruteForce_cursor_size(Spatial self)
+{
+ return sizeof(BruteForceCursor);
+}
+
+
+void BruteForce_start(Spatial self, SpatialCursor cursor, const float * centre, float range)
 {
  BruteForce * this = (BruteForce*)self;
- this->next = 0;
+ BruteForceCursor * cur = (BruteForceCursor*)cursor;
+ 
+ cur->next = (this->dm->exemplars>0) ? 0 : -1;
 }
 
 
-int BruteForce_next(Spatial self)
+int BruteForce_next(Spatial self, SpatialCursor cursor)
 {
  BruteForce * this = (BruteForce*)self;
- int ret = this->next;
+ BruteForceCursor * cur = (BruteForceCursor*)cursor;
+ int ret = cur->next;
  
- if (this->next>=0)
+ if (cur->next>=0)
  {
-  this->next += 1;
-  if (this->next >= this->dm->exemplars)
+  cur->next += 1;
+  if (cur->next >= this->dm->exemplars)
   {
-   this->next = -1; 
+   cur->next = -1; 
   }
  }
  
@@ -124,6 +303,19 @@ int BruteForce_next(Spatial self)
 
 
 
+void BruteForce_add(Spatial self, int index)
+{
+ // Nothing to do - it always iterates the entire data matrix...
+}
+
+
+void BruteForce_remove(Spatial self, int index)
+{
+ // As above...
+}
+
+
+
 size_t BruteForce_byte_size(Spatial self)
 {
  return sizeof(BruteForce);
@@ -138,9 +330,15 @@ const SpatialType BruteForceType =
  BruteForce_new,
  BruteForce_delete,
  BruteForce_dm,
+ BruteForce_cursor_size,
  BruteForce_start,
  BruteForce_next,
+ NULL,
+ NULL,
+ BruteForce_add,
+ BruteForce_remove,
  BruteForce_byte_size,
+ NULL,
 };
 
 
@@ -156,11 +354,14 @@ struct IterDual
  
  int indices; // Number of indices that have a spatial component.
  int * original; // For each index its source in the dm object.
- 
+};
+
+typedef struct IterDualCursor IterDualCursor;
+
+struct IterDualCursor
+{
  int valid; // 1 if we are iterating, 0 if not.
- int * low; // Starting value for each index in the current range.
- int * pos; // Position in the current iteration.
- int * high; // Ending value for each index in the current range (exclusive).
+ int data[0]; // 3 * indices long - low, the starting value for each index in the current range; pos, the position in the current iteration; high, the ending value for each index in the current range (exclusive).
 };
 
 
@@ -190,11 +391,6 @@ Spatial IterDual_new(DataMatrix * dm, float param)
   }
  }
  
- this->valid = 0;
- this->low = (int*)malloc(this->indices * sizeof(int));
- this->pos = (int*)malloc(this->indices * sizeof(int));
- this->high = (int*)malloc(this->indices * sizeof(int));
- 
  return this;
 }
 
@@ -203,9 +399,6 @@ void IterDual_delete(Spatial self)
 {
  IterDual * this = (IterDual*)self;
  
- free(this->high);
- free(this->pos);
- free(this->low);
  free(this->original);
  
  free(this);
@@ -219,11 +412,25 @@ DataMatrix * IterDual_dm(Spatial self)
 }
 
 
-void IterDual_start(Spatial self, const float * centre, float range)
+size_t IterDual_cursor_size(Spatial self)
+{
+ IterDual * this = (IterDual*)self;
+ return sizeof(IterDualCursor) + 3 * this->indices * sizeof(int);
+}
+
+
+void IterDual_start(Spatial self, SpatialCursor cursor, const float * centre, float range)
 {
  IterDual * this = (IterDual*)self;
+ IterDualCursor * cur = (IterDualCursor*)cursor;
  
- // Go through and calculate low and high for each dimension, setting pos to low...
+ int * c_low  = cur->data;
+ int * c_pos  = cur->data + this->indices;
+ int * c_high = cur->data + 2 * this->indices;
+ 
+ // Go through and calculate low and high for each dimension, setting pos to low; if any range is empty there is nothing to iterate...
+  cur->valid = 1;
+  
   int i;
   for (i=0; i<this->indices; i++)
   {
@@ -233,9 +440,9 @@ void IterDual_start(Spatial self, const float * centre, float range)
    if (this->dm->dt[oi]==DIM_DATA)
    {
     // No optimisation possible - just set it to the entire range...
-     this->low[i] = 0;
-     this->pos[i] = 0;
-     this->high[i] = size;
+     c_low[i] = 0;
+     c_pos[i] = 0;
+     c_high[i] = size;
    }
    else
    {
@@ -243,23 +450,27 @@ void IterDual_start(Spatial self, const float * centre, float range)
      float low  = (centre[oi] - range) / this->dm->mult[oi];
      float high = (centre[oi] + range) / this->dm->mult[oi];
      
-     this->low[i] = (int)ceil(low);
-     if (this->low[i]<0) this->low[i] = 0;
-     this->pos[i] = this->low[i];
-     this->high[i] = (int)ceil(high);
-     if (this->high[i]>size) this->high[i] = size;
+     c_low[i] = (int)ceil(low);
+     if (c_low[i]<0) c_low[i] = 0;
+     c_pos[i] = c_low[i];
+     c_high[i] = (int)ceil(high);
+     if (c_high[i]>size) c_high[i] = size;
    }
+   
+   if (c_low[i]>=c_high[i]) cur->valid = 0;
   }
- 
- // Indicate that we are in a valid state...
-  this->valid = 1;
 }
 
 
-int IterDual_next(Spatial self)
+int IterDual_next(Spatial self, SpatialCursor cursor)
 {
  IterDual * this = (IterDual*)self;
- if (this->valid==0) return -1;
+ IterDualCursor * cur = (IterDualCursor*)cursor;
+ if (cur->valid==0) return -1;
+ 
+ int * c_low  = cur->data;
+ int * c_pos  = cur->data + this->indices;
+ int * c_high = cur->data + 2 * this->indices;
 
  // Calculate the index for the current position...
   int ret = 0;
@@ -268,19 +479,19 @@ int IterDual_next(Spatial self)
   {
    int oi = this->original[i];
    ret *= PyArray_DIMS(this->dm->array)[oi];
-   ret += this->pos[i];
+   ret += c_pos[i];
   }
 
  // Move to the next index...
   for (i=this->indices-1;; i--)
   {
-   this->pos[i] += 1;
-   if (this->pos[i]<this->high[i]) break;
+   c_pos[i] += 1;
+   if (c_pos[i]<c_high[i]) break;
    if (i==0) break;
-   this->pos[i] = this->low[i];
+   c_pos[i] = c_low[i];
   }
   
-  if (this->pos[0]>=this->high[0]) this->valid = 0;
+  if (c_pos[0]>=c_high[0]) cur->valid = 0;
 
  // Return the index...
   return ret;
@@ -291,7 +502,7 @@ int IterDual_next(Spatial self)
 size_t IterDual_byte_size(Spatial self)
 {
  IterDual * this = (IterDual*)self;
- return sizeof(IterDual) + 4 * this->indices * sizeof(int);
+ return sizeof(IterDual) + this->indices * sizeof(int);
 }
 
 
@@ -303,9 +514,15 @@ const SpatialType IterDualType =
  IterDual_new,
  IterDual_delete,
  IterDual_dm,
+ IterDual_cursor_size,
  IterDual_start,
  IterDual_next,
+ NULL,
+ NULL,
+ NULL,
+ NULL,
  IterDual_byte_size,
+ NULL,
 };
 
 
@@ -330,36 +547,53 @@ int sort_pos_feat(const void * lhs, const void * rhs)
 
 
 
-typedef struct KDNode KDNode;
-struct KDNode
-{
- KDNode * parent;
- KDNode * child_low;
- KDNode * child_high;
- 
- int low; // Range of values the tree covers in the indices array.
- int high; // Exclusive.
- 
- float range[0]; // 2* number of features, with the low range indexed for feature i as range[i*2], and the high range [i*2+1].
-};
+// The nodes are the generic SpatialNode, so the tree can be exposed...
+typedef SpatialNode KDNode;
 
 
 
+// The tree supports edits by being log structured - there are several trees, at levels, where the tree at level l contains at most KD_TREE_PENDING*2^l exemplars, plus a list of pending exemplars that are brute forced. Adding an exemplar puts it in the pending list; when that fills up it is merged with the trees at the lowest levels, binary counter style, to build a new tree at the first empty level. Removing an exemplar from a tree replaces its entry with -1 and updates the weights of the nodes above it, leaving the bounding boxes conservative...
+#define KD_TREE_LEVELS 32
+#define KD_TREE_PENDING 64
+
+typedef struct KDTreeLevel KDTreeLevel;
+struct KDTreeLevel
+{
+ KDNode * root; // NULL if this level is empty.
+ int * indices; // All the indices - the nodes of the KD tree just have to store ranges into this, as we rearrange them during construction - allows for some fun optimisation tricks. -1 for exemplars that have been removed.
+ int size; // Length of indices.
+ int live; // Number of entries in indices that have not been removed.
+};
+
 typedef struct KDTree KDTree;
 struct KDTree
 {
  const SpatialType * type;
  
  DataMatrix * dm;
+ float min_size;
  
- int * indices; // All the indices - the nodes of the KD tree just have to store ranges into this, as we rearrange them during construction - allows for some fun optimisation tricks.
- KDNode * root; // Root of the tree.
+ KDTreeLevel level[KD_TREE_LEVELS];
  
+ int pending_size; // Exemplars that have been added but are not yet in a tree.
+ int * pending; // KD_TREE_PENDING long.
+ 
+ int where_capacity; // For each exemplar the level it is in (-1 for pending) and its position in the indices of that level (or pending).
+ int * where_level;
+ int * where_pos;
+};
+
+typedef struct KDTreeCursor KDTreeCursor;
+struct KDTreeCursor
+{
+ int level; // Level being searched, KD_TREE_LEVELS when doing the pending list.
  KDNode * targ; // For when iterating - allways a node we are searching.
- int offset; // Offset of iterating.
+ int offset; // Offset of iterating - into pending once we have got that far.
  
  const float * centre; // Bounding box of current iterations.
  float range;
+ 
+ int nodes; // Nodes visited by the current search.
 };
 
 
@@ -375,8 +609,8 @@ KDNode * KDNode_new(DataMatrix * dm, int * indices, int low, int high, int depth
   this->low = low;
   this->high = high;
   
- // Calculate the range...
-  float * fv = DataMatrix_fv(dm, indices[low], NULL);
+ // Calculate the range and weight...
+  float * fv = DataMatrix_fv(dm, indices[low], &this->weight);
   int i;
   for (i=0; i<dm->feats; i++)
   {
@@ -386,7 +620,10 @@ KDNode * KDNode_new(DataMatrix * dm, int * indices, int low, int high, int depth
   
   for (i=low+1; i<high; i++)
   {
-   fv = DataMatrix_fv(dm, indices[i], NULL);
+   float w;
+   fv = DataMatrix_fv(dm, indices[i], &w);
+   this->weight += w;
+   
    int j;
    for (j=0; j<dm->feats; j++)
    {
@@ -449,8 +686,10 @@ void KDNode_delete(KDNode * this)
 }
 
 
-KDNode * KDNode_next_down(KDNode * this, DataMatrix * dm, const float * centre, float range)
+KDNode * KDNode_next_down(KDNode * this, DataMatrix * dm, const float * centre, float range, int * nodes)
 {
+ *nodes += 1;
+ 
  int i;
  // If its a miss return null - we are not going this way...
   int within = 1;
@@ -476,13 +715,13 @@ KDNode * KDNode_next_down(KDNode * this, DataMatrix * dm, const float * centre,
   if (this->child_low==NULL) return this;
  
  // Check each child in turn...
-  KDNode * ret = KDNode_next_down(this->child_low, dm, centre, range);
+  KDNode * ret = KDNode_next_down(this->child_low, dm, centre, range, nodes);
   if (ret!=NULL) return ret;
-  return KDNode_next_down(this->child_high, dm, centre, range);
+  return KDNode_next_down(this->child_high, dm, centre, range, nodes);
 }
 
 
-KDNode * KDNode_next_up(KDNode * this, DataMatrix * dm, const float * centre, float range)
+KDNode * KDNode_next_up(KDNode * this, DataMatrix * dm, const float * centre, float range, int * nodes)
 {
  while (this->parent!=NULL)
  {
@@ -491,7 +730,7 @@ KDNode * KDNode_next_up(KDNode * this, DataMatrix * dm, const float * centre, fl
   
   if (this->child_low==child)
   {
-   KDNode * ret = KDNode_next_down(this->child_high, dm, centre, range);
+   KDNode * ret = KDNode_next_down(this->child_high, dm, centre, range, nodes);
    if (ret!=NULL) return ret;
   }
  }
@@ -511,22 +750,133 @@ int KDNode_count(KDNode * this)
 
 
 
+// Makes sure the where arrays can hold the given exemplar index...
+void KDTree_where_reserve(KDTree * this, int index)
+{
+ if (index<this->where_capacity) return;
+ 
+ this->where_capacity *= 2;
+ if (this->where_capacity<=index) this->where_capacity = index + 1;
+ 
+ this->where_level = (int*)realloc(this->where_level, this->where_capacity * sizeof(int));
+ this->where_pos = (int*)realloc(this->where_pos, this->where_capacity * sizeof(int));
+}
+
+
+// Builds a tree at the given level, which must be empty, from the given array of exemplar indices, taking ownership of it...
+void KDTree_build(KDTree * this, int l, int * indices, int size)
+{
+ KDTreeLevel * targ = &this->level[l];
+ 
+ targ->indices = indices;
+ targ->size = size;
+ targ->live = size;
+ 
+ PosFeat * scratch = (PosFeat*)malloc(size * sizeof(PosFeat));
+ targ->root = KDNode_new(this->dm, targ->indices, 0, size, 0, scratch, this->min_size);
+ free(scratch);
+ 
+ int i;
+ for (i=0; i<size; i++)
+ {
+  this->where_level[targ->indices[i]] = l;
+  this->where_pos[targ->indices[i]] = i;
+ }
+}
+
+
+// Empties a level...
+void KDTree_clear(KDTree * this, int l)
+{
+ KDTreeLevel * targ = &this->level[l];
+ if (targ->root==NULL) return;
+ 
+ KDNode_delete(targ->root);
+ free(targ->indices);
+ 
+ targ->root = NULL;
+ targ->indices = NULL;
+ targ->size = 0;
+ targ->live = 0;
+}
+
+
+// Moves the pending list into a tree, merging it with all the trees at the levels below the first empty level...
+void KDTree_flush(KDTree * this)
+{
+ int l = 0;
+ while ((l<KD_TREE_LEVELS-1)&&(this->level[l].root!=NULL)) l += 1;
+ 
+ int size = this->pending_size;
+ int i, j;
+ for (i=0; i<=l; i++) size += this->level[i].live;
+ 
+ int * indices = (int*)malloc(size * sizeof(int));
+ int pos = 0;
+ 
+ for (i=0; i<=l; i++)
+ {
+  for (j=0; j<this->level[i].size; j++)
+  {
+   if (this->level[i].indices[j]>=0)
+   {
+    indices[pos] = this->level[i].indices[j];
+    pos += 1;
+   }
+  }
+  
+  KDTree_clear(this, i);
+ }
+ 
+ for (i=0; i<this->pending_size; i++)
+ {
+  indices[pos] = this->pending[i];
+  pos += 1;
+ }
+ this->pending_size = 0;
+ 
+ if (size>0) KDTree_build(this, l, indices, size);
+ else free(indices);
+}
+
+
+
 Spatial KDTree_new(DataMatrix * dm, float param)
 {
  KDTree * this = (KDTree*)malloc(sizeof(KDTree));
  
  this->type = &KDTreeType;
  this->dm = dm;
+ this->min_size = param;
  
- this->indices = (int*)malloc(this->dm->exemplars * sizeof(int));
- int i;
- for (i=0; i<this->dm->exemplars; i++) this->indices[i] = i;
+ int l;
+ for (l=0; l<KD_TREE_LEVELS; l++)
+ {
+  this->level[l].root = NULL;
+  this->level[l].indices = NULL;
+  this->level[l].size = 0;
+  this->level[l].live = 0;
+ }
  
- PosFeat * scratch = (PosFeat*)malloc(this->dm->exemplars * sizeof(PosFeat));
- this->root = KDNode_new(this->dm, this->indices, 0, this->dm->exemplars, 0, scratch, param);
- free(scratch);
+ this->pending_size = 0;
+ this->pending = (int*)malloc(KD_TREE_PENDING * sizeof(int));
+ 
+ this->where_capacity = this->dm->exemplars;
+ this->where_level = (int*)malloc(this->where_capacity * sizeof(int));
+ this->where_pos = (int*)malloc(this->where_capacity * sizeof(int));
  
- this->targ = NULL;
+ // Build a single tree, at the level that can hold everything...
+  if (this->dm->exemplars>0)
+  {
+   int * indices = (int*)malloc(this->dm->exemplars * sizeof(int));
+   int i;
+   for (i=0; i<this->dm->exemplars; i++) indices[i] = i;
+   
+   l = 0;
+   while ((l<KD_TREE_LEVELS-1)&&(((long long)KD_TREE_PENDING<<l)<this->dm->exemplars)) l += 1;
+   
+   KDTree_build(this, l, indices, this->dm->exemplars);
+  }
  
  return this;
 }
@@ -536,8 +886,12 @@ void KDTree_delete(Spatial self)
 {
  KDTree * this = (KDTree*)self;
  
- free(this->indices);
- KDNode_delete(this->root);
+ int l;
+ for (l=0; l<KD_TREE_LEVELS; l++) KDTree_clear(this, l);
+ 
+ free(this->pending);
+ free(this->where_level);
+ free(this->where_pos);
  
  free(this);
 }
@@ -550,35 +904,166 @@ DataMatrix * KDTree_dm(Spatial self)
 }
 
 
-void KDTree_start(Spatial self, const float * centre, float range)
+size_t KDTree_cursor_size(Spatial self)
+{
+ return sizeof(KDTreeCursor);
+}
+
+
+// Moves the cursor to the first node to iterate in the next level with anything in range, or to the pending list if there is none...
+void KDTree_advance(KDTree * this, KDTreeCursor * cur)
+{
+ cur->targ = NULL;
+ cur->offset = 0;
+ 
+ while (cur->targ==NULL)
+ {
+  cur->level += 1;
+  if (cur->level>=KD_TREE_LEVELS) return;
+  
+  if (this->level[cur->level].root!=NULL)
+  {
+   cur->targ = KDNode_next_down(this->level[cur->level].root, this->dm, cur->centre, cur->range, &cur->nodes);
+  }
+ }
+}
+
+
+void KDTree_start(Spatial self, SpatialCursor cursor, const float * centre, float range)
 {
  KDTree * this = (KDTree*)self;
+ KDTreeCursor * cur = (KDTreeCursor*)cursor;
  
- this->targ = KDNode_next_down(this->root, this->dm, centre, range);
- this->offset = 0;
- this->centre = centre;
- this->range = range;
+ cur->level = -1;
+ cur->centre = centre;
+ cur->range = range;
+ cur->nodes = 0;
+ 
+ KDTree_advance(this, cur);
 }
 
 
-int KDTree_next(Spatial self)
+int KDTree_next(Spatial self, SpatialCursor cursor)
 {
  KDTree * this = (KDTree*)self;
- if (this->targ==NULL) return -1;
+ KDTreeCursor * cur = (KDTreeCursor*)cursor;
+ 
+ // Work through the trees, skipping removed entries...
+  while (cur->targ!=NULL)
+  {
+   // Calculate the return...
+    int ret = this->level[cur->level].indices[cur->targ->low + cur->offset];
+   
+   // Move to the next position...
+    cur->offset += 1;
+    if ((cur->offset+cur->targ->low)>=cur->targ->high)
+    {
+     cur->targ = KDNode_next_up(cur->targ, this->dm, cur->centre, cur->range, &cur->nodes);
+     cur->offset = 0;
+     
+     if (cur->targ==NULL) KDTree_advance(this, cur);
+    }
+   
+   // Return the return!..
+    if (ret>=0) return ret;
+  }
  
- // Calculate the return...
-  int ret = this->indices[this->targ->low + this->offset];
+ // Then the pending list, which is brute forced...
+  if (cur->offset<this->pending_size)
+  {
+   cur->offset += 1;
+   return this->pending[cur->offset-1];
+  }
+  
+ return -1;
+}
+
+
+
+const SpatialNode * KDTree_tree(Spatial self, const int ** indices)
+{
+ KDTree * this = (KDTree*)self;
  
- // Move to the next position...
-  this->offset += 1;
-  if ((this->offset+this->targ->low)>=this->targ->high)
+ // Only available if its a single tree with nothing removed, which is always the case until it is edited...
+  if (this->pending_size!=0) return NULL;
+  
+  const KDTreeLevel * targ = NULL;
+  int l;
+  for (l=0; l<KD_TREE_LEVELS; l++)
   {
-   this->targ = KDNode_next_up(this->targ, this->dm, this->centre, this->range);
-   this->offset = 0;
+   if (this->level[l].root!=NULL)
+   {
+    if (targ!=NULL) return NULL;
+    targ = &this->level[l];
+   }
   }
+  
+  if ((targ==NULL)||(targ->live!=targ->size)) return NULL;
  
- // Return the return!..
-  return ret;
+ if (indices!=NULL) *indices = targ->indices;
+ return targ->root;
+}
+
+
+
+void KDTree_add(Spatial self, int index)
+{
+ KDTree * this = (KDTree*)self;
+ 
+ // Stick it on the end of the pending list...
+  KDTree_where_reserve(this, index);
+  this->where_level[index] = -1;
+  this->where_pos[index] = this->pending_size;
+  
+  this->pending[this->pending_size] = index;
+  this->pending_size += 1;
+ 
+ // If the pending list is full move it into a tree...
+  if (this->pending_size>=KD_TREE_PENDING) KDTree_flush(this);
+}
+
+
+void KDTree_remove(Spatial self, int index)
+{
+ KDTree * this = (KDTree*)self;
+ 
+ int l = this->where_level[index];
+ int pos = this->where_pos[index];
+ 
+ if (l<0)
+ {
+  // In the pending list - move the last entry into its slot...
+   this->pending_size -= 1;
+   int last = this->pending[this->pending_size];
+   
+   this->pending[pos] = last;
+   this->where_pos[last] = pos;
+ }
+ else
+ {
+  // In a tree - mark it as removed and take its weight out of every node that contains it...
+   KDTreeLevel * targ = &this->level[l];
+   targ->indices[pos] = -1;
+   targ->live -= 1;
+   
+   if (targ->live==0)
+   {
+    KDTree_clear(this, l);
+   }
+   else
+   {
+    float w;
+    DataMatrix_fv(this->dm, index, &w);
+    
+    KDNode * node = targ->root;
+    while (node!=NULL)
+    {
+     node->weight -= w;
+     if (node->child_low==NULL) break;
+     node = (pos<node->child_low->high) ? node->child_low : node->child_high;
+    }
+   }
+ }
 }
 
 
@@ -588,9 +1073,28 @@ size_t KDTree_byte_size(Spatial self)
  KDTree * this = (KDTree*)self;
  
  size_t node_mem = sizeof(KDNode) + this->dm->feats * 2 * sizeof(float);
- node_mem *= KDNode_count(this->root);
+ size_t mem = sizeof(KDTree);
+ 
+ int l;
+ for (l=0; l<KD_TREE_LEVELS; l++)
+ {
+  if (this->level[l].root!=NULL)
+  {
+   mem += this->level[l].size * sizeof(int);
+   mem += node_mem * KDNode_count(this->level[l].root);
+  }
+ }
+ 
+ mem += KD_TREE_PENDING * sizeof(int);
+ mem += this->where_capacity * 2 * sizeof(int);
  
- return sizeof(KDTree) + this->dm->exemplars * sizeof(int) + node_mem;
+ return mem;
+}
+
+
+int KDTree_nodes(Spatial self, SpatialCursor cursor)
+{
+ return ((KDTreeCursor*)cursor)->nodes;
 }
 
 
@@ -598,13 +1102,790 @@ size_t KDTree_byte_size(Spatial self)
 const SpatialType KDTreeType =
 {
  "kd_tree",
- "A standard kd-tree on the feature vectors - best choice if the data has no dual dimensions.",
+ "A standard kd-tree on the feature vectors - best choice if the data has no dual dimensions. Supports adding and removing exemplars without a rebuild - added exemplars are brute forced until there are 64 of them, then put into their own tree, with trees merged as they accumulate, in the style of a binary counter.",
  KDTree_new,
  KDTree_delete,
  KDTree_dm,
+ KDTree_cursor_size,
  KDTree_start,
  KDTree_next,
+ NULL,
+ KDTree_tree,
+ KDTree_add,
+ KDTree_remove,
  KDTree_byte_size,
+ KDTree_nodes,
+};
+
+
+
+// Implimentation of the flat kd tree spatial indexer...
+#define KD_FLAT_DEPTH 64
+
+typedef struct KDFlatNode KDFlatNode;
+struct KDFlatNode
+{
+ int child; // Index of the low child, with the high child at child+1; negative for a leaf.
+ int low; // Range of positions the node covers, into indices, weight and (multiplied by feats) data.
+ int high; // Exclusive.
+};
+
+typedef struct KDFlat KDFlat;
+struct KDFlat
+{
+ const SpatialType * type;
+ 
+ DataMatrix * dm;
+ int feats;
+ int leaf_size;
+ 
+ int nodes; // Number of nodes, in breadth first order, so the root is 0.
+ KDFlatNode * node;
+ float * range; // [node, feature, 2] - low then high of the bounding box.
+ 
+ int * indices; // Exemplar index of each position.
+ float * weight; // Weight of each position.
+ float * data; // Feature vectors of each position - for a leaf covering [low, high) feature i of position low+j is at data[low*feats + i*(high-low) + j].
+};
+
+typedef struct KDFlatCursor KDFlatCursor;
+struct KDFlatCursor
+{
+ const float * centre;
+ float range;
+ 
+ int leaf; // Leaf being iterated, negative when done.
+ int offset; // Offset into the above.
+ 
+ int size; // Stack of nodes still to visit, with the bottom bit set if the node is known to be entirely within the range.
+ int stack[2*KD_FLAT_DEPTH+2];
+ 
+ int nodes; // Nodes visited by the current search.
+};
+
+
+
+Spatial KDFlat_new(DataMatrix * dm, float param)
+{
+ KDFlat * this = (KDFlat*)malloc(sizeof(KDFlat));
+ 
+ this->type = &KDFlatType;
+ this->dm = dm;
+ this->feats = DataMatrix_features(dm);
+ this->leaf_size = (param>=1.0) ? (int)param : 32;
+ 
+ int exemplars = DataMatrix_exemplars(dm);
+ 
+ // Extract every feature vector, as array of structures for now...
+  this->indices = (int*)malloc(exemplars * sizeof(int));
+  this->weight = (float*)malloc(exemplars * sizeof(float));
+  float * fv = (float*)malloc(exemplars * this->feats * sizeof(float));
+  
+  int i, j;
+  for (i=0; i<exemplars; i++)
+  {
+   this->indices[i] = i;
+   float * src = DataMatrix_fv(dm, i, &this->weight[i]);
+   for (j=0; j<this->feats; j++) fv[i*this->feats + j] = src[j];
+  }
+  
+ // Build the tree - processing nodes in the order they are created results in a breadth first layout...
+  int capacity = 64;
+  this->node = (KDFlatNode*)malloc(capacity * sizeof(KDFlatNode));
+  this->range = (float*)malloc(capacity * this->feats * 2 * sizeof(float));
+  char * depth = (char*)malloc(capacity * sizeof(char));
+  
+  this->nodes = 1;
+  this->node[0].child = -1;
+  this->node[0].low = 0;
+  this->node[0].high = exemplars;
+  depth[0] = 0;
+  
+  PosFeat * scratch = (PosFeat*)malloc(exemplars * sizeof(PosFeat));
+  int * temp_index = (int*)malloc(exemplars * sizeof(int));
+  float * temp_weight = (float*)malloc(exemplars * sizeof(float));
+  float * temp_fv = (float*)malloc(exemplars * this->feats * sizeof(float));
+  
+  int n;
+  for (n=0; n<this->nodes; n++)
+  {
+   KDFlatNode * targ = &this->node[n];
+   float * range = this->range + n * this->feats * 2;
+   
+   // Calculate the bounding box...
+    if (targ->low<targ->high)
+    {
+     for (j=0; j<this->feats; j++)
+     {
+      range[j*2] = fv[targ->low*this->feats + j];
+      range[j*2+1] = range[j*2];
+     }
+    
+     for (i=targ->low+1; i<targ->high; i++)
+     {
+      for (j=0; j<this->feats; j++)
+      {
+       float v = fv[i*this->feats + j];
+       if (range[j*2]>v) range[j*2] = v;
+       if (range[j*2+1]<v) range[j*2+1] = v;
+      }
+     }
+    }
+    else
+    {
+     for (j=0; j<this->feats*2; j++) range[j] = 0.0;
+    }
+   
+   // Decide if we are going to divide further or not...
+    if ((targ->high-targ->low)<=this->leaf_size) continue;
+    if (depth[n]>=KD_FLAT_DEPTH) continue;
+   
+   // Choose a division direction - the one with the largest range...
+    int split_feat = 0;
+    float split_range = range[1] - range[0];
+    for (j=1; j<this->feats; j++)
+    {
+     if ((range[j*2+1] - range[j*2])>split_range)
+     {
+      split_feat = j;
+      split_range = range[j*2+1] - range[j*2];
+     }
+    }
+    if (split_range<=0.0) continue;
+   
+   // Sort the positions by the feature, moving everything...
+    int count = targ->high - targ->low;
+    for (i=0; i<count; i++)
+    {
+     scratch[i].pos = targ->low + i;
+     scratch[i].feat = fv[(targ->low + i)*this->feats + split_feat];
+    }
+    
+    qsort(scratch, count, sizeof(PosFeat), sort_pos_feat);
+    
+    for (i=0; i<count; i++)
+    {
+     int src = scratch[i].pos;
+     temp_index[i] = this->indices[src];
+     temp_weight[i] = this->weight[src];
+     for (j=0; j<this->feats; j++) temp_fv[i*this->feats + j] = fv[src*this->feats + j];
+    }
+    
+    for (i=0; i<count; i++)
+    {
+     this->indices[targ->low + i] = temp_index[i];
+     this->weight[targ->low + i] = temp_weight[i];
+     for (j=0; j<this->feats; j++) fv[(targ->low + i)*this->feats + j] = temp_fv[i*this->feats + j];
+    }
+   
+   // Create the children, making sure there is space...
+    if (this->nodes+2>capacity)
+    {
+     capacity *= 2;
+     this->node = (KDFlatNode*)realloc(this->node, capacity * sizeof(KDFlatNode));
+     this->range = (float*)realloc(this->range, capacity * this->feats * 2 * sizeof(float));
+     depth = (char*)realloc(depth, capacity * sizeof(char));
+     targ = &this->node[n];
+    }
+    
+    int half = (targ->low + targ->high) / 2;
+    targ->child = this->nodes;
+    
+    this->node[this->nodes].child = -1;
+    this->node[this->nodes].low = targ->low;
+    this->node[this->nodes].high = half;
+    depth[this->nodes] = depth[n] + 1;
+    
+    this->node[this->nodes+1].child = -1;
+    this->node[this->nodes+1].low = half;
+    this->node[this->nodes+1].high = targ->high;
+    depth[this->nodes+1] = depth[n] + 1;
+    
+    this->nodes += 2;
+  }
+  
+  free(temp_fv);
+  free(temp_weight);
+  free(temp_index);
+  free(scratch);
+  free(depth);
+  
+ // Trim the node storage, and convert the feature vectors of each leaf to structure of arrays...
+  this->node = (KDFlatNode*)realloc(this->node, this->nodes * sizeof(KDFlatNode));
+  this->range = (float*)realloc(this->range, this->nodes * this->feats * 2 * sizeof(float));
+  
+  this->data = (float*)malloc(exemplars * this->feats * sizeof(float));
+  for (n=0; n<this->nodes; n++)
+  {
+   KDFlatNode * targ = &this->node[n];
+   if (targ->child>=0) continue;
+   
+   int count = targ->high - targ->low;
+   float * out = this->data + targ->low * this->feats;
+   for (i=0; i<count; i++)
+   {
+    for (j=0; j<this->feats; j++) out[j*count + i] = fv[(targ->low + i)*this->feats + j];
+   }
+  }
+  
+  free(fv);
+ 
+ return this;
+}
+
+
+void KDFlat_delete(Spatial self)
+{
+ KDFlat * this = (KDFlat*)self;
+ 
+ free(this->data);
+ free(this->weight);
+ free(this->indices);
+ free(this->range);
+ free(this->node);
+ 
+ free(this);
+}
+
+
+DataMatrix * KDFlat_dm(Spatial self)
+{
+ KDFlat * this = (KDFlat*)self;
+ return this->dm;
+}
+
+
+size_t KDFlat_cursor_size(Spatial self)
+{
+ return sizeof(KDFlatCursor);
+}
+
+
+// Moves the cursor to the next leaf that intersects the search range, setting leaf to -1 if there are none left...
+void KDFlat_advance(KDFlat * this, KDFlatCursor * cur)
+{
+ cur->offset = 0;
+ 
+ while (cur->size>0)
+ {
+  cur->size -= 1;
+  cur->nodes += 1;
+  int n = cur->stack[cur->size] >> 1;
+  int within = cur->stack[cur->size] & 1;
+  
+  // Test the bounding box, unless the parent was entirely within the range...
+   if (within==0)
+   {
+    within = 1;
+    const float * range = this->range + n * this->feats * 2;
+    
+    int i;
+    for (i=0; i<this->feats; i++)
+    {
+     float req_low  = cur->centre[i] - cur->range;
+     float req_high = cur->centre[i] + cur->range;
+     
+     if ((req_high<range[i*2])||(req_low>range[i*2+1])) break;
+     if ((req_low>range[i*2])||(req_high<range[i*2+1])) within = 0;
+    }
+    
+    if (i!=this->feats) continue; // A miss.
+   }
+  
+  // If its a leaf we are done, otherwise add the children to the stack, low child on top...
+   const KDFlatNode * targ = &this->node[n];
+   if (targ->child<0)
+   {
+    if (targ->low<targ->high)
+    {
+     cur->leaf = n;
+     return;
+    }
+   }
+   else
+   {
+    cur->stack[cur->size] = ((targ->child+1) << 1) | within;
+    cur->stack[cur->size+1] = (targ->child << 1) | within;
+    cur->size += 2;
+   }
+ }
+ 
+ cur->leaf = -1;
+}
+
+
+void KDFlat_start(Spatial self, SpatialCursor cursor, const float * centre, float range)
+{
+ KDFlat * this = (KDFlat*)self;
+ KDFlatCursor * cur = (KDFlatCursor*)cursor;
+ 
+ cur->centre = centre;
+ cur->range = range;
+ 
+ cur->size = 1;
+ cur->stack[0] = 0;
+ cur->nodes = 0;
+ 
+ KDFlat_advance(this, cur);
+}
+
+
+int KDFlat_next(Spatial self, SpatialCursor cursor)
+{
+ KDFlat * this = (KDFlat*)self;
+ KDFlatCursor * cur = (KDFlatCursor*)cursor;
+ if (cur->leaf<0) return -1;
+ 
+ const KDFlatNode * targ = &this->node[cur->leaf];
+ int ret = this->indices[targ->low + cur->offset];
+ 
+ cur->offset += 1;
+ if ((targ->low + cur->offset)>=targ->high) KDFlat_advance(this, cur);
+ 
+ return ret;
+}
+
+
+int KDFlat_next_block(Spatial self, SpatialCursor cursor, int max, float * fv, int stride, float * weight, int * index)
+{
+ KDFlat * this = (KDFlat*)self;
+ KDFlatCursor * cur = (KDFlatCursor*)cursor;
+ 
+ int count = 0;
+ while ((count<max)&&(cur->leaf>=0))
+ {
+  // Copy as much of the current leaf as will fit...
+   const KDFlatNode * targ = &this->node[cur->leaf];
+   int size = targ->high - targ->low;
+   int take = size - cur->offset;
+   if (take>(max-count)) take = max - count;
+   
+   const float * src = this->data + targ->low * this->feats + cur->offset;
+   int i;
+   for (i=0; i<this->feats; i++)
+   {
+    memcpy(fv + i*stride + count, src + i*size, take * sizeof(float));
+   }
+   
+   memcpy(weight + count, this->weight + targ->low + cur->offset, take * sizeof(float));
+   memcpy(index + count, this->indices + targ->low + cur->offset, take * sizeof(int));
+   
+   count += take;
+   
+  // Move on...
+   cur->offset += take;
+   if (cur->offset>=size) KDFlat_advance(this, cur);
+ }
+ 
+ return count;
+}
+
+
+size_t KDFlat_byte_size(Spatial self)
+{
+ KDFlat * this = (KDFlat*)self;
+ 
+ size_t mem = sizeof(KDFlat);
+ mem += this->nodes * (sizeof(KDFlatNode) + this->feats * 2 * sizeof(float));
+ mem += this->dm->exemplars * (sizeof(int) + sizeof(float) + this->feats * sizeof(float));
+ 
+ return mem;
+}
+
+
+int KDFlat_nodes(Spatial self, SpatialCursor cursor)
+{
+ return ((KDFlatCursor*)cursor)->nodes;
+}
+
+
+
+const SpatialType KDFlatType =
+{
+ "kd_flat",
+ "A kd-tree laid out for speed - the nodes are stored in a single array, in breadth first order, and each leaf stores a copy of its feature vectors, so searching never has to go back to the data matrix. Uses more memory than kd_tree, as it has a copy of the data. The parameter (second argument of set_spatial) is the leaf size, with values less than 1 (including the default) giving 32.",
+ KDFlat_new,
+ KDFlat_delete,
+ KDFlat_dm,
+ KDFlat_cursor_size,
+ KDFlat_start,
+ KDFlat_next,
+ KDFlat_next_block,
+ NULL,
+ NULL,
+ NULL,
+ KDFlat_byte_size,
+ KDFlat_nodes,
+};
+
+
+
+// Implimentation of the random projection forest spatial indexer...
+#define RP_FOREST_TREES 4
+#define RP_FOREST_LEAF 16
+#define RP_FOREST_DEPTH 24
+
+typedef struct RPForest RPForest;
+struct RPForest
+{
+ const SpatialType * type;
+ 
+ DataMatrix * dm;
+ int feats;
+ float sigmas; // Margin used when descending, in standard deviations of the projected offset of a point at distance range.
+ 
+ int depth; // Number of split levels - every tree is complete, with 2^depth leaves.
+ float * dir; // [tree, level, feature] - the random direction used by every node of a level.
+ float * split; // [tree, node] - split value of each internal node, in heap order (children of h are 2h+1 and 2h+2).
+ int * leaf_start; // [leaf + 1] - range of positions each leaf covers; the same for every tree as they all split at the median.
+ 
+ int * indices; // [tree, position] - exemplar indices, ordered so each leaf is contiguous.
+ int * leaf; // [tree, exemplar] - which leaf each exemplar is in, so duplicates between trees can be detected without storing anything per search.
+};
+
+typedef struct RPForestCursor RPForestCursor;
+struct RPForestCursor
+{
+ float margin;
+ 
+ int tree; // Tree being searched.
+ int pos; // Position in the current leaf, with end being one past its end.
+ int end;
+ 
+ int size; // Stack of nodes still to visit in the current tree, as pairs of (heap index, level).
+ int stack[2*RP_FOREST_DEPTH+4];
+ int nodes; // Nodes visited by the current search.
+ 
+ float proj[0]; // [tree, level] - projection of the centre onto each direction.
+};
+
+
+
+// Helper for below - fills in the leaf boundaries by recursivly halving the range...
+void RPForest_bounds(int * out, int low, int high, int levels)
+{
+ if (levels==0)
+ {
+  out[0] = low;
+  return;
+ }
+ 
+ int half = (low + high) / 2;
+ RPForest_bounds(out, low, half, levels-1);
+ RPForest_bounds(out + (1<<(levels-1)), half, high, levels-1);
+}
+
+
+Spatial RPForest_new(DataMatrix * dm, float param)
+{
+ RPForest * this = (RPForest*)malloc(sizeof(RPForest));
+ 
+ this->type = &RPForestType;
+ this->dm = dm;
+ this->feats = DataMatrix_features(dm);
+ this->sigmas = (param>1.0) ? param : 3.0;
+ 
+ int exemplars = DataMatrix_exemplars(dm);
+ 
+ // Decide the depth and work out the leaf boundaries...
+  this->depth = 0;
+  while ((this->depth<RP_FOREST_DEPTH)&&((exemplars>>(this->depth+1))>=RP_FOREST_LEAF)) this->depth += 1;
+  
+  int leaves = 1 << this->depth;
+  int internal = leaves - 1;
+  
+  this->leaf_start = (int*)malloc((leaves+1) * sizeof(int));
+  RPForest_bounds(this->leaf_start, 0, exemplars, this->depth);
+  this->leaf_start[leaves] = exemplars;
+ 
+ // Extract every feature vector...
+  float * fv = (float*)malloc(exemplars * this->feats * sizeof(float));
+  
+  int i, j;
+  for (i=0; i<exemplars; i++)
+  {
+   float * src = DataMatrix_fv(dm, i, NULL);
+   for (j=0; j<this->feats; j++) fv[i*this->feats + j] = src[j];
+  }
+  
+ // Draw the random directions, from a fixed seed so the structure is deterministic...
+  this->dir = (float*)malloc(RP_FOREST_TREES * this->depth * this->feats * sizeof(float));
+  
+  unsigned int index[4] = {0x52504600, 0, 0, 0};
+  PhiloxRNG rng;
+  PhiloxRNG_init(&rng, index);
+  
+  for (i=0; i<RP_FOREST_TREES*this->depth; i++)
+  {
+   float * d = this->dir + i*this->feats;
+   float len = 0.0;
+   for (j=0; j<this->feats; j++)
+   {
+    d[j] = PhiloxRNG_Gaussian(&rng, NULL);
+    len += d[j] * d[j];
+   }
+   
+   len = sqrt(len);
+   if (len>1e-6)
+   {
+    for (j=0; j<this->feats; j++) d[j] /= len;
+   }
+  }
+  
+ // Build each tree in turn, level by level, sorting each node by its projection and splitting at the median...
+  this->split = (float*)malloc(RP_FOREST_TREES * internal * sizeof(float));
+  this->indices = (int*)malloc(RP_FOREST_TREES * exemplars * sizeof(int));
+  this->leaf = (int*)malloc(RP_FOREST_TREES * exemplars * sizeof(int));
+  
+  PosFeat * scratch = (PosFeat*)malloc(exemplars * sizeof(PosFeat));
+  
+  int t, l, k;
+  for (t=0; t<RP_FOREST_TREES; t++)
+  {
+   int * indices = this->indices + t*exemplars;
+   for (i=0; i<exemplars; i++) indices[i] = i;
+   
+   for (l=0; l<this->depth; l++)
+   {
+    const float * d = this->dir + (t*this->depth + l) * this->feats;
+    
+    for (k=0; k<(1<<l); k++)
+    {
+     int low = this->leaf_start[k << (this->depth-l)];
+     int high = this->leaf_start[(k+1) << (this->depth-l)];
+     int half = (low + high) / 2;
+     
+     for (i=low; i<high; i++)
+     {
+      const float * x = fv + indices[i]*this->feats;
+      scratch[i-low].pos = indices[i];
+      scratch[i-low].feat = 0.0;
+      for (j=0; j<this->feats; j++) scratch[i-low].feat += d[j] * x[j];
+     }
+     
+     qsort(scratch, high-low, sizeof(PosFeat), sort_pos_feat);
+     
+     for (i=low; i<high; i++) indices[i] = scratch[i-low].pos;
+     
+     this->split[t*internal + (1<<l) - 1 + k] = 0.5 * (scratch[half-low-1].feat + scratch[half-low].feat);
+    }
+   }
+   
+   int * leaf = this->leaf + t*exemplars;
+   for (k=0; k<leaves; k++)
+   {
+    for (i=this->leaf_start[k]; i<this->leaf_start[k+1]; i++) leaf[indices[i]] = k;
+   }
+  }
+  
+  free(scratch);
+  free(fv);
+ 
+ return this;
+}
+
+
+void RPForest_delete(Spatial self)
+{
+ RPForest * this = (RPForest*)self;
+ 
+ free(this->leaf);
+ free(this->indices);
+ free(this->leaf_start);
+ free(this->split);
+ free(this->dir);
+ 
+ free(this);
+}
+
+
+DataMatrix * RPForest_dm(Spatial self)
+{
+ RPForest * this = (RPForest*)self;
+ return this->dm;
+}
+
+
+size_t RPForest_cursor_size(Spatial self)
+{
+ RPForest * this = (RPForest*)self;
+ return sizeof(RPForestCursor) + RP_FOREST_TREES * this->depth * sizeof(float);
+}
+
+
+// Moves the cursor to the next leaf that the search reaches, moving on to the next tree as required - returns 0 if there are none left...
+int RPForest_advance(RPForest * this, RPForestCursor * cur)
+{
+ int internal = (1 << this->depth) - 1;
+ 
+ while (1)
+ {
+  // If the current tree is done move to the next...
+   if (cur->size==0)
+   {
+    cur->tree += 1;
+    if (cur->tree>=RP_FOREST_TREES) return 0;
+    
+    cur->stack[0] = 0;
+    cur->stack[1] = 0;
+    cur->size = 2;
+   }
+  
+  // Pop a node - if its a leaf we are done, otherwise push the children that the margin around the centre reaches, low child on top...
+   cur->size -= 2;
+   cur->nodes += 1;
+   int h = cur->stack[cur->size];
+   int l = cur->stack[cur->size+1];
+   
+   if (l==this->depth)
+   {
+    cur->pos = this->leaf_start[h - internal];
+    cur->end = this->leaf_start[h - internal + 1];
+    return 1;
+   }
+   
+   float p = cur->proj[cur->tree*this->depth + l];
+   float s = this->split[cur->tree*internal + h];
+   
+   if ((p+cur->margin)>=s)
+   {
+    cur->stack[cur->size] = 2*h + 2;
+    cur->stack[cur->size+1] = l + 1;
+    cur->size += 2;
+   }
+   
+   if ((p-cur->margin)<=s)
+   {
+    cur->stack[cur->size] = 2*h + 1;
+    cur->stack[cur->size+1] = l + 1;
+    cur->size += 2;
+   }
+ }
+}
+
+
+// Returns non-zero if the given exemplar has already been returned by an earlier tree in the current search, by checking if the search would have reached its leaf...
+int RPForest_seen(RPForest * this, RPForestCursor * cur, int exemplar)
+{
+ int exemplars = this->dm->exemplars;
+ int internal = (1 << this->depth) - 1;
+ 
+ int t, l;
+ for (t=0; t<cur->tree; t++)
+ {
+  int k = this->leaf[t*exemplars + exemplar];
+  int h = 0;
+  
+  for (l=0; l<this->depth; l++)
+  {
+   int high = (k >> (this->depth-1-l)) & 1;
+   float p = cur->proj[t*this->depth + l];
+   float s = this->split[t*internal + h];
+   
+   if (high) {if ((p+cur->margin)<s) break;}
+        else {if ((p-cur->margin)>s) break;}
+   
+   h = 2*h + 1 + high;
+  }
+  
+  if (l==this->depth) return 1;
+ }
+ 
+ return 0;
+}
+
+
+void RPForest_start(Spatial self, SpatialCursor cursor, const float * centre, float range)
+{
+ RPForest * this = (RPForest*)self;
+ RPForestCursor * cur = (RPForestCursor*)cursor;
+ 
+ // The margin - the projected offset of a point at distance range is Gaussian with standard deviation range/sqrt(feats), for a random direction...
+  cur->margin = range * this->sigmas / sqrt(this->feats);
+  if (cur->margin>range) cur->margin = range;
+ 
+ // Project the centre onto every direction...
+  int i, j;
+  for (i=0; i<RP_FOREST_TREES*this->depth; i++)
+  {
+   const float * d = this->dir + i*this->feats;
+   cur->proj[i] = 0.0;
+   for (j=0; j<this->feats; j++) cur->proj[i] += d[j] * centre[j];
+  }
+ 
+ // Start at the root of the first tree...
+  cur->tree = -1;
+  cur->size = 0;
+  cur->pos = 0;
+  cur->end = 0;
+  cur->nodes = 0;
+}
+
+
+int RPForest_next(Spatial self, SpatialCursor cursor)
+{
+ RPForest * this = (RPForest*)self;
+ RPForestCursor * cur = (RPForestCursor*)cursor;
+ 
+ while (1)
+ {
+  while (cur->pos<cur->end)
+  {
+   int ret = this->indices[cur->tree*this->dm->exemplars + cur->pos];
+   cur->pos += 1;
+   
+   if (RPForest_seen(this, cur, ret)==0) return ret;
+  }
+  
+  if (RPForest_advance(this, cur)==0)
+  {
+   cur->tree = RP_FOREST_TREES; // So repeated calls stay done.
+   cur->size = 0;
+   return -1;
+  }
+ }
+}
+
+
+size_t RPForest_byte_size(Spatial self)
+{
+ RPForest * this = (RPForest*)self;
+ 
+ int leaves = 1 << this->depth;
+ 
+ size_t mem = sizeof(RPForest);
+ mem += RP_FOREST_TREES * this->depth * this->feats * sizeof(float);
+ mem += RP_FOREST_TREES * (leaves-1) * sizeof(float);
+ mem += (leaves+1) * sizeof(int);
+ mem += RP_FOREST_TREES * this->dm->exemplars * 2 * sizeof(int);
+ 
+ return mem;
+}
+
+
+int RPForest_nodes(Spatial self, SpatialCursor cursor)
+{
+ return ((RPForestCursor*)cursor)->nodes;
+}
+
+
+
+const SpatialType RPForestType =
+{
+ "rp_forest",
+ "An approximate index for high dimensional data, where kd trees degrade to brute force. A forest of random projection trees - each level of a tree splits at the median of the projection onto a random direction. A search descends into every child within a margin of the projected centre, and returns the union over the trees. Unlike the others it can miss exemplars within the range - the margin is the parameter (second argument of set_spatial) multiplied by the standard deviation of the projected offset of a point at the edge of the range, so larger values give better recall but slower searches. Values of 1 or less (including the default) give 3; a value of sqrt(features) or more never misses an exemplar within the range as a Euclidean distance (A radial kernel's support), though the corners of the hyper-cube may still be missed.",
+ RPForest_new,
+ RPForest_delete,
+ RPForest_dm,
+ RPForest_cursor_size,
+ RPForest_start,
+ RPForest_next,
+ NULL,
+ NULL,
+ NULL,
+ NULL,
+ RPForest_byte_size,
+ RPForest_nodes,
 };
 
 
@@ -615,6 +1896,8 @@ const SpatialType * ListSpatial[] =
  &BruteForceType,
  &IterDualType,
  &KDTreeType,
+ &KDFlatType,
+ &RPForestType,
  NULL
 };
 
@@ -20,6 +20,27 @@
 // Typedef for a spatial indexing object...
 typedef void * Spatial;
 
+// Typedef for a cursor - the state of a single search through a spatial indexing object. Kept seperate from the Spatial so that many searches can happen at once, e.g. from multiple threads. A cursor is plain memory, of the size the Spatial requests - it can be malloc-ed, put on the stack or cut from a larger block as convenient, and needs no cleanup beyond freeing that memory...
+typedef void * SpatialCursor;
+
+
+
+// Node of a tree of axis aligned bounding boxes - a spatial indexing structure that is such a tree can optionally expose it (see SpatialTree), which allows algorithms to reason about entire groups of exemplars at once...
+typedef struct SpatialNode SpatialNode;
+
+struct SpatialNode
+{
+ SpatialNode * parent;
+ SpatialNode * child_low; // NULL if a leaf.
+ SpatialNode * child_high;
+ 
+ int low; // Range of exemplars the node covers, as a range into the indices array of the tree.
+ int high; // Exclusive.
+ float weight; // Total weight of the exemplars in the node.
+ 
+ float range[0]; // 2* number of features, with the low range indexed for feature i as range[i*2], and the high range [i*2+1].
+};
+
 
 
 // Typedef the various methods that define a spatial indexing object...
@@ -31,15 +52,31 @@ typedef void (*SpatialDelete)(Spatial this);
 // Returns the data matrix it is a spatial structure for (Note that it does not own this data matrix - user must delete it when done.)...
 typedef DataMatrix * (*SpatialDM)(Spatial this);
 
-// Starts indexing around a given point - you provide an array of floats to define the point and a range for how far to go, definining a hyper-cube. Note that the centre point should remain valid until you stop calling next...
-typedef void (*SpatialStart)(Spatial this, const float * centre, float range);
+// Returns how many bytes a cursor for this spatial indexing object requires...
+typedef size_t (*SpatialCursorSize)(Spatial this);
+
+// Starts indexing around a given point, with the state stored in the provided cursor - you provide an array of floats to define the point and a range for how far to go, definining a hyper-cube. Note that the centre point should remain valid until you stop calling next. Does not modify the Spatial, so is safe to call from multiple threads at once as long as each has its own cursor...
+typedef void (*SpatialStart)(Spatial this, SpatialCursor cursor, const float * centre, float range);
 
 // You call this until it returns a negative number - each return is a value to process. Will include all values in the bounding box, and possibly some outside it as well...
-typedef int (*SpatialNext)(Spatial this);
+typedef int (*SpatialNext)(Spatial this, SpatialCursor cursor);
+
+// Optional (can be NULL) - for spatial indexing structures that keep their own copy of the feature vectors (in the internal format, as DataMatrix_fv returns). Like next, except it returns up to max entries at once, writing their feature vectors into fv as structure of arrays (feature i of entry j goes in fv[i*stride + j]), plus their weights and exemplar indices. Returns how many it wrote, 0 when done. Can be mixed with calls to next on the same cursor...
+typedef int (*SpatialNextBlock)(Spatial this, SpatialCursor cursor, int max, float * fv, int stride, float * weight, int * index);
+
+// Optional (can be NULL) - if the spatial indexing structure is a tree of bounding boxes this returns its root node, and outputs the array of exemplar indices that the nodes index into. Returns NULL if not supported...
+typedef const SpatialNode * (*SpatialTree)(Spatial this, const int ** indices);
+
+// Optional (can be NULL, in which case the structure has to be rebuilt when the data matrix is edited) - updates the structure as exemplars are added to and removed from the data matrix. add is called after the exemplar with the given index has been added to the data matrix; remove before the exemplar with the given index is removed, while its feature vector can still be fetched. Neither can be called while a search is in progress...
+typedef void (*SpatialAdd)(Spatial this, int index);
+typedef void (*SpatialRemove)(Spatial this, int index);
 
 // Returns the size of the object, in bytes; does not include the size of the data matrix...
 typedef size_t (*SpatialByteSize)(Spatial this);
 
+// Optional (can be NULL, for structures that are not made of nodes) - returns how many nodes the current search of the cursor has visited so far, i.e. had their bounds tested. Reset by start...
+typedef int (*SpatialNodes)(Spatial this, SpatialCursor cursor);
+
 
 
 // Define the spatial type...
@@ -55,10 +92,18 @@ struct SpatialType
  
  SpatialDM dm;
  
+ SpatialCursorSize cursor_size;
  SpatialStart start;
  SpatialNext next;
+ SpatialNextBlock next_block;
+ 
+ SpatialTree tree;
+ 
+ SpatialAdd add;
+ SpatialRemove remove;
  
  SpatialByteSize byte_size;
+ SpatialNodes nodes;
 };
 
 
@@ -70,11 +115,91 @@ void Spatial_delete(Spatial this);
 const SpatialType * Spatial_type(Spatial this);
 DataMatrix * Spatial_dm(Spatial this);
 
-void Spatial_start(Spatial this, const float * centre, float range);
-int Spatial_next(Spatial this);
+size_t Spatial_cursor_size(Spatial this);
+void Spatial_start(Spatial this, SpatialCursor cursor, const float * centre, float range);
+int Spatial_next(Spatial this, SpatialCursor cursor);
+
+const SpatialNode * Spatial_tree(Spatial this, const int ** indices); // Deals with the NULL case.
+
+int Spatial_editable(Spatial this); // Returns non-zero if add and remove are supported.
+void Spatial_add(Spatial this, int index);
+void Spatial_remove(Spatial this, int index);
 
 size_t Spatial_byte_size(Spatial this);
 
+// Conveniance methods for creating a cursor with malloc and then freeing it...
+SpatialCursor Spatial_cursor_new(Spatial this);
+void Spatial_cursor_delete(SpatialCursor cursor);
+
+
+
+// Counters of the work done by the searches of a Query and the algorithms that use it (see mean_shift.h), for tuning the parameters. Each Query has its own, so incrementing them needs no locking, and adds them to a running total when deinitialised...
+typedef struct Counters Counters;
+
+struct Counters
+{
+ long long searches; // Number of searches started.
+ long long nodes; // Spatial nodes visited by those searches - always 0 for structures without nodes.
+ long long exemplars; // Exemplars returned by those searches.
+ long long kernels; // Kernel evaluations.
+ 
+ long long converges; // Number of times a feature vector was converged by mode, mode_merge, cluster or assign_cluster...
+ long long iters; // ...the total number of iterations they did...
+ long long capped; // ...and how many stopped because they hit iter_cap, rather than converging or finding a ball.
+ 
+ long long merged; // Converging feature vectors that ended up in an existing ball...
+ long long created; // ...and those that had to create a new ball.
+};
+
+// Sets all counters to zero...
+void Counters_zero(Counters * this);
+
+// Adds the counters in other to this...
+void Counters_add(Counters * this, const Counters * other);
+
+
+
+// A query is everything required to search a Spatial and extract the feature vectors it returns - a cursor plus storage to extract feature vectors into, as the data matrix's internal storage is shared. Each thread needs its own; they are cheap to create...
+typedef struct Query Query;
+
+#define QUERY_BLOCK 64
+
+struct Query
+{
+ Spatial spatial;
+ DataMatrix * dm;
+ 
+ SpatialCursor cursor;
+ float * temp; // Storage for DataMatrix_fv_temp.
+ 
+ // Storage for processing the results of a search in blocks, so kernel weights can be evaluated in bulk - not used by the Query itself (see next_block in mean_shift.h)...
+  float * block; // Structure of arrays, so block[i*QUERY_BLOCK + j] is feature i of entry j.
+  float * block_weight; // Weight of each entry.
+  int * block_index; // Exemplar index of each entry.
+  float * block_out; // Output of kernel weights for each entry.
+ 
+ // Counters of the work done - total is where they are added by Query_deinit, or NULL to discard them. The nodes of the current search are only added to counters when it ends (the next Query_start or Query_deinit)...
+  Counters counters;
+  Counters * total;
+  int searching; // Non-zero if the cursor has a search whose nodes have not been counted.
+};
+
+// Initialises/deinitialises a Query for searching the given spatial - the counters of the Query are added to total (if not NULL) on deinit. As Query_deinit writes to total without locking multithreaded code should only deinitialise queries once the threads are done...
+void Query_init(Query * this, Spatial spatial, Counters * total);
+void Query_deinit(Query * this);
+
+// Starts a search, exactly as for Spatial_start...
+void Query_start(Query * this, const float * centre, float range);
+
+// Returns the feature vector of the next exemplar in the search, or NULL when done. Optionally outputs the index of the exemplar and its weight. The returned pointer is to storage in the Query that is replaced on every call; you are allowed to edit it...
+float * Query_next(Query * this, int * index, float * weight);
+
+// Fills the block storage of the Query (block, block_weight and block_index) with up to QUERY_BLOCK entries from the search, returning how many - 0 when done. Uses the next_block method of the spatial if it has one, otherwise Query_next...
+int Query_next_block(Query * this);
+
+// Extracts the feature vector for the given exemplar into the Query's storage, same as DataMatrix_fv but thread safe...
+float * Query_fv(Query * this, int index, float * weight);
+
 
 
 // The various spatial index implimentations provided by this module...
@@ -85,9 +210,15 @@ extern const SpatialType BruteForceType;
 // This makes use of dual dimensions in the data matrix, and just brute forces within the range; often however the dual dimensions can cut down the amount of data that needs processing rather drammatically. Note that if there are no dual dimensions it ends up equivalent to brute forcing...
 extern const SpatialType IterDualType;
 
-// A classic - the binary kd tree...
+// A classic - the binary kd tree. Supports add and remove, by keeping a log structured set of trees (see spatial.c)...
 extern const SpatialType KDTreeType;
 
+// A kd tree stored for cache efficiency - nodes are in one array, in breadth first order, and each leaf keeps a copy of its feature vectors as structure of arrays, so searches never touch the data matrix. The spatial parameter is the maximum leaf size, if 1 or more (less than 1, including the default, gives 32). Must be rebuilt if the scale changes, like all of the others...
+extern const SpatialType KDFlatType;
+
+// Approximate, for high dimensional data - a forest of random projection trees, searched with a margin around the projected centre. May miss exemplars within the range; the spatial parameter is the recall/speed trade off, as the margin in standard deviations of the projected offset of a point at the edge of the range (1 or less, including the default, gives 3)...
+extern const SpatialType RPForestType;
+
 
 
 // List of all spatial indexing types known to the system - for automatic detection...
@@ -0,0 +1,95 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+
+from ms import MeanShift
+
+
+
+# Create a weighted dataset - a 2D Gaussian with a weight column...
+def rows(count):
+  ret = numpy.random.randn(count, 3)
+  ret[:,2] = numpy.random.random(count) + 0.5
+  return ret
+
+data = rows(20000)
+sam = numpy.random.randn(200, 2)
+
+
+
+# Setup a streaming mean shift object...
+ms = MeanShift()
+ms.set_data(data, 'df', 2)
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.set_scale(numpy.array([4.0, 4.0]))
+ms.probs(sam) # Builds the spatial.
+
+
+
+# Stream in new rows whilst removing old ones, keeping a record of what should be in there...
+truth = data.copy()
+
+start = time.clock()
+for step in xrange(100):
+  new = rows(100)
+  ms.add(new)
+  truth = numpy.concatenate((truth, new), axis=0)
+  
+  gone = numpy.random.permutation(truth.shape[0])[:100]
+  ms.remove(gone)
+  for i in sorted(gone, reverse=True):
+    truth[i,:] = truth[-1,:]
+    truth = truth[:-1,:]
+  
+  ms.probs(sam[:10,:])
+end = time.clock()
+print 'streaming: %.2f seconds for 100 steps of adding and removing 100 rows' % (end-start)
+
+
+
+# Check against a fresh object built from the expected data...
+ms2 = MeanShift()
+ms2.set_data(truth, 'df', 2)
+ms2.copy_all(ms)
+ms2.copy_scale(ms)
+
+print 'exemplars = %i (expected %i)' % (ms.exemplars(), truth.shape[0])
+print 'data max difference = %f' % numpy.fabs(ms.get_dm() - truth).max()
+print 'weight = %.3f (expected %.3f)' % (ms.weight(), ms2.weight())
+print 'prob max difference = %f' % numpy.fabs(ms.probs(sam) - ms2.probs(sam)).max()
+
+draws = ms.draws(10000)
+print 'draw mean = %s (expected %s)' % (str(draws.mean(axis=0)), str(numpy.average(truth[:,:2], axis=0, weights=truth[:,2])))
+
+
+
+# Adding and removing with the cache on, after a draw has built the cumulative weights - the new and moved rows must not be read from the stale cache...
+ms3 = MeanShift()
+ms3.set_data(rows(2000), 'df', 2)
+ms3.set_kernel('gaussian')
+ms3.set_scale(numpy.array([4.0, 4.0]))
+ms3.set_cache(True)
+ms3.probs(sam)
+ms3.draws(5)
+
+ms3.add(rows(3000))
+ms3.remove(numpy.arange(0, 4000, 3))
+ms3.draws(5)
+
+ms4 = MeanShift()
+ms4.set_data(ms3.get_dm().copy(), 'df', 2)
+ms4.copy_all(ms3)
+ms4.copy_scale(ms3)
+
+print 'cached: weight = %.3f (expected %.3f)' % (ms3.weight(), ms4.weight())
+print 'cached: prob max difference = %f' % numpy.fabs(ms3.probs(sam) - ms4.probs(sam)).max()
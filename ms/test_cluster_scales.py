@@ -0,0 +1,70 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+
+from ms import MeanShift
+
+
+
+
+# Create a dataset - a handful of blobs, at a few sizes, so there is structure at several scales...
+centres = numpy.random.random((8, 2)) * 40.0
+data = numpy.concatenate([numpy.random.randn(4000, 2) * (1.0 + i % 3) + c for i, c in enumerate(centres)], axis=0)
+
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.set_balls('hash')
+
+scales = numpy.array([[1.0 / s, 1.0 / s] for s in numpy.exp(numpy.linspace(numpy.log(0.5), numpy.log(32.0), 16))], dtype=numpy.float32)
+
+
+
+# Do it the old way, calling cluster then cluster_on for each level in turn...
+start = time.time()
+old = []
+for level in xrange(scales.shape[0]):
+  ms.set_scale(scales[level,:])
+  if level==0:
+    modes, parents = ms.cluster()
+    parents = parents.flatten()
+  else:
+    modes, parents = ms.cluster_on(old[-1][0])
+  old.append((modes, parents))
+end = time.time()
+print 'cluster + cluster_on: %.2f seconds' % (end-start)
+
+
+
+# Do it with the native version...
+start = time.time()
+levels = ms.cluster_scales(scales)
+end = time.time()
+print 'cluster_scales: %.2f seconds' % (end-start)
+print
+
+
+
+# Compare...
+for level, ((modes, parents, sizes), (old_modes, old_parents)) in enumerate(zip(levels, old)):
+  same = modes.shape==old_modes.shape and (parents==old_parents).all()
+  diff = numpy.fabs(modes - old_modes).max() if modes.shape==old_modes.shape else float('inf')
+  print 'level %i: %i modes (was %i), total weight = %.1f, same assignment = %s, max mode difference = %f' % (level, modes.shape[0], old_modes.shape[0], sizes.sum(), str(same), diff)
+print
+
+
+
+# Check the progress callback is called at the start of each level, in order...
+steps = []
+ms.cluster_scales(scales, lambda i, n: steps.append((i, n)))
+print 'callback called per level: %s' % str(steps==[(i, scales.shape[0]) for i in xrange(scales.shape[0])])
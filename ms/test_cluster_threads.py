@@ -0,0 +1,50 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+
+from ms import MeanShift
+
+
+
+# Create a dataset - a handful of blobs...
+centres = numpy.random.random((6, 3)) * 20.0
+data = numpy.concatenate([numpy.random.randn(500, 3) + c for c in centres], axis=0)
+
+
+
+# Setup the mean shift object...
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.set_balls('hash')
+ms.set_scale(numpy.array([0.5, 0.5, 0.5]))
+
+
+
+# Cluster single threaded, then with various thread counts, checking the multithreaded results all match (the single threaded result can differ slightly, as documented)...
+start = time.time()
+modes, index = ms.cluster()
+end = time.time()
+print 'single threaded: %i modes (%.2f seconds)' % (modes.shape[0], end-start)
+
+first = None
+for threads in [2, 4, 0]:
+  ms.threads = threads
+  start = time.time()
+  modes, index = ms.cluster()
+  end = time.time()
+  
+  if first is None: first = (modes, index)
+  same = (modes.shape==first[0].shape) and (modes==first[0]).all() and (index==first[1]).all()
+  print 'threads = %i: %i modes, matches threads = 2: %s (%.2f seconds)' % (threads, modes.shape[0], str(same), end-start)
+  assert same
@@ -0,0 +1,67 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Create some data with conversion - an angle, euler angles and an angle axis rotation, clustered around a few centres...
+centres = numpy.random.random((3,7)) * 2.0 - 1.0
+data = centres[numpy.random.randint(3, size=8192),:] + 0.05 * numpy.random.randn(8192, 7)
+data = numpy.array(data, dtype=numpy.float32)
+
+points = centres[numpy.random.randint(3, size=1024),:] + 0.1 * numpy.random.randn(1024, 7)
+points = numpy.array(points, dtype=numpy.float32)
+
+codes = 'AEV'
+kernel = 'composite(2:fisher(32.0),4:mirror_fisher(64.0),4:mirror_fisher(64.0))'
+
+
+
+# Two identical models, except the second converts everything in advance...
+ms_lazy = MeanShift()
+ms_lazy.set_data(data, 'df', None, codes)
+ms_lazy.set_kernel(kernel)
+ms_lazy.set_spatial('kd_tree')
+
+ms_pre = MeanShift()
+ms_pre.set_data(data, 'df', None, codes, True)
+ms_pre.set_kernel(kernel)
+ms_pre.set_spatial('kd_tree')
+
+print 'Memory: lazy = %i bytes, converted = %i bytes' % (ms_lazy.memory()['total'], ms_pre.memory()['total'])
+
+
+
+# Compare the results of the batch methods, which also check the block conversion of the input matrix...
+def compare(name, func):
+  start = time.clock()
+  a = func(ms_lazy)
+  mid = time.clock()
+  b = func(ms_pre)
+  end = time.clock()
+  
+  print '%s: max difference = %.3g (lazy %.3fs, converted %.3fs)' % (name, numpy.fabs(a - b).max(), mid - start, end - mid)
+
+
+compare('probs', lambda ms: ms.probs(points))
+compare('probs tiled', lambda ms: ms.probs(points, 0.0, 64))
+compare('modes', lambda ms: ms.modes(points))
+
+ms_lazy.cluster()
+ms_pre.cluster()
+compare('assign_clusters', lambda ms: ms.assign_clusters(points))
@@ -0,0 +1,50 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+
+from ms import MeanShift
+
+
+
+# Create a dataset - three blobs in 3D...
+data = numpy.concatenate((numpy.random.randn(5000, 3), numpy.random.randn(5000, 3) * 0.5 + 4.0, numpy.random.randn(5000, 3) * 2.0 - 3.0), axis=0)
+sam = numpy.random.randn(2000, 3) * 3.0
+
+
+
+# Evaluate the same queries with each spatial indexing structure...
+results = dict()
+for spatial, param in [('kd_tree', 0.1), ('kd_flat', 0.1), ('kd_flat', 8), ('kd_flat', 128)]:
+  ms = MeanShift()
+  ms.set_data(data, 'df')
+  ms.set_kernel('epanechnikov')
+  ms.set_spatial(spatial, param)
+  ms.set_scale(numpy.array([2.0, 2.0, 2.0]))
+  
+  start = time.clock()
+  prob = ms.probs(sam)
+  modes = ms.modes(sam)
+  nll = ms.loo_nll()
+  end = time.clock()
+  
+  name = '%s(%g)' % (spatial, param)
+  results[name] = (prob, modes, nll)
+  print '%s: %.2f seconds; spatial = %i bytes' % (name, end-start, ms.memory()['spatial'])
+
+
+
+# Compare against the kd tree...
+prob, modes, nll = results['kd_tree(0.1)']
+print
+for name in sorted(results.keys()):
+  p, m, n = results[name]
+  print '%s: prob max difference = %f; mode max difference = %f; loo_nll difference = %f' % (name, numpy.fabs(p - prob).max(), numpy.fabs(m - modes).max(), numpy.fabs(n - nll))
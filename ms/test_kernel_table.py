@@ -0,0 +1,47 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+
+from ms import MeanShift
+
+
+
+
+# Create a dataset - two blobs in 3D, plus directional data for the Fisher kernels...
+data = numpy.concatenate((numpy.random.randn(10000, 3), numpy.random.randn(10000, 3) * 0.5 + 3.0), axis=0)
+sam = numpy.random.randn(2000, 3) * 2.0
+
+dirs = numpy.concatenate((numpy.random.randn(10000, 3) * 0.2 + numpy.array([1.0, 0.0, 0.0]), numpy.random.randn(10000, 3) * 0.2 + numpy.array([0.0, 1.0, 0.0])), axis=0)
+dirs /= numpy.sqrt((dirs**2).sum(axis=1))[:,numpy.newaxis]
+dirs_sam = numpy.random.randn(2000, 3)
+dirs_sam /= numpy.sqrt((dirs_sam**2).sum(axis=1))[:,numpy.newaxis]
+
+
+
+# Compare each kernel with and without the lookup table...
+for exact, table, d, s, scale in [('cosine', 'cosine(table)', data, sam, 2.0), ('cauchy', 'cauchy(table)', data, sam, 2.0), ('logistic', 'logistic(table)', data, sam, 2.0), ('fisher(32.0)', 'fisher(32.0,table)', dirs, dirs_sam, 1.0), ('mirror_fisher(32.0)', 'mirror_fisher(32.0,table=4096)', dirs, dirs_sam, 1.0)]:
+  results = []
+  for kernel in [exact, table]:
+    ms = MeanShift()
+    ms.set_data(d, 'df')
+    ms.set_kernel(kernel)
+    ms.set_spatial('kd_tree')
+    ms.set_scale(numpy.ones(3) * scale)
+    
+    start = time.time()
+    prob = ms.probs(s)
+    end = time.time()
+    
+    results.append((prob, end-start, ms.get_error()))
+  
+  (p_exact, t_exact, _), (p_table, t_table, error) = results
+  print '%s: exact %.3f seconds; %s %.3f seconds; reported error = %g; max relative probability difference = %g' % (exact, t_exact, table, t_table, error, (numpy.fabs(p_exact - p_table) / p_exact.max()).max())
@@ -0,0 +1,48 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+
+from ms import MeanShift
+
+
+
+# Create a dataset - uniform over a square...
+data = numpy.random.random((5000, 2)) * 10.0
+
+
+
+# Setup the mean shift object, with a broad kernel...
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.set_scale(numpy.array([0.1, 0.1]))
+
+
+
+# Compare the exact and approximate calculations, checking the bound holds...
+start = time.clock()
+exact_nll = ms.loo_nll()
+exact_entropy = ms.entropy()
+end = time.clock()
+print 'exact: nll = %.3f; entropy = %.4f (%.2f seconds)' % (exact_nll, exact_entropy, end-start)
+print
+
+for tolerance in [0.001, 0.01, 0.1]:
+  start = time.clock()
+  nll, nll_bound = ms.loo_nll_approx(tolerance)
+  ent, ent_bound = ms.entropy_approx(tolerance)
+  end = time.clock()
+  
+  print 'tolerance = %.3f: nll = %.3f (bound %.3f); entropy = %.4f (bound %.4f) (%.2f seconds)' % (tolerance, nll, nll_bound, ent, ent_bound, end-start)
+  print '  nll error = %.3f, within bound = %s' % (numpy.fabs(nll-exact_nll), numpy.fabs(nll-exact_nll)<=nll_bound+1e-2)
+  print '  entropy error = %.4f, within bound = %s' % (numpy.fabs(ent-exact_entropy), numpy.fabs(ent-exact_entropy)<=ent_bound+1e-4)
@@ -0,0 +1,60 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import os
+import time
+import tempfile
+import numpy
+
+from ms import MeanShift
+
+
+
+# Create a dataset and write it to a flat file of float32...
+data = numpy.concatenate((numpy.random.randn(20000, 3), numpy.random.randn(20000, 3) * 0.5 + 3.0), axis=0).astype(numpy.float32)
+
+handle, fn = tempfile.mkstemp(suffix='.f32')
+os.close(handle)
+data.tofile(fn)
+
+handle, cache_fn = tempfile.mkstemp(suffix='.cache')
+os.close(handle)
+
+
+
+# Create two mean shift objects - one with the data in memory, one memory mapping the file, with a file backed cache...
+ms_mem = MeanShift()
+ms_mem.set_data(data, 'df')
+ms_mem.set_kernel('gaussian')
+ms_mem.set_spatial('kd_tree')
+ms_mem.set_scale(numpy.array([2.0, 2.0, 2.0]))
+
+ms_map = MeanShift()
+ms_map.set_data_mmap(fn, 3, cache_fn = cache_fn)
+ms_map.set_kernel('gaussian')
+ms_map.set_spatial('kd_tree')
+ms_map.set_scale(numpy.array([2.0, 2.0, 2.0]))
+
+
+
+# Compare some calculations...
+for name, ms in [('memory', ms_mem), ('mmap', ms_map)]:
+  start = time.time()
+  nll = ms.loo_nll()
+  probs = ms.probs(data[:1000,:])
+  end = time.time()
+  print '%s: loo_nll = %.3f; mean prob = %.6f (%.2f seconds)' % (name, nll, probs.mean(), end-start)
+
+
+
+# Clean up...
+del ms_map
+os.remove(fn)
+os.remove(cache_fn)
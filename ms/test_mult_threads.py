@@ -0,0 +1,60 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+
+from ms import MeanShift
+
+
+import time
+
+
+
+# Create three KDEs to multiply, each a pair of blobs in 2D...
+kde = []
+for offset in [0.0, 0.5, -0.5]:
+  data = numpy.concatenate((numpy.random.randn(2000, 2) + offset, numpy.random.randn(2000, 2) + 4.0 + offset), axis=0)
+  
+  ms = MeanShift()
+  ms.set_data(data, 'df')
+  ms.set_kernel('gaussian')
+  ms.set_spatial('kd_tree')
+  ms.set_scale(numpy.array([4.0, 4.0]))
+  kde.append(ms)
+
+
+
+# Draw with one thread, then with several, checking the multithreaded results match each other...
+output = numpy.empty((4000, 2), dtype=numpy.float32)
+
+start = time.time()
+MeanShift.mult(kde, output)
+end = time.time()
+print 'single threaded: mean = %s (%.2f seconds)' % (str(output.mean(axis=0)), end-start)
+
+first = None
+for threads in [2, 4, 0]:
+  kde[0].threads = threads
+  kde[0].rng0 = 0
+  kde[0].rng1 = 0
+  
+  start = time.time()
+  MeanShift.mult(kde, output)
+  end = time.time()
+  
+  if first is None: first = output.copy()
+  print 'threads = %i: mean = %s, matches threads = 2: %s (%.2f seconds)' % (threads, str(output.mean(axis=0)), str((output==first).all()), end-start)
+
+
+
+# Check that repeated calls give different output...
+MeanShift.mult(kde, output)
+print 'repeat call differs: %s' % str((output!=first).any())
@@ -46,3 +46,19 @@ print
 # Visualise the output...
 for threshold in numpy.arange(prob.max(), 0.0, -prob.max()/15.0):
   print ''.join(map(lambda p: '|' if p>threshold else ' ', prob))
+
+
+
+# Check the tiled evaluation - it only sums exemplars within the kernel range of each point, so it can only lose mass relative to the untiled evaluation, and should match it for kernels with finite support. The tiling itself should make no difference beyond rounding, so a tile size of 1 must give the same answer...
+tiled = ms.probs(sam, 0.0, 16)
+single = ms.probs(sam, 0.0, 1)
+tol = 1e-4 * prob.max()
+
+print
+print 'tiled max difference = %f' % numpy.fabs(tiled - prob).max()
+print 'tiled vs tile size 1 max difference = %f' % numpy.fabs(tiled - single).max()
+
+assert numpy.fabs(tiled - single).max() <= tol
+assert (tiled <= prob + tol).all()
+if ms.get_kernel() not in ['gaussian', 'cauchy', 'logistic']:
+  assert numpy.fabs(tiled - prob).max() <= tol
@@ -0,0 +1,54 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+
+from ms import MeanShift
+
+
+
+# Create a high dimensional dataset - ten blobs in 64D...
+dims = 64
+centres = numpy.random.randn(10, dims) * 4.0
+data = numpy.concatenate([c + numpy.random.randn(2000, dims) * 0.3 for c in centres], axis=0)
+sam = data[numpy.random.permutation(data.shape[0])[:500],:] + numpy.random.randn(500, dims) * 0.1
+
+
+
+# Evaluate with brute force, as the ground truth, and then the random projection forest with various margins...
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('epanechnikov')
+ms.set_scale(numpy.ones(dims) / 1.5)
+
+ms.set_spatial('brute_force')
+start = time.clock()
+truth = ms.probs(sam)
+end = time.clock()
+print 'brute_force: %.2f seconds' % (end-start)
+
+for param in [0.1, 2.0, 5.0, 8.0]:
+  ms.set_spatial('rp_forest', param)
+  
+  start = time.clock()
+  prob = ms.probs(sam)
+  end = time.clock()
+  
+  print 'rp_forest(%g): %.2f seconds; mean prob ratio = %.4f; worst prob ratio = %.4f' % (param, end-start, (prob / truth).mean(), (prob / truth).min())
+
+
+
+# Check mode finding converges to the same place...
+ms.set_spatial('rp_forest')
+modes = ms.modes(sam[:50,:])
+ms.set_spatial('brute_force')
+truth_modes = ms.modes(sam[:50,:])
+print 'mode max difference = %f' % numpy.fabs(modes - truth_modes).max()
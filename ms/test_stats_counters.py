@@ -0,0 +1,63 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Create some clustered data...
+centres = numpy.random.random((4,3))
+data = centres[numpy.random.randint(4, size=4096),:] + 0.02 * numpy.random.randn(4096, 3)
+data = numpy.array(data, dtype=numpy.float32)
+
+points = numpy.random.random((256,3))
+points = numpy.array(points, dtype=numpy.float32)
+
+
+
+# Run the same operations with each spatial, printing out the counters after each...
+def show(name, ms):
+  stats = ms.stats_counters(True)
+  print '  %s:' % name
+  print '    %.1f searches, %.1f nodes, %.1f exemplars, %.1f kernels (per point)' % (stats['searches'] / 256.0, stats['nodes'] / 256.0, stats['exemplars'] / 256.0, stats['kernels'] / 256.0)
+  if stats['converges']!=0:
+    print '    %i converges, %.2f iterations each, %i capped' % (stats['converges'], stats['iters'] / float(stats['converges']), stats['capped'])
+  if (stats['merged'] + stats['created'])!=0:
+    print '    %i merged, %i created' % (stats['merged'], stats['created'])
+
+
+for spatial in ['brute_force', 'kd_tree', 'kd_flat', 'rp_forest']:
+  ms = MeanShift()
+  ms.set_data(data, 'df')
+  ms.set_kernel('gaussian')
+  ms.set_spatial(spatial)
+  ms.scale_silverman()
+  print '%s:' % spatial
+
+  ms.probs(points)
+  show('probs', ms)
+
+  ms.modes(points)
+  show('modes', ms)
+
+  ms.cluster()
+  show('cluster', ms)
+
+  ms.iter_cap = 2
+  ms.modes(points)
+  show('modes with iter_cap=2', ms)
+
+  stats = ms.stats_counters()
+  assert(sum(stats.values())==0)
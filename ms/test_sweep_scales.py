@@ -0,0 +1,85 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+
+from ms import MeanShift
+
+
+
+# Create a dataset - a pair of blobs...
+data = numpy.concatenate((numpy.random.randn(2000, 2), numpy.random.randn(2000, 2) * 0.5 + 4.0), axis=0)
+
+
+
+# Setup the mean shift object...
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('epanechnikov')
+ms.set_spatial('kd_tree')
+
+
+
+# A grid of scales to try...
+scales = numpy.array([[s, s] for s in numpy.exp(numpy.linspace(numpy.log(0.5), numpy.log(8.0), 16))], dtype=numpy.float32)
+
+
+
+# Do it the slow way, one scale at a time...
+start = time.clock()
+slow = []
+for scale in scales:
+  ms.set_scale(scale)
+  slow.append(ms.loo_nll())
+slow = numpy.array(slow)
+end = time.clock()
+print 'one at a time: %.2f seconds' % (end-start)
+
+
+
+# Do it the fast way, sharing the spatial index...
+start = time.clock()
+fast = ms.sweep_scales(scales)
+end = time.clock()
+print 'sweep_scales: %.2f seconds' % (end-start)
+print
+
+
+
+# Compare...
+for i in xrange(scales.shape[0]):
+  print 'scale %.3f: loo_nll = %.3f; sweep = %.3f' % (scales[i,0], slow[i], fast[i])
+print 'maximum difference = %.6f' % numpy.fabs(slow - fast).max()
+print 'best scale: %.3f (sweep %.3f)' % (scales[numpy.argmin(slow),0], scales[numpy.argmin(fast),0])
+print
+
+
+
+# Check the progress callback is called once per scale, in order...
+steps = []
+ms.sweep_scales(scales, 1e-16, -1, lambda i, n: steps.append((i, n)))
+print 'callback steps in order: %s' % str(steps==[(i, scales.shape[0]) for i in xrange(scales.shape[0])])
+
+
+
+# Directional kernels, where scale does nothing, are rejected...
+dirs = numpy.random.randn(1000, 3)
+dirs /= numpy.sqrt((dirs**2).sum(axis=1))[:,numpy.newaxis]
+
+ms_dir = MeanShift()
+ms_dir.set_data(dirs, 'df')
+ms_dir.set_kernel('fisher(16.0)')
+
+try:
+  ms_dir.sweep_scales(numpy.ones((4, 3), dtype=numpy.float32))
+  print 'fisher rejected: False'
+except RuntimeError:
+  print 'fisher rejected: True'